@@ -0,0 +1,38 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+int GetAddressIndexType(const CTxDestination& dest, uint160& hashRet)
+{
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        hashRet = *keyID;
+        return ADDRESS_INDEX_KEYHASH;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        hashRet = *scriptID;
+        return ADDRESS_INDEX_SCRIPTHASH;
+    }
+    hashRet.SetNull();
+    return ADDRESS_INDEX_NONE;
+}
+
+int GetAddressIndexType(const CScript& scriptPubKey, uint160& hashRet)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest)) {
+        hashRet.SetNull();
+        return ADDRESS_INDEX_NONE;
+    }
+    return GetAddressIndexType(dest, hashRet);
+}
+
+CTxDestination GetAddressIndexDestination(int nType, const uint160& hash)
+{
+    if (nType == ADDRESS_INDEX_KEYHASH)
+        return CKeyID(hash);
+    if (nType == ADDRESS_INDEX_SCRIPTHASH)
+        return CScriptID(hash);
+    return CNoDestination();
+}
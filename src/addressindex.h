@@ -0,0 +1,264 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "script/script.h"
+#include "script/standard.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <utility>
+#include <vector>
+
+/**
+ * Kind of destination an address index entry belongs to. Part of the database
+ * keys, so the values must never change. Both the legacy and the cashaddr
+ * encoding of an address decode to the same destination and find the same entries.
+ */
+enum AddressIndexType
+{
+    ADDRESS_INDEX_NONE = 0,
+    ADDRESS_INDEX_KEYHASH = 1,
+    ADDRESS_INDEX_SCRIPTHASH = 2,
+};
+
+/** The address index type and hash of dest, or ADDRESS_INDEX_NONE if it is not indexed */
+int GetAddressIndexType(const CTxDestination& dest, uint160& hashRet);
+/** The address index type and hash of the destination scriptPubKey pays to */
+int GetAddressIndexType(const CScript& scriptPubKey, uint160& hashRet);
+/** The destination of an address index entry */
+CTxDestination GetAddressIndexDestination(int nType, const uint160& hash);
+
+/**
+ * One output paid to (fSpending false) or spent from (fSpending true) an
+ * address, with the amount as value. Height and position in the block are
+ * stored big endian so that the entries of an address iterate in chain order.
+ */
+struct CAddressIndexKey
+{
+    uint8_t nAddressType;
+    uint160 hash;
+    int nHeight;
+    unsigned int nTxIndex;
+    uint256 txhash;
+    unsigned int nIndex;
+    bool fSpending;
+
+    CAddressIndexKey() { SetNull(); }
+
+    CAddressIndexKey(int nAddressTypeIn, const uint160& hashIn, int nHeightIn, unsigned int nTxIndexIn, const uint256& txhashIn, unsigned int nIndexIn, bool fSpendingIn) :
+        nAddressType(nAddressTypeIn), hash(hashIn), nHeight(nHeightIn), nTxIndex(nTxIndexIn), txhash(txhashIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    void SetNull()
+    {
+        nAddressType = ADDRESS_INDEX_NONE;
+        hash.SetNull();
+        nHeight = 0;
+        nTxIndex = 0;
+        txhash.SetNull();
+        nIndex = 0;
+        fSpending = false;
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 1 + 20 + 4 + 4 + 32 + 4 + 1;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, nAddressType);
+        hash.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, nHeight);
+        ser_writedata32be(s, nTxIndex);
+        txhash.Serialize(s, nType, nVersion);
+        ser_writedata32(s, nIndex);
+        ser_writedata8(s, fSpending);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        nAddressType = ser_readdata8(s);
+        hash.Unserialize(s, nType, nVersion);
+        nHeight = ser_readdata32be(s);
+        nTxIndex = ser_readdata32be(s);
+        txhash.Unserialize(s, nType, nVersion);
+        nIndex = ser_readdata32(s);
+        fSpending = ser_readdata8(s) != 0;
+    }
+};
+
+/** Start of the address index entries of an address from nHeight on, to seek to */
+struct CAddressIndexSeekKey
+{
+    uint8_t nAddressType;
+    uint160 hash;
+    int nHeight;
+
+    CAddressIndexSeekKey(int nAddressTypeIn, const uint160& hashIn, int nHeightIn) : nAddressType(nAddressTypeIn), hash(hashIn), nHeight(nHeightIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 1 + 20 + 4;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, nAddressType);
+        hash.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, nHeight);
+    }
+};
+
+/** An unspent output paying to an address */
+struct CAddressUnspentKey
+{
+    uint8_t nAddressType;
+    uint160 hash;
+    uint256 txhash;
+    unsigned int nIndex;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nAddressType);
+        READWRITE(hash);
+        READWRITE(txhash);
+        READWRITE(nIndex);
+    }
+
+    CAddressUnspentKey() : nAddressType(ADDRESS_INDEX_NONE), nIndex(0) {}
+    CAddressUnspentKey(int nAddressTypeIn, const uint160& hashIn, const uint256& txhashIn, unsigned int nIndexIn) :
+        nAddressType(nAddressTypeIn), hash(hashIn), txhash(txhashIn), nIndex(nIndexIn) {}
+};
+
+/** Amount, script and height of an unspent output. A null value erases the entry. */
+struct CAddressUnspentValue
+{
+    CAmount nValue;
+    CScript script;
+    int nHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nValue);
+        READWRITE(*(CScriptBase*)(&script));
+        READWRITE(nHeight);
+    }
+
+    CAddressUnspentValue() : nValue(-1), nHeight(0) {}
+    CAddressUnspentValue(CAmount nValueIn, const CScript& scriptIn, int nHeightIn) : nValue(nValueIn), script(scriptIn), nHeight(nHeightIn) {}
+
+    bool IsNull() const { return nValue == -1; }
+};
+
+/** An output that has been spent */
+struct CSpentIndexKey
+{
+    uint256 txid;
+    unsigned int nIndex;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(nIndex);
+    }
+
+    CSpentIndexKey() : nIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, unsigned int nIndexIn) : txid(txidIn), nIndex(nIndexIn) {}
+};
+
+/** The input that spent an output, and what the output was. A null value erases the entry. */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    unsigned int nInput;
+    int nHeight;
+    CAmount nValue;
+    uint8_t nAddressType;
+    uint160 hash;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(nInput);
+        READWRITE(nHeight);
+        READWRITE(nValue);
+        READWRITE(nAddressType);
+        READWRITE(hash);
+    }
+
+    CSpentIndexValue() : nInput(0), nHeight(-1), nValue(0), nAddressType(ADDRESS_INDEX_NONE) {}
+    CSpentIndexValue(const uint256& txidIn, unsigned int nInputIn, int nHeightIn, CAmount nValueIn, int nAddressTypeIn, const uint160& hashIn) :
+        txid(txidIn), nInput(nInputIn), nHeight(nHeightIn), nValue(nValueIn), nAddressType(nAddressTypeIn), hash(hashIn) {}
+
+    bool IsNull() const { return txid.IsNull(); }
+};
+
+/** What connecting or disconnecting one block changes in the address, unspent and spent indexes */
+struct CAddressIndexUpdate
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<CAddressIndexKey> vAddressIndexErase;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+};
+
+/** A mempool transaction paying to (fSpending false) or spending from an address */
+struct CMempoolAddressDeltaKey
+{
+    int nAddressType;
+    uint160 hash;
+    uint256 txhash;
+    unsigned int nIndex;
+    bool fSpending;
+
+    CMempoolAddressDeltaKey(int nAddressTypeIn, const uint160& hashIn, const uint256& txhashIn, unsigned int nIndexIn, bool fSpendingIn) :
+        nAddressType(nAddressTypeIn), hash(hashIn), txhash(txhashIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    /** The first key of an address */
+    CMempoolAddressDeltaKey(int nAddressTypeIn, const uint160& hashIn) :
+        nAddressType(nAddressTypeIn), hash(hashIn), nIndex(0), fSpending(false) {}
+
+    bool operator<(const CMempoolAddressDeltaKey& b) const
+    {
+        if (nAddressType != b.nAddressType)
+            return nAddressType < b.nAddressType;
+        if (hash != b.hash)
+            return hash < b.hash;
+        if (txhash != b.txhash)
+            return txhash < b.txhash;
+        if (nIndex != b.nIndex)
+            return nIndex < b.nIndex;
+        return fSpending < b.fSpending;
+    }
+};
+
+/** Amount of a CMempoolAddressDeltaKey, negative when spending, and for spends the output spent */
+struct CMempoolAddressDelta
+{
+    int64_t nTime;
+    CAmount nAmount;
+    COutPoint prevout;
+
+    CMempoolAddressDelta(int64_t nTimeIn, CAmount nAmountIn, const COutPoint& prevoutIn = COutPoint()) :
+        nTime(nTimeIn), nAmount(nAmountIn), prevout(prevoutIn) {}
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
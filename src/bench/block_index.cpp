@@ -0,0 +1,73 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <iostream>
+
+#include <bench/bench.h>
+#include <chain.h>
+#include <memusage.h>
+#include <random.h>
+
+static const int BENCH_BLOCK_INDEX_ENTRIES = 200000;
+
+/**
+ * Build a chain of nEntries block index entries, each either a separate heap
+ * allocation (as before CBlockIndexArena) or from an arena. In a running node
+ * the entries are allocated between blocks, transactions and messages, which is
+ * simulated with an unrelated allocation after each entry.
+ */
+static CBlockIndex* BuildChain(int nEntries, CBlockIndexArena* pArena, std::vector<CBlockIndex*>& vHeap, std::vector<std::vector<unsigned char> >& vOther)
+{
+    FastRandomContext rand(true);
+    CBlockIndex* pindexPrev = NULL;
+    for (int i = 0; i < nEntries; i++) {
+        CBlockIndex* pindex = pArena ? pArena->Allocate() : new CBlockIndex();
+        if (!pArena)
+            vHeap.push_back(pindex);
+        pindex->pprev = pindexPrev;
+        pindex->nHeight = i;
+        pindex->nTime = i;
+        pindex->BuildSkip();
+        pindexPrev = pindex;
+        vOther.push_back(std::vector<unsigned char>(64 + rand.rand32() % 512));
+    }
+    return pindexPrev;
+}
+
+static void WalkChain(benchmark::State& state, bool fArena)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vHeap;
+    std::vector<std::vector<unsigned char> > vOther;
+    const CBlockIndex* pindexTip = BuildChain(BENCH_BLOCK_INDEX_ENTRIES, fArena ? &arena : NULL, vHeap, vOther);
+
+    const size_t nUsage = fArena ? arena.DynamicMemoryUsage() : vHeap.size() * memusage::MallocUsage(sizeof(CBlockIndex));
+    const double nPerEntry = (double)nUsage / BENCH_BLOCK_INDEX_ENTRIES;
+    std::cout << (fArena ? "BlockIndexMemoryArena," : "BlockIndexMemoryHeap,") << BENCH_BLOCK_INDEX_ENTRIES << ","
+              << nPerEntry << "," << nPerEntry << "," << nPerEntry << "\n";
+
+    // The walks chainActive.SetTip and GetMedianTimePast do over pprev
+    int64_t nSum = 0;
+    while (state.KeepRunning()) {
+        for (const CBlockIndex* pindex = pindexTip; pindex; pindex = pindex->pprev)
+            nSum += pindex->nTime;
+    }
+    assert(nSum != 0);
+
+    for (unsigned int i = 0; i < vHeap.size(); i++)
+        delete vHeap[i];
+}
+
+static void BlockIndexWalkHeap(benchmark::State& state)
+{
+    WalkChain(state, false);
+}
+
+static void BlockIndexWalkArena(benchmark::State& state)
+{
+    WalkChain(state, true);
+}
+
+BENCHMARK(BlockIndexWalkHeap);
+BENCHMARK(BlockIndexWalkArena);
@@ -5,6 +5,8 @@
 #include <bench/bench.h>
 #include <wallet/wallet.h>
 
+#include <random.h>
+
 #include <boost/foreach.hpp>
 #include <set>
 
@@ -59,4 +61,71 @@ static void CoinSelection(benchmark::State& state)
     }
 }
 
+// Consolidation-sized wallet: 100k outputs of random value between 0.001 and
+// 1 coin, in steps of 0.001. The pool is built once; each iteration runs every confirmation tier
+// a send would try, for a target that needs a few hundred inputs.
+static const int LARGE_WALLET_COINS = 100000;
+
+static void BuildLargeWallet(const CWallet& wallet, vector<COutput>& vCoins)
+{
+    FastRandomContext rand(true);
+    for (int i = 0; i < LARGE_WALLET_COINS; i++)
+        addCoin((1 + rand.rand32() % 1000) * (COIN / 1000), wallet, vCoins);
+}
+
+static void CoinSelectionLargeWallet(benchmark::State& state, const CAmount& nTargetValue)
+{
+    const CWallet wallet;
+    vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    BuildLargeWallet(wallet, vCoins);
+    CCoinSelectionPool pool;
+    pool.Set(vCoins);
+
+    while (state.KeepRunning()) {
+        set<pair<const CWalletTx*, unsigned int> > setCoinsRet;
+        CAmount nValueRet;
+        bool success = wallet.SelectCoinsMinConf(nTargetValue, 1, 6, 0, pool, setCoinsRet, nValueRet);
+        assert(success);
+        assert(nValueRet >= nTargetValue);
+    }
+
+    BOOST_FOREACH (COutput output, vCoins)
+        delete output.tx;
+}
+
+// Small targets usually have an exact match, found by the branch and bound search
+static void CoinSelectionLargeWalletBnB(benchmark::State& state)
+{
+    CoinSelectionLargeWallet(state, 5 * COIN);
+}
+
+// A target no subset can hit exactly exhausts the search and falls back to the knapsack solver
+static void CoinSelectionLargeWalletKnapsack(benchmark::State& state)
+{
+    CoinSelectionLargeWallet(state, 250 * COIN + 1);
+}
+
+// Sorting the outputs of a large wallet into a selection pool
+static void CoinSelectionPoolBuild(benchmark::State& state)
+{
+    const CWallet wallet;
+    vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    BuildLargeWallet(wallet, vCoins);
+    while (state.KeepRunning()) {
+        CCoinSelectionPool pool;
+        pool.Set(vCoins);
+        assert(pool.size() == vCoins.size());
+    }
+
+    BOOST_FOREACH (COutput output, vCoins)
+        delete output.tx;
+}
+
 BENCHMARK(CoinSelection);
+BENCHMARK(CoinSelectionLargeWalletBnB);
+BENCHMARK(CoinSelectionLargeWalletKnapsack);
+BENCHMARK(CoinSelectionPoolBuild);
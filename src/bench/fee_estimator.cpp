@@ -0,0 +1,107 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <policy/fees.h>
+#include <policy/policy.h>
+#include <random.h>
+#include <txmempool.h>
+
+#include <algorithm>
+#include <list>
+#include <vector>
+
+/** A block of the recording: the transactions relayed before it, and the ones it confirmed */
+struct RecordedBlock
+{
+    std::vector<std::pair<CTransaction, CAmount> > vRelayed;
+    std::vector<CTransaction> vConfirmed;
+};
+
+struct CompareRecordedFeeRate
+{
+    bool operator()(const std::pair<CTransaction, CAmount>& a, const std::pair<CTransaction, CAmount>& b) const
+    {
+        return CFeeRate(a.second, a.first.GetTotalSize()) > CFeeRate(b.second, b.first.GetTotalSize());
+    }
+};
+
+/**
+ * Record nBlocks of a fee market where miners take the best paying
+ * transactions that fit. Halfway through demand and fees double, which the
+ * estimators have to follow.
+ */
+static std::vector<RecordedBlock> RecordBlocks(int nBlocks)
+{
+    FastRandomContext rand(true);
+    std::vector<RecordedBlock> vBlocks(nBlocks);
+    std::vector<std::pair<CTransaction, CAmount> > vPool;
+    const unsigned int nBlockSize = 40000;
+
+    for (int nHeight = 0; nHeight < nBlocks; nHeight++) {
+        const bool fBusy = nHeight >= nBlocks / 2;
+        const int nRelayed = fBusy ? 150 : 75;
+        for (int i = 0; i < nRelayed; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.hash = GetRandHash();
+            tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(100 + rand.rand32() % 300, 0);
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            tx.vout[0].nValue = COIN;
+            CTransaction txRelayed(tx);
+            CAmount nFeePerK = (fBusy ? 2 : 1) * (1000 + rand.rand32() % 50000);
+            vBlocks[nHeight].vRelayed.push_back(std::make_pair(txRelayed, CFeeRate(nFeePerK).GetFee(txRelayed.GetTotalSize())));
+        }
+        vPool.insert(vPool.end(), vBlocks[nHeight].vRelayed.begin(), vBlocks[nHeight].vRelayed.end());
+
+        std::sort(vPool.begin(), vPool.end(), CompareRecordedFeeRate());
+        unsigned int nSize = 0;
+        size_t nMined = 0;
+        while (nMined < vPool.size() && nSize + vPool[nMined].first.GetTotalSize() <= nBlockSize) {
+            nSize += vPool[nMined].first.GetTotalSize();
+            vBlocks[nHeight].vConfirmed.push_back(vPool[nMined].first);
+            nMined++;
+        }
+        vPool.erase(vPool.begin(), vPool.begin() + nMined);
+    }
+    return vBlocks;
+}
+
+/** Replay the recording into a fresh mempool, asking for estimates after every block */
+static void ReplayBlocks(benchmark::State& state, FeeEstimateMode mode)
+{
+    static const std::vector<RecordedBlock> vBlocks = RecordBlocks(200);
+    std::list<CTransaction> dummyConflicted;
+    LockPoints lp;
+
+    while (state.KeepRunning()) {
+        CTxMemPool pool(CFeeRate(1000));
+        pool.setFeeEstimateMode(mode);
+        for (unsigned int nHeight = 0; nHeight < vBlocks.size(); nHeight++) {
+            const RecordedBlock& block = vBlocks[nHeight];
+            for (unsigned int i = 0; i < block.vRelayed.size(); i++) {
+                const CTransaction& tx = block.vRelayed[i].first;
+                pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, block.vRelayed[i].second, 0, 0, nHeight, true,
+                                                                tx.GetValueOut(), false, 4, lp));
+            }
+            pool.removeForBlock(block.vConfirmed, nHeight + 1, dummyConflicted);
+            for (int nTarget = 1; nTarget <= (int)MAX_BLOCK_CONFIRMS; nTarget++)
+                pool.estimateSmartFee(nTarget);
+        }
+    }
+}
+
+static void FeeEstimatorReplayClassic(benchmark::State& state)
+{
+    ReplayBlocks(state, FEE_ESTIMATE_CLASSIC);
+}
+
+static void FeeEstimatorReplayHorizon(benchmark::State& state)
+{
+    ReplayBlocks(state, FEE_ESTIMATE_HORIZON);
+}
+
+BENCHMARK(FeeEstimatorReplayClassic);
+BENCHMARK(FeeEstimatorReplayHorizon);
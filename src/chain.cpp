@@ -5,8 +5,36 @@
 
 #include "chain.h"
 
+#include "memusage.h"
+
 using namespace std;
 
+CBlockIndex* CBlockIndexArena::Allocate(const CBlockIndex& index)
+{
+    if (vChunks.empty() || vChunks.back().size() == vChunks.back().capacity()) {
+        vChunks.push_back(std::vector<CBlockIndex>());
+        vChunks.back().reserve(nChunkSize);
+    }
+    // A chunk never grows past what it reserved, so its entries never move
+    vChunks.back().push_back(index);
+    nSize++;
+    return &vChunks.back().back();
+}
+
+void CBlockIndexArena::Clear()
+{
+    vChunks.clear();
+    nSize = 0;
+}
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(vChunks);
+    for (unsigned int i = 0; i < vChunks.size(); i++)
+        nUsage += memusage::DynamicUsage(vChunks[i]);
+    return nUsage;
+}
+
 /**
  * CChain implementation
  */
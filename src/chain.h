@@ -285,6 +285,9 @@ public:
 
     uint256 GetBlockPoWHash() const
     {
+        // Up to version 6 the block hash is the scrypt hash already
+        if (nVersion <= 6)
+            return GetBlockHash();
         return GetBlockHeader().GetPoWHash();
     }
 
@@ -371,6 +374,40 @@ public:
     const CBlockIndex* GetAncestor(int height) const;
 };
 
+/** Number of entries CBlockIndexArena allocates at once */
+static const size_t BLOCK_INDEX_ARENA_CHUNK = 4096;
+
+/**
+ * Storage for block index entries.
+ *
+ * Entries are carved out of chunks of nChunkSize entries rather than being
+ * allocated one by one. That saves the allocator's per-allocation overhead and
+ * keeps entries that were created together, as during a sync or when loading
+ * the index, next to each other, which is what walks along pprev touch. An
+ * entry stays at its address until Clear(), which releases all of them; there
+ * is no way to free a single entry.
+ */
+class CBlockIndexArena
+{
+private:
+    std::vector<std::vector<CBlockIndex> > vChunks;
+    size_t nChunkSize;
+    size_t nSize;
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    void operator=(const CBlockIndexArena&);
+
+public:
+    explicit CBlockIndexArena(size_t nChunkSizeIn = BLOCK_INDEX_ARENA_CHUNK) : nChunkSize(nChunkSizeIn), nSize(0) {}
+
+    //! Store a copy of index and return its address
+    CBlockIndex* Allocate(const CBlockIndex& index = CBlockIndex());
+    void Clear();
+
+    size_t Size() const { return nSize; }
+    size_t DynamicMemoryUsage() const;
+};
+
 arith_uint256 GetBlockProof(const CBlockIndex& block);
 /** Return the time it would take to redo the work difference between from and to, assuming the current hashrate corresponds to the difficulty at tip, in seconds. */
 int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& from, const CBlockIndex& tip, const Consensus::Params&);
@@ -307,6 +307,12 @@ public:
         consensus.vDeployments[d].nStartTime = nStartTime;
         consensus.vDeployments[d].nTimeout = nTimeout;
     }
+
+    void UpdateTxOutSetSnapshot(int nHeight, const uint256& hashBlock, const uint256& hashSnapshot)
+    {
+        mapTxOutSetSnapshots[nHeight].hashBlock = hashBlock;
+        mapTxOutSetSnapshots[nHeight].hashSnapshot = hashSnapshot;
+    }
 };
 static CRegTestParams regTestParams;
 
@@ -340,4 +346,9 @@ void UpdateRegtestBIP9Parameters(Consensus::DeploymentPos d, int64_t nStartTime,
     regTestParams.UpdateBIP9Parameters(d, nStartTime, nTimeout);
 }
 
+void UpdateRegtestTxOutSetSnapshot(int nHeight, const uint256& hashBlock, const uint256& hashSnapshot)
+{
+    regTestParams.UpdateTxOutSetSnapshot(nHeight, hashBlock, hashSnapshot);
+}
+
 
@@ -44,6 +44,14 @@ struct CCheckpointData {
     double fTransactionsPerDay;
 };
 
+/** A UTXO set snapshot that -loadtxoutset accepts */
+struct CTxOutSetSnapshotData {
+    uint256 hashBlock;    //!< block the snapshot was taken at
+    uint256 hashSnapshot; //!< hash of the snapshot contents, as dumptxoutset reports it
+};
+
+typedef std::map<int, CTxOutSetSnapshotData> MapTxOutSetSnapshots;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -87,6 +95,8 @@ public:
     const std::string &CashAddrPrefix() const { return cashaddrPrefix; }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    /** UTXO set snapshots that can be loaded, by the height of their block */
+    const MapTxOutSetSnapshots& TxOutSetSnapshots() const { return mapTxOutSetSnapshots; }
     int LastPOWBlock() const { return consensus.nLastPOWBlock; }
 protected:
     CChainParams() {}
@@ -107,6 +117,7 @@ protected:
     bool fMineBlocksOnDemand;
     bool fTestnetToBeDeprecatedFieldRPC;
     CCheckpointData checkpointData;
+    MapTxOutSetSnapshots mapTxOutSetSnapshots;
 };
 
 /**
@@ -131,4 +142,9 @@ void SelectParams(const std::string& chain);
  */
 void UpdateRegtestBIP9Parameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
 
+/**
+ * Allows accepting a UTXO set snapshot on regtest.
+ */
+void UpdateRegtestTxOutSetSnapshot(int nHeight, const uint256& hashBlock, const uint256& hashSnapshot);
+
 #endif // BITCOIN_CHAINPARAMS_H
@@ -7,6 +7,8 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "rpc/cbor.h"
+#include "rpc/jsonstream.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -66,7 +68,7 @@ static std::string strRPCUserColonPass;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
 
-static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
+static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id, bool fCBOR)
 {
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
@@ -77,6 +79,12 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     else if (code == RPC_METHOD_NOT_FOUND)
         nStatus = HTTP_NOT_FOUND;
 
+    if (fCBOR) {
+        req->WriteHeader("Content-Type", CBOR_CONTENT_TYPE);
+        req->WriteReply(nStatus, EncodeCBOR(JSONRPCReplyObj(NullUniValue, objError, id)));
+        return;
+    }
+
     std::string strReply = JSONRPCReply(NullUniValue, objError, id);
 
     req->WriteHeader("Content-Type", "application/json");
@@ -172,36 +180,71 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         return false;
     }
 
+    // Requests sent as CBOR are answered in CBOR, through the same dispatch
+    std::pair<bool, std::string> contentType = req->GetHeader("content-type");
+    const bool fCBOR = contentType.first && boost::istarts_with(contentType.second, CBOR_CONTENT_TYPE);
+
     JSONRequest jreq;
     try {
         // Parse request
         UniValue valRequest;
-        if (!valRequest.read(req->ReadBody()))
+        if (fCBOR ? !DecodeCBOR(req->ReadBody(), valRequest) : !valRequest.read(req->ReadBody()))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-        std::string strReply;
+        UniValue reply;
+        std::string strCBORReply;
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
-
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            if (fCBOR) {
+                // CBOR replies are encoded whole, only JSON replies are streamed
+                UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
+                strCBORReply = EncodeCBORReply(JSONRPCReplyObj(result, NullUniValue, jreq.id), jreq.strMethod);
+            } else {
+                // Send the reply while it is produced, so that a large result
+                // is never held in memory whole
+                HTTPReplyStream stream(req, "application/json");
+                JSONStreamWriter writer(std::ref(stream));
+                try {
+                    writer.BeginObject();
+                    writer.Key("result");
+                    tableRPC.executeStream(jreq.strMethod, jreq.params, writer);
+                    writer.Field("error", NullUniValue);
+                    writer.Field("id", jreq.id);
+                    writer.End();
+                } catch (...) {
+                    if (!stream.Started())
+                        throw;
+                    // Part of the result is out, all we can do is cut it short
+                    LogPrintf("%s: %s failed after sending part of its result\n", __func__, jreq.strMethod);
+                    stream.Finish("");
+                    return false;
+                }
+                stream.Finish(writer.TakeBuffer() + "\n");
+                return true;
+            }
 
         // array of requests
-        } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+        } else if (valRequest.isArray()) {
+            reply = JSONRPCExecBatch(valRequest.get_array());
+            if (fCBOR)
+                strCBORReply = EncodeCBORBatchReply(reply, valRequest);
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strReply);
+        if (fCBOR) {
+            req->WriteHeader("Content-Type", CBOR_CONTENT_TYPE);
+            req->WriteReply(HTTP_OK, strCBORReply);
+        } else {
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, reply.write() + "\n");
+        }
     } catch (const UniValue& objError) {
-        JSONErrorReply(req, objError, jreq.id);
+        JSONErrorReply(req, objError, jreq.id, fCBOR);
         return false;
     } catch (const std::exception& e) {
-        JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id, fCBOR);
         return false;
     }
     return true;
@@ -20,12 +20,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <atomic>
 #include <future>
 
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/thread.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
@@ -39,6 +41,31 @@
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
 
+/** Bytes of a chunked reply that may wait to be written to the client before its worker pauses */
+static const size_t MAX_HTTP_REPLY_BUFFERED = 1024 * 1024;
+
+/** Flow control of a chunked reply, shared by the worker writing it and the
+ * http thread sending it. The worker waits while the reply is backed up; the
+ * http thread wakes it from a callback on the output buffer of the
+ * connection as the client reads.
+ */
+struct HTTPReplyFlow
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    size_t nQueued;   //!< bytes of chunks not yet added to the output buffer
+    size_t nBuffered; //!< bytes in the output buffer of the connection
+    bool fClosed;     //!< the connection went away
+
+    // Used from the http thread only
+    struct evhttp_connection* evcon;
+    struct evbuffer_cb_entry* outputCb;
+
+    HTTPReplyFlow() : nQueued(0), nBuffered(0), fClosed(false), evcon(0), outputCb(0) {}
+
+    bool Full() const { return nQueued + nBuffered > MAX_HTTP_REPLY_BUFFERED; }
+};
+
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
 {
@@ -168,6 +195,9 @@ struct HTTPPathHandler
     HTTPRequestHandler handler;
 };
 
+/** Set when the server is interrupted, so no worker keeps waiting for a client */
+static std::atomic<bool> fHTTPInterrupted(false);
+
 /** HTTP module state */
 
 //! libevent event loop
@@ -464,6 +494,7 @@ bool StartHTTPServer()
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
+    fHTTPInterrupted = true;
     if (eventHTTP) {
         // Unlisten sockets
         for (evhttp_bound_socket *socket : boundSockets) {
@@ -548,7 +579,8 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
@@ -556,7 +588,8 @@ HTTPRequest::~HTTPRequest()
     if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
-        WriteReply(HTTP_INTERNAL, "Unhandled request");
+        // A chunked reply can only be cut short
+        WriteReply(HTTP_INTERNAL, replyStarted ? "" : "Unhandled request");
     }
     // evhttpd cleans up the request, as long as a reply was sent.
 }
@@ -599,6 +632,64 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
+/** Track the output buffer of a connection with a chunked reply, and wake the worker once the client caught up */
+static void http_reply_output_cb(struct evbuffer* buffer, const struct evbuffer_cb_info* info, void* arg)
+{
+    HTTPReplyFlow* flow = (HTTPReplyFlow*)arg;
+    std::lock_guard<std::mutex> lock(flow->cs);
+    flow->nBuffered = evbuffer_get_length(buffer);
+    if (!flow->Full())
+        flow->cond.notify_all();
+}
+
+/** Stop watching the connection of a chunked reply */
+static void http_reply_detach(HTTPReplyFlow* flow)
+{
+    if (!flow->outputCb)
+        return;
+    evbuffer_remove_cb_entry(bufferevent_get_output(evhttp_connection_get_bufferevent(flow->evcon)), flow->outputCb);
+    evhttp_connection_set_closecb(flow->evcon, NULL, NULL);
+    flow->outputCb = 0;
+}
+
+/** The connection of a chunked reply closed: let the worker drop the rest */
+static void http_reply_close_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPReplyFlow* flow = (HTTPReplyFlow*)arg;
+    http_reply_detach(flow);
+    std::lock_guard<std::mutex> lock(flow->cs);
+    flow->fClosed = true;
+    flow->cond.notify_all();
+}
+
+/** Start a chunked reply from the main http thread, and watch its connection */
+static void http_send_reply_start(struct evhttp_request* req, int nStatus, std::shared_ptr<HTTPReplyFlow> flow)
+{
+    evhttp_send_reply_start(req, nStatus, NULL);
+    flow->evcon = evhttp_request_get_connection(req);
+    flow->outputCb = evbuffer_add_cb(bufferevent_get_output(evhttp_connection_get_bufferevent(flow->evcon)),
+                                     http_reply_output_cb, flow.get());
+    evhttp_connection_set_closecb(flow->evcon, http_reply_close_cb, flow.get());
+}
+
+/** Send a reply chunk from the main http thread, and free it */
+static void http_send_reply_chunk(struct evhttp_request* req, struct evbuffer* chunk, std::shared_ptr<HTTPReplyFlow> flow)
+{
+    size_t nSize = evbuffer_get_length(chunk);
+    if (flow->outputCb)
+        evhttp_send_reply_chunk(req, chunk);
+    evbuffer_free(chunk);
+    std::lock_guard<std::mutex> lock(flow->cs);
+    flow->nQueued -= nSize;
+}
+
+/** Finish a chunked reply from the main http thread */
+static void http_send_reply_end(struct evhttp_request* req, std::shared_ptr<HTTPReplyFlow> flow)
+{
+    http_reply_detach(flow.get());
+    evhttp_send_reply_end(req);
+}
+
 /** Closure sent to main thread to request a reply to be sent to
  * a HTTP request.
  * Replies must be sent in the main loop in the main http thread,
@@ -607,6 +698,15 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
+    if (replyStarted) {
+        if (!strReply.empty())
+            WriteReplyChunk(nStatus, strReply);
+        HTTPEvent* ev = new HTTPEvent(eventBase, true, std::bind(http_send_reply_end, req, replyFlow));
+        ev->trigger(0);
+        replySent = true;
+        req = 0; // transferred back to main thread
+        return;
+    }
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
@@ -618,6 +718,54 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+void HTTPRequest::WriteReplyChunk(int nStatus, const std::string& strChunk)
+{
+    assert(!replySent && req);
+    // Events triggered from this thread run in order, so the chunks follow
+    // the status line and each other
+    if (!replyStarted) {
+        replyFlow = std::make_shared<HTTPReplyFlow>();
+        HTTPEvent* ev = new HTTPEvent(eventBase, true, std::bind(http_send_reply_start, req, nStatus, replyFlow));
+        ev->trigger(0);
+        replyStarted = true;
+    }
+    {
+        // Don't produce the reply faster than the client reads it
+        std::unique_lock<std::mutex> lock(replyFlow->cs);
+        while (replyFlow->Full() && !replyFlow->fClosed && !fHTTPInterrupted)
+            replyFlow->cond.wait_for(lock, std::chrono::milliseconds(100));
+        if (replyFlow->fClosed)
+            return;
+        replyFlow->nQueued += strChunk.size();
+    }
+    struct evbuffer* chunk = evbuffer_new();
+    assert(chunk);
+    evbuffer_add(chunk, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, std::bind(http_send_reply_chunk, req, chunk, replyFlow));
+    ev->trigger(0);
+}
+
+HTTPReplyStream::HTTPReplyStream(HTTPRequest* reqIn, const std::string& strContentTypeIn) :
+    req(reqIn), strContentType(strContentTypeIn), fStarted(false)
+{
+}
+
+void HTTPReplyStream::operator()(const std::string& strChunk)
+{
+    if (!fStarted) {
+        req->WriteHeader("Content-Type", strContentType);
+        fStarted = true;
+    }
+    req->WriteReplyChunk(HTTP_OK, strChunk);
+}
+
+void HTTPReplyStream::Finish(const std::string& strLast)
+{
+    if (!fStarted)
+        req->WriteHeader("Content-Type", strContentType);
+    req->WriteReply(HTTP_OK, strLast);
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
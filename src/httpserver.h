@@ -8,6 +8,7 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -17,6 +18,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPReplyFlow;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -55,6 +57,8 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyStarted; //!< a chunked reply is being sent
+    std::shared_ptr<HTTPReplyFlow> replyFlow; //!< flow control of the chunked reply
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -106,10 +110,48 @@ public:
      * nStatus is the HTTP status code to send.
      * strReply is the body of the reply. Keep it empty to send a standard message.
      *
+     * If a chunked reply was started with WriteReplyChunk, strReply is sent
+     * as its last chunk instead, and nStatus is ignored.
+     *
      * @note Can be called only once. As this will give the request back to the
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Send part of the reply body right away. The first call sends the
+     * status line, with status nStatus, and the headers. Finish the reply
+     * with WriteReply.
+     *
+     * Blocks while more than MAX_HTTP_REPLY_BUFFERED bytes of the reply wait
+     * to be written to the client. Chunks for a client that disconnected
+     * are dropped.
+     */
+    void WriteReplyChunk(int nStatus, const std::string& strChunk);
+};
+
+/** Sink for a reply body produced in pieces, such as by a JSONStreamWriter.
+ * Pieces are sent as they come with WriteReplyChunk, the first one along with
+ * the status line and the Content-Type header. A body that is finished before
+ * any piece was sent goes out as a normal reply.
+ */
+class HTTPReplyStream
+{
+private:
+    HTTPRequest* req;
+    std::string strContentType;
+    bool fStarted;
+
+public:
+    HTTPReplyStream(HTTPRequest* reqIn, const std::string& strContentTypeIn);
+
+    void operator()(const std::string& strChunk);
+
+    /** Whether part of the body was sent, after which the status can't change */
+    bool Started() const { return fStarted; }
+
+    /** Send the rest of the body and finish the reply */
+    void Finish(const std::string& strLast);
 };
 
 /** Event handler closure.
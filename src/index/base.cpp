@@ -0,0 +1,218 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/base.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "init.h"
+#include "primitives/block.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/function.hpp>
+
+//! Seconds between progress lines in the log while an index catches up
+static const int64_t INDEX_SYNC_LOG_INTERVAL = 30;
+//! Seconds between writes of the locator while an index catches up
+static const int64_t INDEX_SYNC_COMMIT_INTERVAL = 30;
+
+static void FatalError(const std::string& strMessage)
+{
+    strMiscWarning = strMessage;
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(_("Error: A fatal internal error occurred, see debug.log for details"), "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+CBaseIndex::CBaseIndex() : pindexBest(NULL), fSynced(false), fInterrupt(false), fNotified(false), fIdle(false)
+{
+}
+
+CBaseIndex::~CBaseIndex()
+{
+    // Stop() is expected to have run already, as the thread calls virtual methods
+    Interrupt();
+    if (thread.joinable())
+        thread.join();
+}
+
+bool CBaseIndex::Init()
+{
+    CBlockLocator locator;
+    if (!pblocktree->ReadIndexBestBlock(GetName(), locator))
+        return true;
+
+    // The block may have been disconnected since, the thread continues from where it forks off
+    LOCK(cs_main);
+    BOOST_FOREACH(const uint256& hash, locator.vHave) {
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it != mapBlockIndex.end()) {
+            pindexBest = it->second;
+            break;
+        }
+    }
+    return true;
+}
+
+bool CBaseIndex::Start()
+{
+    if (!Init())
+        return false;
+    RegisterValidationInterface(this);
+    boost::function<void()> threadSync = boost::bind(&CBaseIndex::ThreadSync, this);
+    thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, GetName(), threadSync));
+    return true;
+}
+
+void CBaseIndex::Interrupt()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fInterrupt = true;
+    cond.notify_all();
+}
+
+void CBaseIndex::Stop()
+{
+    UnregisterValidationInterface(this);
+    Interrupt();
+    if (thread.joinable())
+        thread.join();
+    Commit();
+}
+
+void CBaseIndex::Notify()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fNotified = true;
+    cond.notify_all();
+}
+
+void CBaseIndex::BlockConnected(const CBlock& block, const CBlockIndex* pindex)
+{
+    Notify();
+}
+
+void CBaseIndex::BlockDisconnected(const CBlock& block)
+{
+    Notify();
+}
+
+bool CBaseIndex::Commit()
+{
+    const CBlockIndex* pindex = pindexBest;
+    if (!pindex)
+        return true;
+    CBlockLocator locator;
+    {
+        LOCK(cs_main);
+        locator = chainActive.GetLocator(pindex);
+    }
+    if (!pblocktree->WriteIndexBestBlock(GetName(), locator))
+        return error("%s: failed to write the locator of %s", __func__, GetName());
+    return true;
+}
+
+void CBaseIndex::ThreadSync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const CBlockIndex* pindexCommitted = pindexBest;
+    int64_t nLastLog = 0;
+    int64_t nLastCommit = GetTime();
+
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fInterrupt)
+                return;
+        }
+
+        // Nothing written for blocks that were disconnected is removed; the
+        // index continues from the fork, and WriteBlock overwrites the entries
+        // of transactions that are in a block of the active chain again.
+        const CBlockIndex* pindex = pindexBest;
+        CDiskBlockPos pos;
+        {
+            LOCK(cs_main);
+            if (pindex && !chainActive.Contains(pindex))
+                pindexBest = pindex = chainActive.FindFork(pindex);
+            pindex = pindex ? chainActive.Next(pindex) : chainActive.Genesis();
+            // The blocks before a UTXO set snapshot were never downloaded, the index starts after them
+            if (fTxOutSetSnapshot && pindex && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+                while (pindex && !(pindex->nStatus & BLOCK_HAVE_DATA))
+                    pindex = chainActive.Next(pindex);
+                pindexBest = pindex ? pindex->pprev : chainActive.Tip();
+                LogPrintf("%s starts after height %d, the blocks up to there are not available\n", GetName(), pindexBest.load()->nHeight);
+            }
+            if (pindex)
+                pos = pindex->GetBlockPos();
+        }
+
+        if (!pindex) {
+            if (!fSynced) {
+                const CBlockIndex* pindexSynced = pindexBest;
+                LogPrintf("%s is enabled at height %d\n", GetName(), pindexSynced ? pindexSynced->nHeight : -1);
+                fSynced = true;
+            }
+            if (pindexCommitted != pindexBest && Commit()) {
+                pindexCommitted = pindexBest;
+                nLastCommit = GetTime();
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!fNotified && !fInterrupt) {
+                fIdle = true;
+                cond.notify_all();
+                while (!fNotified && !fInterrupt)
+                    cond.wait(lock);
+                fIdle = false;
+            }
+            fNotified = false;
+            continue;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pos, consensusParams) || block.GetHash() != pindex->GetBlockHash()) {
+            FatalError(strprintf("%s: failed to read block %s from disk", GetName(), pindex->GetBlockHash().ToString()));
+            break;
+        }
+        if (!WriteBlock(block, pindex)) {
+            FatalError(strprintf("%s: failed to write block %s", GetName(), pindex->GetBlockHash().ToString()));
+            break;
+        }
+        pindexBest = pindex;
+
+        int64_t nNow = GetTime();
+        if (!fSynced && nNow - nLastLog >= INDEX_SYNC_LOG_INTERVAL) {
+            LogPrintf("Syncing %s with block chain from height %d\n", GetName(), pindex->nHeight);
+            nLastLog = nNow;
+        }
+        if (nNow - nLastCommit >= INDEX_SYNC_COMMIT_INTERVAL && Commit()) {
+            pindexCommitted = pindex;
+            nLastCommit = nNow;
+        }
+    }
+
+    // Failed, wake whoever waits for the index
+    fSynced = false;
+    Interrupt();
+}
+
+bool CBaseIndex::BlockUntilSyncedToCurrentChain()
+{
+    if (!fSynced)
+        return false;
+
+    // The thread was notified of every block connected so far, so once it is
+    // idle with no notification pending it has seen the current tip.
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!fInterrupt && (fNotified || !fIdle))
+        cond.wait(lock);
+    return !fInterrupt;
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BASE_H
+#define BITCOIN_INDEX_BASE_H
+
+#include "validationinterface.h"
+
+#include <atomic>
+
+#include <boost/thread.hpp>
+
+class CBlock;
+class CBlockIndex;
+
+/**
+ * Base of the optional indexes that are built in a thread of their own rather
+ * than in ConnectBlock. The thread reads the blocks of the active chain from
+ * disk from the last one the index has written up to the tip, and then
+ * follows the tip as it is woken for each block connected. Each index keeps a
+ * locator of the last block it has written in the block tree database, so it
+ * resumes there after a restart and can be turned on and off without
+ * reindexing the chainstate.
+ */
+class CBaseIndex : public CValidationInterface
+{
+private:
+    //! Last block written to the index, NULL if none
+    std::atomic<const CBlockIndex*> pindexBest;
+    //! Whether the index has caught up with the active chain since it started
+    std::atomic<bool> fSynced;
+
+    boost::thread thread;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fInterrupt; //!< the thread is to stop
+    bool fNotified;  //!< the active chain changed since the thread last looked
+    bool fIdle;      //!< the thread waits, having written everything up to the tip it saw
+
+    void ThreadSync();
+    /** Wake the thread, the active chain has changed */
+    void Notify();
+    /** Store the locator of pindexBest, so a restart resumes from there */
+    bool Commit();
+
+protected:
+    void BlockConnected(const CBlock& block, const CBlockIndex* pindex);
+    void BlockDisconnected(const CBlock& block);
+
+    /** Called before the thread starts; finds the last block written from the stored locator */
+    virtual bool Init();
+    /** Add the contents of block, connected at pindex, to the index */
+    virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) = 0;
+    /** Name of the index, for the log and the key of its locator */
+    virtual const char* GetName() const = 0;
+
+public:
+    CBaseIndex();
+    virtual ~CBaseIndex();
+
+    /** Find where the index left off and start its thread */
+    bool Start();
+    /** Ask the thread to stop, without waiting */
+    void Interrupt();
+    /** Stop the thread and store how far the index got */
+    void Stop();
+
+    /**
+     * Wait until the index has written every block of the active chain as it
+     * is now. Returns false right away if the index has not caught up since it
+     * started, and the caller should not rely on it. Must not be called with
+     * cs_main held.
+     */
+    bool BlockUntilSyncedToCurrentChain();
+
+    /** Last block written to the index, NULL if none */
+    const CBlockIndex* GetBestBlock() const { return pindexBest; }
+    bool IsSynced() const { return fSynced; }
+};
+
+#endif // BITCOIN_INDEX_BASE_H
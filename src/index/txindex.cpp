@@ -0,0 +1,47 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/txindex.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "serialize.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/foreach.hpp>
+
+CTxIndex* ptxindex = NULL;
+
+bool CTxIndex::Init()
+{
+    // Earlier versions wrote the index in ConnectBlock and only set the flag,
+    // so such an index is complete up to the tip of the chainstate.
+    CBlockLocator locator;
+    bool fInline = false;
+    if (!pblocktree->ReadIndexBestBlock(GetName(), locator) && pblocktree->ReadFlag("txindex", fInline) && fInline) {
+        LOCK(cs_main);
+        if (chainActive.Tip() && !pblocktree->WriteIndexBestBlock(GetName(), chainActive.GetLocator()))
+            return error("%s: failed to write the locator", __func__);
+        LogPrintf("%s: taking over the transaction index up to height %d\n", __func__, chainActive.Height());
+    }
+    // Clearing the flag makes earlier versions, which expect a complete index, ask for a reindex
+    if (fInline && !pblocktree->WriteFlag("txindex", false))
+        return error("%s: failed to clear the txindex flag", __func__);
+    return CBaseIndex::Init();
+}
+
+bool CTxIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    vPos.reserve(block.vtx.size());
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        vPos.push_back(std::make_pair(tx.GetHash(), pos));
+        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+    }
+    return pblocktree->WriteTxIndex(vPos);
+}
@@ -0,0 +1,26 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_TXINDEX_H
+#define BITCOIN_INDEX_TXINDEX_H
+
+#include "index/base.h"
+
+/**
+ * Position on disk of every transaction of the active chain by txid, for
+ * GetTransaction (-txindex). The entries live in the block tree database,
+ * where ConnectBlock used to write them.
+ */
+class CTxIndex : public CBaseIndex
+{
+protected:
+    bool Init();
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex);
+    const char* GetName() const { return "txindex"; }
+};
+
+/** The running transaction index, NULL when -txindex is off */
+extern CTxIndex* ptxindex;
+
+#endif // BITCOIN_INDEX_TXINDEX_H
@@ -19,11 +19,13 @@
 #include "consensus/validation.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "index/txindex.h"
 #include "key.h"
 #include "validation.h"
 #include "miner.h"
 #include "netbase.h"
 #include "net.h"
+#include "policy/fees.h"
 #include "policy/policy.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
@@ -175,6 +177,8 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    if (ptxindex)
+        ptxindex->Interrupt();
     threadGroup.interrupt_all();
 }
 
@@ -216,10 +220,17 @@ void Shutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    if (ptxindex) {
+        ptxindex->Stop();
+        delete ptxindex;
+        ptxindex = NULL;
+    }
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            WriteBlockIndexSnapshot();
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
@@ -235,6 +246,12 @@ void Shutdown()
         pwalletMain->Flush(true);
 #endif
 
+    if (pblocktemplatecache) {
+        UnregisterValidationInterface(pblocktemplatecache);
+        delete pblocktemplatecache;
+        pblocktemplatecache = NULL;
+    }
+
 #if ENABLE_ZMQ
     if (pzmqNotificationInterface) {
         UnregisterValidationInterface(pzmqNotificationInterface);
@@ -309,7 +326,9 @@ std::string HelpMessage(HelpMessageMode mode)
     string strUsage = HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of the outputs paid to and spent from each address, used by the getaddress* rpc calls (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockcompression", strprintf(_("Compress blocks and undo data as they are written to disk. Older versions cannot read them (default: %u)"), DEFAULT_BLOCK_COMPRESSION));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -327,6 +346,9 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external scho000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadtxoutset=<file>", _("Load the UTXO set from a snapshot written by dumptxoutset into a new data directory, and sync from the block it was taken at. "
+            "Only snapshots pinned in the chain parameters are accepted. This mode is incompatible with -addressindex"));
+    strUsage += HelpMessageOpt("-maxorphanpeersize=<n>", strprintf(_("Keep at most <n> kilobytes of unconnectable transactions from a single peer (default: %u)"), DEFAULT_MAX_ORPHAN_PEER_SIZE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
@@ -335,15 +357,16 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
-    strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode is incompatible with -txindex and -rescan. "
+    strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode is incompatible with -txindex, -addressindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the scho*.dat files on disk"));
+    strUsage += HelpMessageOpt("-stakeindex", strprintf(_("Maintain a record of the kernel, proof-of-stake hash, value and staker of each proof-of-stake block, used by the getstakerecords rpc call (default: %u)"), DEFAULT_STAKEINDEX));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
-    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call. It is built in the background, so it can be turned on at any time (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -415,7 +438,9 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitclustercount=<n>", strprintf("Do not accept transactions that would join a group of more than <n> connected in-mempool transactions (default: %u)", DEFAULT_CLUSTER_LIMIT));
         strUsage += HelpMessageOpt("-bip9params=deployment:start:end", "Use given start/end times for specified bip9 deployment (regtest-only)");
+        strUsage += HelpMessageOpt("-txoutsetparams=height:blockhash:hash", "Accept the UTXO set snapshot with the given hash of the given block in -loadtxoutset (regtest-only)");
     }
     string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
@@ -440,6 +465,8 @@ std::string HelpMessage(HelpMessageMode mode)
         CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)));
     strUsage += HelpMessageOpt("-maxtxfee=<amt>", strprintf(_("Maximum total fees (in %s) to use in a single wallet transaction or raw transaction; setting this too low may abort large transactions (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_TRANSACTION_MAXFEE)));
+    strUsage += HelpMessageOpt("-feeestimatemode=<mode>", strprintf(_("How to estimate smart fees: classic, or horizon to combine several history lengths with the current mempool (default: %s)"),
+        FeeEstimateModeString(DEFAULT_FEE_ESTIMATE_MODE)));
     strUsage += HelpMessageOpt("-printtoconsole", _("Send trace/debug info to console instead of debug.log file"));
     if (showDebug)
     {
@@ -608,17 +635,10 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
 
     // -reindex
     if (fReindex) {
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "scho")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file scho%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
+        // The reindexing flag stays set, so the next start carries on with it
+        if (!ReindexBlockFiles(chainparams)) {
+            AbortNode("Reindexing failed", _("Error: Reindexing the block files failed, see debug.log for details"));
+            return;
         }
         pblocktree->WriteReindexing(false);
         fReindex = false;
@@ -864,6 +884,8 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
 #ifdef ENABLE_WALLET
         if (GetBoolArg("-rescan", false)) {
             return InitError(_("Rescans are not possible in pruned mode. You will need to use -reindex which will download the whole blockchain again."));
@@ -871,6 +893,14 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
 #endif
     }
 
+    // a UTXO set snapshot goes into a new chainstate, and brings none of the blocks an address index is built from
+    if (mapArgs.count("-loadtxoutset")) {
+        if (GetBoolArg("-reindex", false) || GetBoolArg("-reindex-chainstate", false))
+            return InitError(_("-loadtxoutset is incompatible with -reindex and -reindex-chainstate."));
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("-loadtxoutset is incompatible with -addressindex."));
+    }
+
     // Make sure enough file descriptors are available
     int nBind = std::max(
                 (mapMultiArgs.count("-bind") ? mapMultiArgs.at("-bind").size() : 0) +
@@ -921,6 +951,7 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fBlockCompression = GetBoolArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION);
     if (GetBoolArg("-checkpoints", false))
             return InitError(_("Error: Unsupported argument -checkpoints found. We rely on it to verify pre protocol v3 era."));
     fCheckpointsEnabled = true;
@@ -982,6 +1013,11 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
             return InitError(AmountErrMsg("minrelaytxfee", mapArgs["-minrelaytxfee"]));
     }
 
+    FeeEstimateMode feeEstimateMode;
+    if (!ParseFeeEstimateMode(GetArg("-feeestimatemode", FeeEstimateModeString(DEFAULT_FEE_ESTIMATE_MODE)), feeEstimateMode))
+        return InitError(strprintf(_("Unknown -feeestimatemode: '%s'"), GetArg("-feeestimatemode", "")));
+    mempool.setFeeEstimateMode(feeEstimateMode);
+
     fRequireStandard = !GetBoolArg("-acceptnonstdtxn", !Params().RequireStandard());
     if (Params().RequireStandard() && !fRequireStandard)
         return InitError(strprintf("acceptnonstdtxn is not currently supported for %s chain", chainparams.NetworkIDString()));
@@ -1041,6 +1077,21 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
         }
     }
 
+    if (mapArgs.count("-txoutsetparams")) {
+        // Allow accepting UTXO set snapshots for testing
+        if (!Params().MineBlocksOnDemand()) {
+            return InitError("UTXO set snapshots may only be accepted on regtest.");
+        }
+        std::vector<std::string> vSnapshotParams;
+        boost::split(vSnapshotParams, mapArgs["-txoutsetparams"], boost::is_any_of(":"));
+        int32_t nHeight;
+        if (vSnapshotParams.size() != 3 || !ParseInt32(vSnapshotParams[0], &nHeight) || !IsHex(vSnapshotParams[1]) || !IsHex(vSnapshotParams[2])) {
+            return InitError("UTXO set snapshot parameters malformed, expecting height:blockhash:hash");
+        }
+        UpdateRegtestTxOutSetSnapshot(nHeight, uint256S(vSnapshotParams[1]), uint256S(vSnapshotParams[2]));
+        LogPrintf("Accepting the UTXO set snapshot %s of block %s at height %d\n", vSnapshotParams[2], vSnapshotParams[1], nHeight);
+    }
+
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
     // Initialize elliptic curve code
@@ -1301,7 +1352,7 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) || GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
@@ -1357,15 +1408,37 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
+                // Check for changed -addressindex state
+                if (fAddressIndex != GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -addressindex");
+                    break;
+                }
+
+                // Check for changed -stakeindex state
+                if (fStakeIndex != GetBoolArg("-stakeindex", DEFAULT_STAKEINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -stakeindex");
                     break;
                 }
 
+                // A chainstate loaded from a UTXO set snapshot cannot be rebuilt from the blocks on disk
+                if (fTxOutSetSnapshot && fReindexChainState)
+                    return InitError(_("The chain state was loaded from a UTXO set snapshot and cannot be rebuilt with -reindex-chainstate, use -reindex"));
+
+                // Load the UTXO set snapshot into the new chainstate
+                if (mapArgs.count("-loadtxoutset")) {
+                    if (mapBlockIndex.size() == 1) {
+                        uiInterface.InitMessage(_("Loading UTXO set snapshot..."));
+                        if (!LoadTxOutSetSnapshot(chainparams, pcoinsdbview, GetArg("-loadtxoutset", "")))
+                            return InitError(_("Unable to load the UTXO set snapshot, see debug.log for details"));
+                    } else if (!fTxOutSetSnapshot) {
+                        return InitError(_("-loadtxoutset can only be used with a new data directory"));
+                    }
+                }
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
-                // in the past, but is now trying to run unpruned.
-                if (fHavePruned && !fPruneMode) {
+                // in the past, but is now trying to run unpruned. The blocks before a UTXO set snapshot
+                // were never there to begin with.
+                if (fHavePruned && !fPruneMode && !fTxOutSetSnapshot) {
                     strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
                     break;
                 }
@@ -1467,6 +1540,12 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
 
     // ********************************************************* Step 9: data directory maintenance
 
+    // without the blocks before its UTXO set snapshot, the node cannot serve the block chain either
+    if (fTxOutSetSnapshot && !fPruneMode) {
+        LogPrintf("Unsetting NODE_NETWORK, the chainstate was loaded from a UTXO set snapshot\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
+
     // if pruning, unset the service bit and perform the initial blockstore prune
     // after any wallet rescanning has taken place.
     if (fPruneMode) {
@@ -1501,6 +1580,14 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
             vImportFiles.push_back(strFile);
     }
 
+    // The transaction index catches up in the background, and then follows the blocks connected
+    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
+    if (fTxIndex) {
+        ptxindex = new CTxIndex();
+        if (!ptxindex->Start())
+            return InitError(_("Failed to start the transaction index"));
+    }
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
     // Wait for genesis block to be processed
@@ -1526,6 +1613,17 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
     LogPrintf("mapAddressBook.size() = %u\n",  pwalletMain ? pwalletMain->mapAddressBook.size() : 0);
 #endif
 
+    // Keep the next block's transaction selection up to date for the staker and getblocktemplate,
+    // unless neither of them can ask for templates
+    bool fBlockTemplates = fServer;
+#ifdef ENABLE_WALLET
+    fBlockTemplates |= pwalletMain && GetBoolArg("-staking", true);
+#endif
+    if (fBlockTemplates) {
+        pblocktemplatecache = new CBlockTemplateCache(chainparams);
+        RegisterValidationInterface(pblocktemplatecache);
+    }
+
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup, scheduler);
 
@@ -1535,9 +1633,14 @@ bool AppInit2(Config& config, boost::thread_group& threadGroup, CScheduler& sche
     // Mine proof-of-stake blocks in the background
     if (!GetBoolArg("-staking", true))
         LogPrintf("Staking disabled\n");
-    else if (pwalletMain)
+    else if (pwalletMain) {
         threadGroup.create_thread(boost::bind(&ThreadStakeMiner, pwalletMain, chainparams));
 
+        // Keep the staking outputs near the configured distribution
+        if (CWallet::stakePolicy.fRebalance)
+            scheduler.scheduleEvery(boost::bind(&CWallet::RebalanceStakeOutputs, pwalletMain), STAKE_REBALANCE_INTERVAL);
+    }
+
     // ********************************************************* Step 12: finished
 #endif
     SetRPCWarmupFinished();
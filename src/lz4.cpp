@@ -0,0 +1,152 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lz4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/** Shortest match a sequence can refer to */
+static const size_t LZ4_MIN_MATCH = 4;
+/** The last bytes of the input are always literals */
+static const size_t LZ4_LAST_LITERALS = 5;
+/** The last match starts at least this many bytes before the end of the input */
+static const size_t LZ4_MATCH_FIND_LIMIT = 12;
+/** Matches are at most this far back */
+static const size_t LZ4_MAX_OFFSET = 65535;
+/** Lengths up to this fit in the token */
+static const size_t LZ4_TOKEN_LENGTH_MAX = 15;
+
+static const int LZ4_HASH_BITS = 12;
+
+static uint32_t Read32(const unsigned char* p)
+{
+    uint32_t n;
+    memcpy(&n, p, sizeof(n));
+    return n;
+}
+
+static unsigned int Hash32(uint32_t n)
+{
+    return (n * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/** Write the part of a length that does not fit in the token */
+static void WriteLength(std::vector<unsigned char>& vchOut, size_t n)
+{
+    while (n >= 255) {
+        vchOut.push_back(255);
+        n -= 255;
+    }
+    vchOut.push_back(n);
+}
+
+/** Write nLiteral literals and, unless this is the last sequence (nMatch == 0), a match */
+static void WriteSequence(std::vector<unsigned char>& vchOut, const unsigned char* pLiteral, size_t nLiteral, size_t nOffset, size_t nMatch)
+{
+    const size_t nToken = vchOut.size();
+    vchOut.push_back(0);
+    unsigned char token = (nLiteral < LZ4_TOKEN_LENGTH_MAX ? nLiteral : LZ4_TOKEN_LENGTH_MAX) << 4;
+    if (nLiteral >= LZ4_TOKEN_LENGTH_MAX)
+        WriteLength(vchOut, nLiteral - LZ4_TOKEN_LENGTH_MAX);
+    vchOut.insert(vchOut.end(), pLiteral, pLiteral + nLiteral);
+
+    if (nMatch > 0) {
+        vchOut.push_back(nOffset & 0xff);
+        vchOut.push_back(nOffset >> 8);
+        const size_t nMatchCode = nMatch - LZ4_MIN_MATCH;
+        token |= nMatchCode < LZ4_TOKEN_LENGTH_MAX ? nMatchCode : LZ4_TOKEN_LENGTH_MAX;
+        if (nMatchCode >= LZ4_TOKEN_LENGTH_MAX)
+            WriteLength(vchOut, nMatchCode - LZ4_TOKEN_LENGTH_MAX);
+    }
+    vchOut[nToken] = token;
+}
+
+bool LZ4Compress(const unsigned char* pIn, size_t nIn, std::vector<unsigned char>& vchOut)
+{
+    vchOut.clear();
+    vchOut.reserve(nIn);
+
+    // Last position each hashed 4-byte sequence was seen at
+    std::vector<uint32_t> vTable(1 << LZ4_HASH_BITS, 0);
+    size_t nAnchor = 0;
+    if (nIn > LZ4_MATCH_FIND_LIMIT) {
+        const size_t nMatchEnd = nIn - LZ4_LAST_LITERALS;
+        size_t i = 0;
+        while (i < nIn - LZ4_MATCH_FIND_LIMIT) {
+            const uint32_t nSeq = Read32(pIn + i);
+            const unsigned int nHash = Hash32(nSeq);
+            const size_t nCandidate = vTable[nHash];
+            vTable[nHash] = i;
+            if (nCandidate >= i || i - nCandidate > LZ4_MAX_OFFSET || Read32(pIn + nCandidate) != nSeq) {
+                i++;
+                continue;
+            }
+
+            size_t nMatch = LZ4_MIN_MATCH;
+            while (i + nMatch < nMatchEnd && pIn[nCandidate + nMatch] == pIn[i + nMatch])
+                nMatch++;
+            WriteSequence(vchOut, pIn + nAnchor, i - nAnchor, i - nCandidate, nMatch);
+            i += nMatch;
+            nAnchor = i;
+            if (vchOut.size() >= nIn)
+                return false;
+        }
+    }
+    WriteSequence(vchOut, pIn + nAnchor, nIn - nAnchor, 0, 0);
+    return vchOut.size() < nIn;
+}
+
+/** Add the part of a length that did not fit in the token */
+static bool ReadLength(const unsigned char* pIn, size_t nIn, size_t& nPos, size_t& nLength)
+{
+    unsigned char n;
+    do {
+        if (nPos >= nIn)
+            return false;
+        n = pIn[nPos++];
+        nLength += n;
+    } while (n == 255);
+    return true;
+}
+
+bool LZ4Decompress(const unsigned char* pIn, size_t nIn, unsigned char* pOut, size_t nOut)
+{
+    size_t nPos = 0, nOutPos = 0;
+    while (nPos < nIn) {
+        const unsigned char token = pIn[nPos++];
+
+        size_t nLiteral = token >> 4;
+        if (nLiteral == LZ4_TOKEN_LENGTH_MAX && !ReadLength(pIn, nIn, nPos, nLiteral))
+            return false;
+        if (nLiteral > nIn - nPos || nLiteral > nOut - nOutPos)
+            return false;
+        memcpy(pOut + nOutPos, pIn + nPos, nLiteral);
+        nPos += nLiteral;
+        nOutPos += nLiteral;
+
+        // The last sequence has no match
+        if (nPos == nIn)
+            break;
+
+        if (nIn - nPos < 2)
+            return false;
+        const size_t nOffset = pIn[nPos] | (pIn[nPos + 1] << 8);
+        nPos += 2;
+        if (nOffset == 0 || nOffset > nOutPos)
+            return false;
+        size_t nMatch = token & 0x0f;
+        if (nMatch == LZ4_TOKEN_LENGTH_MAX && !ReadLength(pIn, nIn, nPos, nMatch))
+            return false;
+        nMatch += LZ4_MIN_MATCH;
+        if (nMatch > nOut - nOutPos)
+            return false;
+        // A match may overlap the bytes it produces, so copy forwards one at a time
+        const unsigned char* pMatch = pOut + nOutPos - nOffset;
+        for (size_t i = 0; i < nMatch; i++)
+            pOut[nOutPos + i] = pMatch[i];
+        nOutPos += nMatch;
+    }
+    return nOutPos == nOut;
+}
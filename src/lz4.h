@@ -0,0 +1,27 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LZ4_H
+#define BITCOIN_LZ4_H
+
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Compression in the LZ4 block format, used for block and undo data on disk.
+ * It is fast enough in both directions to sit in the block read and write
+ * paths, and blocks are mostly hashes and public keys that appear more than once.
+ *
+ * Compress nIn bytes at pIn into vchOut. Returns false, leaving vchOut
+ * unspecified, if the result would not be smaller than the input.
+ */
+bool LZ4Compress(const unsigned char* pIn, size_t nIn, std::vector<unsigned char>& vchOut);
+
+/**
+ * Decompress nIn bytes at pIn into exactly nOut bytes at pOut. Returns false
+ * if the input is malformed or does not decompress to exactly nOut bytes.
+ */
+bool LZ4Decompress(const unsigned char* pIn, size_t nIn, unsigned char* pOut, size_t nOut);
+
+#endif // BITCOIN_LZ4_H
@@ -0,0 +1,37 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include <stddef.h>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * A read-only memory mapping of a whole file, as large as the file was when it
+ * was mapped. Only reading what existed then is safe: the file may be appended
+ * to or truncated afterwards.
+ */
+class CMappedFile
+{
+private:
+    const unsigned char* pbegin;
+    size_t nSize;
+
+    // Disallow copies
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    /** Map the file at path. IsNull() if that fails, which it always does on Windows. */
+    explicit CMappedFile(const boost::filesystem::path& path);
+    ~CMappedFile();
+
+    bool IsNull() const { return pbegin == NULL; }
+    const unsigned char* begin() const { return pbegin; }
+    size_t size() const { return nSize; }
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
@@ -29,6 +29,7 @@
 #include "wallet/wallet.h"
 
 #include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -50,6 +51,7 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
 unsigned int nMinerSleep = 500;
+CBlockTemplateCache* pblocktemplatecache = NULL;
 
 class ScoreCompare
 {
@@ -144,7 +146,7 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, in
                        : pblock->GetBlockTime();
 
     addPriorityTxs(pblock->GetBlockTime(), fProofOfStake);
-    addPackageTxs();
+    addChunkTxs();
 
     nLastBlockTx = nBlockTx;
     nLastBlockSize = nBlockSize;
@@ -202,19 +204,6 @@ bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
     return false;
 }
 
-void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
-{
-    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
-        // Only test txs not already in the block
-        if (inBlock.count(*iit)) {
-            testSet.erase(iit++);
-        }
-        else {
-            iit++;
-        }
-    }
-}
-
 bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOps)
 {
     auto blockSizeWithPackage = nBlockSize + packageSize;
@@ -306,175 +295,80 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     }
 }
 
-void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
-        indexed_modified_transaction_set &mapModifiedTx)
-{
-    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
-        CTxMemPool::setEntries descendants;
-        mempool.CalculateDescendants(it, descendants);
-        // Insert all descendants (not yet in block) into the modified set
-        BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
-            if (alreadyAdded.count(desc))
-                continue;
-            modtxiter mit = mapModifiedTx.find(desc);
-            if (mit == mapModifiedTx.end()) {
-                CTxMemPoolModifiedEntry modEntry(desc);
-                modEntry.nSizeWithAncestors -= it->GetTxSize();
-                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
-                modEntry.nSigOpCountWithAncestors -= it->GetSigOpCount();
-                mapModifiedTx.insert(modEntry);
-            } else {
-                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
-            }
+// Orders the next chunks of clusters with the best fee rate on top of the heap
+struct CompareClusterChunk {
+    bool operator()(const std::pair<const CTxMemPool::TxCluster*, size_t>& a, const std::pair<const CTxMemPool::TxCluster*, size_t>& b) const
+    {
+        const CTxMemPool::TxChunk& chunkA = a.first->vChunks[a.second];
+        const CTxMemPool::TxChunk& chunkB = b.first->vChunks[b.second];
+        double f1 = (double)chunkA.nModFees * chunkB.nSize;
+        double f2 = (double)chunkB.nModFees * chunkA.nSize;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(b.first->vTxs[chunkB.nEnd - 1], a.first->vTxs[chunkA.nEnd - 1]);
         }
+        return f1 < f2;
     }
-}
-
-// Skip entries in mapTx that are already in a block or are present
-// in mapModifiedTx (which implies that the mapTx ancestor state is
-// stale due to ancestor inclusion in the block)
-// Also skip transactions that we've already failed to add. This can happen if
-// we consider a transaction in mapModifiedTx and it fails: we can then
-// potentially consider it again while walking mapTx.  It's currently
-// guaranteed to fail again, but as a belt-and-suspenders check we put it in
-// failedTx and avoid re-evaluation, since the re-evaluation would be using
-// cached size/sigops/fee values that are not actually correct.
-bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
-{
-    assert (it != mempool.mapTx.end());
-    if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it))
-        return true;
-    return false;
-}
-
-void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries)
-{
-    // Sort package by ancestor count
-    // If a transaction A depends on transaction B, then A's ancestor count
-    // must be greater than B's.  So this is sufficient to validly order the
-    // transactions for block inclusion.
-    sortedEntries.clear();
-    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
-    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
-}
+};
 
-// This transaction selection algorithm orders the mempool based
-// on feerate of a transaction including all unconfirmed ancestors.
-// Since we don't remove transactions from the mempool as we select them
-// for block inclusion, we need an alternate method of updating the feerate
-// of a transaction with its not-yet-selected ancestors as we go.
-// This is accomplished by walking the in-mempool descendants of selected
-// transactions and storing a temporary modified state in mapModifiedTxs.
-// Each time through the loop, we compare the best transaction in
-// mapModifiedTxs with the next transaction in the mempool to decide what
-// transaction package to work on next.
-void BlockAssembler::addPackageTxs()
+// This transaction selection algorithm takes the mempool's cluster chunks
+// best fee rate first. Chunks of one cluster come in non-increasing fee rate
+// order and each only depends on the chunks before it, so merging all
+// clusters' chunk sequences by fee rate gives a valid block. A chunk that
+// does not fit ends its cluster, as the following chunks may depend on it.
+void BlockAssembler::addChunkTxs()
 {
-    // mapModifiedTx will store sorted packages after they are modified
-    // because some of their txs are already in the block
-    indexed_modified_transaction_set mapModifiedTx;
-    // Keep track of entries that failed inclusion, to avoid duplicate work
-    CTxMemPool::setEntries failedTx;
-
-    // Start by adding all descendants of previously added txs to mapModifiedTx
-    // and modifying them for their already included ancestors
-    UpdatePackagesForAdded(inBlock, mapModifiedTx);
-
-    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
-    CTxMemPool::txiter iter;
-    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    typedef std::pair<const CTxMemPool::TxCluster*, size_t> ClusterChunk;
+    std::vector<ClusterChunk> vHeap;
+    vHeap.reserve(mempool.GetClusters().size());
+    for (CTxMemPool::clusterSet::const_iterator it = mempool.GetClusters().begin(); it != mempool.GetClusters().end(); ++it)
+        vHeap.push_back(ClusterChunk(it->second, 0));
+    std::make_heap(vHeap.begin(), vHeap.end(), CompareClusterChunk());
+
+    while (!vHeap.empty())
     {
-        // First try to find a new transaction in mapTx to evaluate.
-        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
-                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
-            ++mi;
-            continue;
-        }
-
-        // Now that mi is not stale, determine which transaction to evaluate:
-        // the next entry from mapTx, or the best from mapModifiedTx?
-        bool fUsingModified = false;
-
-        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
-        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
-            // We're out of entries in mapTx; use the entry from mapModifiedTx
-            iter = modit->iter;
-            fUsingModified = true;
-        } else {
-            // Try to compare the mapTx entry to the mapModifiedTx entry
-            iter = mempool.mapTx.project<0>(mi);
-            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
-                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
-                // The best entry in mapModifiedTx has higher score
-                // than the one from mapTx.
-                // Switch which transaction (package) to consider
-                iter = modit->iter;
-                fUsingModified = true;
-            } else {
-                // Either no entry in mapModifiedTx, or it's worse than mapTx.
-                // Increment mi for the next loop iteration.
-                ++mi;
-            }
-        }
-
-        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
-        // contain anything that is inBlock.
-        assert(!inBlock.count(iter));
-
-        uint64_t packageSize = iter->GetSizeWithAncestors();
-        CAmount packageFees = iter->GetModFeesWithAncestors();
-        int64_t packageSigOps = iter->GetSigOpCountWithAncestors();
-        if (fUsingModified) {
-            packageSize = modit->nSizeWithAncestors;
-            packageFees = modit->nModFeesWithAncestors;
-            packageSigOps = modit->nSigOpCountWithAncestors;
-        }
-
-        if (packageFees < ::minRelayTxFee.GetFee(packageSize)) {
-            // Everything else we might consider has a lower fee rate
-            return;
+        std::pop_heap(vHeap.begin(), vHeap.end(), CompareClusterChunk());
+        const ClusterChunk next = vHeap.back();
+        vHeap.pop_back();
+
+        const CTxMemPool::TxCluster& cluster = *next.first;
+        const size_t nBegin = next.second == 0 ? 0 : cluster.vChunks[next.second - 1].nEnd;
+        const size_t nEnd = cluster.vChunks[next.second].nEnd;
+
+        // Leave out anything addPriorityTxs already took
+        CTxMemPool::setEntries package;
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        int64_t packageSigOps = 0;
+        for (size_t i = nBegin; i < nEnd; i++) {
+            CTxMemPool::txiter iter = cluster.vTxs[i];
+            if (inBlock.count(iter))
+                continue;
+            package.insert(iter);
+            packageSize += iter->GetTxSize();
+            packageFees += iter->GetModifiedFee();
+            packageSigOps += iter->GetSigOpCount();
         }
 
-        if (!TestPackage(packageSize, packageSigOps)) {
-            if (fUsingModified) {
-                // Since we always look at the best entry in mapModifiedTx,
-                // we must erase failed entries so that we can consider the
-                // next best entry on the next loop iteration
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
+        if (!package.empty()) {
+            if (packageFees < ::minRelayTxFee.GetFee(packageSize)) {
+                // Everything else we might consider has a lower fee rate
+                return;
             }
-            continue;
-        }
 
-        CTxMemPool::setEntries ancestors;
-        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-        std::string dummy;
-        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-
-        onlyUnconfirmed(ancestors);
-        ancestors.insert(iter);
+            if (!TestPackage(packageSize, packageSigOps) || !TestPackageTransactions(package))
+                continue;
 
-        // Test if all tx's are Final
-        if (!TestPackageTransactions(ancestors)) {
-            if (fUsingModified) {
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
+            // The linearization is a valid order for the block
+            for (size_t i = nBegin; i < nEnd; i++) {
+                if (package.count(cluster.vTxs[i]))
+                    AddToBlock(cluster.vTxs[i]);
             }
-            continue;
         }
 
-        // Package can be added. Sort the entries in a valid order.
-        vector<CTxMemPool::txiter> sortedEntries;
-        SortForBlock(ancestors, iter, sortedEntries);
-
-        for (size_t i=0; i<sortedEntries.size(); ++i) {
-            AddToBlock(sortedEntries[i]);
-            // Erase from the modified set, if present
-            mapModifiedTx.erase(sortedEntries[i]);
+        if (next.second + 1 < cluster.vChunks.size()) {
+            vHeap.push_back(ClusterChunk(next.first, next.second + 1));
+            std::push_heap(vHeap.begin(), vHeap.end(), CompareClusterChunk());
         }
-
-        // Update transactions that depend on each of these
-        UpdatePackagesForAdded(ancestors, mapModifiedTx);
     }
 }
 
@@ -555,6 +449,198 @@ void BlockAssembler::addPriorityTxs(int64_t nBlockTime, bool fProofOfStake)
     }
 }
 
+CBlockTemplateCache::CBlockTemplateCache(const CChainParams& _chainparams)
+    : chainparams(_chainparams)
+{
+    nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+
+    mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateCache::TransactionAddedToMempool, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateCache::TransactionRemovedFromMempool, this, _1));
+}
+
+CBlockTemplateCache::~CBlockTemplateCache()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&CBlockTemplateCache::TransactionAddedToMempool, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&CBlockTemplateCache::TransactionRemovedFromMempool, this, _1));
+}
+
+void CBlockTemplateCache::Rebuild(bool fProofOfStake)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    // An empty coinbase script, the caller's one is filled in when handing out
+    int64_t nFees = 0;
+    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams).CreateNewBlock(CScript(), &nFees, fProofOfStake));
+    const CBlock& block = pblocktemplate->block;
+
+    LOCK(cs);
+    CCachedTemplate& tmpl = cached[fProofOfStake];
+    tmpl.pindexPrev = chainActive.Tip();
+    tmpl.nHeight = tmpl.pindexPrev->nHeight + 1;
+    tmpl.nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                           ? tmpl.pindexPrev->GetPastTimeLimit()
+                           : block.GetBlockTime();
+    tmpl.nFees = nFees;
+
+    // Same reservations for the coinbase as BlockAssembler
+    tmpl.nBlockSize = 1000;
+    tmpl.nBlockSigOps = 100;
+    tmpl.setTxHashes.clear();
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+    {
+        tmpl.setTxHashes.insert(block.vtx[i].GetHash());
+        tmpl.nBlockSize += ::GetSerializeSize(block.vtx[i], SER_NETWORK, PROTOCOL_VERSION);
+        tmpl.nBlockSigOps += pblocktemplate->vTxSigOpsCost[i];
+    }
+
+    tmpl.pblocktemplate.swap(pblocktemplate);
+    tmpl.nBuilt = GetTime();
+    tmpl.fStale = false;
+    tmpl.fDirty = false;
+}
+
+bool CBlockTemplateCache::TryAppend(CCachedTemplate& tmpl, CTxMemPool::txiter it, bool fProofOfStake)
+{
+    // A package with unselected ancestors needs the full selection
+    BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(it))
+    {
+        if (!tmpl.setTxHashes.count(parent->GetTx().GetHash()))
+            return false;
+    }
+
+    // Transactions the selection would skip anyway
+    if (it->GetModifiedFee() < ::minRelayTxFee.GetFee(it->GetTxSize()))
+        return true;
+    if (!IsFinalTx(it->GetTx(), tmpl.nHeight, tmpl.nLockTimeCutoff))
+        return true;
+
+    // As in addPriorityTxs, a proof-of-stake block leaves out transactions
+    // from its future; they may fit once the template is rebuilt
+    if (fProofOfStake && (int64_t)it->GetTx().nTime > GetAdjustedTime())
+        return false;
+
+    if (tmpl.nBlockSize + it->GetTxSize() >= std::min(nBlockMaxSize, DEFAULT_BLOCK_MAX_SIZE))
+        return false;
+    if (tmpl.nBlockSigOps + it->GetSigOpCount() >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    tmpl.pblocktemplate->block.vtx.push_back(it->GetTx());
+    tmpl.pblocktemplate->vTxFees.push_back(it->GetFee());
+    tmpl.pblocktemplate->vTxSigOpsCost.push_back(it->GetSigOpCount());
+    tmpl.setTxHashes.insert(it->GetTx().GetHash());
+    tmpl.nBlockSize += it->GetTxSize();
+    tmpl.nBlockSigOps += it->GetSigOpCount();
+    tmpl.nFees += it->GetFee();
+    return true;
+}
+
+void CBlockTemplateCache::TransactionAddedToMempool(CTxMemPool::txiter it)
+{
+    LOCK(cs);
+    for (int i = 0; i < 2; i++)
+    {
+        CCachedTemplate& tmpl = cached[i];
+        if (tmpl.pblocktemplate && !tmpl.fStale && !TryAppend(tmpl, it, i))
+            tmpl.fDirty = true;
+    }
+}
+
+void CBlockTemplateCache::TransactionRemovedFromMempool(CTxMemPool::txiter it)
+{
+    LOCK(cs);
+    const uint256& hash = it->GetTx().GetHash();
+    for (int i = 0; i < 2; i++)
+    {
+        if (cached[i].setTxHashes.count(hash))
+            cached[i].fStale = true;
+    }
+}
+
+void CBlockTemplateCache::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    // Called from within block connection, so the selection is only dropped
+    // here; the next request rebuilds it for the new tip
+    LOCK(cs);
+    for (int i = 0; i < 2; i++)
+        cached[i].fStale = true;
+}
+
+CBlockTemplate* CBlockTemplateCache::CreateNewBlock(const CScript& scriptPubKeyIn, int64_t* pFees, bool fProofOfStake)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+
+    bool fRebuild;
+    {
+        LOCK(cs);
+        CCachedTemplate& tmpl = cached[fProofOfStake];
+        fRebuild = !tmpl.pblocktemplate || tmpl.pindexPrev != pindexPrev || tmpl.fStale ||
+                   (tmpl.fDirty && GetTime() - tmpl.nBuilt >= BLOCK_TEMPLATE_REFRESH_INTERVAL);
+    }
+    for (int nAttempt = 0; ; nAttempt++)
+    {
+        if (fRebuild)
+        {
+            LOCK(mempool.cs);
+            Rebuild(fProofOfStake);
+        }
+
+        std::unique_ptr<CBlockTemplate> pblocktemplate;
+        CAmount nFees;
+        int nHeight;
+        {
+            LOCK(cs);
+            const CCachedTemplate& tmpl = cached[fProofOfStake];
+            pblocktemplate.reset(new CBlockTemplate(*tmpl.pblocktemplate));
+            nFees = tmpl.nFees;
+            nHeight = tmpl.nHeight;
+            nLastBlockSize = tmpl.nBlockSize;
+        }
+        CBlock* pblock = &pblocktemplate->block;
+
+        pblock->nTime = max(pindexPrev->GetPastTimeLimit()+1, GetMaxTransactionTime(pblock));
+        if (!fProofOfStake)
+            UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+
+        if (!fProofOfStake) {
+            // The coinbase time has to follow the block time, see bad-cb-time
+            CMutableTransaction coinbaseTx(pblock->vtx[0]);
+            coinbaseTx.nTime = pblock->nTime;
+            coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+            coinbaseTx.vout[0].nValue = nFees + GetProofOfWorkSubsidy(nHeight, chainparams.GetConsensus());
+            pblock->vtx[0] = coinbaseTx;
+            pblocktemplate->vTxSigOpsCost[0] = GetSigOpCountWithoutP2SH(pblock->vtx[0]);
+        }
+        pblocktemplate->vTxFees[0] = -nFees;
+
+        // Appended transactions have not been through TestBlockValidity yet;
+        // on failure start over once from a fresh selection, which has
+        CValidationState state;
+        if (!fProofOfStake && !TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false, true)) {
+            if (nAttempt > 0 || fRebuild)
+                throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+            LogPrintf("CBlockTemplateCache::CreateNewBlock: cached template is invalid (%s), rebuilding\n", FormatStateMessage(state));
+            fRebuild = true;
+            continue;
+        }
+
+        nLastBlockTx = pblock->vtx.size() - 1;
+        if (pFees)
+            *pFees = nFees;
+
+        return pblocktemplate.release();
+    }
+}
+
+CBlockTemplate* CreateNewBlockTemplate(const CChainParams& chainparams, const CScript& scriptPubKeyIn, int64_t* pFees, bool fProofOfStake)
+{
+    if (pblocktemplatecache)
+        return pblocktemplatecache->CreateNewBlock(scriptPubKeyIn, pFees, fProofOfStake);
+    return BlockAssembler(chainparams).CreateNewBlock(scriptPubKeyIn, pFees, fProofOfStake);
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -620,23 +706,34 @@ void ThreadStakeMiner(CWallet *pwallet, const CChainParams& chainparams)
         // Create new block
         //
         if (pwallet->HaveAvailableCoinsForStaking()) {
-            int64_t nFees = 0;
-            // First just create an empty block. No need to process transactions until we know we can create a block
-            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(reservekey.reserveScript, &nFees, true));
-            if (!pblocktemplate.get())
-                 return;
-
-            CBlock *pblock = &pblocktemplate->block;
-            // Trying to sign a block
-            if (SignBlock(*pblock, *pwallet, nFees))
+            // Search for a kernel first; the block is only assembled, and the
+            // mempool only locked, once we know we can create one
+            CMutableTransaction txCoinStake;
+            CKey key;
+            uint256 hashPrevBlock;
+            unsigned int nBits;
+            if (FindStake(*pwallet, txCoinStake, key, hashPrevBlock, nBits))
             {
-                // increase priority
-                SetThreadPriority(THREAD_PRIORITY_ABOVE_NORMAL);
-                 // Sign the full block
-                CheckStake(pblock, *pwallet, chainparams);
-                // return back to low priority
-                SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                MilliSleep(500);
+                int64_t nFees = 0;
+                std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockTemplate(Params(), reservekey.reserveScript, &nFees, true));
+                if (!pblocktemplate.get())
+                     return;
+
+                CBlock *pblock = &pblocktemplate->block;
+                // The tip may have moved while searching
+                if (pblock->hashPrevBlock != hashPrevBlock || pblock->nBits != nBits)
+                    LogPrint("staking", "ThreadStakeMiner : tip changed during kernel search\n");
+                // Trying to sign a block
+                else if (SignBlock(*pblock, *pwallet, nFees, txCoinStake, key))
+                {
+                    // increase priority
+                    SetThreadPriority(THREAD_PRIORITY_ABOVE_NORMAL);
+                     // Sign the full block
+                    CheckStake(pblock, *pwallet, chainparams);
+                    // return back to low priority
+                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                    MilliSleep(500);
+                }
             }
         }
         MilliSleep(nMinerSleep);
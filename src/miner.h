@@ -7,7 +7,9 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "sync.h"
 #include "txmempool.h"
+#include "validationinterface.h"
 
 #include <stdint.h>
 #include <memory>
@@ -22,6 +24,8 @@ class CBlock;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Seconds a cached template may lag behind mempool additions it could not take in */
+static const int64_t BLOCK_TEMPLATE_REFRESH_INTERVAL = 5;
 
 struct CBlockTemplate
 {
@@ -30,104 +34,6 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOpsCost;
 };
 
-// Container for tracking updates to ancestor feerate as we include (parent)
-// transactions in a block
-struct CTxMemPoolModifiedEntry {
-    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
-    {
-        iter = entry;
-        nSizeWithAncestors = entry->GetSizeWithAncestors();
-        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
-        nSigOpCountWithAncestors = entry->GetSigOpCountWithAncestors();
-    }
-
-    CTxMemPool::txiter iter;
-    uint64_t nSizeWithAncestors;
-    CAmount nModFeesWithAncestors;
-    int64_t nSigOpCountWithAncestors;
-};
-
-/** Comparator for CTxMemPool::txiter objects.
- *  It simply compares the internal memory address of the CTxMemPoolEntry object
- *  pointed to. This means it has no meaning, and is only useful for using them
- *  as key in other indexes.
- */
-struct CompareCTxMemPoolIter {
-    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
-    {
-        return &(*a) < &(*b);
-    }
-};
-
-struct modifiedentry_iter {
-    typedef CTxMemPool::txiter result_type;
-    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
-    {
-        return entry.iter;
-    }
-};
-
-// This matches the calculation in CompareTxMemPoolEntryByAncestorFee,
-// except operating on CTxMemPoolModifiedEntry.
-// TODO: refactor to avoid duplication of this logic.
-struct CompareModifiedEntry {
-    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
-    {
-        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
-        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
-        if (f1 == f2) {
-            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
-        }
-        return f1 > f2;
-    }
-};
-
-// A comparator that sorts transactions based on number of ancestors.
-// This is sufficient to sort an ancestor package in an order that is valid
-// to appear in a block.
-struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
-    {
-        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
-            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
-        return CTxMemPool::CompareIteratorByHash()(a, b);
-    }
-};
-
-typedef boost::multi_index_container<
-    CTxMemPoolModifiedEntry,
-    boost::multi_index::indexed_by<
-        boost::multi_index::ordered_unique<
-            modifiedentry_iter,
-            CompareCTxMemPoolIter
-        >,
-        // sorted by modified ancestor fee rate
-        boost::multi_index::ordered_non_unique<
-            // Reuse same tag from CTxMemPool's similar index
-            boost::multi_index::tag<ancestor_score>,
-            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
-            CompareModifiedEntry
-        >
-    >
-> indexed_modified_transaction_set;
-
-typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
-typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
-
-struct update_for_parent_inclusion
-{
-    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
-
-    void operator() (CTxMemPoolModifiedEntry &e)
-    {
-        e.nModFeesWithAncestors -= iter->GetFee();
-        e.nSizeWithAncestors -= iter->GetTxSize();
-        e.nSigOpCountWithAncestors -= iter->GetSigOpCount();
-    }
-
-    CTxMemPool::txiter iter;
-};
-
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
@@ -171,8 +77,7 @@ private:
     // Methods for how to add transactions to a block.
     /** Add transactions based on tx "priority" */
     void addPriorityTxs(int64_t nBlockTime, bool fProofOfStake);
-    /** Add transactions based on feerate including unconfirmed ancestors */
-    void addPackageTxs();
+    void addChunkTxs();
 
     // helper function for addPriorityTxs
     /** Test if tx will still "fit" in the block */
@@ -180,9 +85,7 @@ private:
     /** Test if tx still has unconfirmed parents not yet in block */
     bool isStillDependent(CTxMemPool::txiter iter);
 
-    // helper functions for addPackageTxs()
-    /** Remove confirmed (inBlock) entries from given set */
-    void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
+    // helper functions for addChunkTxs()
     /** Test if a new package would "fit" in the block */
     bool TestPackage(uint64_t packageSize, int64_t packageSigOps);
     /** Perform checks on each transaction in a package:
@@ -190,16 +93,69 @@ private:
       * These checks should always succeed, and they're here
       * only as an extra check in case of suboptimal node configuration */
     bool TestPackageTransactions(const CTxMemPool::setEntries& package);
-    /** Return true if given transaction from mapTx has already been evaluated,
-      * or if the transaction's cached data in mapTx is incorrect. */
-    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx);
-    /** Sort the package in an order that is valid to appear in a block */
-    void SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries);
-    /** Add descendants of given transactions to mapModifiedTx with ancestor
-      * state updated assuming given transactions are inBlock. */
-    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Keeps the transaction selection for the next block current as the mempool
+ * and the tip change, so templates are handed out without running the
+ * package selection while the caller waits. The first request after the tip
+ * moves rebuilds the selection; transactions entering the mempool are appended
+ * when their parents are already selected and they fit, and a transaction
+ * leaving the mempool that was selected forces a rebuild on the next request.
+ * Proof-of-work and proof-of-stake templates are cached separately, each once
+ * requested.
+ */
+class CBlockTemplateCache : public CValidationInterface
+{
+private:
+    struct CCachedTemplate
+    {
+        std::unique_ptr<CBlockTemplate> pblocktemplate;
+        const CBlockIndex* pindexPrev;
+        std::set<uint256> setTxHashes;
+        CAmount nFees;
+        uint64_t nBlockSize;
+        int64_t nBlockSigOps;
+        int nHeight;
+        int64_t nLockTimeCutoff;
+        int64_t nBuilt;
+        bool fStale;  //!< holds a transaction that left the mempool, or the tip moved
+        bool fDirty;  //!< missed a mempool addition
+
+        CCachedTemplate() : pindexPrev(NULL), nFees(0), nBlockSize(0), nBlockSigOps(0), nHeight(0),
+                            nLockTimeCutoff(0), nBuilt(0), fStale(false), fDirty(false) {}
+    };
+
+    const CChainParams& chainparams;
+    CCriticalSection cs;
+    CCachedTemplate cached[2]; //!< indexed by fProofOfStake
+    unsigned int nBlockMaxSize;
+
+    /** Run the package selection for the current tip; requires cs_main and mempool.cs */
+    void Rebuild(bool fProofOfStake);
+    /** Append a new mempool entry to a cached selection, returns false if it does not fit */
+    bool TryAppend(CCachedTemplate& tmpl, CTxMemPool::txiter it, bool fProofOfStake);
+
+    void TransactionAddedToMempool(CTxMemPool::txiter it);
+    void TransactionRemovedFromMempool(CTxMemPool::txiter it);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex);
+
+public:
+    CBlockTemplateCache(const CChainParams& chainparams);
+    ~CBlockTemplateCache();
+
+    /** Same as BlockAssembler::CreateNewBlock, served from the cached selection when it is current */
+    CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, int64_t* pFees = 0, bool fProofOfStake = false);
+};
+
+/** The running template cache, NULL when not started */
+extern CBlockTemplateCache* pblocktemplatecache;
+
+/** Block template from pblocktemplatecache if it is running, else freshly assembled */
+CBlockTemplate* CreateNewBlockTemplate(const CChainParams& chainparams, const CScript& scriptPubKeyIn, int64_t* pFees = 0, bool fProofOfStake = false);
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlock* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
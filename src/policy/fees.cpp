@@ -13,6 +13,8 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay, std::string _dataTypeString)
 {
@@ -246,6 +248,215 @@ void TxConfirmStats::Read(CAutoFile& filein)
              numBuckets, dataTypeString, maxConfirms);
 }
 
+void DecayingConfirmStats::Initialize(size_t numBuckets, unsigned int maxConfirms, double _decay)
+{
+    decay = _decay;
+    scale = 1;
+    txCtAvg.assign(numBuckets, 0);
+    avg.assign(numBuckets, 0);
+    confAvg.assign(maxConfirms, std::vector<double>(numBuckets, 0));
+    failAvg.assign(maxConfirms, std::vector<double>(numBuckets, 0));
+    unconfTxs.assign(maxConfirms, std::vector<int>(numBuckets, 0));
+    oldUnconfTxs.assign(numBuckets, 0);
+}
+
+void DecayingConfirmStats::Rescale()
+{
+    for (unsigned int j = 0; j < txCtAvg.size(); j++) {
+        for (unsigned int i = 0; i < confAvg.size(); i++) {
+            confAvg[i][j] /= scale;
+            failAvg[i][j] /= scale;
+        }
+        avg[j] /= scale;
+        txCtAvg[j] /= scale;
+    }
+    scale = 1;
+}
+
+void DecayingConfirmStats::NewBlock(unsigned int nBlockHeight)
+{
+    // Growing the weight of new data points is the same as decaying the old
+    // ones; only rescale every few thousand blocks
+    scale /= decay;
+    if (scale > 1e100)
+        Rescale();
+
+    std::vector<int>& unconfAtHeight = unconfTxs[nBlockHeight % unconfTxs.size()];
+    for (unsigned int j = 0; j < unconfAtHeight.size(); j++) {
+        oldUnconfTxs[j] += unconfAtHeight[j];
+        unconfAtHeight[j] = 0;
+    }
+}
+
+void DecayingConfirmStats::Record(int blocksToConfirm, unsigned int bucketIndex, double val)
+{
+    // blocksToConfirm is 1-based
+    if (blocksToConfirm < 1)
+        return;
+    for (size_t i = blocksToConfirm; i <= confAvg.size(); i++)
+        confAvg[i - 1][bucketIndex] += scale;
+    txCtAvg[bucketIndex] += scale;
+    avg[bucketIndex] += val * scale;
+}
+
+void DecayingConfirmStats::NewTx(unsigned int nBlockHeight, unsigned int bucketIndex)
+{
+    unconfTxs[nBlockHeight % unconfTxs.size()][bucketIndex]++;
+}
+
+void DecayingConfirmStats::RemoveTx(unsigned int entryHeight, unsigned int nBestSeenHeight, unsigned int bucketIndex, bool fInBlock)
+{
+    // nBestSeenHeight is not updated yet for the new block
+    int blocksAgo = nBestSeenHeight - entryHeight;
+    if (nBestSeenHeight == 0)
+        blocksAgo = 0;
+    if (blocksAgo < 0)
+        return;
+
+    if (blocksAgo >= (int)unconfTxs.size()) {
+        if (oldUnconfTxs[bucketIndex] > 0)
+            oldUnconfTxs[bucketIndex]--;
+    } else {
+        int& nUnconf = unconfTxs[entryHeight % unconfTxs.size()][bucketIndex];
+        if (nUnconf > 0)
+            nUnconf--;
+    }
+
+    // Evicted, expired or replaced after waiting blocksAgo blocks
+    if (!fInBlock) {
+        for (size_t i = 0; i < (size_t)blocksAgo && i < failAvg.size(); i++)
+            failAvg[i][bucketIndex] += scale;
+    }
+}
+
+double DecayingConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal, double successBreakPoint, unsigned int nBlockHeight) const
+{
+    if (confTarget < 1 || (unsigned int)confTarget > confAvg.size())
+        return -1;
+
+    double nConf = 0;
+    double totalNum = 0;
+    double failNum = 0;
+    int extraNum = 0;
+    const double sufficientNum = sufficientTxVal / (1 - decay) * scale;
+    const unsigned int bins = unconfTxs.size();
+
+    // Like TxConfirmStats, combine buckets from the highest fee rate down
+    // until there are enough data points, and stop at the first range that
+    // fails. All decayed counts carry the same scale, so the ratios need no
+    // unscaling; txs still in the mempool are current and so weigh scale.
+    int bestNearBucket = -1, bestFarBucket = -1;
+    int curNearBucket = txCtAvg.size() - 1;
+    for (int bucket = txCtAvg.size() - 1; bucket >= 0; bucket--) {
+        nConf += confAvg[confTarget - 1][bucket];
+        totalNum += txCtAvg[bucket];
+        failNum += failAvg[confTarget - 1][bucket];
+        for (unsigned int confct = confTarget; confct < bins; confct++)
+            extraNum += unconfTxs[(nBlockHeight - confct) % bins][bucket];
+        extraNum += oldUnconfTxs[bucket];
+        if (totalNum >= sufficientNum) {
+            if (nConf / (totalNum + failNum + extraNum * scale) < successBreakPoint)
+                break;
+            bestNearBucket = curNearBucket;
+            bestFarBucket = bucket;
+            curNearBucket = bucket - 1;
+            nConf = 0;
+            totalNum = 0;
+            failNum = 0;
+            extraNum = 0;
+        }
+    }
+    if (bestFarBucket < 0)
+        return -1;
+
+    // Report the average fee rate of the bucket holding the median tx of the range
+    double txSum = 0;
+    for (int j = bestFarBucket; j <= bestNearBucket; j++)
+        txSum += txCtAvg[j];
+    txSum = txSum / 2;
+    for (int j = bestFarBucket; j <= bestNearBucket; j++) {
+        if (txCtAvg[j] < txSum)
+            txSum -= txCtAvg[j];
+        else
+            return avg[j] / txCtAvg[j];
+    }
+    return -1;
+}
+
+void DecayingConfirmStats::Write(CAutoFile& fileout) const
+{
+    // Store actual values so that the file does not depend on the scale
+    std::vector<double> fileTxCtAvg(txCtAvg), fileAvg(avg);
+    std::vector<std::vector<double> > fileConfAvg(confAvg), fileFailAvg(failAvg);
+    for (unsigned int j = 0; j < txCtAvg.size(); j++) {
+        for (unsigned int i = 0; i < confAvg.size(); i++) {
+            fileConfAvg[i][j] /= scale;
+            fileFailAvg[i][j] /= scale;
+        }
+        fileAvg[j] /= scale;
+        fileTxCtAvg[j] /= scale;
+    }
+    fileout << decay;
+    fileout << fileAvg;
+    fileout << fileTxCtAvg;
+    fileout << fileConfAvg;
+    fileout << fileFailAvg;
+}
+
+void DecayingConfirmStats::Read(CAutoFile& filein, size_t numBuckets)
+{
+    double fileDecay;
+    std::vector<double> fileAvg;
+    std::vector<double> fileTxCtAvg;
+    std::vector<std::vector<double> > fileConfAvg;
+    std::vector<std::vector<double> > fileFailAvg;
+
+    filein >> fileDecay;
+    if (fileDecay <= 0 || fileDecay >= 1)
+        throw std::runtime_error("Corrupt estimates file. Decay must be between 0 and 1 (non-inclusive)");
+    filein >> fileAvg;
+    filein >> fileTxCtAvg;
+    if (fileAvg.size() != numBuckets || fileTxCtAvg.size() != numBuckets)
+        throw std::runtime_error("Corrupt estimates file. Mismatch in horizon bucket count");
+    filein >> fileConfAvg;
+    if (fileConfAvg.size() != confAvg.size())
+        throw std::runtime_error("Corrupt estimates file. Mismatch in horizon confirm count");
+    for (unsigned int i = 0; i < fileConfAvg.size(); i++) {
+        if (fileConfAvg[i].size() != numBuckets)
+            throw std::runtime_error("Corrupt estimates file. Mismatch in horizon conf average bucket count");
+    }
+    filein >> fileFailAvg;
+    if (fileFailAvg.size() != confAvg.size())
+        throw std::runtime_error("Corrupt estimates file. Mismatch in horizon fail count");
+    for (unsigned int i = 0; i < fileFailAvg.size(); i++) {
+        if (fileFailAvg[i].size() != numBuckets)
+            throw std::runtime_error("Corrupt estimates file. Mismatch in horizon fail average bucket count");
+    }
+
+    decay = fileDecay;
+    scale = 1;
+    avg = fileAvg;
+    txCtAvg = fileTxCtAvg;
+    confAvg = fileConfAvg;
+    failAvg = fileFailAvg;
+}
+
+bool ParseFeeEstimateMode(const std::string& strMode, FeeEstimateMode& modeRet)
+{
+    if (strMode == "classic")
+        modeRet = FEE_ESTIMATE_CLASSIC;
+    else if (strMode == "horizon")
+        modeRet = FEE_ESTIMATE_HORIZON;
+    else
+        return false;
+    return true;
+}
+
+std::string FeeEstimateModeString(FeeEstimateMode mode)
+{
+    return mode == FEE_ESTIMATE_HORIZON ? "horizon" : "classic";
+}
+
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
@@ -283,7 +494,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
     }
 }
 
-void CBlockPolicyEstimator::removeTx(uint256 hash)
+void CBlockPolicyEstimator::removeTx(uint256 hash, bool fInBlock)
 {
     std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
     if (pos == mapMemPoolTxs.end()) {
@@ -297,11 +508,18 @@ void CBlockPolicyEstimator::removeTx(uint256 hash)
 
     if (stats != NULL)
         stats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
+    if (stats == &feeStats) {
+        shortStats.RemoveTx(entryHeight, nBestSeenHeight, bucketIndex, fInBlock);
+        medStats.RemoveTx(entryHeight, nBestSeenHeight, bucketIndex, fInBlock);
+        longStats.RemoveTx(entryHeight, nBestSeenHeight, bucketIndex, fInBlock);
+    }
+    if (pos->second.nTxSize != 0)
+        mempoolBytes[pos->second.feeBucketIndex] -= pos->second.nTxSize;
     mapMemPoolTxs.erase(hash);
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
-    : nBestSeenHeight(0)
+    : nBestSeenHeight(0), mode(DEFAULT_FEE_ESTIMATE_MODE), nHorizonBlocks(0)
 {
     minTrackedFee = _minRelayFee < CFeeRate(MIN_FEERATE) ? CFeeRate(MIN_FEERATE) : _minRelayFee;
     std::vector<double> vfeelist;
@@ -311,6 +529,14 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
     vfeelist.push_back(INF_FEERATE);
     feeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, DEFAULT_DECAY, "FeeRate");
 
+    feeBuckets = vfeelist;
+    for (unsigned int i = 0; i < feeBuckets.size(); i++)
+        feeBucketMap[feeBuckets[i]] = i;
+    shortStats.Initialize(feeBuckets.size(), SHORT_BLOCK_CONFIRMS, SHORT_DECAY);
+    medStats.Initialize(feeBuckets.size(), MED_BLOCK_CONFIRMS, MED_DECAY);
+    longStats.Initialize(feeBuckets.size(), LONG_BLOCK_CONFIRMS, LONG_DECAY);
+    mempoolBytes.resize(feeBuckets.size());
+
     minTrackedPriority = AllowFreeThreshold() < MIN_PRIORITY ? MIN_PRIORITY : AllowFreeThreshold();
     std::vector<double> vprilist;
     for (double bucketBoundary = minTrackedPriority; bucketBoundary <= MAX_PRIORITY; bucketBoundary *= PRI_SPACING) {
@@ -325,6 +551,14 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
     priLikely = INF_PRIORITY;
 }
 
+unsigned int CBlockPolicyEstimator::FeeBucketIndex(double feeRate) const
+{
+    std::map<double, unsigned int>::const_iterator it = feeBucketMap.lower_bound(feeRate);
+    if (it == feeBucketMap.end())
+        return feeBuckets.size() - 1;
+    return it->second;
+}
+
 bool CBlockPolicyEstimator::isFeeDataPoint(const CFeeRate &fee, double pri)
 {
     if ((pri < minTrackedPriority && fee >= minTrackedFee) ||
@@ -347,12 +581,17 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
 {
     unsigned int txHeight = entry.GetHeight();
     uint256 hash = entry.GetTx().GetHash();
-    if (mapMemPoolTxs[hash].stats != NULL) {
+    if (mapMemPoolTxs[hash].stats != NULL || mapMemPoolTxs[hash].nTxSize != 0) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s already being tracked\n",
                  hash.ToString().c_str());
 	return;
     }
 
+    // Every mempool transaction counts towards the mempool fee rate histogram
+    mapMemPoolTxs[hash].nTxSize = entry.GetTxSize();
+    mapMemPoolTxs[hash].feeBucketIndex = FeeBucketIndex(CFeeRate(entry.GetFee(), entry.GetTxSize()).GetFeePerK());
+    mempoolBytes[mapMemPoolTxs[hash].feeBucketIndex] += entry.GetTxSize();
+
     if (txHeight < nBestSeenHeight) {
         // Ignore side chains and re-orgs; assuming they are random they don't
         // affect the estimate.  We'll potentially double count transactions in 1-block reorgs.
@@ -390,6 +629,9 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     else if (isFeeDataPoint(feeRate, curPri)) {
         mapMemPoolTxs[hash].stats = &feeStats;
         mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        shortStats.NewTx(txHeight, mapMemPoolTxs[hash].bucketIndex);
+        medStats.NewTx(txHeight, mapMemPoolTxs[hash].bucketIndex);
+        longStats.NewTx(txHeight, mapMemPoolTxs[hash].bucketIndex);
     }
     else {
         LogPrint("estimatefee", "not adding");
@@ -431,6 +673,10 @@ void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
         feeStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
+        const unsigned int bucketIndex = FeeBucketIndex(feeRate.GetFeePerK());
+        shortStats.Record(blocksToConfirm, bucketIndex, feeRate.GetFeePerK());
+        medStats.Record(blocksToConfirm, bucketIndex, feeRate.GetFeePerK());
+        longStats.Record(blocksToConfirm, bucketIndex, feeRate.GetFeePerK());
     }
 }
 
@@ -479,6 +725,10 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     // Clear the current block states
     feeStats.ClearCurrent(nBlockHeight);
     priStats.ClearCurrent(nBlockHeight);
+    shortStats.NewBlock(nBlockHeight);
+    medStats.NewBlock(nBlockHeight);
+    longStats.NewBlock(nBlockHeight);
+    nHorizonBlocks++;
 
     // Repopulate the current block states
     for (unsigned int i = 0; i < entries.size(); i++)
@@ -507,8 +757,60 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     return CFeeRate(median);
 }
 
+double CBlockPolicyEstimator::estimateMempoolFee(int confTarget) const
+{
+    // Walk down from the highest fee rate until the transactions ahead no
+    // longer fit in confTarget blocks; a new transaction has to outbid
+    // the bucket where that happens
+    const uint64_t nCapacity = (uint64_t)confTarget * DEFAULT_BLOCK_MAX_SIZE;
+    uint64_t nBytes = 0;
+    for (int bucket = feeBuckets.size() - 1; bucket >= 0; bucket--) {
+        nBytes += mempoolBytes[bucket];
+        if (nBytes >= nCapacity)
+            return feeBuckets[std::min(bucket, (int)feeBuckets.size() - 2)];
+    }
+    return 0;
+}
+
+CFeeRate CBlockPolicyEstimator::estimateHorizonFee(int confTarget, int *answerFoundAtTarget)
+{
+    if (answerFoundAtTarget)
+        *answerFoundAtTarget = confTarget;
+    if (confTarget <= 0 || (unsigned int)confTarget > longStats.GetMaxConfirms())
+        return CFeeRate(0);
+
+    // Prefer the horizon that follows the fee market most closely
+    double median = shortStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, nBestSeenHeight);
+    if (median < 0)
+        median = medStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, nBestSeenHeight);
+    if (median < 0)
+        median = longStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, nBestSeenHeight);
+
+    // The mempool histogram only means something once we have watched the
+    // mempool through a block
+    if (nHorizonBlocks > 0) {
+        median = std::max(median, estimateMempoolFee(confTarget));
+        median = std::max(median, (double)minTrackedFee.GetFeePerK());
+    }
+
+    LogPrint("estimatefee", "%3d: horizon estimate %12.5g after %u blocks\n", confTarget, median, nHorizonBlocks);
+
+    if (median < 0)
+        return CFeeRate(0);
+    return CFeeRate(median);
+}
+
 CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
 {
+    if (mode == FEE_ESTIMATE_HORIZON) {
+        CFeeRate feeRate = estimateHorizonFee(confTarget, answerFoundAtTarget);
+        if (feeRate == CFeeRate(0))
+            return feeRate;
+        // If mempool is limiting txs , return at least the min fee from the mempool
+        CFeeRate minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        return std::max(feeRate, minPoolFee);
+    }
+
     if (answerFoundAtTarget)
         *answerFoundAtTarget = confTarget;
     // Return failure if trying to analyze a target we're not tracking
@@ -576,6 +878,10 @@ void CBlockPolicyEstimator::Write(CAutoFile& fileout)
     fileout << nBestSeenHeight;
     feeStats.Write(fileout);
     priStats.Write(fileout);
+    fileout << feeBuckets;
+    shortStats.Write(fileout);
+    medStats.Write(fileout);
+    longStats.Write(fileout);
 }
 
 void CBlockPolicyEstimator::Read(CAutoFile& filein)
@@ -585,6 +891,24 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+
+    // Files written before the horizon mode end here; start those horizons
+    // over rather than failing the classic estimates with them
+    try {
+        std::vector<double> fileBuckets;
+        filein >> fileBuckets;
+        if (fileBuckets != feeBuckets)
+            throw std::runtime_error("horizon fee buckets changed");
+        DecayingConfirmStats fileShortStats(shortStats), fileMedStats(medStats), fileLongStats(longStats);
+        fileShortStats.Read(filein, feeBuckets.size());
+        fileMedStats.Read(filein, feeBuckets.size());
+        fileLongStats.Read(filein, feeBuckets.size());
+        shortStats = fileShortStats;
+        medStats = fileMedStats;
+        longStats = fileLongStats;
+    } catch (const std::exception& e) {
+        LogPrint("estimatefee", "Not reading horizon estimates: %s\n", e.what());
+    }
 }
 
 FeeFilterRounder::FeeFilterRounder(const CFeeRate& minIncrementalFee)
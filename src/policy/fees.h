@@ -9,6 +9,7 @@
 #include "uint256.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -65,6 +66,15 @@ class CTxMemPool;
  * the number of transactions we've seen in that fee bucket when calculating
  * an estimate for any number of confirmations below the number of blocks
  * they've been outstanding.
+ *
+ * In the horizon mode (-feeestimatemode=horizon) estimateSmartFee instead
+ * keeps the same confirmation statistics at three decay rates. The shortest
+ * horizon follows the fee market within a few dozen blocks, and the longer
+ * ones answer when it has too few data points. The answer is never below
+ * the fee rate needed to outbid the transactions currently in the mempool
+ * over the target number of blocks. The estimator tracks that from a
+ * histogram of the mempool by fee rate bucket, kept up to date as
+ * transactions enter and leave.
  */
 
 /**
@@ -175,7 +185,86 @@ public:
     void Read(CAutoFile& filein);
 };
 
+/**
+ * Confirmation statistics of fee transactions at one decay rate, used by the
+ * horizon mode. Unlike TxConfirmStats a new block does not touch every
+ * bucket: values are stored multiplied by decay^-n for the n blocks since the
+ * last rescale, so decaying all of them is a single update of that common
+ * scale. Recording a confirmation only updates its own bucket, and an
+ * estimate is a single pass over the buckets.
+ */
+class DecayingConfirmStats
+{
+private:
+    double decay;
+    double scale; //!< stored values are the actual values times scale
+
+    // For each bucket X, scaled like above:
+    std::vector<double> txCtAvg;               // txs confirmed
+    std::vector<std::vector<double> > confAvg; // confAvg[Y][X], txs confirmed within Y+1 blocks
+    std::vector<std::vector<double> > failAvg; // failAvg[Y][X], txs that left the mempool unconfirmed after more than Y blocks
+    std::vector<double> avg;                   // total fee rate of the txs confirmed
+
+    // Txs now in the mempool, not scaled, as in TxConfirmStats
+    std::vector<std::vector<int> > unconfTxs; // unconfTxs[Y][X], entered at a height equal to Y modulo the confirm count
+    std::vector<int> oldUnconfTxs;            // entered longer ago than that
+
+    /** Divide the stored values by scale before it overflows */
+    void Rescale();
+
+public:
+    DecayingConfirmStats() : decay(0), scale(1) {}
+
+    void Initialize(size_t numBuckets, unsigned int maxConfirms, double decay);
+
+    /** Decay the history by one block, before recording the txs of block nBlockHeight */
+    void NewBlock(unsigned int nBlockHeight);
+
+    /**
+     * Record a transaction in bucketIndex confirmed after blocksToConfirm
+     * (1-based) blocks
+     */
+    void Record(int blocksToConfirm, unsigned int bucketIndex, double val);
+
+    /** Track a transaction in bucketIndex entering the mempool at nBlockHeight */
+    void NewTx(unsigned int nBlockHeight, unsigned int bucketIndex);
+
+    /**
+     * Stop tracking a mempool transaction, counting it as failed for every
+     * target it outlived unless it left the mempool in a block
+     */
+    void RemoveTx(unsigned int entryHeight, unsigned int nBestSeenHeight, unsigned int bucketIndex, bool fInBlock);
+
+    /**
+     * Return the median fee rate of the lowest range of buckets such that
+     * all higher buckets were confirmed within confTarget at minSuccess,
+     * or -1 if there is not enough data. Ranges hold at least
+     * sufficientTxVal confirmed txs per block on average; txs that failed
+     * the target or are still in the mempool past it count against it.
+     */
+    double EstimateMedianVal(int confTarget, double sufficientTxVal, double minSuccess, unsigned int nBlockHeight) const;
+
+    unsigned int GetMaxConfirms() const { return confAvg.size(); }
+
+    void Write(CAutoFile& fileout) const;
+
+    /** Read saved state, which must have numBuckets buckets */
+    void Read(CAutoFile& filein, size_t numBuckets);
+};
+
+/** How estimateSmartFee answers */
+enum FeeEstimateMode
+{
+    FEE_ESTIMATE_CLASSIC, //!< One decay rate, from past confirmations only
+    FEE_ESTIMATE_HORIZON, //!< Several decay rates, bounded below by the current mempool
+};
 
+/** Default for -feeestimatemode */
+static const FeeEstimateMode DEFAULT_FEE_ESTIMATE_MODE = FEE_ESTIMATE_CLASSIC;
+
+/** Parse a -feeestimatemode value, returns false if it is unknown */
+bool ParseFeeEstimateMode(const std::string& strMode, FeeEstimateMode& modeRet);
+std::string FeeEstimateModeString(FeeEstimateMode mode);
 
 /** Track confirm delays up to 25 blocks, can't estimate beyond that */
 static const unsigned int MAX_BLOCK_CONFIRMS = 25;
@@ -183,6 +272,16 @@ static const unsigned int MAX_BLOCK_CONFIRMS = 25;
 /** Decay of .998 is a half-life of 346 blocks or about 2.4 days */
 static const double DEFAULT_DECAY = .998;
 
+/** Horizons of the horizon mode: decay of .962 is a half-life of 18 blocks */
+static const double SHORT_DECAY = .962;
+static const unsigned int SHORT_BLOCK_CONFIRMS = 12;
+/** Decay of .9952 is a half-life of 144 blocks */
+static const double MED_DECAY = .9952;
+static const unsigned int MED_BLOCK_CONFIRMS = 24;
+/** Decay of .99931 is a half-life of 1004 blocks */
+static const double LONG_DECAY = .99931;
+static const unsigned int LONG_BLOCK_CONFIRMS = 48;
+
 /** Require greater than 95% of X fee transactions to be confirmed within Y blocks for X to be big enough */
 static const double MIN_SUCCESS_PCT = .95;
 static const double UNLIKELY_PCT = .5;
@@ -231,8 +330,8 @@ public:
     /** Process a transaction accepted to the mempool*/
     void processTransaction(const CTxMemPoolEntry& entry, bool fCurrentEstimate);
 
-    /** Remove a transaction from the mempool tracking stats*/
-    void removeTx(uint256 hash);
+    /** Remove a transaction from the mempool tracking stats, fInBlock if it was confirmed */
+    void removeTx(uint256 hash, bool fInBlock = false);
 
     /** Is this transaction likely included in a block because of its fee?*/
     bool isFeeDataPoint(const CFeeRate &fee, double pri);
@@ -264,16 +363,21 @@ public:
     /** Read estimation data from a file */
     void Read(CAutoFile& filein);
 
+    void SetMode(FeeEstimateMode modeIn) { mode = modeIn; }
+
 private:
     CFeeRate minTrackedFee;    //!< Passed to constructor to avoid dependency on main
     double minTrackedPriority; //!< Set to AllowFreeThreshold
     unsigned int nBestSeenHeight;
+    FeeEstimateMode mode;
     struct TxStatsInfo
     {
         TxConfirmStats *stats;
         unsigned int blockHeight;
         unsigned int bucketIndex;
-        TxStatsInfo() : stats(NULL), blockHeight(0), bucketIndex(0) {}
+        unsigned int nTxSize;        //!< counted in mempoolBytes if non-zero
+        unsigned int feeBucketIndex; //!< bucket in mempoolBytes
+        TxStatsInfo() : stats(NULL), blockHeight(0), bucketIndex(0), nTxSize(0), feeBucketIndex(0) {}
     };
 
     // map of txids to information about that transaction
@@ -285,6 +389,30 @@ private:
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
+
+    /** Fee rate buckets of the horizon mode */
+    std::vector<double> feeBuckets;
+    std::map<double, unsigned int> feeBucketMap;
+
+    /** Fee confirmation history of the horizon mode, per decay horizon */
+    DecayingConfirmStats shortStats, medStats, longStats;
+
+    /** Serialized size of the mempool transactions in each fee rate bucket */
+    std::vector<uint64_t> mempoolBytes;
+
+    /** Blocks recorded in the horizon stats since startup */
+    unsigned int nHorizonBlocks;
+
+    unsigned int FeeBucketIndex(double feeRate) const;
+
+    /** estimateSmartFee in the horizon mode */
+    CFeeRate estimateHorizonFee(int confTarget, int *answerFoundAtTarget);
+
+    /**
+     * Fee rate needed to outbid the current mempool within confTarget
+     * blocks, or 0 if all of it fits
+     */
+    double estimateMempoolFee(int confTarget) const;
 };
 
 class FeeFilterRounder
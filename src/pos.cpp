@@ -69,9 +69,22 @@ bool CheckStakeBlockTimestamp(int64_t nTimeBlock)
 //   quantities so as to generate blocks faster, degrading the system back into
 //   a proof-of-work situation.
 //
+uint256 ComputeStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nTimeTxPrev, const COutPoint& prevout, unsigned int nTimeTx)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << pindexPrev->nStakeModifier;
+    ss << nTimeTxPrev << prevout.hash << prevout.n << nTimeTx;
+    return ss.GetHash();
+}
+
 bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, const CCoins* txPrev, const COutPoint& prevout, unsigned int nTimeTx, bool fPrintProofOfStake)
 {
-    if (nTimeTx < txPrev->nTime)  // Transaction timestamp violation
+    return CheckStakeKernelHash(pindexPrev, nBits, txPrev->nTime, txPrev->vout[prevout.n].nValue, prevout, nTimeTx, fPrintProofOfStake);
+}
+
+bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, unsigned int nTimeTxPrev, CAmount nValueIn, const COutPoint& prevout, unsigned int nTimeTx, bool fPrintProofOfStake)
+{
+    if (nTimeTx < nTimeTxPrev)  // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
 
     // Base target
@@ -79,7 +92,6 @@ bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, con
     bnTarget.SetCompact(nBits);
 
     // Weighted target
-    int64_t nValueIn = txPrev->vout[prevout.n].nValue;
     if (nValueIn == 0)
         return error("CheckStakeKernelHash() : nValueIn = 0");
     arith_uint256 bnWeight = arith_uint256(nValueIn);
@@ -88,17 +100,13 @@ bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, con
     uint256 nStakeModifier = pindexPrev->nStakeModifier;
 
     // Calculate hash
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << nStakeModifier;
-    ss << txPrev->nTime << prevout.hash << prevout.n << nTimeTx;
-
-    uint256 hashProofOfStake = ss.GetHash();
+    uint256 hashProofOfStake = ComputeStakeKernelHash(pindexPrev, nTimeTxPrev, prevout, nTimeTx);
 
     if (fPrintProofOfStake)
     {
         LogPrintf("CheckStakeKernelHash() : nStakeModifier=%s, txPrev.nTime=%u, txPrev.vout.hash=%s, txPrev.vout.n=%u, nTime=%u, hashProof=%s\n",
             nStakeModifier.GetHex().c_str(),
-            txPrev->nTime, prevout.hash.ToString(), prevout.n, nTimeTx,
+            nTimeTxPrev, prevout.hash.ToString(), prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
 
@@ -110,13 +118,34 @@ bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, con
     {
         LogPrintf("CheckStakeKernelHash() : nStakeModifier=%s, txPrev.nTime=%u, txPrev.vout.hash=%s, txPrev.vout.n=%u, nTime=%u, hashProof=%s\n",
             nStakeModifier.GetHex().c_str(),
-            txPrev->nTime, prevout.hash.ToString(), prevout.n, nTimeTx,
+            nTimeTxPrev, prevout.hash.ToString(), prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
 
     return true;
 }
 
+/**
+ * Look the kernel prevout up in the chainstate, which also works for coins
+ * whose block this node never downloaded because it started from a UTXO set
+ * snapshot. Fails if it is spent, unknown or not mature on top of pindexPrev.
+ */
+static bool GetKernelCoin(CBlockIndex* pindexPrev, const COutPoint& prevout, CStakeCache& stake, CTxOut* ptxout = NULL)
+{
+    LOCK(cs_main);
+    const CCoins* coins = pcoinsTip->AccessCoins(prevout.hash);
+    if (!coins || !coins->IsAvailable(prevout.n))
+        return error("%s: could not find previous output %s", __func__, prevout.ToString());
+
+    if (pindexPrev->nHeight + 1 - coins->nHeight < Params().GetConsensus().nCoinbaseMaturity)
+        return error("%s: stake prevout is not mature, expecting %i and only matured to %i", __func__, Params().GetConsensus().nCoinbaseMaturity, pindexPrev->nHeight + 1 - coins->nHeight);
+
+    stake = CStakeCache(coins->nHeight, coins->nTime, coins->vout[prevout.n].nValue);
+    if (ptxout)
+        *ptxout = coins->vout[prevout.n];
+    return true;
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned int nBits, CValidationState &state)
 {
@@ -126,29 +155,16 @@ bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx.vin[0];
 
-    // First try finding the previous transaction in database
-    CTransaction txPrev;
-    uint256 hashBlock = uint256();
-    if (!GetTransaction(txin.prevout.hash, txPrev, Params().GetConsensus(), hashBlock, true))
+    CStakeCache stake;
+    CTxOut txoutPrev;
+    if (!GetKernelCoin(pindexPrev, txin.prevout, stake, &txoutPrev))
        return state.DoS(100, error("CheckProofOfStake() : INFO: read txPrev failed"));  // previous transaction not in main chain, may occur during initial download
 
-    if (mapBlockIndex.count(hashBlock) == 0)
-        return fDebug ? state.DoS(100, error("CheckProofOfStake() : read block failed")) : false; // unable to read block of previous transaction
-
-    // Verify inputs
-    if (txin.prevout.hash != txPrev.GetHash())
-        return state.DoS(100, error("CheckProofOfStake() : coinstake input does not match previous output %s", txin.prevout.hash.GetHex()));
-
     // Verify signature
-    if (!VerifySignature(txPrev, tx, 0, SCRIPT_VERIFY_NONE, 0))
+    if (!VerifyScript(txin.scriptSig, txoutPrev.scriptPubKey, SCRIPT_VERIFY_NONE, TransactionSignatureChecker(&tx, 0, 0), NULL))
        return state.DoS(100, error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString()));
 
-    // Min age requirement
-    if (pindexPrev->nHeight + 1 - mapBlockIndex[hashBlock]->nHeight < Params().GetConsensus().nCoinbaseMaturity){
-        return state.DoS(100, error("CheckProofOfStake() : stake prevout is not mature, expecting %i and only matured to %i", Params().GetConsensus().nCoinbaseMaturity, pindexPrev->nHeight + 1 - mapBlockIndex[hashBlock]->nHeight));
-    }
-
-    if (!CheckStakeKernelHash(pindexPrev, nBits, new CCoins(txPrev, pindexPrev->nHeight), txin.prevout, tx.nTime, fDebug))
+    if (!CheckStakeKernelHash(pindexPrev, nBits, stake.nTime, stake.nValue, txin.prevout, tx.nTime, fDebug))
        return state.DoS(1, error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s", tx.GetHash().ToString())); // may occur during initial download or if behind on block chain sync
 
     return true;
@@ -175,53 +191,19 @@ bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTimeBloc
 
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTime, const COutPoint& prevout, const std::map<COutPoint, CStakeCache>& cache)
 {
-    uint256 hashProofOfStake, targetProofOfStake;
     auto it=cache.find(prevout);
 
     if(it == cache.end()) {
-        CTransaction txPrev;
-        uint256 hashBlock = uint256();
-        if (!GetTransaction(prevout.hash, txPrev, Params().GetConsensus(), hashBlock, true)){
-            LogPrintf("CheckKernel() : could not find previous transaction %s\n", prevout.hash.ToString());
+        CStakeCache stake;
+        if (!GetKernelCoin(pindexPrev, prevout, stake))
             return false;
-        }
-
-        if (mapBlockIndex.count(hashBlock) == 0) {
-            LogPrintf("CheckKernel() : could not find block of previous transaction %s\n", hashBlock.ToString());
-            return false;
-        }
-
-        if (pindexPrev->nHeight + 1 - mapBlockIndex[hashBlock]->nHeight < Params().GetConsensus().nCoinbaseMaturity){
-            LogPrintf("CheckKernel() : stake prevout is not mature in block %s\n", hashBlock.ToString());
-            return false;
-        }
-
-        //CheckStakeKernalHash needs a pointer to coins in order to be used to validate the chain on disk/memort
-        //Using a pointer in this context is not needed, but is required by the function. 
-        //Must ensure coins is deleted to prevent memory leak. 
-        CCoins* coins = new CCoins(txPrev, pindexPrev->nHeight);
-        bool result = CheckStakeKernelHash(pindexPrev, nBits, coins, prevout, nTime);
-        delete coins;
-
-        return result;
+        return CheckStakeKernelHash(pindexPrev, nBits, stake.nTime, stake.nValue, prevout, nTime);
     } else {
         //found in cache
         const CStakeCache& stake = it->second;
-        /*
-        if (CheckStakeKernelHash(pindexPrev, nBits, new CCoins(stake.txPrev, pindexPrev->nHeight), prevout, nTime)) {
-            // Cache could potentially cause false positive stakes in the event of deep reorgs, so check without cache also
-            return CheckKernel(pindexPrev, nBits, nTime, prevout);
-        }
-        */
-
-        //CheckStakeKernalHash needs a pointer to coins in order to be used to validate the chain on disk/memort
-        //Using a pointer in this context is not needed, but is required by the function.
-        //Must ensure coins is deleted to prevent memory leak. 
-        CCoins* coins = new CCoins(stake.txPrev, pindexPrev->nHeight);
-        bool result = CheckStakeKernelHash(pindexPrev, nBits, coins, prevout, nTime);
-        delete coins;
-
-        return result;
+        if (pindexPrev->nHeight + 1 - stake.nHeight < Params().GetConsensus().nCoinbaseMaturity)
+            return false;
+        return CheckStakeKernelHash(pindexPrev, nBits, stake.nTime, stake.nValue, prevout, nTime);
     }
 }
 
@@ -230,23 +212,8 @@ void CacheKernel(std::map<COutPoint, CStakeCache>& cache, const COutPoint& prevo
         //already in cache
         return;
     }
-    CTransaction txPrev;
-    uint256 hashBlock = uint256();
-    if (!GetTransaction(prevout.hash, txPrev, Params().GetConsensus(), hashBlock, true)){
-        LogPrintf("CacheKernel() : could not find previous transaction %s\n", prevout.hash.ToString());
+    CStakeCache stake;
+    if (!GetKernelCoin(pindexPrev, prevout, stake))
         return;
-    }
-
-    if (mapBlockIndex.count(hashBlock) == 0) {
-        LogPrintf("CacheKernel() : could not find block of previous transaction %s\n", hashBlock.ToString());
-        return;
-    }
-
-    if (pindexPrev->nHeight + 1 - mapBlockIndex[hashBlock]->nHeight < Params().GetConsensus().nCoinbaseMaturity){
-        LogPrintf("CheckKernel() : stake prevout is not mature in block %s\n", hashBlock.ToString());
-        return;
-    }
-
-    CStakeCache c(hashBlock, txPrev);
-    cache.insert({prevout, c});
+    cache.insert({prevout, stake});
 }
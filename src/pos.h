@@ -27,11 +27,15 @@ using namespace std;
 /** Compute the hash modifier for proof-of-stake */
 uint256 ComputeStakeModifier(const CBlockIndex* pindexPrev, const uint256& kernel);
 
+/** What the kernel check needs of a staked output, as the chainstate has it */
 struct CStakeCache{
-    CStakeCache(uint256 hashBlock_, const CTransaction txPrev_) : hashBlock(hashBlock_), txPrev(txPrev_){
+    CStakeCache() : nHeight(0), nTime(0), nValue(0){
     }
-    uint256 hashBlock;
-    const CTransaction txPrev;
+    CStakeCache(int nHeight_, unsigned int nTime_, CAmount nValue_) : nHeight(nHeight_), nTime(nTime_), nValue(nValue_){
+    }
+    int nHeight;            //!< height of the block that created the output
+    unsigned int nTime;     //!< time of the transaction that created the output
+    CAmount nValue;
 };
 
 // Check whether the coinstake timestamp meets protocol
@@ -39,7 +43,10 @@ bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx);
 bool CheckStakeBlockTimestamp(int64_t nTimeBlock);
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTime, const COutPoint& prevout);
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTime, const COutPoint& prevout, const std::map<COutPoint, CStakeCache>& cache);
+/** The proof-of-stake hash of kernel prevout, from a transaction of time nTimeTxPrev, staked at nTimeTx on top of pindexPrev */
+uint256 ComputeStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nTimeTxPrev, const COutPoint& prevout, unsigned int nTimeTx);
 bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, const CCoins* txPrev, const COutPoint& prevout, unsigned int nTimeTx, bool fPrintProofOfStake = false);
+bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, unsigned int nTimeTxPrev, CAmount nValueIn, const COutPoint& prevout, unsigned int nTimeTx, bool fPrintProofOfStake = false);
 bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned int nBits, CValidationState &state);
 void CacheKernel(std::map<COutPoint, CStakeCache>& cache, const COutPoint& prevout, CBlockIndex* pindexPrev);
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
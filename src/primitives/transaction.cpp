@@ -95,6 +95,16 @@ CTransaction& CTransaction::operator=(const CTransaction &tx) {
     return *this;
 }
 
+CTransaction& CTransaction::operator=(CTransaction &&tx) {
+    *const_cast<int*>(&nVersion) = tx.nVersion;
+    *const_cast<unsigned int*>(&nTime) = tx.nTime;
+    const_cast<std::vector<CTxIn>*>(&vin)->swap(*const_cast<std::vector<CTxIn>*>(&tx.vin));
+    const_cast<std::vector<CTxOut>*>(&vout)->swap(*const_cast<std::vector<CTxOut>*>(&tx.vout));
+    *const_cast<unsigned int*>(&nLockTime) = tx.nLockTime;
+    *const_cast<uint256*>(&hash) = tx.hash;
+    return *this;
+}
+
 CAmount CTransaction::GetValueOut() const
 {
     CAmount nValueOut = 0;
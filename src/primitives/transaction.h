@@ -249,7 +249,10 @@ public:
     /** Convert a CMutableTransaction into a CTransaction. */
     CTransaction(const CMutableTransaction &tx);
 
+    CTransaction(const CTransaction& tx) = default;
     CTransaction& operator=(const CTransaction& tx);
+    /** Take over the inputs and outputs of tx, which is left for destruction or assignment only */
+    CTransaction& operator=(CTransaction&& tx);
 
     ADD_SERIALIZE_METHODS;
 
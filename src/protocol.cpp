@@ -35,6 +35,8 @@ const char *FILTERCLEAR="filterclear";
 const char *REJECT="reject";
 const char *SENDHEADERS="sendheaders";
 const char *FEEFILTER="feefilter";
+const char *GETPACKAGE="getpackage";
+const char *PACKAGE="package";
 /*
 // Disable BIP152
 const char *SENDCMPCT="sendcmpct";
@@ -70,6 +72,8 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::REJECT,
     NetMsgType::SENDHEADERS,
     NetMsgType::FEEFILTER,
+    NetMsgType::GETPACKAGE,
+    NetMsgType::PACKAGE,
     /*
     // Disable BIP152
     NetMsgType::SENDCMPCT,
@@ -217,6 +217,21 @@ extern const char *SENDHEADERS;
  * @since protocol version 70013 as described by BIP133
  */
 extern const char *FEEFILTER;
+/**
+ * The getpackage message asks for a transaction together with its
+ * unconfirmed ancestors, to be sent back in a "package" message. It is sent
+ * for transactions whose parents were rejected on their own, typically for
+ * paying too low a fee.
+ * @since protocol version 70014
+ */
+extern const char *GETPACKAGE;
+/**
+ * The package message contains a transaction with its unconfirmed
+ * ancestors, parents first. The receiver accepts or rejects them as a whole,
+ * based on their combined fee rate.
+ * @since protocol version 70014
+ */
+extern const char *PACKAGE;
 
 // Disable BIP152
 /**
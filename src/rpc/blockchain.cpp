@@ -13,6 +13,7 @@
 #include "validation.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -25,6 +26,7 @@
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 using namespace std;
@@ -129,9 +131,11 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+/** The fields of blockToJSON that come before and after the transactions */
+static void blockInfoToJSON(const CBlock& block, const CBlockIndex* blockindex, UniValue& result, UniValue& resultTail)
 {
-    UniValue result(UniValue::VOBJ);
+    result.setObject();
+    resultTail.setObject();
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
@@ -143,38 +147,64 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx.GetHash().GetHex());
-    }
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("mediantime", (int64_t)blockindex->GetPastTimeLimit()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+    resultTail.push_back(Pair("time", block.GetBlockTime()));
+    resultTail.push_back(Pair("mediantime", (int64_t)blockindex->GetPastTimeLimit()));
+    resultTail.push_back(Pair("nonce", (uint64_t)block.nNonce));
+    resultTail.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+    resultTail.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+    resultTail.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
 
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+        resultTail.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
     CBlockIndex *pnext = chainActive.Next(blockindex);
     if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
-    result.push_back(Pair("flags", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work"));
-    result.push_back(Pair("modifier", blockindex->nStakeModifier.GetHex()));
+        resultTail.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    resultTail.push_back(Pair("flags", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work"));
+    resultTail.push_back(Pair("modifier", blockindex->nStakeModifier.GetHex()));
     if (block.IsProofOfStake())
-    	result.push_back(Pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end())));
+    	resultTail.push_back(Pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end())));
+}
+
+static UniValue blockTxToJSON(const CTransaction& tx, bool txDetails)
+{
+    if (!txDetails)
+        return tx.GetHash().GetHex();
+    UniValue objTx(UniValue::VOBJ);
+    TxToJSON(tx, uint256(), objTx);
+    return objTx;
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue result, resultTail;
+    blockInfoToJSON(block, blockindex, result, resultTail);
+    UniValue txs(UniValue::VARR);
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        txs.push_back(blockTxToJSON(tx, txDetails));
+    result.push_back(Pair("tx", txs));
+    result.pushKVs(resultTail);
     return result;
 }
 
+/** blockToJSON, written one transaction at a time. Takes cs_main only for the block info. */
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, JSONStreamWriter& writer)
+{
+    UniValue result, resultTail;
+    {
+        LOCK(cs_main);
+        blockInfoToJSON(block, blockindex, result, resultTail);
+    }
+    writer.BeginObject();
+    writer.Fields(result);
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        writer.Value(blockTxToJSON(tx, txDetails));
+    writer.End();
+    writer.Fields(resultTail);
+    writer.End();
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -253,30 +283,69 @@ std::string EntryDescriptionString()
            "       ... ]\n";
 }
 
-void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+/** What entryToJSON shows of a mempool entry, copied so that it can be written out after mempool.cs is released */
+struct CMempoolEntryInfo
 {
-    AssertLockHeld(mempool.cs);
-
-    info.push_back(Pair("size", (int)e.GetTxSize()));
-    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-    info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
-    info.push_back(Pair("time", e.GetTime()));
-    info.push_back(Pair("height", (int)e.GetHeight()));
-    info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-    info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-    info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
-    info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
-    info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
-    info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
-    info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
-    info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
-    const CTransaction& tx = e.GetTx();
-    set<string> setDepends;
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    uint256 hash;
+    size_t nSize;
+    CAmount nFee;
+    CAmount nModifiedFee;
+    int64_t nTime;
+    unsigned int nHeight;
+    double dStartingPriority;
+    double dCurrentPriority;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    std::vector<uint256> vDepends;
+
+    explicit CMempoolEntryInfo(const CTxMemPoolEntry& e)
     {
-        if (mempool.exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
+        AssertLockHeld(mempool.cs);
+
+        hash = e.GetTx().GetHash();
+        nSize = e.GetTxSize();
+        nFee = e.GetFee();
+        nModifiedFee = e.GetModifiedFee();
+        nTime = e.GetTime();
+        nHeight = e.GetHeight();
+        dStartingPriority = e.GetPriority(e.GetHeight());
+        dCurrentPriority = e.GetPriority(chainActive.Height());
+        nCountWithDescendants = e.GetCountWithDescendants();
+        nSizeWithDescendants = e.GetSizeWithDescendants();
+        nModFeesWithDescendants = e.GetModFeesWithDescendants();
+        nCountWithAncestors = e.GetCountWithAncestors();
+        nSizeWithAncestors = e.GetSizeWithAncestors();
+        nModFeesWithAncestors = e.GetModFeesWithAncestors();
+        BOOST_FOREACH(const CTxIn& txin, e.GetTx().vin)
+        {
+            if (mempool.exists(txin.prevout.hash))
+                vDepends.push_back(txin.prevout.hash);
+        }
     }
+};
+
+static void entryToJSON(UniValue &info, const CMempoolEntryInfo &e)
+{
+    info.push_back(Pair("size", (int)e.nSize));
+    info.push_back(Pair("fee", ValueFromAmount(e.nFee)));
+    info.push_back(Pair("modifiedfee", ValueFromAmount(e.nModifiedFee)));
+    info.push_back(Pair("time", e.nTime));
+    info.push_back(Pair("height", (int)e.nHeight));
+    info.push_back(Pair("startingpriority", e.dStartingPriority));
+    info.push_back(Pair("currentpriority", e.dCurrentPriority));
+    info.push_back(Pair("descendantcount", e.nCountWithDescendants));
+    info.push_back(Pair("descendantsize", e.nSizeWithDescendants));
+    info.push_back(Pair("descendantfees", e.nModFeesWithDescendants));
+    info.push_back(Pair("ancestorcount", e.nCountWithAncestors));
+    info.push_back(Pair("ancestorsize", e.nSizeWithAncestors));
+    info.push_back(Pair("ancestorfees", e.nModFeesWithAncestors));
+    set<string> setDepends;
+    BOOST_FOREACH(const uint256& hash, e.vDepends)
+        setDepends.insert(hash.ToString());
 
     UniValue depends(UniValue::VARR);
     BOOST_FOREACH(const string& dep, setDepends)
@@ -287,6 +356,11 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("depends", depends));
 }
 
+void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+{
+    entryToJSON(info, CMempoolEntryInfo(e));
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
     if (fVerbose)
@@ -315,6 +389,41 @@ UniValue mempoolToJSON(bool fVerbose = false)
     }
 }
 
+/** mempoolToJSON, written one entry at a time */
+void mempoolToJSON(bool fVerbose, JSONStreamWriter& writer)
+{
+    if (fVerbose)
+    {
+        // Writing may wait for a slow client, so only the copy is made under the lock
+        vector<CMempoolEntryInfo> vInfo;
+        {
+            LOCK(mempool.cs);
+            vInfo.reserve(mempool.mapTx.size());
+            BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+                vInfo.push_back(CMempoolEntryInfo(e));
+        }
+
+        writer.BeginObject();
+        BOOST_FOREACH(const CMempoolEntryInfo& e, vInfo)
+        {
+            UniValue info(UniValue::VOBJ);
+            entryToJSON(info, e);
+            writer.Field(e.hash.ToString(), info);
+        }
+        writer.End();
+    }
+    else
+    {
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+
+        writer.BeginArray();
+        BOOST_FOREACH(const uint256& hash, vtxid)
+            writer.Value(hash.ToString());
+        writer.End();
+    }
+}
+
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -346,6 +455,18 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     return mempoolToJSON(fVerbose);
 }
 
+static void getrawmempoolStream(const UniValue& params, JSONStreamWriter& writer)
+{
+    if (params.size() > 1)
+        getrawmempool(params, true); // throws the help text
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    mempoolToJSON(fVerbose, writer);
+}
+
 UniValue getmempoolancestors(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2) {
@@ -591,6 +712,28 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+/** Look up and read the block with the hash in param */
+static CBlockIndex* ReadBlockForRPC(const UniValue& param, CBlock& block)
+{
+    AssertLockHeld(cs_main);
+
+    std::string strHash = param.get_str();
+    uint256 hash(uint256S(strHash));
+
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockIndex* pblockindex = mapBlockIndex[hash];
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return pblockindex;
+}
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -632,24 +775,12 @@ UniValue getblock(const UniValue& params, bool fHelp)
 
     LOCK(cs_main);
 
-    std::string strHash = params[0].get_str();
-    uint256 hash(uint256S(strHash));
-
     bool fVerbose = true;
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    CBlockIndex* pblockindex = ReadBlockForRPC(params[0], block);
 
     if (!fVerbose)
     {
@@ -662,6 +793,23 @@ UniValue getblock(const UniValue& params, bool fHelp)
     return blockToJSON(block, pblockindex);
 }
 
+static void getblockStream(const UniValue& params, JSONStreamWriter& writer)
+{
+    // Only the JSON form is big enough to be worth streaming
+    if (params.size() < 1 || params.size() > 2 || (params.size() > 1 && !params[1].get_bool())) {
+        writer.Value(getblock(params, false));
+        return;
+    }
+
+    CBlock block;
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        pblockindex = ReadBlockForRPC(params[0], block);
+    }
+    blockToJSON(block, pblockindex, false, writer);
+}
+
 struct CCoinsStats
 {
     int nHeight;
@@ -756,6 +904,47 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set to a snapshot file, together with the block index entries\n"
+            "of its chain, which a new node can start from with -loadtxoutset.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"          (string, required) The file to write, relative to the data directory if not absolute. It must not exist.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\":n,             (numeric) The height of the block the snapshot was taken at\n"
+            "  \"bestblock\": \"hex\",     (string) The hash of that block\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"hash_snapshot\": \"hash\", (string) The hash of the snapshot, which -loadtxoutset checks against the chain parameters\n"
+            "  \"path\": \"path\"          (string) The absolute path of the snapshot\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.snapshot\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.snapshot\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CTxOutSetSnapshotInfo info;
+    FlushStateToDisk();
+    if (!DumpTxOutSetSnapshot(pcoinsTip, path, info))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to write the UTXO set snapshot");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", info.nHeight));
+    ret.push_back(Pair("bestblock", info.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)info.nTransactions));
+    ret.push_back(Pair("hash_snapshot", info.hashSnapshot.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -1161,6 +1350,77 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+static UniValue feeHistogramToJSON(const std::vector<CFeeRateHistogram::Bucket>& vBuckets)
+{
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const CFeeRateHistogram::Bucket& bucket, vBuckets) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("from", ValueFromAmount(bucket.nFeeRateFrom)));
+        entry.push_back(Pair("count", bucket.nCount));
+        entry.push_back(Pair("size", bucket.nSize));
+        entry.push_back(Pair("fees", ValueFromAmount(bucket.nFees)));
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+UniValue mempoolFeeHistogramToJSON(bool fDelta, uint64_t nSinceSequence)
+{
+    std::vector<CFeeRateHistogram::Bucket> vFeeRate, vAncestorFeeRate;
+    uint64_t nSequence = mempool.GetFeeHistograms(fDelta, nSinceSequence, vFeeRate, vAncestorFeeRate);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("sequence", (int64_t)nSequence));
+    ret.push_back(Pair("delta", fDelta));
+    ret.push_back(Pair("feerate", feeHistogramToJSON(vFeeRate)));
+    ret.push_back(Pair("ancestorfeerate", feeHistogramToJSON(vAncestorFeeRate)));
+    return ret;
+}
+
+UniValue getmempoolfeehistogram(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmempoolfeehistogram ( since_sequence )\n"
+            "\nReturns the count, size and fees of the TX memory pool transactions by fee rate range,\n"
+            "both by their own fee rate and by their fee rate with in-mempool ancestors.\n"
+            "\nArguments:\n"
+            "1. since_sequence    (numeric, optional) Return only the changes made after this sequence number,\n"
+            "                     as returned by an earlier call. Only the ranges that changed are listed.\n"
+            "                     If the changes are no longer known the full histograms are returned.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sequence\": n,            (numeric) The sequence number the histograms are current as of\n"
+            "  \"delta\": true|false,      (boolean) If the counts are changes since since_sequence\n"
+            "  \"feerate\": [             (array) Transactions by modified fee rate\n"
+            "    {\n"
+            "      \"from\": x.xxxx,       (numeric) Lowest fee rate of the range, in " + CURRENCY_UNIT + "/kB\n"
+            "      \"count\": n,           (numeric) Number of transactions\n"
+            "      \"size\": n,            (numeric) Sum of their sizes\n"
+            "      \"fees\": x.xxxx        (numeric) Sum of their modified fees, in " + CURRENCY_UNIT + "\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"ancestorfeerate\": [     (array) Transactions by modified fee rate with ancestors, as above\n"
+            "    ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolfeehistogram", "")
+            + HelpExampleCli("getmempoolfeehistogram", "1234")
+            + HelpExampleRpc("getmempoolfeehistogram", "1234")
+        );
+
+    bool fDelta = params.size() > 0;
+    int64_t nSinceSequence = 0;
+    if (fDelta) {
+        nSinceSequence = params[0].get_int64();
+        if (nSinceSequence < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative since_sequence");
+    }
+
+    return mempoolFeeHistogramToJSON(fDelta, nSinceSequence);
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -1250,10 +1510,12 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true  },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true  },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true  },
+    { "blockchain",         "getmempoolfeehistogram", &getmempoolfeehistogram, true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
 
     /* Not shown in help */
@@ -1261,8 +1523,20 @@ static const CRPCCommand commands[] =
     { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
 };
 
+static const struct {
+    const char* name;
+    rpcstreamfn_type actor;
+} streamCommands[] =
+{ //  name                      actor (function)
+  //  ------------------------  -----------------------
+    { "getblock",               &getblockStream         },
+    { "getrawmempool",          &getrawmempoolStream    },
+};
+
 void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+    for (unsigned int vcidx = 0; vcidx < ARRAYLEN(streamCommands); vcidx++)
+        tableRPC.appendStreamCommand(streamCommands[vcidx].name, streamCommands[vcidx].actor);
 }
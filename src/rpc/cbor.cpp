@@ -0,0 +1,403 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/cbor.h"
+
+#include "utilstrencodings.h"
+
+#include <cmath>
+#include <limits>
+#include <set>
+#include <string.h>
+
+#include <boost/lexical_cast.hpp>
+
+enum CBORMajorType
+{
+    CBOR_UNSIGNED = 0,
+    CBOR_NEGATIVE = 1,
+    CBOR_BYTES = 2,
+    CBOR_TEXT = 3,
+    CBOR_ARRAY = 4,
+    CBOR_MAP = 5,
+    CBOR_TAG = 6,
+    CBOR_SIMPLE = 7,
+};
+
+static const uint64_t CBOR_TAG_DECIMAL_FRACTION = 4;
+static const uint64_t CBOR_TAG_EXPECT_BASE16 = 23;
+
+static const unsigned char CBOR_FALSE = 0xf4;
+static const unsigned char CBOR_TRUE = 0xf5;
+static const unsigned char CBOR_NULL = 0xf6;
+static const unsigned char CBOR_DOUBLE = 0xfb;
+
+/** Largest exponent of a decimal fraction DecodeCBOR writes out in full */
+static const int64_t MAX_DECIMAL_EXPONENT = 64;
+
+static void WriteBigEndian(std::string& out, uint64_t n, int nBytes)
+{
+    for (int i = nBytes - 1; i >= 0; i--)
+        out += (char)((n >> (8 * i)) & 0xff);
+}
+
+static void WriteHead(std::string& out, CBORMajorType nMajor, uint64_t n)
+{
+    const unsigned char nType = nMajor << 5;
+    if (n < 24) {
+        out += (char)(nType | n);
+    } else if (n <= 0xff) {
+        out += (char)(nType | 24);
+        WriteBigEndian(out, n, 1);
+    } else if (n <= 0xffff) {
+        out += (char)(nType | 25);
+        WriteBigEndian(out, n, 2);
+    } else if (n <= 0xffffffff) {
+        out += (char)(nType | 26);
+        WriteBigEndian(out, n, 4);
+    } else {
+        out += (char)(nType | 27);
+        WriteBigEndian(out, n, 8);
+    }
+}
+
+static void WriteInt(std::string& out, int64_t n)
+{
+    if (n >= 0)
+        WriteHead(out, CBOR_UNSIGNED, n);
+    else
+        WriteHead(out, CBOR_NEGATIVE, -1 - n);
+}
+
+static void WriteNumber(std::string& out, const std::string& strNum)
+{
+    int64_t n;
+    uint64_t u;
+    if (ParseInt64(strNum, &n)) {
+        WriteInt(out, n);
+        return;
+    }
+    if (ParseUInt64(strNum, &u)) {
+        WriteHead(out, CBOR_UNSIGNED, u);
+        return;
+    }
+
+    // Plain decimals, as amounts are written, become [exponent, mantissa]
+    // so that they arrive exactly as sent
+    size_t nPoint = strNum.find('.');
+    if (nPoint != std::string::npos && strNum.find_first_of("eE") == std::string::npos) {
+        std::string strDigits = strNum.substr(0, nPoint) + strNum.substr(nPoint + 1);
+        if (ParseInt64(strDigits, &n)) {
+            WriteHead(out, CBOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+            WriteHead(out, CBOR_ARRAY, 2);
+            WriteInt(out, -(int64_t)(strNum.size() - nPoint - 1));
+            WriteInt(out, n);
+            return;
+        }
+    }
+
+    double d = 0;
+    ParseDouble(strNum, &d);
+    uint64_t nBits;
+    memcpy(&nBits, &d, sizeof(nBits));
+    out += (char)CBOR_DOUBLE;
+    WriteBigEndian(out, nBits, 8);
+}
+
+/** Whether str decodes to bytes that HexStr turns back into str */
+static bool IsLowerHex(const std::string& str)
+{
+    if (str.empty() || str.size() % 2 != 0)
+        return false;
+    for (std::string::const_iterator it = str.begin(); it != str.end(); ++it)
+        if (!((*it >= '0' && *it <= '9') || (*it >= 'a' && *it <= 'f')))
+            return false;
+    return true;
+}
+
+static void WriteValue(std::string& out, const UniValue& value, bool fHex)
+{
+    switch (value.getType()) {
+    case UniValue::VNULL:
+        out += (char)CBOR_NULL;
+        break;
+    case UniValue::VBOOL:
+        out += (char)(value.get_bool() ? CBOR_TRUE : CBOR_FALSE);
+        break;
+    case UniValue::VNUM:
+        WriteNumber(out, value.getValStr());
+        break;
+    case UniValue::VSTR: {
+        const std::string& str = value.get_str();
+        if (fHex && IsLowerHex(str)) {
+            WriteHead(out, CBOR_TAG, CBOR_TAG_EXPECT_BASE16);
+            WriteHead(out, CBOR_BYTES, str.size() / 2);
+            std::vector<unsigned char> vch = ParseHex(str);
+            out.append(vch.begin(), vch.end());
+        } else {
+            WriteHead(out, CBOR_TEXT, str.size());
+            out += str;
+        }
+        break;
+    }
+    case UniValue::VARR:
+        WriteHead(out, CBOR_ARRAY, value.size());
+        for (unsigned int i = 0; i < value.size(); i++)
+            WriteValue(out, value[i], fHex);
+        break;
+    case UniValue::VOBJ: {
+        const std::vector<std::string>& vKeys = value.getKeys();
+        const std::vector<UniValue>& vValues = value.getValues();
+        WriteHead(out, CBOR_MAP, vKeys.size());
+        for (unsigned int i = 0; i < vKeys.size(); i++) {
+            WriteHead(out, CBOR_TEXT, vKeys[i].size());
+            out += vKeys[i];
+            WriteValue(out, vValues[i], IsHexField(vKeys[i]));
+        }
+        break;
+    }
+    }
+}
+
+std::string EncodeCBOR(const UniValue& value, bool fHex)
+{
+    std::string out;
+    WriteValue(out, value, fHex);
+    return out;
+}
+
+bool IsHexField(const std::string& strKey)
+{
+    static const char* const pszHexFields[] = {
+        // hashes
+        "hash", "txid", "blockhash", "previousblockhash", "nextblockhash", "merkleroot", "chainwork",
+        "bestblock", "lastblock", "prevtxid", "proofhash", "modifier", "hash_serialized", "hash_snapshot",
+        "tx",
+        // scripts and raw data
+        "hex", "scriptPubKey", "redeemScript", "coinbase",
+    };
+    static const std::set<std::string> setHexFields(pszHexFields, pszHexFields + sizeof(pszHexFields) / sizeof(pszHexFields[0]));
+    return setHexFields.count(strKey) != 0;
+}
+
+bool IsHexResult(const std::string& strMethod)
+{
+    static const char* const pszHexResults[] = {
+        "getbestblockhash", "getblockhash", "getblock", "getblockheader", "getrawmempool",
+        "getrawtransaction", "createrawtransaction", "sendrawtransaction", "sendrawpackage",
+        "gettxoutproof", "verifytxoutproof", "getnormalizedtxid",
+        "sendtoaddress", "sendfrom", "sendmany",
+    };
+    static const std::set<std::string> setHexResults(pszHexResults, pszHexResults + sizeof(pszHexResults) / sizeof(pszHexResults[0]));
+    return setHexResults.count(strMethod) != 0;
+}
+
+/** Write a reply object, the result of which is hex data if fHexResult */
+static void WriteReply(std::string& out, const UniValue& reply, bool fHexResult)
+{
+    if (!reply.isObject()) {
+        WriteValue(out, reply, false);
+        return;
+    }
+    const std::vector<std::string>& vKeys = reply.getKeys();
+    const std::vector<UniValue>& vValues = reply.getValues();
+    WriteHead(out, CBOR_MAP, vKeys.size());
+    for (unsigned int i = 0; i < vKeys.size(); i++) {
+        WriteHead(out, CBOR_TEXT, vKeys[i].size());
+        out += vKeys[i];
+        WriteValue(out, vValues[i], vKeys[i] == "result" && fHexResult);
+    }
+}
+
+std::string EncodeCBORReply(const UniValue& reply, const std::string& strMethod)
+{
+    std::string out;
+    WriteReply(out, reply, IsHexResult(strMethod));
+    return out;
+}
+
+std::string EncodeCBORBatchReply(const UniValue& replies, const UniValue& requests)
+{
+    std::string out;
+    WriteHead(out, CBOR_ARRAY, replies.size());
+    for (unsigned int i = 0; i < replies.size(); i++) {
+        const UniValue& method = i < requests.size() && requests[i].isObject() ? find_value(requests[i], "method") : NullUniValue;
+        WriteReply(out, replies[i], method.isStr() && IsHexResult(method.get_str()));
+    }
+    return out;
+}
+
+static bool ReadBigEndian(const std::string& str, size_t& nPos, int nBytes, uint64_t& nRet)
+{
+    if (str.size() - nPos < (size_t)nBytes)
+        return false;
+    nRet = 0;
+    for (int i = 0; i < nBytes; i++)
+        nRet = (nRet << 8) | (unsigned char)str[nPos++];
+    return true;
+}
+
+/** Read the initial byte of an item and its argument. Indefinite lengths are not supported. */
+static bool ReadHead(const std::string& str, size_t& nPos, int& nMajorRet, int& nInfoRet, uint64_t& nRet)
+{
+    if (nPos >= str.size())
+        return false;
+    const unsigned char nInitial = str[nPos++];
+    nMajorRet = nInitial >> 5;
+    nInfoRet = nInitial & 0x1f;
+    if (nInfoRet < 24) {
+        nRet = nInfoRet;
+        return true;
+    }
+    if (nInfoRet > 27)
+        return false;
+    return ReadBigEndian(str, nPos, 1 << (nInfoRet - 24), nRet);
+}
+
+static double HalfToDouble(uint16_t nHalf)
+{
+    const int nExp = (nHalf >> 10) & 0x1f;
+    const int nMantissa = nHalf & 0x3ff;
+    double d;
+    if (nExp == 0)
+        d = ldexp(nMantissa, -24);
+    else if (nExp != 31)
+        d = ldexp(nMantissa + 1024, nExp - 25);
+    else
+        d = nMantissa == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+    return (nHalf & 0x8000) ? -d : d;
+}
+
+/** Write mantissa * 10^exponent as a JSON number */
+static bool DecimalToNumStr(int64_t nExponent, int64_t nMantissa, std::string& strRet)
+{
+    if (nExponent > MAX_DECIMAL_EXPONENT || nExponent < -MAX_DECIMAL_EXPONENT)
+        return false;
+    const bool fNegative = nMantissa < 0;
+    const uint64_t nAbs = fNegative ? -(uint64_t)nMantissa : (uint64_t)nMantissa;
+    std::string strDigits = boost::lexical_cast<std::string>(nAbs);
+    if (nExponent >= 0) {
+        strDigits.append(nExponent, '0');
+    } else {
+        const size_t nScale = -nExponent;
+        if (strDigits.size() <= nScale)
+            strDigits.insert(0, nScale + 1 - strDigits.size(), '0');
+        strDigits.insert(strDigits.size() - nScale, ".");
+    }
+    strRet = (fNegative ? "-" : "") + strDigits;
+    return true;
+}
+
+static bool ReadValue(const std::string& str, size_t& nPos, UniValue& valRet, int nDepth)
+{
+    if (nDepth > MAX_CBOR_DEPTH)
+        return false;
+
+    int nMajor, nInfo;
+    uint64_t n;
+    if (!ReadHead(str, nPos, nMajor, nInfo, n))
+        return false;
+    const size_t nRemaining = str.size() - nPos;
+
+    switch (nMajor) {
+    case CBOR_UNSIGNED:
+        valRet = UniValue(n);
+        return true;
+    case CBOR_NEGATIVE:
+        if (n > (uint64_t)std::numeric_limits<int64_t>::max())
+            return false;
+        valRet = UniValue(-1 - (int64_t)n);
+        return true;
+    case CBOR_BYTES:
+        if (n > nRemaining)
+            return false;
+        valRet = UniValue(HexStr(str.begin() + nPos, str.begin() + nPos + n));
+        nPos += n;
+        return true;
+    case CBOR_TEXT:
+        if (n > nRemaining)
+            return false;
+        valRet = UniValue(str.substr(nPos, n));
+        nPos += n;
+        return true;
+    case CBOR_ARRAY:
+        // Every element takes at least one byte
+        if (n > nRemaining)
+            return false;
+        valRet.setArray();
+        for (uint64_t i = 0; i < n; i++) {
+            UniValue element;
+            if (!ReadValue(str, nPos, element, nDepth + 1))
+                return false;
+            valRet.push_back(element);
+        }
+        return true;
+    case CBOR_MAP:
+        if (n > nRemaining / 2)
+            return false;
+        valRet.setObject();
+        for (uint64_t i = 0; i < n; i++) {
+            UniValue key, element;
+            if (!ReadValue(str, nPos, key, nDepth + 1) || !key.isStr())
+                return false;
+            if (!ReadValue(str, nPos, element, nDepth + 1))
+                return false;
+            valRet.pushKV(key.get_str(), element);
+        }
+        return true;
+    case CBOR_TAG: {
+        UniValue content;
+        if (!ReadValue(str, nPos, content, nDepth + 1))
+            return false;
+        if (n != CBOR_TAG_DECIMAL_FRACTION) {
+            // Other tags only hint at how to show the content
+            valRet = content;
+            return true;
+        }
+        int64_t nExponent, nMantissa;
+        std::string strNum;
+        if (!content.isArray() || content.size() != 2 || !content[0].isNum() || !content[1].isNum() ||
+            !ParseInt64(content[0].getValStr(), &nExponent) || !ParseInt64(content[1].getValStr(), &nMantissa) ||
+            !DecimalToNumStr(nExponent, nMantissa, strNum))
+            return false;
+        return valRet.setNumStr(strNum);
+    }
+    case CBOR_SIMPLE: {
+        double d;
+        if (nInfo == 20 || nInfo == 21) {
+            valRet = UniValue(nInfo == 21);
+            return true;
+        } else if (nInfo == 22 || nInfo == 23) {
+            valRet = NullUniValue;
+            return true;
+        } else if (nInfo == 25) {
+            d = HalfToDouble(n);
+        } else if (nInfo == 26) {
+            uint32_t nBits = n;
+            float f;
+            memcpy(&f, &nBits, sizeof(f));
+            d = f;
+        } else if (nInfo == 27) {
+            memcpy(&d, &n, sizeof(d));
+        } else {
+            return false;
+        }
+        if (!std::isfinite(d))
+            return false;
+        valRet = UniValue(d);
+        return true;
+    }
+    }
+    return false;
+}
+
+bool DecodeCBOR(const std::string& str, UniValue& valRet)
+{
+    size_t nPos = 0;
+    UniValue value;
+    if (!ReadValue(str, nPos, value, 0) || nPos != str.size())
+        return false;
+    valRet = value;
+    return true;
+}
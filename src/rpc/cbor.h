@@ -0,0 +1,55 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_CBOR_H
+#define BITCOIN_RPC_CBOR_H
+
+#include <string>
+
+#include <univalue.h>
+
+/** Requests with this Content-Type are read and answered in CBOR instead of JSON */
+static const char* const CBOR_CONTENT_TYPE = "application/cbor";
+
+/** Deepest nesting of arrays and maps DecodeCBOR accepts */
+static const int MAX_CBOR_DEPTH = 512;
+
+/**
+ * Binary encoding of RPC requests and replies (CBOR, RFC 7049).
+ *
+ * The mapping is chosen so that nothing is lost on the way:
+ * - integers become CBOR integers, and decimals without an exponent (amounts)
+ *   become exact decimal fractions (tag 4). Other numbers become doubles.
+ * - hex data (hashes, raw blocks and transactions, scripts) becomes byte
+ *   strings tagged 23 ("expected base16"), so it travels as half as many
+ *   bytes and decodes back to the same hex string. Which strings are hex is
+ *   known from where they are: the value itself if fHex, the values of the
+ *   object keys that IsHexField lists, and the elements of arrays that are
+ *   hex. A string that would not come back unchanged, such as uppercase hex,
+ *   stays text, as do all other strings.
+ * - arrays, objects, booleans and null map to their CBOR counterparts.
+ */
+std::string EncodeCBOR(const UniValue& value, bool fHex = false);
+
+/** Whether the values of object key strKey are hex data in RPC results */
+bool IsHexField(const std::string& strKey);
+
+/** Whether the result of RPC method strMethod is hex data when it is a string or an array of strings */
+bool IsHexResult(const std::string& strMethod);
+
+/** Encode a JSON-RPC reply object to a request for strMethod, see IsHexResult */
+std::string EncodeCBORReply(const UniValue& reply, const std::string& strMethod);
+
+/** Encode the replies to a batch of JSON-RPC requests, which are in the same order */
+std::string EncodeCBORBatchReply(const UniValue& replies, const UniValue& requests);
+
+/**
+ * Decode a single CBOR item into valRet. Byte strings come back as lowercase
+ * hex strings, so RPC handlers see the same values as from a JSON request.
+ * Indefinite lengths, map keys that are not text, non-finite floats and
+ * trailing bytes are rejected.
+ */
+bool DecodeCBOR(const std::string& str, UniValue& valRet);
+
+#endif // BITCOIN_RPC_CBOR_H
@@ -75,12 +75,21 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockheader", 1 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
+    { "getaddressmempool", 0 },
+    { "getaddressutxos", 0 },
+    { "getaddresstxids", 0 },
+    { "getaddressbalance", 0 },
+    { "getspentinfo", 0 },
+    { "getstakerecords", 0 },
+    { "getstakerecords", 1 },
     { "createrawtransaction", 0 },
     { "createrawtransaction", 1 },
     { "createrawtransaction", 2 },
     { "signrawtransaction", 1 },
     { "signrawtransaction", 2 },
     { "sendrawtransaction", 1 },
+    { "sendrawpackage", 0 },
+    { "sendrawpackage", 1 },
     { "fundrawtransaction", 1 },
     { "gettxout", 1 },
     { "gettxout", 2 },
@@ -105,6 +114,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "setban", 3 },
     { "getmempoolancestors", 1 },
     { "getmempooldescendants", 1 },
+    { "getmempoolfeehistogram", 0 },
     { "reservebalance", 0},
     { "reservebalance", 1},
     { "burn", 0 },
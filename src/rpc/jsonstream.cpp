@@ -0,0 +1,92 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonstream.h"
+
+#include <assert.h>
+
+JSONStreamWriter::JSONStreamWriter(const Sink& sinkIn, size_t nChunkSizeIn) :
+    sink(sinkIn), nChunkSize(nChunkSizeIn), fFirst(true), fAfterKey(false), fStarted(false)
+{
+}
+
+void JSONStreamWriter::Separate()
+{
+    if (fAfterKey)
+        fAfterKey = false;
+    else if (!fFirst)
+        strBuffer += ',';
+    fFirst = false;
+}
+
+void JSONStreamWriter::MaybeFlush()
+{
+    if (strBuffer.size() < nChunkSize)
+        return;
+    sink(strBuffer);
+    strBuffer.clear();
+    fStarted = true;
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separate();
+    strBuffer += '{';
+    strClose += '}';
+    fFirst = true;
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separate();
+    strBuffer += '[';
+    strClose += ']';
+    fFirst = true;
+}
+
+void JSONStreamWriter::End()
+{
+    assert(!strClose.empty() && !fAfterKey);
+    strBuffer += strClose[strClose.size() - 1];
+    strClose.erase(strClose.size() - 1);
+    fFirst = false;
+    MaybeFlush();
+}
+
+void JSONStreamWriter::Key(const std::string& strKey)
+{
+    assert(!strClose.empty() && strClose[strClose.size() - 1] == '}' && !fAfterKey);
+    Separate();
+    strBuffer += UniValue(strKey).write();
+    strBuffer += ':';
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& value)
+{
+    Separate();
+    strBuffer += value.write();
+    MaybeFlush();
+}
+
+void JSONStreamWriter::Field(const std::string& strKey, const UniValue& value)
+{
+    Key(strKey);
+    Value(value);
+}
+
+void JSONStreamWriter::Fields(const UniValue& obj)
+{
+    const std::vector<std::string>& vKeys = obj.getKeys();
+    const std::vector<UniValue>& vValues = obj.getValues();
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+        Field(vKeys[i], vValues[i]);
+}
+
+std::string JSONStreamWriter::TakeBuffer()
+{
+    std::string strRet;
+    strRet.swap(strBuffer);
+    return strRet;
+}
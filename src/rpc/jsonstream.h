@@ -0,0 +1,66 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONSTREAM_H
+#define BITCOIN_RPC_JSONSTREAM_H
+
+#include <functional>
+#include <string>
+
+#include <univalue.h>
+
+/** Default number of bytes a JSONStreamWriter collects before handing them to its sink */
+static const size_t DEFAULT_JSON_STREAM_CHUNK = 64 * 1024;
+
+/**
+ * Incremental JSON encoder.
+ *
+ * Large replies are written a value at a time, instead of being built as one
+ * UniValue tree and then encoded as one string. Output collects in a buffer
+ * that is handed to the sink each time it grows past nChunkSize, so only about
+ * one chunk is held at once. Small parts of the document, like a single
+ * transaction, can still be built as a UniValue and written with Value.
+ *
+ * Nothing reaches the sink before the first chunk fills up. Until then
+ * (Started() is false) the caller can still throw the output away and reply
+ * with an error instead.
+ */
+class JSONStreamWriter
+{
+public:
+    typedef std::function<void(const std::string&)> Sink;
+
+    JSONStreamWriter(const Sink& sinkIn, size_t nChunkSizeIn = DEFAULT_JSON_STREAM_CHUNK);
+
+    void BeginObject();
+    void BeginArray();
+    /** Close the innermost open object or array */
+    void End();
+    /** Write the key of the next value of the open object */
+    void Key(const std::string& strKey);
+    void Value(const UniValue& value);
+    void Field(const std::string& strKey, const UniValue& value);
+    /** Write all key/value pairs of obj into the open object */
+    void Fields(const UniValue& obj);
+
+    /** Whether any output has been handed to the sink */
+    bool Started() const { return fStarted; }
+
+    /** Take the output not handed to the sink yet */
+    std::string TakeBuffer();
+
+private:
+    Sink sink;
+    size_t nChunkSize;
+    std::string strBuffer;
+    std::string strClose; //!< closing brackets of the open objects and arrays, innermost last
+    bool fFirst;          //!< nothing written into the innermost open object or array yet
+    bool fAfterKey;
+    bool fStarted;
+
+    void Separate();
+    void MaybeFlush();
+};
+
+#endif // BITCOIN_RPC_JSONSTREAM_H
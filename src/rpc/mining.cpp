@@ -3,6 +3,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "base58.h"
 #include "amount.h"
 #include "chain.h"
@@ -19,6 +20,7 @@
 #include "pow.h"
 #include "pos.h"
 #include "rpc/server.h"
+#include "stakeindex.h"
 #include "txmempool.h"
 #include "timedata.h"
 #include "util.h"
@@ -137,7 +139,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
         }
         CValidationState state;
         uint256 hash = pblock->GetHash();
-        if (!ProcessNewBlock(state, Params(), NULL, pblock, true, NULL, false))
+        if (!ProcessNewBlock(state, Params(), NULL, pblock, true, NULL, false, &hash))
             throw JSONRPCError(RPC_INTERNAL_ERROR, "ProcessNewBlock, block not accepted");
         ++nHeight;
         blockHashes.push_back(hash.GetHex());
@@ -260,20 +262,33 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+// Seconds until a weight of nWeight is expected to find a kernel; 0 if it never will
+static uint64_t ExpectedStakeTime(uint64_t nNetworkWeight, uint64_t nWeight)
+{
+    return nWeight > 0 ? 1.0455 * 64 * nNetworkWeight / nWeight : 0;
+}
+
 UniValue getstakinginfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "getstakinginfo\n"
-            "Returns an object containing staking-related information.");
+            "Returns an object containing staking-related information.\n"
+            "\"stakeoutputs\" describes the wallet's staking outputs: their count, how many are\n"
+            "below the combine and above the split threshold, the -staketargetoutputs policy and,\n"
+            "while staking, the expected time in seconds until the largest, median and smallest\n"
+            "output stakes.");
 
     uint64_t nWeight = 0;
-    if (pwalletMain)
+    CStakeOutputStats stats;
+    if (pwalletMain) {
         nWeight = pwalletMain->GetStakeWeight();
+        stats = pwalletMain->GetStakeOutputStats();
+    }
 
     uint64_t nNetworkWeight = 1.1429 * GetPoSKernelPS();
     bool staking = nLastCoinStakeSearchInterval && nWeight;
-    uint64_t nExpectedTime = staking ? 1.0455 * 64 * nNetworkWeight / nWeight : 0;
+    uint64_t nExpectedTime = staking ? ExpectedStakeTime(nNetworkWeight, nWeight) : 0;
 
     UniValue obj(UniValue::VOBJ);
 
@@ -293,6 +308,21 @@ UniValue getstakinginfo(const UniValue& params, bool fHelp)
 
     obj.push_back(Pair("expectedtime", nExpectedTime));
 
+    // How the weight is spread: the time until one given output stakes
+    UniValue outputs(UniValue::VOBJ);
+    outputs.push_back(Pair("count", (uint64_t)stats.nOutputs));
+    outputs.push_back(Pair("small", (uint64_t)stats.nSmall));
+    outputs.push_back(Pair("large", (uint64_t)stats.nLarge));
+    outputs.push_back(Pair("target", (uint64_t)CWallet::stakePolicy.nTargetOutputs));
+    outputs.push_back(Pair("targetvalue", ValueFromAmount(CWallet::stakePolicy.GetTargetOutputValue(stats.nTotal))));
+    outputs.push_back(Pair("rebalance", CWallet::stakePolicy.fRebalance));
+    if (staking && stats.nOutputs > 0) {
+        outputs.push_back(Pair("expectedtimemin", ExpectedStakeTime(nNetworkWeight, stats.nMax)));
+        outputs.push_back(Pair("expectedtimemedian", ExpectedStakeTime(nNetworkWeight, stats.nMedian)));
+        outputs.push_back(Pair("expectedtimemax", ExpectedStakeTime(nNetworkWeight, stats.nMin)));
+    }
+    obj.push_back(Pair("stakeoutputs", outputs));
+
     return obj;
 }
 
@@ -581,7 +611,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             pblocktemplate = NULL;
         }
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, 0, false);
+        pblocktemplate = CreateNewBlockTemplate(Params(), scriptDummy, 0, false);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -775,7 +805,7 @@ UniValue submitblock(const UniValue& params, bool fHelp)
     CValidationState state;
     submitblock_StateCatcher sc(hash);
     RegisterValidationInterface(&sc);
-    bool fAccepted = ProcessNewBlock(state, Params(), NULL, &block, true, NULL, false);
+    bool fAccepted = ProcessNewBlock(state, Params(), NULL, &block, true, NULL, false, &hash);
     UnregisterValidationInterface(&sc);
     if (fBlockPresent)
     {
@@ -897,7 +927,7 @@ UniValue checkkernel(const UniValue& params, bool fHelp)
             pwalletMain->TopUpKeyPool();
 
         CReserveKey pMiningKey(pwalletMain);
-        std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(pMiningKey.reserveScript, &nFees, true));
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockTemplate(Params(), pMiningKey.reserveScript, &nFees, true));
         if (!pblocktemplate.get())
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Couldn't create new block");
 
@@ -919,6 +949,79 @@ UniValue checkkernel(const UniValue& params, bool fHelp)
         return result;
 }
 
+UniValue getstakerecords(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getstakerecords start ( end )\n"
+            "\nReturns what the proof-of-stake blocks of the active chain from height start to end staked.\n"
+            "Proof-of-work blocks in the range are left out. Requires -stakeindex.\n"
+            "\nArguments:\n"
+            "1. start       (numeric, required) The height of the first block\n"
+            "2. end         (numeric, optional, default=start) The height of the last block\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"height\" : n,             (numeric) The block height\n"
+            "    \"hash\" : \"hash\",          (string) The block hash\n"
+            "    \"modifier\" : \"hex\",       (string) The stake modifier of the block\n"
+            "    \"kernel\" : {              (json object) The output staked\n"
+            "      \"txid\" : \"id\",          (string) The transaction id\n"
+            "      \"vout\" : n              (numeric) The output number\n"
+            "    },\n"
+            "    \"proofhash\" : \"hash\",     (string) The proof-of-stake hash of the kernel\n"
+            "    \"stakevalue\" : x.xxx,     (numeric) The value of the kernel\n"
+            "    \"address\" : \"address\"     (string, optional) The address the kernel paid to\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getstakerecords", "1000 1100")
+            + HelpExampleRpc("getstakerecords", "1000, 1100")
+        );
+
+    if (!fStakeIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Stake index not enabled, restart with -stakeindex and -reindex-chainstate");
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM)(UniValue::VNUM));
+
+    int nStart = params[0].get_int();
+    int nEnd = params.size() > 1 ? params[1].get_int() : nStart;
+
+    // Block index entries are never freed, so the records can be read without holding cs_main
+    std::vector<const CBlockIndex*> vBlocks;
+    {
+        LOCK(cs_main);
+        if (nStart < 0 || nEnd < nStart || nEnd > chainActive.Height())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        vBlocks.reserve(nEnd - nStart + 1);
+        for (int nHeight = nStart; nHeight <= nEnd; nHeight++)
+            vBlocks.push_back(chainActive[nHeight]);
+    }
+
+    UniValue result(UniValue::VARR);
+    BOOST_FOREACH(const CBlockIndex* pindex, vBlocks) {
+        CStakeRecord record;
+        if (!GetStakeRecord(pindex, record))
+            continue;
+
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("height", pindex->nHeight));
+        entry.push_back(Pair("hash", pindex->GetBlockHash().GetHex()));
+        entry.push_back(Pair("modifier", pindex->nStakeModifier.GetHex()));
+        UniValue kernel(UniValue::VOBJ);
+        kernel.push_back(Pair("txid", record.prevoutKernel.hash.GetHex()));
+        kernel.push_back(Pair("vout", (int64_t)record.prevoutKernel.n));
+        entry.push_back(Pair("kernel", kernel));
+        entry.push_back(Pair("proofhash", record.hashProofOfStake.GetHex()));
+        entry.push_back(Pair("stakevalue", ValueFromAmount(record.nStakeValue)));
+        if (record.nStakerType != ADDRESS_INDEX_NONE)
+            entry.push_back(Pair("address", EncodeDestination(GetAddressIndexDestination(record.nStakerType, record.hashStaker))));
+        result.push_back(entry);
+    }
+    return result;
+}
+
 UniValue estimatepriority(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -966,6 +1069,8 @@ UniValue estimatesmartfee(const UniValue& params, bool fHelp)
             "A negative value is returned if not enough transactions and blocks\n"
             "have been observed to make an estimate for any number of blocks.\n"
             "However it will not return a value below the mempool reject fee.\n"
+            "With -feeestimatemode=horizon the estimate is also never below the fee rate needed\n"
+            "to outbid the current mempool within nblocks, and nblocks can be up to 48.\n"
             "\nExample:\n"
             + HelpExampleCli("estimatesmartfee", "6")
             );
@@ -1028,6 +1133,7 @@ static const CRPCCommand commands[] =
     { "mining",             "submitblock",            &submitblock,            true  },
     { "mining",             "checkkernel",            &checkkernel,            true  },
     { "mining",             "getstakinginfo",         &getstakinginfo,         true  },
+    { "mining",             "getstakerecords",        &getstakerecords,        true  },
 
     { "generating",         "generate",               &generate,               true  },
     { "generating",         "generatetoaddress",      &generatetoaddress,      true  },
@@ -3,6 +3,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "base58.h"
 #include "clientversion.h"
 #include "dstencode.h"
@@ -436,6 +437,288 @@ UniValue signmessagewithprivkey(const UniValue& params, bool fHelp)
     return EncodeBase64(&vchSig[0], vchSig.size());
 }
 
+/** Parse the addresses of the address index calls: one address, or an object with an "addresses" array */
+static std::vector<std::pair<int, uint160> > ParseAddressIndexAddresses(const UniValue& param)
+{
+    std::vector<UniValue> vValues;
+    if (param.isStr()) {
+        vValues.push_back(param);
+    } else if (param.isObject()) {
+        const UniValue& addresses = find_value(param.get_obj(), "addresses");
+        if (!addresses.isArray())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Addresses is expected to be an array");
+        vValues = addresses.getValues();
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an address or an object with addresses");
+    }
+
+    std::vector<std::pair<int, uint160> > vAddresses;
+    BOOST_FOREACH(const UniValue& value, vValues) {
+        if (!value.isStr())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Address is expected to be a string");
+        uint160 hash;
+        int nType = GetAddressIndexType(DecodeDestination(value.get_str()), hash);
+        if (nType == ADDRESS_INDEX_NONE)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + value.get_str());
+        if (std::find(vAddresses.begin(), vAddresses.end(), std::make_pair(nType, hash)) == vAddresses.end())
+            vAddresses.push_back(std::make_pair(nType, hash));
+    }
+    return vAddresses;
+}
+
+static std::string EncodeAddressIndexAddress(int nType, const uint160& hash)
+{
+    return EncodeDestination(GetAddressIndexDestination(nType, hash));
+}
+
+struct CompareAddressUnspentHeight
+{
+    bool operator()(const std::pair<CAddressUnspentKey, CAddressUnspentValue>& a, const std::pair<CAddressUnspentKey, CAddressUnspentValue>& b) const
+    {
+        return a.second.nHeight < b.second.nHeight;
+    }
+};
+
+struct CompareAddressMempoolTime
+{
+    bool operator()(const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& a, const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& b) const
+    {
+        return a.second.nTime < b.second.nTime;
+    }
+};
+
+UniValue getaddressmempool(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressmempool addresses\n"
+            "\nReturns the mempool transactions paying to or spending from the given addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. addresses          (string or object, required) An address, or an object with the addresses\n"
+            "   {\n"
+            "     \"addresses\": [ \"address\", ... ]\n"
+            "   }\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"  (string) The address, legacy or cashaddr as set by -usecashaddr\n"
+            "    \"txid\"  (string) The transaction id\n"
+            "    \"index\"  (number) The output index, or input index if spending\n"
+            "    \"satoshis\"  (number) The amount in satoshis, negative if spending\n"
+            "    \"timestamp\"  (number) When the transaction entered the mempool\n"
+            "    \"prevtxid\"  (string) The previous transaction id, if spending\n"
+            "    \"prevout\"  (number) The previous output index, if spending\n"
+            "  }\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressmempool", "'{\"addresses\": [\"BC53sDtweXF9YFYKY1AkEbY2FBiNBrJpXX\"]}'")
+            + HelpExampleRpc("getaddressmempool", "{\"addresses\": [\"BC53sDtweXF9YFYKY1AkEbY2FBiNBrJpXX\"]}")
+        );
+
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addressindex and -reindex-chainstate");
+
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > vEntries;
+    mempool.getAddressIndex(ParseAddressIndexAddresses(params[0]), vEntries);
+    std::stable_sort(vEntries.begin(), vEntries.end(), CompareAddressMempoolTime());
+
+    UniValue result(UniValue::VARR);
+    for (std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it) {
+        UniValue delta(UniValue::VOBJ);
+        delta.push_back(Pair("address", EncodeAddressIndexAddress(it->first.nAddressType, it->first.hash)));
+        delta.push_back(Pair("txid", it->first.txhash.GetHex()));
+        delta.push_back(Pair("index", (int)it->first.nIndex));
+        delta.push_back(Pair("satoshis", it->second.nAmount));
+        delta.push_back(Pair("timestamp", it->second.nTime));
+        if (it->first.fSpending) {
+            delta.push_back(Pair("prevtxid", it->second.prevout.hash.GetHex()));
+            delta.push_back(Pair("prevout", (int)it->second.prevout.n));
+        }
+        result.push_back(delta);
+    }
+    return result;
+}
+
+UniValue getaddressutxos(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos addresses\n"
+            "\nReturns the unspent outputs of the given addresses in the best chain (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. addresses          (string or object, required) An address, or an object with the addresses\n"
+            "   {\n"
+            "     \"addresses\": [ \"address\", ... ]\n"
+            "   }\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"  (string) The address, legacy or cashaddr as set by -usecashaddr\n"
+            "    \"txid\"  (string) The transaction id\n"
+            "    \"outputIndex\"  (number) The output index\n"
+            "    \"script\"  (string) The script hex encoded\n"
+            "    \"satoshis\"  (number) The amount of the output in satoshis\n"
+            "    \"height\"  (number) The height of the block the output is in\n"
+            "  }\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"BC53sDtweXF9YFYKY1AkEbY2FBiNBrJpXX\"]}'")
+            + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"BC53sDtweXF9YFYKY1AkEbY2FBiNBrJpXX\"]}")
+        );
+
+    std::vector<std::pair<int, uint160> > vAddresses = ParseAddressIndexAddresses(params[0]);
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vEntries;
+    for (std::vector<std::pair<int, uint160> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        if (!GetAddressUnspent(it->first, it->second, vEntries))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+    std::stable_sort(vEntries.begin(), vEntries.end(), CompareAddressUnspentHeight());
+
+    UniValue result(UniValue::VARR);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it) {
+        UniValue output(UniValue::VOBJ);
+        output.push_back(Pair("address", EncodeAddressIndexAddress(it->first.nAddressType, it->first.hash)));
+        output.push_back(Pair("txid", it->first.txhash.GetHex()));
+        output.push_back(Pair("outputIndex", (int)it->first.nIndex));
+        output.push_back(Pair("script", HexStr(it->second.script.begin(), it->second.script.end())));
+        output.push_back(Pair("satoshis", it->second.nValue));
+        output.push_back(Pair("height", it->second.nHeight));
+        result.push_back(output);
+    }
+    return result;
+}
+
+UniValue getaddresstxids(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids addresses\n"
+            "\nReturns the ids of the transactions in the best chain paying to or spending from the given addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. addresses          (string or object, required) An address, or an object with the addresses and a range of heights\n"
+            "   {\n"
+            "     \"addresses\": [ \"address\", ... ],\n"
+            "     \"start\": n,    (number, optional) The first height to include\n"
+            "     \"end\": n       (number, optional) The last height to include\n"
+            "   }\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"transactionid\"  (string) The transaction id, in chain order\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"BC53sDtweXF9YFYKY1AkEbY2FBiNBrJpXX\"], \"start\": 1000}'")
+            + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"BC53sDtweXF9YFYKY1AkEbY2FBiNBrJpXX\"], \"start\": 1000}")
+        );
+
+    std::vector<std::pair<int, uint160> > vAddresses = ParseAddressIndexAddresses(params[0]);
+    int nStart = 0, nEnd = 0;
+    if (params[0].isObject()) {
+        const UniValue& start = find_value(params[0].get_obj(), "start");
+        const UniValue& end = find_value(params[0].get_obj(), "end");
+        if (!start.isNull())
+            nStart = start.get_int();
+        if (!end.isNull())
+            nEnd = end.get_int();
+        if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start or end height");
+    }
+
+    // Sorted by height and position in the block, as the index keys are
+    std::set<std::pair<std::pair<int, unsigned int>, uint256> > setTxids;
+    for (std::vector<std::pair<int, uint160> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vEntries;
+        if (!GetAddressIndex(it->first, it->second, vEntries, nStart, nEnd))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator eit = vEntries.begin(); eit != vEntries.end(); ++eit)
+            setTxids.insert(std::make_pair(std::make_pair(eit->first.nHeight, eit->first.nTxIndex), eit->first.txhash));
+    }
+
+    UniValue result(UniValue::VARR);
+    for (std::set<std::pair<std::pair<int, unsigned int>, uint256> >::const_iterator it = setTxids.begin(); it != setTxids.end(); ++it)
+        result.push_back(it->second.GetHex());
+    return result;
+}
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance addresses\n"
+            "\nReturns the balance of the given addresses in the best chain (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. addresses          (string or object, required) An address, or an object with the addresses\n"
+            "   {\n"
+            "     \"addresses\": [ \"address\", ... ]\n"
+            "   }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\"  (number) The current balance in satoshis\n"
+            "  \"received\"  (number) The total amount received in satoshis, including change\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"BC53sDtweXF9YFYKY1AkEbY2FBiNBrJpXX\"]}'")
+            + HelpExampleRpc("getaddressbalance", "{\"addresses\": [\"BC53sDtweXF9YFYKY1AkEbY2FBiNBrJpXX\"]}")
+        );
+
+    std::vector<std::pair<int, uint160> > vAddresses = ParseAddressIndexAddresses(params[0]);
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    for (std::vector<std::pair<int, uint160> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vEntries;
+        if (!GetAddressIndex(it->first, it->second, vEntries))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator eit = vEntries.begin(); eit != vEntries.end(); ++eit) {
+            nBalance += eit->second;
+            if (eit->second > 0)
+                nReceived += eit->second;
+        }
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("balance", nBalance));
+    result.push_back(Pair("received", nReceived));
+    return result;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !params[0].isObject())
+        throw runtime_error(
+            "getspentinfo {\"txid\": \"id\", \"index\": n}\n"
+            "\nReturns the input in the best chain that spent an output (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. {\n"
+            "     \"txid\": \"id\"  (string, required) The id of the transaction of the output\n"
+            "     \"index\": n    (number, required) The output index\n"
+            "   }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\"  (string) The id of the spending transaction\n"
+            "  \"index\"  (number) The spending input index\n"
+            "  \"height\"  (number) The height of the block the spending transaction is in\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'")
+            + HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}")
+        );
+
+    uint256 txid = ParseHashV(find_value(params[0].get_obj(), "txid"), "txid");
+    const UniValue& index = find_value(params[0].get_obj(), "index");
+    if (!index.isNum() || index.get_int() < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid index");
+
+    CSpentIndexValue value;
+    if (!GetSpentIndex(CSpentIndexKey(txid, index.get_int()), value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (int)value.nInput));
+    result.push_back(Pair("height", value.nHeight));
+    return result;
+}
+
 UniValue setmocktime(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -475,6 +758,13 @@ static const CRPCCommand commands[] =
     { "util",               "createmultisig",         &createmultisig,         true  },
     { "util",               "verifymessage",          &verifymessage,          true  },
     { "util",               "signmessagewithprivkey", &signmessagewithprivkey, true  },
+
+    /* Address index */
+    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true  },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        true  },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        true  },
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      true  },
+    { "addressindex",       "getspentinfo",           &getspentinfo,           true  },
     
     /* Not shown in help */
     { "hidden",             "setmocktime",            &setmocktime,            true  },
@@ -9,6 +9,7 @@
 #include "consensus/validation.h"
 #include "core_io.h"
 #include "dstencode.h"
+#include "index/txindex.h"
 #include "init.h"
 #include "keystore.h"
 #include "validation.h"
@@ -186,6 +187,9 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getrawtransaction", "\"mytxid\", 1")
         );
 
+    if (ptxindex)
+        ptxindex->BlockUntilSyncedToCurrentChain();
+
     LOCK(cs_main);
 
     uint256 hash = ParseHashV(params[0], "parameter 1");
@@ -246,6 +250,9 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
        oneTxid = hash;
     }
 
+    if (ptxindex)
+        ptxindex->BlockUntilSyncedToCurrentChain();
+
     LOCK(cs_main);
 
     CBlockIndex* pblockindex = NULL;
@@ -915,6 +922,63 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
     return hashTx.GetHex();
 }
 
+UniValue sendrawpackage(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "sendrawpackage [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits a transaction with its unconfirmed parents to local node and network.\n"
+            "The transactions are accepted or rejected together, and the fee checks apply to\n"
+            "their combined fee rate, so a child can pay for parents with too low a fee.\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The raw transactions (serialized, hex-encoded), parents first\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees, which apply to the package as a whole\n"
+            "\nResult:\n"
+            "\"hex\"             (string) The hash of the last transaction in hex\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawpackage", "\"[\\\"signedparenthex\\\",\\\"signedchildhex\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendrawpackage", "[\"signedparenthex\",\"signedchildhex\"]")
+        );
+
+    LOCK(cs_main);
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+
+    UniValue hexs = params[0].get_array();
+    if (hexs.empty() || hexs.size() > MAX_PACKAGE_COUNT)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Package must have between 1 and %u transactions", MAX_PACKAGE_COUNT));
+    vector<CTransaction> package;
+    for (unsigned int idx = 0; idx < hexs.size(); idx++) {
+        CTransaction tx;
+        if (!hexs[idx].isStr() || !DecodeHexTx(tx, hexs[idx].get_str()))
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed for transaction %u", idx));
+        package.push_back(tx);
+    }
+
+    CAmount nMaxRawTxFee = maxTxFee;
+    if (params.size() > 1 && params[1].get_bool())
+        nMaxRawTxFee = 0;
+
+    // push to local node and sync with wallets
+    CValidationState state;
+    bool fMissingInputs;
+    if (!AcceptPackageToMemoryPool(mempool, state, package, false, &fMissingInputs, nMaxRawTxFee)) {
+        if (state.IsInvalid()) {
+            if (state.GetRejectCode() != REJECT_ALREADY_KNOWN)
+                throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
+        } else {
+            if (fMissingInputs) {
+                throw JSONRPCError(RPC_TRANSACTION_ERROR, "Missing inputs");
+            }
+            throw JSONRPCError(RPC_TRANSACTION_ERROR, state.GetRejectReason());
+        }
+    }
+    BOOST_FOREACH(const CTransaction& tx, package)
+        RelayTransaction(tx);
+
+    return package.back().GetHash().GetHex();
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -923,6 +987,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
     { "rawtransactions",    "decodescript",           &decodescript,           true  },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
+    { "rawtransactions",    "sendrawpackage",         &sendrawpackage,         false },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
 	{ "rawtransactions",    "getnormalizedtxid",      &getnormalizedtxid,      true },
 
@@ -6,6 +6,7 @@
 #include "rpc/server.h"
 
 #include "base58.h"
+#include "rpc/jsonstream.h"
 #include "init.h"
 #include "random.h"
 #include "sync.h"
@@ -337,6 +338,15 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamCommand(const std::string& name, rpcstreamfn_type pfn)
+{
+    if (IsRPCRunning() || !mapCommands.count(name))
+        return false;
+
+    mapStreamCommands[name] = pfn;
+    return true;
+}
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
@@ -439,16 +449,16 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+UniValue JSONRPCExecBatch(const UniValue& vReq)
 {
     UniValue ret(UniValue::VARR);
     for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
         ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
 
-    return ret.write() + "\n";
+    return ret;
 }
 
-UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
+const CRPCCommand* CRPCTable::prepare(const std::string &strMethod) const
 {
     // Return immediately if in warmup
     {
@@ -463,6 +473,12 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
         throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
 
     g_rpcSignals.PreCommand(*pcmd);
+    return pcmd;
+}
+
+UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
+{
+    const CRPCCommand *pcmd = prepare(strMethod);
 
     try
     {
@@ -477,6 +493,29 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+void CRPCTable::executeStream(const std::string &strMethod, const UniValue &params, JSONStreamWriter& writer) const
+{
+    std::map<std::string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+    if (it == mapStreamCommands.end()) {
+        writer.Value(execute(strMethod, params));
+        return;
+    }
+
+    const CRPCCommand *pcmd = prepare(strMethod);
+
+    try
+    {
+        // Execute
+        it->second(params, writer);
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
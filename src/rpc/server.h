@@ -126,6 +126,11 @@ void RPCRunLater(const std::string& name, boost::function<void(void)> func, int6
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
 
+class JSONStreamWriter;
+
+/** Variant of a command that writes its result to writer instead of returning it */
+typedef void(*rpcstreamfn_type)(const UniValue& params, JSONStreamWriter& writer);
+
 class CRPCCommand
 {
 public:
@@ -142,6 +147,9 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
+
+    const CRPCCommand* prepare(const std::string &method) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -156,6 +164,14 @@ public:
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
 
+    /**
+     * Execute a method, writing its result to writer. Methods with a
+     * streaming variant write their result as they go; for the others the
+     * result of execute is written.
+     * @throws an exception (UniValue) when an error happens.
+     */
+    void executeStream(const std::string &method, const UniValue &params, JSONStreamWriter& writer) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
@@ -168,6 +184,13 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Adds a streaming variant to an appended command, for callers that can
+     * send the result on while it is produced.
+     * Returns false if RPC server is already running or the command is unknown.
+     */
+    bool appendStreamCommand(const std::string& name, rpcstreamfn_type pfn);
 };
 
 extern CRPCTable tableRPC;
@@ -195,7 +218,7 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+UniValue JSONRPCExecBatch(const UniValue& vReq);
 
 // Retrieves any serialization flags requested in command line argument
 int RPCSerializationFlags();
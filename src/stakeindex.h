@@ -0,0 +1,53 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_STAKEINDEX_H
+#define BITCOIN_STAKEINDEX_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/**
+ * What a proof-of-stake block staked (-stakeindex): the kernel output, the
+ * proof-of-stake hash it met the target with, its value and the address it
+ * paid to, as an address index type and hash (see addressindex.h). Recorded
+ * in ConnectBlock while the kernel is still in the coins view, so that none of
+ * it has to be worked out again from the block and the transaction it spends.
+ */
+struct CStakeRecord
+{
+    COutPoint prevoutKernel;
+    uint256 hashProofOfStake;
+    CAmount nStakeValue;
+    uint8_t nStakerType;
+    uint160 hashStaker;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(prevoutKernel);
+        READWRITE(hashProofOfStake);
+        READWRITE(VARINT(nStakeValue));
+        READWRITE(nStakerType);
+        READWRITE(hashStaker);
+    }
+
+    CStakeRecord() { SetNull(); }
+
+    void SetNull()
+    {
+        prevoutKernel.SetNull();
+        hashProofOfStake.SetNull();
+        nStakeValue = 0;
+        nStakerType = 0;
+        hashStaker.SetNull();
+    }
+
+    bool IsNull() const { return prevoutKernel.IsNull(); }
+};
+
+#endif // BITCOIN_STAKEINDEX_H
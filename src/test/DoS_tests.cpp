@@ -11,27 +11,19 @@
 #include <pow.h>
 #include <script/sign.h>
 #include <serialize.h>
+#include <txorphanage.h>
 #include <util.h>
+#include <utiltime.h>
 
 #include <test/test_bitcoin.h>
 
+#include <limits>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/test/unit_test.hpp>
 
-// Tests this internal-to-validation.cpp method:
-extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
-extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-struct COrphanTx {
-    CTransaction tx;
-    NodeId fromPeer;
-};
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
-
 CService ip(uint32_t i)
 {
     struct in_addr s;
@@ -104,13 +96,16 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     BOOST_CHECK(!CNode::IsBanned(addr));
 }
 
-CTransaction RandomOrphan()
+static const size_t nNoQuota = std::numeric_limits<size_t>::max() / 2;
+
+CTransaction RandomOrphan(const CTxOrphanage& orphanage, const std::vector<CTransaction>& vOrphans)
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    // Pick among the orphans still stored
+    while (true) {
+        const CTransaction& tx = vOrphans[GetRand(vOrphans.size())];
+        if (orphanage.HaveTx(tx.GetHash()))
+            return tx;
+    }
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -120,6 +115,9 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     CBasicKeyStore keystore;
     keystore.AddKey(key);
 
+    CTxOrphanage orphanage;
+    std::vector<CTransaction> vOrphans;
+
     // 50 orphan transactions:
     for (int i = 0; i < 50; i++)
     {
@@ -132,13 +130,14 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, i);
+        BOOST_CHECK(orphanage.AddTx(tx, i, nNoQuota));
+        vOrphans.push_back(tx);
     }
 
     // ... and 50 that depend on other orphans:
     for (int i = 0; i < 50; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(orphanage, vOrphans);
 
         CMutableTransaction tx;
         tx.vin.resize(1);
@@ -149,13 +148,14 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0, SIGHASH_ALL);
 
-        AddOrphanTx(tx, i);
+        orphanage.AddTx(tx, i, nNoQuota);
+        vOrphans.push_back(tx);
     }
 
     // This really-big orphan should be ignored:
     for (int i = 0; i < 10; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(orphanage, vOrphans);
 
         CMutableTransaction tx;
         tx.vout.resize(1);
@@ -173,25 +173,129 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(tx, i));
+        BOOST_CHECK(!orphanage.AddTx(tx, i, nNoQuota));
     }
 
-    // Test EraseOrphansFor:
+    // Test EraseForPeer:
     for (NodeId i = 0; i < 3; i++)
     {
-        size_t sizeBefore = mapOrphanTransactions.size();
-        EraseOrphansFor(i);
-        BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        size_t sizeBefore = orphanage.Size();
+        orphanage.EraseForPeer(i);
+        BOOST_CHECK(orphanage.Size() < sizeBefore);
+        BOOST_CHECK_EQUAL(orphanage.GetPeerSize(i), 0U);
+    }
+
+    // Test LimitOrphans() function:
+    orphanage.LimitOrphans(40);
+    BOOST_CHECK(orphanage.Size() <= 40);
+    orphanage.LimitOrphans(10);
+    BOOST_CHECK(orphanage.Size() <= 10);
+    orphanage.LimitOrphans(0);
+    BOOST_CHECK_EQUAL(orphanage.Size(), 0U);
+    for (NodeId i = 0; i < 50; i++)
+        BOOST_CHECK_EQUAL(orphanage.GetPeerSize(i), 0U);
+
+    // No parent index entries may be left behind
+    BOOST_FOREACH(const CTransaction& tx, vOrphans)
+        orphanage.AddChildrenToWorkSet(tx);
+    for (NodeId i = 0; i < 50; i++)
+        BOOST_CHECK(!orphanage.HaveTxToReconsider(i));
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanage)
+{
+    CTxOrphanage orphanage;
+    int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime);
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout.n = 0;
+    txParent.vin[0].prevout.hash = GetRandHash();
+    txParent.vout.resize(10);
+    for (unsigned int i = 0; i < txParent.vout.size(); i++)
+    {
+        txParent.vout[i].nValue = 1*CENT;
+        txParent.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+
+    // Ten children of the same parent, from peers 0 and 1
+    std::vector<CTransaction> vChildren;
+    for (unsigned int i = 0; i < 10; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = txParent.GetHash();
+        tx.vin[0].prevout.n = i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1*CENT;
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        vChildren.push_back(tx);
+    }
+    const size_t nTxSize = vChildren[0].GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+
+    // A peer cannot store more than its quota
+    for (unsigned int i = 0; i < 5; i++)
+        BOOST_CHECK(orphanage.AddTx(vChildren[i], 0, 3 * nTxSize) == (i < 3));
+    BOOST_CHECK_EQUAL(orphanage.Size(), 3U);
+    BOOST_CHECK_EQUAL(orphanage.GetPeerSize(0), 3 * nTxSize);
+    BOOST_CHECK(!orphanage.AddTx(vChildren[0], 1, nNoQuota));
+
+    // ... while other peers are unaffected by it
+    for (unsigned int i = 5; i < 10; i++)
+        BOOST_CHECK(orphanage.AddTx(vChildren[i], 1, 3 * nTxSize) == (i < 8));
+    BOOST_CHECK_EQUAL(orphanage.Size(), 6U);
+
+    // The parent arriving queues each child for the peer it came from
+    orphanage.AddChildrenToWorkSet(txParent);
+    BOOST_CHECK(orphanage.HaveTxToReconsider(0));
+    BOOST_CHECK(orphanage.HaveTxToReconsider(1));
+    BOOST_CHECK(!orphanage.HaveTxToReconsider(2));
+
+    CTransaction tx;
+    NodeId fromPeer;
+    std::set<uint256> setReconsidered;
+    while (orphanage.GetTxToReconsider(0, tx, fromPeer))
+    {
+        BOOST_CHECK_EQUAL(fromPeer, 0);
+        setReconsidered.insert(tx.GetHash());
     }
+    BOOST_CHECK_EQUAL(setReconsidered.size(), 3U);
+    BOOST_CHECK(!orphanage.HaveTxToReconsider(0));
+
+    // Orphans erased after being queued are skipped
+    orphanage.EraseTx(vChildren[5].GetHash());
+    orphanage.EraseTx(vChildren[6].GetHash());
+    BOOST_CHECK(orphanage.GetTxToReconsider(1, tx, fromPeer));
+    BOOST_CHECK(tx.GetHash() == vChildren[7].GetHash());
+    BOOST_CHECK(!orphanage.GetTxToReconsider(1, tx, fromPeer));
+
+    // A block spending one of the same outputs conflicts with that orphan
+    CMutableTransaction txConflict(vChildren[0]);
+    txConflict.vout[0].nValue = 2*CENT;
+    std::vector<CTransaction> vtx;
+    vtx.push_back(txConflict);
+    vtx.push_back(vChildren[1]);
+    orphanage.EraseForBlock(vtx);
+    BOOST_CHECK(!orphanage.HaveTx(vChildren[0].GetHash()));
+    BOOST_CHECK(!orphanage.HaveTx(vChildren[1].GetHash()));
+    BOOST_CHECK(orphanage.HaveTx(vChildren[2].GetHash()));
+    BOOST_CHECK_EQUAL(orphanage.GetPeerSize(0), nTxSize);
 
-    // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
-    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    // Orphans expire after ORPHAN_TX_EXPIRE_TIME
+    SetMockTime(nStartTime + 10);
+    BOOST_CHECK(orphanage.AddTx(vChildren[3], 2, nNoQuota));
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME - 1);
+    BOOST_CHECK_EQUAL(orphanage.LimitOrphans(100), 0U);
+    BOOST_CHECK_EQUAL(orphanage.Size(), 3U);
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME);
+    orphanage.LimitOrphans(100);
+    BOOST_CHECK_EQUAL(orphanage.Size(), 1U);
+    BOOST_CHECK(orphanage.HaveTx(vChildren[3].GetHash()));
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME + 10);
+    orphanage.LimitOrphans(100);
+    BOOST_CHECK_EQUAL(orphanage.Size(), 0U);
+    SetMockTime(0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
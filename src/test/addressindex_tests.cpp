@@ -0,0 +1,237 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "random.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(addressindex_destinations)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CKeyID keyID = key.GetPubKey().GetID();
+    const CScript redeemScript = GetScriptForDestination(keyID);
+
+    uint160 hash;
+    BOOST_CHECK_EQUAL(GetAddressIndexType(GetScriptForDestination(keyID), hash), ADDRESS_INDEX_KEYHASH);
+    BOOST_CHECK(hash == keyID);
+    // Pay to pubkey outputs belong to the address of the key
+    BOOST_CHECK_EQUAL(GetAddressIndexType(CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG, hash), ADDRESS_INDEX_KEYHASH);
+    BOOST_CHECK(hash == keyID);
+    BOOST_CHECK_EQUAL(GetAddressIndexType(GetScriptForDestination(CScriptID(redeemScript)), hash), ADDRESS_INDEX_SCRIPTHASH);
+    BOOST_CHECK(hash == CScriptID(redeemScript));
+    BOOST_CHECK(GetAddressIndexDestination(ADDRESS_INDEX_SCRIPTHASH, hash) == CTxDestination(CScriptID(redeemScript)));
+    BOOST_CHECK_EQUAL(GetAddressIndexType(CScript() << OP_RETURN, hash), ADDRESS_INDEX_NONE);
+    BOOST_CHECK(GetAddressIndexDestination(ADDRESS_INDEX_NONE, hash) == CTxDestination(CNoDestination()));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_database)
+{
+    const uint160 hashA = uint160(std::vector<unsigned char>(20, 0xaa));
+    const uint160 hashB = uint160(std::vector<unsigned char>(20, 0xab));
+    const uint256 txid1 = GetRandHash(), txid2 = GetRandHash(), txid3 = GetRandHash();
+
+    // Heights that sort differently little endian, and another address in between
+    CAddressIndexUpdate update;
+    update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_INDEX_KEYHASH, hashA, 256, 1, txid1, 0, false), 5 * COIN));
+    update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_INDEX_KEYHASH, hashA, 1, 2, txid2, 1, false), 2 * COIN));
+    update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_INDEX_KEYHASH, hashA, 300, 1, txid3, 0, true), -2 * COIN));
+    update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_INDEX_SCRIPTHASH, hashA, 2, 1, txid3, 0, false), 7 * COIN));
+    update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_INDEX_KEYHASH, hashB, 2, 1, txid3, 1, false), COIN));
+    update.vUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_INDEX_KEYHASH, hashA, txid1, 0), CAddressUnspentValue(5 * COIN, CScript() << OP_TRUE, 256)));
+    update.vUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_INDEX_KEYHASH, hashA, txid2, 1), CAddressUnspentValue(2 * COIN, CScript() << OP_TRUE, 1)));
+    update.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(txid2, 1), CSpentIndexValue(txid3, 0, 300, 2 * COIN, ADDRESS_INDEX_KEYHASH, hashA)));
+    BOOST_CHECK(pblocktree->UpdateAddressIndex(update));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vEntries;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRESS_INDEX_KEYHASH, hashA, vEntries));
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 3U);
+    BOOST_CHECK_EQUAL(vEntries[0].first.nHeight, 1);
+    BOOST_CHECK(vEntries[0].first.txhash == txid2);
+    BOOST_CHECK_EQUAL(vEntries[1].first.nHeight, 256);
+    BOOST_CHECK_EQUAL(vEntries[2].first.nHeight, 300);
+    BOOST_CHECK(vEntries[2].first.fSpending);
+    BOOST_CHECK_EQUAL(vEntries[0].second + vEntries[1].second + vEntries[2].second, 5 * COIN);
+
+    vEntries.clear();
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRESS_INDEX_KEYHASH, hashA, vEntries, 2, 299));
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 1U);
+    BOOST_CHECK(vEntries[0].first.txhash == txid1);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(ADDRESS_INDEX_KEYHASH, hashA, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 2U);
+    CSpentIndexValue spent;
+    BOOST_CHECK(pblocktree->ReadSpentIndex(CSpentIndexKey(txid2, 1), spent));
+    BOOST_CHECK(spent.txid == txid3);
+    BOOST_CHECK_EQUAL(spent.nHeight, 300);
+
+    // Undoing the spend at height 300, as disconnecting its block would
+    CAddressIndexUpdate undo;
+    undo.vAddressIndexErase.push_back(CAddressIndexKey(ADDRESS_INDEX_KEYHASH, hashA, 300, 1, txid3, 0, true));
+    undo.vUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_INDEX_KEYHASH, hashA, txid1, 0), CAddressUnspentValue()));
+    undo.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(txid2, 1), CSpentIndexValue()));
+    BOOST_CHECK(pblocktree->UpdateAddressIndex(undo));
+
+    vEntries.clear();
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRESS_INDEX_KEYHASH, hashA, vEntries));
+    BOOST_CHECK_EQUAL(vEntries.size(), 2U);
+    vUnspent.clear();
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(ADDRESS_INDEX_KEYHASH, hashA, vUnspent));
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txhash == txid2);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nHeight, 1);
+    BOOST_CHECK(!pblocktree->ReadSpentIndex(CSpentIndexKey(txid2, 1), spent));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_mempool)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptFrom = GetScriptForDestination(key.GetPubKey().GetID());
+    const CScript scriptTo = GetScriptForDestination(CScriptID(CScript() << OP_TRUE));
+
+    CMutableTransaction txPrev;
+    txPrev.vin.resize(1);
+    txPrev.vout.resize(1);
+    txPrev.vout[0].nValue = 10 * COIN;
+    txPrev.vout[0].scriptPubKey = scriptFrom;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 6 * COIN;
+    tx.vout[0].scriptPubKey = scriptTo;
+    tx.vout[1].nValue = 3 * COIN;
+    tx.vout[1].scriptPubKey = scriptFrom;
+
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    view.ModifyCoins(txPrev.GetHash())->FromTx(txPrev, 1);
+
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    pool.addUnchecked(tx.GetHash(), entry.Time(1234).FromTx(tx));
+    pool.addAddressIndex(entry.Time(1234).FromTx(tx), view);
+
+    uint160 hashFrom, hashTo;
+    std::vector<std::pair<int, uint160> > vAddresses;
+    vAddresses.push_back(std::make_pair(GetAddressIndexType(scriptFrom, hashFrom), hashFrom));
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > vResults;
+    pool.getAddressIndex(vAddresses, vResults);
+    BOOST_REQUIRE_EQUAL(vResults.size(), 2U);
+    CAmount nDelta = 0;
+    for (unsigned int i = 0; i < vResults.size(); i++) {
+        nDelta += vResults[i].second.nAmount;
+        BOOST_CHECK_EQUAL(vResults[i].second.nTime, 1234);
+        if (vResults[i].first.fSpending)
+            BOOST_CHECK(vResults[i].second.prevout == tx.vin[0].prevout);
+    }
+    BOOST_CHECK_EQUAL(nDelta, -7 * COIN);
+
+    vAddresses.push_back(std::make_pair(GetAddressIndexType(scriptTo, hashTo), hashTo));
+    vResults.clear();
+    pool.getAddressIndex(vAddresses, vResults);
+    BOOST_CHECK_EQUAL(vResults.size(), 3U);
+
+    // Leaving the mempool removes the entries
+    std::list<CTransaction> removed;
+    pool.removeRecursive(tx, removed);
+    vResults.clear();
+    pool.getAddressIndex(vAddresses, vResults);
+    BOOST_CHECK(vResults.empty());
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_connect_disconnect, TestChain100Setup)
+{
+    bool fAddressIndexOld = fAddressIndex;
+    fAddressIndex = true;
+
+    CKey key;
+    key.MakeNewKey(true);
+    const CKeyID keyID = key.GetPubKey().GetID();
+    const CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // Spend a mature coinbase to a new address
+    CMutableTransaction tx;
+    tx.nTime = coinbaseTxns[0].nTime;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = coinbaseTxns[0].vout[0].nValue - CENT;
+    tx.vout[0].scriptPubKey = GetScriptForDestination(keyID);
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(coinbaseKey.Sign(SignatureHash(scriptCoinbase, tx, 0, SIGHASH_ALL, 0), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(tx);
+    CBlock block = CreateAndProcessBlock(txns, scriptCoinbase);
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    const int nHeight = chainActive.Height();
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vEntries;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRESS_INDEX_KEYHASH, keyID, vEntries));
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 1U);
+    BOOST_CHECK(vEntries[0].first.txhash == tx.GetHash());
+    BOOST_CHECK_EQUAL(vEntries[0].first.nHeight, nHeight);
+    BOOST_CHECK_EQUAL(vEntries[0].second, tx.vout[0].nValue);
+
+    // The coinbase pays to a public key, indexed under its key hash
+    vEntries.clear();
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRESS_INDEX_KEYHASH, coinbaseKey.GetPubKey().GetID(), vEntries, nHeight, nHeight));
+    bool fSpendFound = false;
+    for (unsigned int i = 0; i < vEntries.size(); i++) {
+        if (vEntries[i].first.fSpending && vEntries[i].first.txhash == tx.GetHash()) {
+            fSpendFound = true;
+            BOOST_CHECK_EQUAL(vEntries[i].second, -coinbaseTxns[0].vout[0].nValue);
+        }
+    }
+    BOOST_CHECK(fSpendFound);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(ADDRESS_INDEX_KEYHASH, keyID, vUnspent));
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txhash == tx.GetHash());
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nValue, tx.vout[0].nValue);
+
+    CSpentIndexValue spent;
+    BOOST_CHECK(pblocktree->ReadSpentIndex(CSpentIndexKey(coinbaseTxns[0].GetHash(), 0), spent));
+    BOOST_CHECK(spent.txid == tx.GetHash());
+    BOOST_CHECK_EQUAL(spent.nHeight, nHeight);
+
+    // Disconnecting the block takes its entries out of all three indexes
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight - 1);
+
+    vEntries.clear();
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRESS_INDEX_KEYHASH, keyID, vEntries));
+    BOOST_CHECK(vEntries.empty());
+    vUnspent.clear();
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(ADDRESS_INDEX_KEYHASH, keyID, vUnspent));
+    BOOST_CHECK(vUnspent.empty());
+    BOOST_CHECK(!pblocktree->ReadSpentIndex(CSpentIndexKey(coinbaseTxns[0].GetHash(), 0), spent));
+
+    fAddressIndex = fAddressIndexOld;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,134 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "random.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockindex_snapshot_tests, TestingSetup)
+
+/** Headers-only chain of nLength entries on top of pindexFork. They exist only in memory, not in the block tree database. */
+static CBlockIndex* AddHeaders(CBlockIndex* pindexFork, int nLength)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = pindexFork;
+    for (int i = 0; i < nLength; i++) {
+        CBlockIndex* pindex = InsertBlockIndex(GetRandHash());
+        pindex->pprev = pindexPrev;
+        pindex->nHeight = pindexPrev->nHeight + 1;
+        pindex->nTime = pindexPrev->nTime + 60;
+        pindex->nBits = pindexPrev->nBits;
+        pindex->nStatus = BLOCK_VALID_TREE;
+        pindex->nStakeModifier = GetRandHash();
+        pindex->nChainWork = pindexPrev->nChainWork + GetBlockProof(*pindex);
+        pindex->BuildSkip();
+        pindexPrev = pindex;
+    }
+    return pindexPrev;
+}
+
+static void ReloadBlockIndex()
+{
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex());
+    BOOST_CHECK(InitBlockIndex(Params()));
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_roundtrip)
+{
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    CBlockIndex* pindexLong = AddHeaders(pindexGenesis, 700);
+    CBlockIndex* pindexShort = AddHeaders(pindexLong->GetAncestor(300), 50);
+
+    std::map<uint256, std::pair<uint256, uint256> > mapExpected;
+    BOOST_FOREACH(const BlockMap::value_type& entry, mapBlockIndex) {
+        const CBlockIndex* pindex = entry.second;
+        mapExpected[entry.first] = std::make_pair(ArithToUint256(pindex->nChainWork),
+                                                  pindex->pskip ? pindex->pskip->GetBlockHash() : uint256());
+    }
+    const uint256 hashBestHeader = pindexLong->GetBlockHash();
+    const uint256 hashShort = pindexShort->GetBlockHash();
+    const uint256 hashModifier = pindexShort->nStakeModifier;
+
+    FlushStateToDisk();
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    uint256 id;
+    BOOST_CHECK(pblocktree->ReadIndexSnapshotId(id));
+
+    // The headers are not in the database, so they can only come from the snapshot
+    ReloadBlockIndex();
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), mapExpected.size());
+    BOOST_FOREACH(const BlockMap::value_type& entry, mapBlockIndex) {
+        const CBlockIndex* pindex = entry.second;
+        BOOST_CHECK(mapExpected.count(entry.first));
+        BOOST_CHECK(ArithToUint256(pindex->nChainWork) == mapExpected[entry.first].first);
+        BOOST_CHECK((pindex->pskip ? pindex->pskip->GetBlockHash() : uint256()) == mapExpected[entry.first].second);
+        BOOST_CHECK(pindex->pprev || entry.first == Params().GetConsensus().hashGenesisBlock);
+    }
+    BOOST_CHECK(pindexBestHeader->GetBlockHash() == hashBestHeader);
+    BOOST_CHECK(mapBlockIndex[hashShort]->nStakeModifier == hashModifier);
+    BOOST_CHECK(mapBlockIndex[hashShort]->GetAncestor(300) == mapBlockIndex[hashBestHeader]->GetAncestor(300));
+    BOOST_CHECK(chainActive.Tip() == chainActive.Genesis());
+
+    // Writing the index to the database makes the snapshot stale
+    std::vector<const CBlockIndex*> vBlocks(1, chainActive.Genesis());
+    BOOST_CHECK(pblocktree->WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(), 0, vBlocks));
+    BOOST_CHECK(!pblocktree->ReadIndexSnapshotId(id));
+    ReloadBlockIndex();
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_blocks_stored)
+{
+    AddHeaders(chainActive.Genesis(), 20);
+    FlushStateToDisk();
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+
+    // A build without snapshot support storing a block keeps the id, but
+    // changes the block file info
+    CBlockFileInfo info;
+    BOOST_CHECK(pblocktree->ReadBlockFileInfo(0, info));
+    info.AddBlock(info.nHeightLast + 1, info.nTimeLast + 60);
+    info.nSize += 1000;
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles(1, std::make_pair(0, &info));
+    BOOST_CHECK(pblocktree->WriteBatchSync(vFiles, 0, std::vector<const CBlockIndex*>()));
+    uint256 id;
+    BOOST_CHECK(pblocktree->ReadIndexSnapshotId(id));
+
+    ReloadBlockIndex();
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 1U);
+    BOOST_CHECK(chainActive.Tip() == chainActive.Genesis());
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_corrupt)
+{
+    AddHeaders(chainActive.Genesis(), 20);
+    FlushStateToDisk();
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+
+    // Flip one byte in the middle of the snapshot
+    boost::filesystem::path path = GetDataDir() / "blocks" / "index.snapshot";
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_CHECK(fseek(file, boost::filesystem::file_size(path) / 2, SEEK_SET) == 0);
+    int ch = fgetc(file);
+    BOOST_CHECK(fseek(file, -1, SEEK_CUR) == 0);
+    fputc(ch ^ 0x01, file);
+    fclose(file);
+
+    // The checksum catches it and the database is used instead
+    ReloadBlockIndex();
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 1U);
+    BOOST_CHECK(chainActive.Tip() == chainActive.Genesis());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,204 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/cbor.h"
+#include "rpc/server.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+static std::string EncodeJSON(const std::string& strJSON, bool fHex = false)
+{
+    UniValue value;
+    BOOST_REQUIRE(value.read("[" + strJSON + "]"));
+    return HexStr(EncodeCBOR(value[0], fHex));
+}
+
+static std::string DecodeHex(const std::string& strHex)
+{
+    std::vector<unsigned char> vch = ParseHex(strHex);
+    UniValue value;
+    if (!DecodeCBOR(std::string(vch.begin(), vch.end()), value))
+        return "invalid";
+    UniValue wrapper(UniValue::VARR);
+    wrapper.push_back(value);
+    std::string str = wrapper.write();
+    return str.substr(1, str.size() - 2);
+}
+
+BOOST_FIXTURE_TEST_SUITE(cbor_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cbor_rfc7049_vectors)
+{
+    // Appendix A of RFC 7049, both ways where the mapping allows
+    static const char* vectors[][2] = {
+        {"0", "00"},
+        {"23", "17"},
+        {"24", "1818"},
+        {"100", "1864"},
+        {"1000", "1903e8"},
+        {"1000000", "1a000f4240"},
+        {"1000000000000", "1b000000e8d4a51000"},
+        {"18446744073709551615", "1bffffffffffffffff"},
+        {"-1", "20"},
+        {"-10", "29"},
+        {"-1000", "3903e7"},
+        {"-9223372036854775808", "3b7fffffffffffffff"},
+        {"273.15", "c48221196ab3"},
+        {"false", "f4"},
+        {"true", "f5"},
+        {"null", "f6"},
+        {"\"\"", "60"},
+        {"\"IETF\"", "6449455446"},
+        {"\"\xc3\xbc\"", "62c3bc"},
+        {"[]", "80"},
+        {"[1,[2,3],[4,5]]", "8301820203820405"},
+        {"{}", "a0"},
+        {"{\"a\":1,\"b\":[2,3]}", "a26161016162820203"},
+    };
+    for (unsigned int i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        BOOST_CHECK_EQUAL(EncodeJSON(vectors[i][0]), vectors[i][1]);
+        BOOST_CHECK_EQUAL(DecodeHex(vectors[i][1]), vectors[i][0]);
+    }
+
+    // Items only seen from other encoders
+    BOOST_CHECK_EQUAL(DecodeHex("4401020304"), "\"01020304\"");
+    BOOST_CHECK_EQUAL(DecodeHex("f7"), "null");
+    BOOST_CHECK_EQUAL(DecodeHex("f93c00"), "1");
+    BOOST_CHECK_EQUAL(DecodeHex("f97bff"), "65504");
+    BOOST_CHECK_EQUAL(DecodeHex("fa47c35000"), "100000");
+    BOOST_CHECK_EQUAL(DecodeHex("fb3ff199999999999a"), "1.1");
+    BOOST_CHECK_EQUAL(DecodeHex("c11a514b67b0"), "1363896240");
+    BOOST_CHECK_EQUAL(DecodeHex("c48221196ab3"), "273.15");
+    BOOST_CHECK_EQUAL(DecodeHex("c4820105"), "50");
+}
+
+BOOST_AUTO_TEST_CASE(cbor_amounts_and_hex)
+{
+    // Amounts keep every digit instead of going through a double
+    BOOST_CHECK_EQUAL(EncodeJSON("0.00000001"), "c4822701");
+    BOOST_CHECK_EQUAL(DecodeHex("c4822701"), "0.00000001");
+    static const CAmount amounts[] = {0, 1, COIN / 3, 21000000 * COIN, -COIN / 2};
+    for (unsigned int i = 0; i < sizeof(amounts) / sizeof(amounts[0]); i++) {
+        UniValue value = ValueFromAmount(amounts[i]);
+        UniValue decoded;
+        BOOST_CHECK(DecodeCBOR(EncodeCBOR(value), decoded));
+        BOOST_CHECK(decoded.isNum());
+        BOOST_CHECK_EQUAL(decoded.getValStr(), value.getValStr());
+        CAmount nAmount;
+        BOOST_CHECK(ParseFixedPoint(decoded.getValStr(), 8, &nAmount));
+        BOOST_CHECK_EQUAL(nAmount, amounts[i]);
+    }
+
+    // Numbers with an exponent become doubles
+    BOOST_CHECK_EQUAL(EncodeJSON("1e+300"), "fb7e37e43c8800759c");
+
+    // Hashes and raw data travel as tagged bytes and come back as the same hex
+    uint256 hash = uint256S("000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f");
+    std::string strEncoded = EncodeCBOR(UniValue(hash.GetHex()), true);
+    BOOST_CHECK_EQUAL(strEncoded.size(), 3U + 32U);
+    BOOST_CHECK_EQUAL(HexStr(strEncoded.substr(0, 3)), "d75820");
+    UniValue decoded;
+    BOOST_CHECK(DecodeCBOR(strEncoded, decoded));
+    BOOST_CHECK_EQUAL(decoded.get_str(), hash.GetHex());
+
+    // Only hex strings that would come back unchanged are sent as bytes
+    BOOST_CHECK_EQUAL(EncodeJSON("\"abc\"", true), "63616263");
+    BOOST_CHECK_EQUAL(EncodeJSON("\"ABCD\"", true), "6441424344");
+    BOOST_CHECK_EQUAL(EncodeJSON("\"00ff\"", true), "d74200ff");
+
+    // Strings that merely look like hex stay text
+    BOOST_CHECK_EQUAL(EncodeJSON("\"00ff\""), "6430306666");
+    BOOST_CHECK_EQUAL(EncodeJSON("{\"label\":\"cafe\",\"txid\":\"cafe\"}"), "a2656c6162656c64636166656474786964d742cafe");
+    BOOST_CHECK_EQUAL(EncodeJSON("{\"tx\":[\"cafe\"]}"), "a162747881d742cafe");
+}
+
+BOOST_AUTO_TEST_CASE(cbor_reply_results)
+{
+    // The bare result of a method is bytes only if that method returns hex
+    UniValue reply = JSONRPCReplyObj(UniValue("cafe"), NullUniValue, UniValue(1));
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBORReply(reply, "getrawtransaction")), "a366726573756c74d742cafe656572726f72f6626964" "01");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBORReply(reply, "getaccount")), "a366726573756c746463616665656572726f72f6626964" "01");
+
+    // Batches look up the method of every request
+    UniValue requests(UniValue::VARR), replies(UniValue::VARR);
+    UniValue request(UniValue::VOBJ);
+    request.push_back(Pair("method", "getaccount"));
+    requests.push_back(request);
+    request.setObject();
+    request.push_back(Pair("method", "getrawmempool"));
+    requests.push_back(request);
+    UniValue mempool(UniValue::VARR);
+    mempool.push_back("cafe");
+    replies.push_back(reply);
+    replies.push_back(JSONRPCReplyObj(mempool, NullUniValue, UniValue(2)));
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBORBatchReply(replies, requests)),
+                      "82" "a366726573756c746463616665656572726f72f6626964" "01"
+                      "a366726573756c7481d742cafe656572726f72f6626964" "02");
+    UniValue decoded;
+    BOOST_CHECK(DecodeCBOR(EncodeCBORBatchReply(replies, requests), decoded));
+    BOOST_CHECK_EQUAL(decoded.write(), replies.write());
+}
+
+BOOST_AUTO_TEST_CASE(cbor_roundtrip)
+{
+    UniValue request(UniValue::VOBJ);
+    request.push_back(Pair("jsonrpc", "1.0"));
+    request.push_back(Pair("id", 42));
+    request.push_back(Pair("method", "sendrawtransaction"));
+    UniValue params(UniValue::VARR);
+    params.push_back("0100000001deadbeef");
+    params.push_back(false);
+    UniValue options(UniValue::VOBJ);
+    options.push_back(Pair("feeRate", ValueFromAmount(12345)));
+    options.push_back(Pair("label", "a \"quoted\" label"));
+    options.push_back(Pair("nested", UniValue(UniValue::VARR)));
+    options.push_back(Pair("none", NullUniValue));
+    params.push_back(options);
+    request.push_back(Pair("params", params));
+
+    UniValue decoded;
+    BOOST_CHECK(DecodeCBOR(EncodeCBOR(request), decoded));
+    BOOST_CHECK_EQUAL(decoded.write(), request.write());
+}
+
+BOOST_AUTO_TEST_CASE(cbor_malformed)
+{
+    static const char* malformed[] = {
+        "",                   // nothing
+        "18",                 // argument missing
+        "1b0000",             // argument cut short
+        "5f4101ff",           // indefinite length
+        "6261",               // text cut short
+        "83010203ff",         // trailing byte
+        "0000",               // two items
+        "9bffffffffffffffff", // absurd array length
+        "a10102",             // integer map key
+        "3bffffffffffffffff", // below the int64 range
+        "f97c00",             // infinity
+        "fb7ff8000000000000", // NaN
+        "f820",               // unassigned simple value
+        "c48201",             // decimal fraction cut short
+        "c4826161 01",        // decimal fraction with text exponent
+        "c482186501",         // decimal exponent out of range
+        "ff",                 // stray break
+    };
+    for (unsigned int i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        std::string strHex = malformed[i];
+        strHex.erase(std::remove(strHex.begin(), strHex.end(), ' '), strHex.end());
+        BOOST_CHECK_MESSAGE(DecodeHex(strHex) == "invalid", strHex);
+    }
+
+    // Nesting is bounded
+    std::string strDeep(MAX_CBOR_DEPTH, '\x81');
+    UniValue value;
+    BOOST_CHECK(DecodeCBOR(strDeep + '\x00', value));
+    BOOST_CHECK(!DecodeCBOR('\x81' + strDeep + '\x00', value));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
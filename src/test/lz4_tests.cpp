@@ -0,0 +1,160 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "lz4.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+static bool RoundTrip(const std::vector<unsigned char>& vch)
+{
+    std::vector<unsigned char> vchCompressed;
+    if (!LZ4Compress(vch.data(), vch.size(), vchCompressed))
+        return false;
+    BOOST_CHECK(vchCompressed.size() < vch.size());
+    std::vector<unsigned char> vchOut(vch.size());
+    BOOST_CHECK(LZ4Decompress(vchCompressed.data(), vchCompressed.size(), vchOut.data(), vchOut.size()));
+    BOOST_CHECK(vchOut == vch);
+    return true;
+}
+
+BOOST_FIXTURE_TEST_SUITE(lz4_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(lz4_decompress_reference)
+{
+    // "abc" ten times: three literals, a 22 byte match at offset 3, five last literals
+    std::vector<unsigned char> vchIn = ParseHex("3f616263030003506263616263");
+    std::string strExpected;
+    for (int i = 0; i < 10; i++)
+        strExpected += "abc";
+    std::vector<unsigned char> vchOut(strExpected.size());
+    BOOST_CHECK(LZ4Decompress(vchIn.data(), vchIn.size(), vchOut.data(), vchOut.size()));
+    BOOST_CHECK_EQUAL(std::string(vchOut.begin(), vchOut.end()), strExpected);
+
+    // The output size has to be exact
+    std::vector<unsigned char> vchShort(strExpected.size() - 1), vchLong(strExpected.size() + 1);
+    BOOST_CHECK(!LZ4Decompress(vchIn.data(), vchIn.size(), vchShort.data(), vchShort.size()));
+    BOOST_CHECK(!LZ4Decompress(vchIn.data(), vchIn.size(), vchLong.data(), vchLong.size()));
+
+    static const char* malformed[] = {
+        "3f616263",                   // match offset missing
+        "3f616263000003506263616263", // zero offset
+        "3f616263040003506263616263", // offset before the start
+        "3f61626303",                 // offset cut short
+        "f0ff",                       // literal length cut short
+        "40616263",                   // literals cut short
+    };
+    for (unsigned int i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        std::vector<unsigned char> vch = ParseHex(malformed[i]);
+        BOOST_CHECK_MESSAGE(!LZ4Decompress(vch.data(), vch.size(), vchOut.data(), vchOut.size()), malformed[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lz4_roundtrip)
+{
+    FastRandomContext rand(true);
+
+    // Repetitive data, with long literal runs and long matches
+    std::vector<unsigned char> vch;
+    for (int i = 0; i < 100000; i++)
+        vch.push_back(i % 1000 < 300 ? rand.rand32() : i % 7);
+    BOOST_CHECK(RoundTrip(vch));
+
+    // Matches of every length up to well past the token limit
+    for (int nLength = 4; nLength < 300; nLength += 13) {
+        std::vector<unsigned char> vchPart(nLength);
+        for (int i = 0; i < nLength; i++)
+            vchPart[i] = rand.rand32();
+        std::vector<unsigned char> vchTwice(vchPart);
+        vchTwice.insert(vchTwice.end(), vchPart.begin(), vchPart.end());
+        vchTwice.resize(vchTwice.size() + 16, 0);
+        BOOST_CHECK(RoundTrip(vchTwice));
+    }
+
+    // Random data does not get smaller, and neither does nothing at all
+    std::vector<unsigned char> vchRandom(10000), vchCompressed;
+    for (unsigned int i = 0; i < vchRandom.size(); i++)
+        vchRandom[i] = rand.rand32();
+    BOOST_CHECK(!LZ4Compress(vchRandom.data(), vchRandom.size(), vchCompressed));
+    BOOST_CHECK(!LZ4Compress(NULL, 0, vchCompressed));
+}
+
+BOOST_AUTO_TEST_CASE(lz4_block_files)
+{
+    CBlock block(Params().GenesisBlock());
+    for (int i = 0; i < 50; i++)
+        block.vtx.push_back(block.vtx[0]);
+    CMutableTransaction txLast(block.vtx.back());
+    txLast.nLockTime = 1;
+    block.vtx.back() = txLast;
+
+    // Uncompressed and compressed blocks side by side in one file
+    CDiskBlockPos posRaw(9, 0), posCompressed;
+    BOOST_CHECK(WriteBlockToDisk(CDiskRecord(block), posRaw, Params().MessageStart()));
+    CBlock blockFirst;
+    BOOST_CHECK(ReadBlockFromDisk(blockFirst, posRaw, Params().GetConsensus()));
+    BOOST_CHECK(blockFirst.GetHash() == block.GetHash());
+    fBlockCompression = true;
+    CDiskRecord record(block);
+    fBlockCompression = DEFAULT_BLOCK_COMPRESSION;
+    BOOST_CHECK(record.nSize & DISK_RECORD_COMPRESSED);
+    BOOST_CHECK(record.vchData.size() < ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) / 2);
+    posCompressed = CDiskBlockPos(9, posRaw.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION));
+    BOOST_CHECK(WriteBlockToDisk(record, posCompressed, Params().MessageStart()));
+
+    // The file has grown since it was first read, and is mapped again
+    for (int i = 0; i < 2; i++) {
+        CBlock blockRead;
+        BOOST_CHECK(ReadBlockFromDisk(blockRead, i == 0 ? posRaw : posCompressed, Params().GetConsensus()));
+        BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+        BOOST_CHECK_EQUAL(blockRead.vtx.size(), block.vtx.size());
+        BOOST_CHECK(blockRead.vtx.back().GetHash() == block.vtx.back().GetHash());
+    }
+
+    // Transaction index lookups find the transaction inside the compressed block
+    CDiskTxPos postx(posCompressed, GetSizeOfCompactSize(block.vtx.size()));
+    for (unsigned int i = 0; i < block.vtx.size() - 1; i++)
+        postx.nTxOffset += ::GetSerializeSize(block.vtx[i], SER_DISK, CLIENT_VERSION);
+    const uint256 hashTx = block.vtx.back().GetHash();
+    BOOST_CHECK(pblocktree->WriteTxIndex(std::vector<std::pair<uint256, CDiskTxPos> >(1, std::make_pair(hashTx, postx))));
+    const bool fTxIndexOld = fTxIndex;
+    fTxIndex = true;
+    CTransaction tx;
+    uint256 hashBlock;
+    BOOST_CHECK(GetTransaction(hashTx, tx, Params().GetConsensus(), hashBlock));
+    fTxIndex = fTxIndexOld;
+    BOOST_CHECK(tx.GetHash() == hashTx);
+    BOOST_CHECK(hashBlock == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(lz4_block_files_after_unload)
+{
+    CBlock block(Params().GenesisBlock());
+    for (int i = 0; i < 50; i++)
+        block.vtx.push_back(block.vtx[0]);
+    CDiskBlockPos pos(9, 0);
+    BOOST_CHECK(WriteBlockToDisk(CDiskRecord(block), pos, Params().MessageStart()));
+    CBlock blockRead;
+    BOOST_CHECK(ReadBlockFromDisk(blockRead, pos, Params().GetConsensus()));
+    BOOST_CHECK_EQUAL(blockRead.vtx.size(), block.vtx.size());
+
+    // The block files of the next chainstate may have the same numbers, but
+    // different contents, so the mapping of the old file must not be used
+    UnloadBlockIndex();
+    boost::filesystem::remove(GetBlockPosFilename(CDiskBlockPos(9, 0), "scho"));
+    CDiskBlockPos posGenesis(9, 0);
+    BOOST_CHECK(WriteBlockToDisk(CDiskRecord(Params().GenesisBlock()), posGenesis, Params().MessageStart()));
+    BOOST_CHECK(posGenesis == pos);
+    BOOST_CHECK(ReadBlockFromDisk(blockRead, posGenesis, Params().GetConsensus()));
+    BOOST_CHECK_EQUAL(blockRead.vtx.size(), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
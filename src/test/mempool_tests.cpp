@@ -2,8 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "consensus/validation.h"
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
+#include "validation.h"
 
 #include "test/test_bitcoin.h"
 
@@ -528,23 +531,26 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(tx6.GetHash(), entry.Fee(1100LL).FromTx(tx6, &pool));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
-    // we only require this remove, at max, 2 txn, because its not clear what we're really optimizing for aside from that
+    // the cluster linearizes into the chunks [tx4] and [tx6, tx5, tx7]; eviction
+    // takes the whole tail chunk, since tx7 pays for both of its parents
     pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
     BOOST_CHECK(pool.exists(tx4.GetHash()));
-    BOOST_CHECK(pool.exists(tx6.GetHash()));
+    BOOST_CHECK(!pool.exists(tx5.GetHash()));
+    BOOST_CHECK(!pool.exists(tx6.GetHash()));
     BOOST_CHECK(!pool.exists(tx7.GetHash()));
 
-    if (!pool.exists(tx5.GetHash()))
-        pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5, &pool));
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5, &pool));
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(1100LL).FromTx(tx6, &pool));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/7
+    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // keeps the high fee rate head chunk
     BOOST_CHECK(pool.exists(tx4.GetHash()));
     BOOST_CHECK(!pool.exists(tx5.GetHash()));
-    BOOST_CHECK(pool.exists(tx6.GetHash()));
+    BOOST_CHECK(!pool.exists(tx6.GetHash()));
     BOOST_CHECK(!pool.exists(tx7.GetHash()));
 
     pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5, &pool));
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(1100LL).FromTx(tx6, &pool));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
     std::vector<CTransaction> vtx;
@@ -577,4 +583,468 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolClusterTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A low fee parent with a high fee child is one chunk
+    CMutableTransaction txParent = CMutableTransaction();
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_1;
+    txParent.vout.resize(2);
+    txParent.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    txParent.vout[1] = txParent.vout[0];
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_1;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    txChild.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(50000LL).FromTx(txChild));
+
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 1U);
+    const CTxMemPool::TxCluster* cluster = pool.GetClusters().begin()->second;
+    BOOST_CHECK_EQUAL(cluster->vTxs.size(), 2U);
+    BOOST_CHECK(cluster->vTxs[0]->GetTx().GetHash() == txParent.GetHash());
+    BOOST_CHECK_EQUAL(cluster->vChunks.size(), 1U);
+    BOOST_CHECK_EQUAL(cluster->vChunks[0].nModFees, 51000);
+
+    // A second, lower fee child of the same parent ends the cluster in its own chunk
+    CMutableTransaction txLow = CMutableTransaction();
+    txLow.vin.resize(1);
+    txLow.vin[0].prevout = COutPoint(txParent.GetHash(), 1);
+    txLow.vin[0].scriptSig = CScript() << OP_1;
+    txLow.vout.resize(1);
+    txLow.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    txLow.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txLow.GetHash(), entry.Fee(100LL).FromTx(txLow));
+
+    // An unrelated transaction is a cluster of its own
+    CMutableTransaction txOther = CMutableTransaction();
+    txOther.vin.resize(1);
+    txOther.vin[0].scriptSig = CScript() << OP_2;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    txOther.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(10000LL).FromTx(txOther));
+
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 2U);
+    cluster = pool.GetClusters().begin()->second; // lowest tail fee rate first
+    BOOST_CHECK_EQUAL(cluster->vTxs.size(), 3U);
+    BOOST_CHECK_EQUAL(cluster->vChunks.size(), 2U);
+    BOOST_CHECK(cluster->vTxs[2]->GetTx().GetHash() == txLow.GetHash());
+
+    CTxMemPool::setEntries setAncestors;
+    setAncestors.insert(pool.mapTx.find(txChild.GetHash()));
+    setAncestors.insert(pool.mapTx.find(txOther.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetClusterCountWith(setAncestors), 5U);
+
+    // Eviction takes the worst tail chunk, leaving the parent and its better child
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(txLow.GetHash()));
+    BOOST_CHECK(pool.exists(txParent.GetHash()));
+    BOOST_CHECK(pool.exists(txChild.GetHash()));
+    BOOST_CHECK(pool.exists(txOther.GetHash()));
+
+    // Confirming the parent splits nothing off but removes it from its cluster
+    std::vector<CTransaction> vtx;
+    vtx.push_back(txParent);
+    std::list<CTransaction> dummy;
+    pool.removeForBlock(vtx, 1, dummy, false);
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 2U);
+    for (CTxMemPool::clusterSet::const_iterator it = pool.GetClusters().begin(); it != pool.GetClusters().end(); ++it)
+        BOOST_CHECK_EQUAL(it->second->vTxs.size(), 1U);
+
+    pool.removeRecursive(txChild, dummy);
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 1U);
+
+    // The parent coming back from a disconnected block joins both children
+    // into one cluster; past the cluster limit its tail chunk is evicted
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(50000LL).FromTx(txChild));
+    pool.addUnchecked(txLow.GetHash(), entry.Fee(100LL).FromTx(txLow));
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 4U);
+    pool.UpdateTransactionsFromBlock(std::vector<uint256>(1, txParent.GetHash()), 2);
+    BOOST_CHECK(pool.exists(txParent.GetHash()));
+    BOOST_CHECK(pool.exists(txChild.GetHash()));
+    BOOST_CHECK(!pool.exists(txLow.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 2U);
+    cluster = pool.GetClusters().rbegin()->second;
+    BOOST_CHECK_EQUAL(cluster->vTxs.size(), 2U);
+    BOOST_CHECK_EQUAL(cluster->vChunks.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterCheckTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    pool.setSanityCheck(1.0);
+    TestMemPoolEntryHelper entry;
+    CCoinsViewCache view(pcoinsTip);
+
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFund.vout.resize(1);
+    txFund.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txFund.vout[0].nValue = 10 * COIN;
+    view.ModifyCoins(txFund.GetHash())->FromTx(txFund, 0);
+
+    // A chain of five transactions is one cluster
+    std::vector<CMutableTransaction> vChain(5);
+    uint256 hashPrev = txFund.GetHash();
+    CAmount nValue = txFund.vout[0].nValue;
+    for (unsigned int i = 0; i < vChain.size(); i++) {
+        const CAmount nFee = 1000 * (i + 1);
+        nValue -= nFee;
+        vChain[i].vin.resize(1);
+        vChain[i].vin[0].prevout = COutPoint(hashPrev, 0);
+        vChain[i].vout.resize(1);
+        vChain[i].vout[0].scriptPubKey = CScript() << OP_TRUE;
+        vChain[i].vout[0].nValue = nValue;
+        pool.addUnchecked(vChain[i].GetHash(), entry.Fee(nFee).FromTx(vChain[i]));
+        hashPrev = vChain[i].GetHash();
+    }
+    BOOST_CHECK_EQUAL(pool.GetClusters().size(), 1U);
+    BOOST_CHECK_EQUAL(pool.GetClusters().begin()->second->vTxs.size(), 5U);
+
+    // The consistency checks count the memory of the clusters
+    pool.check(&view);
+
+    std::list<CTransaction> removed;
+    pool.removeRecursive(vChain[3], removed);
+    BOOST_CHECK_EQUAL(removed.size(), 2U);
+    pool.check(&view);
+    pool.clear();
+    pool.check(&view);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPackageTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A chain of three, added out of order
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    tx1.vout[1] = tx1.vout[0];
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(2);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_3;
+    tx3.vin[1].prevout = COutPoint(tx1.GetHash(), 1);
+    tx3.vin[1].scriptSig = CScript() << OP_3;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+
+    pool.addUnchecked(tx1.GetHash(), entry.FromTx(tx1, &pool));
+    pool.addUnchecked(tx2.GetHash(), entry.FromTx(tx2, &pool));
+    pool.addUnchecked(tx3.GetHash(), entry.FromTx(tx3, &pool));
+
+    std::vector<CTransaction> vtx;
+    BOOST_CHECK(pool.GetPackage(tx3.GetHash(), MAX_PACKAGE_COUNT, vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 3U);
+    BOOST_CHECK(vtx[0].GetHash() == tx1.GetHash());
+    BOOST_CHECK(vtx[1].GetHash() == tx2.GetHash());
+    BOOST_CHECK(vtx[2].GetHash() == tx3.GetHash());
+    BOOST_CHECK(pool.GetPackage(tx2.GetHash(), MAX_PACKAGE_COUNT, vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK(!pool.GetPackage(tx3.GetHash(), 2, vtx));
+    BOOST_CHECK(!pool.GetPackage(uint256(), MAX_PACKAGE_COUNT, vtx));
+
+    // Packages have to be sorted and be a child with its ancestors
+    CTxMemPool poolEmpty(CFeeRate(0));
+    LOCK(cs_main);
+    std::vector<CTransaction> package;
+    package.push_back(tx2);
+    package.push_back(tx1);
+    CValidationState state;
+    BOOST_CHECK(!AcceptPackageToMemoryPool(poolEmpty, state, package, false, NULL));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-package-order");
+
+    package.clear();
+    package.push_back(tx1);
+    package.push_back(tx1);
+    state = CValidationState();
+    BOOST_CHECK(!AcceptPackageToMemoryPool(poolEmpty, state, package, false, NULL));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-package-duplicate");
+
+    CMutableTransaction txOther = CMutableTransaction();
+    txOther.vin.resize(1);
+    txOther.vin[0].prevout = COutPoint(tx3.GetHash(), 0);
+    txOther.vin[0].scriptSig = CScript() << OP_4;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    txOther.vout[0].nValue = 10 * COIN;
+    package.clear();
+    package.push_back(tx1);
+    package.push_back(txOther);
+    state = CValidationState();
+    BOOST_CHECK(!AcceptPackageToMemoryPool(poolEmpty, state, package, false, NULL));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-package-unrelated");
+}
+
+BOOST_AUTO_TEST_CASE(PackageFeePolicyTest)
+{
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFund.vout.resize(1);
+    txFund.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txFund.vout[0].nValue = 10 * COIN;
+
+    // A parent without fee, and a child that pays for it
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txParent.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txChild.vout[0].nValue = 5 * COIN;
+
+    std::vector<CTransaction> package;
+    package.push_back(txParent);
+    package.push_back(txChild);
+
+    CTxMemPool pool(CFeeRate(0));
+    LOCK(cs_main);
+    // Fund the package in a cache layered on the chainstate, dropped at the end
+    CCoinsViewCache* pcoinsTipOld = pcoinsTip;
+    CCoinsViewCache coins(pcoinsTipOld);
+    pcoinsTip = &coins;
+    pcoinsTip->ModifyCoins(txFund.GetHash())->FromTx(txFund, 0);
+    bool fRequireStandardOld = fRequireStandard;
+    fRequireStandard = false;
+    CFeeRate minRelayTxFeeOld = minRelayTxFee;
+    minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
+
+    // The parent alone does not pay the min relay fee
+    CValidationState state;
+    BOOST_CHECK(!AcceptToMemoryPool(pool, state, txParent, true, NULL));
+    BOOST_CHECK_EQUAL(state.GetRejectCode(), REJECT_INSUFFICIENTFEE);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+
+    // The absurd fee limit applies to the fee of the package as a whole
+    state = CValidationState();
+    BOOST_CHECK(!AcceptPackageToMemoryPool(pool, state, package, true, NULL, COIN));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "absurdly-high-fee");
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+
+    // The child pays for both
+    state = CValidationState();
+    BOOST_CHECK(AcceptPackageToMemoryPool(pool, state, package, true, NULL, 0));
+    BOOST_CHECK(pool.exists(txParent.GetHash()));
+    BOOST_CHECK(pool.exists(txChild.GetHash()));
+
+    minRelayTxFee = minRelayTxFeeOld;
+    fRequireStandard = fRequireStandardOld;
+    pcoinsTip = pcoinsTipOld;
+}
+
+BOOST_AUTO_TEST_CASE(DisconnectedBlockTransactionsTest)
+{
+    // Two blocks, the second spending from the first
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_3;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+
+    std::vector<CTransaction> vtxBlock1;
+    vtxBlock1.push_back(tx1);
+    vtxBlock1.push_back(tx2);
+    std::vector<CTransaction> vtxBlock2;
+    vtxBlock2.push_back(tx3);
+
+    // Disconnected tip first, read back to front in topological order
+    DisconnectedBlockTransactions disconnectpool;
+    disconnectpool.addForBlock(vtxBlock2);
+    disconnectpool.addForBlock(vtxBlock1);
+    BOOST_CHECK_EQUAL(disconnectpool.queuedTx.size(), 3U);
+    std::vector<uint256> vOrder;
+    DisconnectedBlockTransactions::indexed_disconnected_transactions::index<insertion_order>::type::reverse_iterator it;
+    for (it = disconnectpool.queuedTx.get<insertion_order>().rbegin(); it != disconnectpool.queuedTx.get<insertion_order>().rend(); ++it)
+        vOrder.push_back(it->GetHash());
+    BOOST_CHECK(vOrder[0] == tx1.GetHash());
+    BOOST_CHECK(vOrder[1] == tx2.GetHash());
+    BOOST_CHECK(vOrder[2] == tx3.GetHash());
+
+    // A new block confirming tx2 again takes it out of the queue
+    size_t nUsage = disconnectpool.DynamicMemoryUsage();
+    std::vector<CTransaction> vtxNew;
+    vtxNew.push_back(tx2);
+    disconnectpool.removeForBlock(vtxNew);
+    BOOST_CHECK_EQUAL(disconnectpool.queuedTx.size(), 2U);
+    BOOST_CHECK(disconnectpool.queuedTx.get<1>().count(tx2.GetHash()) == 0);
+    BOOST_CHECK(disconnectpool.DynamicMemoryUsage() < nUsage);
+
+    // The oldest entry belongs to the most recently disconnected block
+    disconnectpool.removeOldest();
+    BOOST_CHECK_EQUAL(disconnectpool.queuedTx.size(), 1U);
+    BOOST_CHECK(disconnectpool.queuedTx.front().GetHash() == tx1.GetHash());
+
+    disconnectpool.clear();
+    BOOST_CHECK_EQUAL(disconnectpool.DynamicMemoryUsage(), 0U);
+}
+
+/** The histogram range holding nFeePerK */
+static const CFeeRateHistogram::Bucket& FindFeeBucket(const std::vector<CFeeRateHistogram::Bucket>& vBuckets, CAmount nFeePerK)
+{
+    size_t i = 0;
+    while (i + 1 < vBuckets.size() && vBuckets[i + 1].nFeeRateFrom <= nFeePerK)
+        i++;
+    return vBuckets[i];
+}
+
+static int64_t CountFeeBuckets(const std::vector<CFeeRateHistogram::Bucket>& vBuckets)
+{
+    int64_t nCount = 0;
+    BOOST_FOREACH(const CFeeRateHistogram::Bucket& bucket, vBuckets)
+        nCount += bucket.nCount;
+    return nCount;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolFeeHistogramTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    std::vector<CFeeRateHistogram::Bucket> vFeeRate, vAncestorFeeRate;
+    std::vector<CFeeRateHistogram::Bucket> vFeeRateDelta, vAncestorFeeRateDelta;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    const int64_t tx1Size = ::GetSerializeSize(tx1, SER_NETWORK, PROTOCOL_VERSION);
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    const int64_t tx2Size = ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000).FromTx(tx1, &pool));
+    bool fDelta = false;
+    const uint64_t nSequence1 = pool.GetFeeHistograms(fDelta, 0, vFeeRate, vAncestorFeeRate);
+    const CAmount tx1FeePerK = CFeeRate(1000, tx1Size).GetFeePerK();
+    BOOST_CHECK_EQUAL(FindFeeBucket(vFeeRate, tx1FeePerK).nCount, 1);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vFeeRate, tx1FeePerK).nSize, tx1Size);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vFeeRate, tx1FeePerK).nFees, 1000);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vAncestorFeeRate, tx1FeePerK).nCount, 1);
+
+    // A child paying a lot more is counted at its own rate, and at the
+    // combined rate with its parent
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(100000).FromTx(tx2, &pool));
+    const CAmount tx2FeePerK = CFeeRate(100000, tx2Size).GetFeePerK();
+    const CAmount tx2AncestorFeePerK = CFeeRate(101000, tx1Size + tx2Size).GetFeePerK();
+    fDelta = false;
+    const uint64_t nSequence2 = pool.GetFeeHistograms(fDelta, 0, vFeeRate, vAncestorFeeRate);
+    BOOST_CHECK(nSequence2 > nSequence1);
+    BOOST_CHECK(FindFeeBucket(vFeeRate, tx2FeePerK).nFeeRateFrom != FindFeeBucket(vFeeRate, tx2AncestorFeePerK).nFeeRateFrom);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vFeeRate, tx2FeePerK).nCount, 1);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vAncestorFeeRate, tx2AncestorFeePerK).nCount, 1);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vAncestorFeeRate, tx2AncestorFeePerK).nFees, 100000);
+    BOOST_CHECK_EQUAL(CountFeeBuckets(vFeeRate), 2);
+    BOOST_CHECK_EQUAL(CountFeeBuckets(vAncestorFeeRate), 2);
+
+    // The delta holds just the ranges the child went into
+    fDelta = true;
+    BOOST_CHECK_EQUAL(pool.GetFeeHistograms(fDelta, nSequence1, vFeeRateDelta, vAncestorFeeRateDelta), nSequence2);
+    BOOST_CHECK(fDelta);
+    BOOST_CHECK_EQUAL(vFeeRateDelta.size(), 1U);
+    BOOST_CHECK_EQUAL(vFeeRateDelta[0].nFeeRateFrom, FindFeeBucket(vFeeRate, tx2FeePerK).nFeeRateFrom);
+    BOOST_CHECK_EQUAL(vFeeRateDelta[0].nCount, 1);
+    BOOST_CHECK_EQUAL(vFeeRateDelta[0].nSize, tx2Size);
+    BOOST_CHECK_EQUAL(vAncestorFeeRateDelta.size(), 1U);
+    BOOST_CHECK_EQUAL(vAncestorFeeRateDelta[0].nFeeRateFrom, FindFeeBucket(vFeeRate, tx2AncestorFeePerK).nFeeRateFrom);
+    fDelta = true;
+    pool.GetFeeHistograms(fDelta, nSequence2, vFeeRateDelta, vAncestorFeeRateDelta);
+    BOOST_CHECK(fDelta);
+    BOOST_CHECK(vFeeRateDelta.empty() && vAncestorFeeRateDelta.empty());
+
+    // Prioritising the parent moves it, and the changes cancel out in the
+    // range it left
+    pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0, 100000);
+    fDelta = true;
+    pool.GetFeeHistograms(fDelta, nSequence2, vFeeRateDelta, vAncestorFeeRateDelta);
+    BOOST_CHECK(fDelta);
+    BOOST_CHECK_EQUAL(vFeeRateDelta.size(), 2U);
+    BOOST_CHECK_EQUAL(CountFeeBuckets(vFeeRateDelta), 0);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vFeeRateDelta, tx1FeePerK).nCount, -1);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vFeeRateDelta, tx1FeePerK).nFees, -1000);
+    pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0, -100000);
+
+    // Once the parent is mined the child's ancestor rate is its own
+    std::vector<CTransaction> vtxBlock;
+    vtxBlock.push_back(tx1);
+    std::list<CTransaction> dummyConflicted;
+    pool.removeForBlock(vtxBlock, 1, dummyConflicted);
+    fDelta = false;
+    const uint64_t nSequence3 = pool.GetFeeHistograms(fDelta, 0, vFeeRate, vAncestorFeeRate);
+    BOOST_CHECK_EQUAL(CountFeeBuckets(vFeeRate), 1);
+    BOOST_CHECK_EQUAL(CountFeeBuckets(vAncestorFeeRate), 1);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vFeeRate, tx2FeePerK).nCount, 1);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vAncestorFeeRate, tx2FeePerK).nCount, 1);
+    BOOST_CHECK_EQUAL(FindFeeBucket(vAncestorFeeRate, tx2FeePerK).nSize, tx2Size);
+
+    // Sequence numbers from the future, or from before the pool was
+    // cleared, get the full histograms
+    fDelta = true;
+    pool.GetFeeHistograms(fDelta, nSequence3 + 1, vFeeRate, vAncestorFeeRate);
+    BOOST_CHECK(!fDelta);
+    BOOST_CHECK_EQUAL(CountFeeBuckets(vFeeRate), 1);
+    pool.clear();
+    fDelta = true;
+    BOOST_CHECK(pool.GetFeeHistograms(fDelta, nSequence3, vFeeRate, vAncestorFeeRate) > nSequence3);
+    BOOST_CHECK(!fDelta);
+    BOOST_CHECK_EQUAL(CountFeeBuckets(vFeeRate), 0);
+    BOOST_CHECK_EQUAL(CountFeeBuckets(vAncestorFeeRate), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include "miner.h"
 #include "pubkey.h"
 #include "script/standard.h"
+#include "timedata.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
@@ -18,6 +19,8 @@
 
 #include "test/test_bitcoin.h"
 
+#include <memory>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
@@ -501,4 +504,83 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(blocktemplate_cache)
+{
+    const CChainParams& chainparams = Params(CBaseChainParams::MAIN);
+    TestMemPoolEntryHelper entry;
+    CScript scriptPubKey;
+    int64_t nFees;
+
+    LOCK(cs_main);
+    mempool.clear();
+    CBlockTemplateCache cache(chainparams);
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate(cache.CreateNewBlock(scriptPubKey, &nFees, true));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(nFees, 0);
+
+    // A transaction without mempool parents is appended to the cached selection
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout.hash = GetRandHash();
+    txParent.vin[0].prevout.n = 0;
+    txParent.vout.resize(1);
+    txParent.vout[0].nValue = COIN;
+    mempool.addUnchecked(txParent.GetHash(), entry.Fee(100000).Time(GetTime()).FromTx(txParent));
+
+    pblocktemplate.reset(cache.CreateNewBlock(scriptPubKey, &nFees, true));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+    BOOST_CHECK_EQUAL(nFees, 100000);
+
+    // So is a child of a selected transaction
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].nValue = COIN - 200000;
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(200000).Time(GetTime()).FromTx(txChild));
+
+    pblocktemplate.reset(cache.CreateNewBlock(scriptPubKey, &nFees, true));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(nFees, 300000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -300000);
+
+    // A transaction from the future is left out of a proof-of-stake block
+    CMutableTransaction txFuture;
+    txFuture.nTime = GetAdjustedTime() + 3600;
+    txFuture.vin.resize(1);
+    txFuture.vin[0].prevout.hash = GetRandHash();
+    txFuture.vin[0].prevout.n = 0;
+    txFuture.vout.resize(1);
+    txFuture.vout[0].nValue = COIN;
+    mempool.addUnchecked(txFuture.GetHash(), entry.Fee(100000).Time(GetTime()).FromTx(txFuture));
+
+    pblocktemplate.reset(cache.CreateNewBlock(scriptPubKey, &nFees, true));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK_EQUAL(nFees, 300000);
+    std::list<CTransaction> removed;
+    mempool.removeRecursive(txFuture, removed);
+
+    // Removing a selected transaction makes the next request rebuild
+    removed.clear();
+    mempool.removeRecursive(txParent, removed);
+    BOOST_CHECK_EQUAL(removed.size(), 2U);
+
+    pblocktemplate.reset(cache.CreateNewBlock(scriptPubKey, &nFees, true));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(nFees, 0);
+
+    // A proof-of-work template handed out later carries its own coinbase time
+    pblocktemplate.reset(cache.CreateNewBlock(scriptPubKey, &nFees, false));
+    SetMockTime(GetTime() + 60);
+    pblocktemplate.reset(cache.CreateNewBlock(scriptPubKey, &nFees, false));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].nTime, pblocktemplate->block.nTime);
+    SetMockTime(0);
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
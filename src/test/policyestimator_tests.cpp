@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "policy/fees.h"
+#include "policy/policy.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
@@ -221,4 +222,108 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_AUTO_TEST_CASE(HorizonPolicyEstimates)
+{
+    CTxMemPool mpool(CFeeRate(1000));
+    mpool.setFeeEstimateMode(FEE_ESTIMATE_HORIZON);
+    TestMemPoolEntryHelper entry;
+    CAmount basefee(2000);
+    CAmount deltaFee(100);
+    std::list<CTransaction> dummyConflicted;
+
+    CScript garbage;
+    for (unsigned int i = 0; i < 128; i++)
+        garbage.push_back('X');
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = garbage;
+    tx.vout.resize(1);
+    tx.vout[0].nValue=0LL;
+    CFeeRate baseRate(basefee, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+
+    // No estimate before any block has been seen
+    int answerFound;
+    BOOST_CHECK(mpool.estimateSmartFee(1, &answerFound) == CFeeRate(0));
+
+    // Blocks confirming the 5 highest of 10 fee rates right away, and
+    // leaving the others for later
+    std::vector<CTransaction> block;
+    std::vector<uint256> txLow;
+    int blocknum = 0;
+    while (blocknum < 20) {
+        for (int j = 0; j < 10; j++) {
+            for (int k = 0; k < 4; k++) {
+                tx.vin[0].prevout.n = 10000*blocknum+100*j+k;
+                uint256 hash = tx.GetHash();
+                mpool.addUnchecked(hash, entry.Fee(basefee * (j+1)).Time(GetTime()).Height(blocknum).FromTx(tx, &mpool));
+                if (j >= 5)
+                    block.push_back(*mpool.get(hash));
+                else
+                    txLow.push_back(hash);
+            }
+        }
+        if (blocknum % 10 == 9) {
+            for (unsigned int i = 0; i < txLow.size(); i++)
+                block.push_back(*mpool.get(txLow[i]));
+            txLow.clear();
+        }
+        mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+        block.clear();
+    }
+
+    // The short horizon has enough data after 20 blocks, while the classic
+    // estimator with its single long horizon still has none
+    BOOST_CHECK(mpool.estimateFee(2) == CFeeRate(0));
+    for (int i = 1; i <= 2; i++) {
+        CFeeRate feeRate = mpool.estimateSmartFee(i, &answerFound);
+        BOOST_CHECK_EQUAL(answerFound, i);
+        BOOST_CHECK(feeRate.GetFeePerK() > 6*baseRate.GetFeePerK() - deltaFee);
+        BOOST_CHECK(feeRate.GetFeePerK() < 10*baseRate.GetFeePerK() + deltaFee);
+    }
+
+    // A mempool backlog larger than a block at 20*baseRate has to be outbid
+    // for the next block, but not over two
+    CScript big;
+    for (unsigned int i = 0; i < 20000; i++)
+        big.push_back('X');
+    tx.vin[0].scriptSig = big;
+    CAmount bigFee = 20 * baseRate.GetFee(::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    for (unsigned int k = 0; k < DEFAULT_BLOCK_MAX_SIZE / 20000 + 1; k++) {
+        tx.vin[0].prevout.n = 1000000 + k;
+        mpool.addUnchecked(tx.GetHash(), entry.Fee(bigFee).Time(GetTime()).Height(blocknum).FromTx(tx, &mpool));
+    }
+    CFeeRate feeRate1 = mpool.estimateSmartFee(1, &answerFound);
+    CFeeRate feeRate2 = mpool.estimateSmartFee(2, &answerFound);
+    BOOST_CHECK(feeRate1.GetFeePerK() > 20*baseRate.GetFeePerK() - deltaFee);
+    BOOST_CHECK(feeRate2.GetFeePerK() < feeRate1.GetFeePerK());
+
+    // Mining the backlog takes it out of the estimate again
+    block.clear();
+    for (CTxMemPool::txiter it = mpool.mapTx.begin(); it != mpool.mapTx.end(); it++)
+        block.push_back(it->GetTx());
+    mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+    BOOST_CHECK(mpool.estimateSmartFee(1, &answerFound) < feeRate1);
+    BOOST_CHECK_EQUAL(mpool.size(), 0U);
+
+    // Transactions at 10*baseRate waiting past the target count against
+    // that fee rate, and so do they once evicted unconfirmed; only the
+    // backlog's fee rate is still safe
+    BOOST_CHECK(mpool.estimateSmartFee(1, &answerFound).GetFeePerK() < 10*baseRate.GetFeePerK() + deltaFee);
+    tx.vin[0].scriptSig = garbage;
+    std::vector<CTransaction> vStuck;
+    for (int k = 0; k < 40; k++) {
+        tx.vin[0].prevout.n = 2000000 + k;
+        mpool.addUnchecked(tx.GetHash(), entry.Fee(basefee * 10).Time(GetTime()).Height(blocknum).FromTx(tx, &mpool));
+        vStuck.push_back(tx);
+    }
+    block.clear();
+    for (int i = 0; i < 3; i++)
+        mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+    BOOST_CHECK(mpool.estimateSmartFee(1, &answerFound).GetFeePerK() > 10*baseRate.GetFeePerK() + deltaFee);
+    for (unsigned int i = 0; i < vStuck.size(); i++)
+        mpool.removeRecursive(vStuck[i], dummyConflicted);
+    BOOST_CHECK_EQUAL(mpool.size(), 0U);
+    BOOST_CHECK(mpool.estimateSmartFee(1, &answerFound).GetFeePerK() > 10*baseRate.GetFeePerK() + deltaFee);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
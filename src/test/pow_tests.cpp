@@ -4,9 +4,11 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "consensus/validation.h"
 #include "pow.h"
 #include "random.h"
 #include "util.h"
+#include "validation.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
@@ -95,4 +97,29 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(pow_hash_of_old_headers)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const CBlock& genesis = Params().GenesisBlock();
+    CBlockHeader header = genesis.GetBlockHeader();
+    BOOST_CHECK(header.nVersion <= 6);
+    BOOST_CHECK(header.GetHash() == Params().GetConsensus().hashGenesisBlock);
+    BOOST_CHECK(header.GetPoWHash() == header.GetHash());
+
+    // The block index hands out the hash it has instead of computing it again
+    uint256 hash = header.GetHash();
+    CBlockIndex index(header);
+    index.phashBlock = &hash;
+    BOOST_CHECK(index.GetBlockPoWHash() == header.GetPoWHash());
+
+    // Passing the known hash to the header checks gives the same result
+    CValidationState state;
+    BOOST_CHECK(CheckBlockHeader(header, state, Params().GetConsensus(), true));
+    BOOST_CHECK(CheckBlockHeader(header, state, Params().GetConsensus(), true, &hash));
+    header.nNonce++;
+    uint256 hashChanged = header.GetHash();
+    BOOST_CHECK(!CheckBlockHeader(header, state, Params().GetConsensus(), true));
+    BOOST_CHECK(!CheckBlockHeader(header, state, Params().GetConsensus(), true, &hashChanged));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,9 +4,12 @@
 
 #include "rpc/server.h"
 #include "rpc/client.h"
+#include "rpc/jsonstream.h"
 
 #include "base58.h"
+#include "chainparams.h"
 #include "netbase.h"
+#include "validation.h"
 
 #include "test/test_bitcoin.h"
 
@@ -48,6 +51,25 @@ UniValue CallRPC(string args)
     }
 }
 
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, JSONStreamWriter& writer);
+
+/** Sink collecting what a JSONStreamWriter writes */
+struct JSONChunks
+{
+    std::vector<std::string> vChunks;
+
+    void operator()(const std::string& strChunk) { vChunks.push_back(strChunk); }
+
+    std::string Join(const std::string& strLast) const
+    {
+        std::string strRet;
+        BOOST_FOREACH(const std::string& strChunk, vChunks)
+            strRet += strChunk;
+        return strRet + strLast;
+    }
+};
+
 
 BOOST_FIXTURE_TEST_SUITE(rpc_tests, TestingSetup)
 
@@ -332,4 +354,61 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_jsonstream)
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("quote\"d", "line\nbreak"));
+    inner.push_back(Pair("empty", UniValue(UniValue::VARR)));
+    UniValue expected(UniValue::VOBJ);
+    expected.push_back(Pair("a", 1));
+    UniValue list(UniValue::VARR);
+    list.push_back(inner);
+    list.push_back(NullUniValue);
+    list.push_back(true);
+    list.push_back(UniValue(UniValue::VOBJ));
+    expected.push_back(Pair("list", list));
+    expected.push_back(Pair("b", -2.5));
+
+    // Written piece by piece, in chunks of at least 8 bytes
+    JSONChunks chunks;
+    JSONStreamWriter writer(std::ref(chunks), 8);
+    writer.BeginObject();
+    writer.Field("a", 1);
+    writer.Key("list");
+    writer.BeginArray();
+    writer.BeginObject();
+    writer.Fields(inner);
+    writer.End();
+    writer.Value(NullUniValue);
+    writer.Value(true);
+    writer.BeginObject();
+    writer.End();
+    writer.End();
+    writer.Field("b", -2.5);
+    writer.End();
+    BOOST_CHECK(writer.Started());
+    BOOST_CHECK(chunks.vChunks.size() > 1);
+    BOOST_FOREACH(const std::string& strChunk, chunks.vChunks)
+        BOOST_CHECK(strChunk.size() >= 8);
+    BOOST_CHECK_EQUAL(chunks.Join(writer.TakeBuffer()), expected.write());
+
+    // Nothing is handed over before a chunk fills up
+    JSONChunks chunksSmall;
+    JSONStreamWriter writerSmall(std::ref(chunksSmall));
+    writerSmall.Value(expected);
+    BOOST_CHECK(!writerSmall.Started());
+    BOOST_CHECK(chunksSmall.vChunks.empty());
+    BOOST_CHECK_EQUAL(writerSmall.TakeBuffer(), expected.write());
+
+    // A streamed block is the same as the one built whole
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), Params().GetConsensus()));
+    for (int i = 0; i < 2; i++) {
+        JSONChunks chunksBlock;
+        JSONStreamWriter writerBlock(std::ref(chunksBlock), 16);
+        blockToJSON(block, chainActive.Tip(), i == 1, writerBlock);
+        BOOST_CHECK_EQUAL(chunksBlock.Join(writerBlock.TakeBuffer()), blockToJSON(block, chainActive.Tip(), i == 1).write());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,88 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "arith_uint256.h"
+#include "chain.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "key.h"
+#include "pos.h"
+#include "random.h"
+#include "stakeindex.h"
+#include "streams.h"
+#include "txdb.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stakeindex_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(stakeindex_kernel_hash)
+{
+    CBlockIndex indexPrev;
+    indexPrev.nStakeModifier = uint256S("5e1b2a8fd3c94e70b6a1d2c3e4f50617283940a1b2c3d4e5f60718293a4b5c6d");
+
+    CMutableTransaction txPrev;
+    txPrev.nTime = 1500000000;
+    txPrev.vin.resize(1);
+    txPrev.vout.resize(1);
+    txPrev.vout[0].nValue = 1000 * COIN;
+    CCoins coins(txPrev, 1);
+    const COutPoint prevout(txPrev.GetHash(), 0);
+    const unsigned int nTimeTx = txPrev.nTime + 3600;
+
+    // CheckStakeKernelHash checks the hash ComputeStakeKernelHash returns against the weighted target
+    const arith_uint256 hash = UintToArith256(ComputeStakeKernelHash(&indexPrev, txPrev.nTime, prevout, nTimeTx));
+    BOOST_CHECK(hash != UintToArith256(ComputeStakeKernelHash(&indexPrev, txPrev.nTime, prevout, nTimeTx + 16)));
+    const arith_uint256 nTarget = hash / arith_uint256(txPrev.vout[0].nValue);
+    BOOST_CHECK(CheckStakeKernelHash(&indexPrev, arith_uint256(nTarget + nTarget / 1000).GetCompact(), &coins, prevout, nTimeTx));
+    BOOST_CHECK(!CheckStakeKernelHash(&indexPrev, arith_uint256(nTarget - nTarget / 1000).GetCompact(), &coins, prevout, nTimeTx));
+}
+
+BOOST_AUTO_TEST_CASE(stakeindex_database)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CStakeRecord record;
+    BOOST_CHECK(record.IsNull());
+    record.prevoutKernel = COutPoint(GetRandHash(), 2);
+    record.hashProofOfStake = GetRandHash();
+    record.nStakeValue = 1234 * COIN;
+    record.nStakerType = GetAddressIndexType(GetScriptForDestination(key.GetPubKey().GetID()), record.hashStaker);
+    BOOST_CHECK(!record.IsNull());
+    BOOST_CHECK_EQUAL(record.nStakerType, ADDRESS_INDEX_KEYHASH);
+
+    // Compact: the value is a varint
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << record;
+    BOOST_CHECK(ss.size() < 36 + 32 + 8 + 1 + 20);
+
+    const uint256 hashBlock = GetRandHash();
+    BOOST_CHECK(pblocktree->WriteStakeIndex(hashBlock, record));
+    CStakeRecord recordRead;
+    BOOST_CHECK(pblocktree->ReadStakeIndex(hashBlock, recordRead));
+    BOOST_CHECK(recordRead.prevoutKernel == record.prevoutKernel);
+    BOOST_CHECK(recordRead.hashProofOfStake == record.hashProofOfStake);
+    BOOST_CHECK_EQUAL(recordRead.nStakeValue, record.nStakeValue);
+    BOOST_CHECK_EQUAL(recordRead.nStakerType, record.nStakerType);
+    BOOST_CHECK(recordRead.hashStaker == key.GetPubKey().GetID());
+    BOOST_CHECK(!pblocktree->ReadStakeIndex(GetRandHash(), recordRead));
+
+    // Only proof-of-stake blocks have a record, and only with -stakeindex
+    CBlockIndex index;
+    index.phashBlock = &hashBlock;
+    const bool fStakeIndexOld = fStakeIndex;
+    fStakeIndex = true;
+    BOOST_CHECK(!GetStakeRecord(&index, recordRead));
+    index.SetProofOfStake();
+    BOOST_CHECK(GetStakeRecord(&index, recordRead));
+    fStakeIndex = false;
+    BOOST_CHECK(!GetStakeRecord(&index, recordRead));
+    fStakeIndex = fStakeIndexOld;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -63,4 +63,29 @@ BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
             std::string(ds.begin(), ds.end()));
 }
 
+BOOST_AUTO_TEST_CASE(streams_span_reader)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << (uint32_t)0x01020304 << std::string("span") << (uint8_t)7;
+    std::vector<char> vch(ss.begin(), ss.end());
+
+    CSpanReader reader(SER_DISK, 0, vch.data(), vch.data() + vch.size());
+    uint32_t n;
+    std::string str;
+    uint8_t c;
+    reader >> n >> str;
+    BOOST_CHECK_EQUAL(n, 0x01020304U);
+    BOOST_CHECK_EQUAL(str, "span");
+    BOOST_CHECK_EQUAL(reader.size(), 1U);
+    reader >> c;
+    BOOST_CHECK_EQUAL(c, 7);
+    BOOST_CHECK(reader.empty());
+
+    // Reading past the end throws instead of touching memory beyond it
+    BOOST_CHECK_THROW(reader >> c, std::ios_base::failure);
+    CSpanReader readerShort(SER_DISK, 0, vch.data(), vch.data() + 6);
+    BOOST_CHECK_THROW(readerShort >> n >> str, std::ios_base::failure);
+    BOOST_CHECK_THROW(CSpanReader(SER_DISK, 0, vch.data(), vch.data() + 2).ignore(3), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
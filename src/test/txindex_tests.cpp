@@ -0,0 +1,70 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "index/txindex.h"
+#include "txdb.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txindex_tests, TestingSetup)
+
+/** Wait for the index thread to catch up with the chain, for up to ten seconds */
+static bool WaitForSync(CTxIndex& index)
+{
+    for (int i = 0; i < 1000 && !index.IsSynced(); i++)
+        MilliSleep(10);
+    return index.IsSynced();
+}
+
+BOOST_AUTO_TEST_CASE(txindex_initial_sync)
+{
+    const uint256 hashGenesisTx = Params().GenesisBlock().vtx[0].GetHash();
+    CDiskTxPos pos;
+    BOOST_CHECK(!pblocktree->ReadTxIndex(hashGenesisTx, pos));
+
+    // Not synced before the thread has caught up
+    CTxIndex index;
+    BOOST_CHECK(!index.BlockUntilSyncedToCurrentChain());
+    BOOST_CHECK(index.Start());
+    BOOST_REQUIRE(WaitForSync(index));
+    BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+    BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+    BOOST_CHECK(pblocktree->ReadTxIndex(hashGenesisTx, pos));
+    BOOST_CHECK(pos.nFile == chainActive.Tip()->GetBlockPos().nFile);
+    index.Stop();
+
+    CBlockLocator locator;
+    BOOST_CHECK(pblocktree->ReadIndexBestBlock("txindex", locator));
+    BOOST_CHECK(!locator.IsNull() && locator.vHave[0] == chainActive.Tip()->GetBlockHash());
+
+    // A restart resumes at the stored block
+    CTxIndex indexRestarted;
+    BOOST_CHECK(indexRestarted.Start());
+    BOOST_CHECK(indexRestarted.GetBestBlock() == chainActive.Tip());
+    indexRestarted.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(txindex_written_inline)
+{
+    // An index written by ConnectBlock in an earlier version is taken over as it is
+    BOOST_CHECK(pblocktree->WriteFlag("txindex", true));
+    CTxIndex index;
+    BOOST_CHECK(index.Start());
+    BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+    BOOST_REQUIRE(WaitForSync(index));
+    index.Stop();
+
+    CDiskTxPos pos;
+    BOOST_CHECK(!pblocktree->ReadTxIndex(Params().GenesisBlock().vtx[0].GetHash(), pos));
+    bool fInline = true;
+    BOOST_CHECK(pblocktree->ReadFlag("txindex", fInline));
+    BOOST_CHECK(!fInline);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,183 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "pos.h"
+#include "pow.h"
+#include "random.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+/** Regtest, where snapshots can be accepted, with a way to start over with a new data directory */
+struct TxOutSetSnapshotSetup : public TestingSetup {
+    TxOutSetSnapshotSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+
+    void ResetChainstate()
+    {
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        delete pcoinsdbview;
+        delete pblocktree;
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        // As at startup, the genesis block is not connected yet
+        BOOST_CHECK(InitBlockIndex(Params()));
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(txoutset_snapshot_tests, TxOutSetSnapshotSetup)
+
+/** Chain of nLength headers after the genesis block, with the transaction counts and stake modifiers of connected blocks */
+static CBlockIndex* AddChain(int nLength)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Genesis();
+    for (int i = 0; i < nLength; i++) {
+        CBlockIndex* pindex = InsertBlockIndex(GetRandHash());
+        pindex->pprev = pindexPrev;
+        pindex->nHeight = pindexPrev->nHeight + 1;
+        pindex->nTime = pindexPrev->nTime + 60;
+        pindex->nBits = pindexPrev->nBits;
+        pindex->nTx = 1 + i % 3;
+        pindex->nChainTx = pindexPrev->nChainTx + pindex->nTx;
+        pindex->nStatus = BLOCK_VALID_SCRIPTS;
+        if (i % 2)
+            pindex->SetProofOfStake();
+        pindex->nStakeModifier = GetRandHash();
+        pindex->nChainWork = pindexPrev->nChainWork + GetBlockProof(*pindex);
+        pindex->BuildSkip();
+        pindexPrev = pindex;
+    }
+    return pindexPrev;
+}
+
+static void FlipByte(const boost::filesystem::path& path, uint64_t nPos)
+{
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_CHECK(fseek(file, nPos, SEEK_SET) == 0);
+    int ch = fgetc(file);
+    BOOST_CHECK(fseek(file, -1, SEEK_CUR) == 0);
+    fputc(ch ^ 0x01, file);
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(txoutset_snapshot_roundtrip)
+{
+    CBlockIndex* pindexTip = AddChain(30);
+    const CBlockIndex* pindexStake = pindexTip->GetAncestor(12);
+    const uint256 hashStake = pindexStake->GetBlockHash();
+    const uint256 hashModifier = pindexStake->nStakeModifier;
+    const unsigned int nChainTx = pindexTip->nChainTx;
+
+    std::vector<CMutableTransaction> vTx(50);
+    for (unsigned int i = 0; i < vTx.size(); i++) {
+        vTx[i].vin.resize(1);
+        vTx[i].vin[0].prevout = COutPoint(GetRandHash(), 0);
+        vTx[i].vout.resize(2);
+        vTx[i].vout[0].nValue = i * COIN;
+        vTx[i].vout[0].scriptPubKey = CScript() << OP_TRUE;
+        vTx[i].vout[1].nValue = 1;
+        vTx[i].vout[1].scriptPubKey = CScript() << OP_2;
+        pcoinsTip->ModifyCoins(vTx[i].GetHash())->FromTx(vTx[i], i % 30);
+    }
+    pcoinsTip->SetBestBlock(pindexTip->GetBlockHash());
+    FlushStateToDisk();
+
+    const boost::filesystem::path path = GetDataDir() / "utxo.snapshot";
+    const boost::filesystem::path pathCorrupt = GetDataDir() / "corrupt.snapshot";
+    CTxOutSetSnapshotInfo info;
+    BOOST_REQUIRE(DumpTxOutSetSnapshot(pcoinsTip, path, info));
+    BOOST_CHECK(info.hashBlock == pindexTip->GetBlockHash());
+    BOOST_CHECK_EQUAL(info.nHeight, 30);
+    BOOST_CHECK_EQUAL(info.nTransactions, vTx.size());
+
+    // The same UTXO set gives the same snapshot
+    CTxOutSetSnapshotInfo infoAgain;
+    BOOST_REQUIRE(DumpTxOutSetSnapshot(pcoinsTip, pathCorrupt, infoAgain));
+    BOOST_CHECK(infoAgain.hashSnapshot == info.hashSnapshot);
+    FlipByte(pathCorrupt, boost::filesystem::file_size(pathCorrupt) / 2);
+
+    ResetChainstate();
+
+    // Snapshots that are not pinned, or do not match what is, are refused
+    BOOST_CHECK(!LoadTxOutSetSnapshot(Params(), pcoinsdbview, path));
+    UpdateRegtestTxOutSetSnapshot(info.nHeight, info.hashBlock, GetRandHash());
+    BOOST_CHECK(!LoadTxOutSetSnapshot(Params(), pcoinsdbview, path));
+    UpdateRegtestTxOutSetSnapshot(info.nHeight, info.hashBlock, info.hashSnapshot);
+    BOOST_CHECK(!LoadTxOutSetSnapshot(Params(), pcoinsdbview, pathCorrupt));
+    BOOST_CHECK(chainActive.Tip() == NULL);
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 1U);
+
+    BOOST_REQUIRE(LoadTxOutSetSnapshot(Params(), pcoinsdbview, path));
+    BOOST_CHECK(fTxOutSetSnapshot);
+    BOOST_CHECK(fHavePruned);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 30);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == info.hashBlock);
+    BOOST_CHECK_EQUAL(chainActive.Tip()->nChainTx, nChainTx);
+    BOOST_CHECK(!(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA));
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == info.hashBlock);
+    for (unsigned int i = 0; i < vTx.size(); i++) {
+        const CCoins* coins = pcoinsTip->AccessCoins(vTx[i].GetHash());
+        BOOST_REQUIRE(coins != NULL);
+        BOOST_CHECK_EQUAL(coins->nHeight, (int)(i % 30));
+        BOOST_CHECK(coins->vout[0] == vTx[i].vout[0]);
+        BOOST_CHECK(coins->vout[1] == vTx[i].vout[1]);
+    }
+
+    // Only a new data directory takes a snapshot
+    BOOST_CHECK(!LoadTxOutSetSnapshot(Params(), pcoinsdbview, path));
+
+    // The block index and the chainstate are where the next startup finds them
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex());
+    BOOST_CHECK(fTxOutSetSnapshot);
+    BOOST_CHECK(fHavePruned);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == info.hashBlock);
+    BOOST_REQUIRE(mapBlockIndex.count(hashStake));
+    BOOST_CHECK(mapBlockIndex[hashStake]->IsProofOfStake());
+    BOOST_CHECK(mapBlockIndex[hashStake]->nStakeModifier == hashModifier);
+    BOOST_CHECK(!mapBlockIndex[hashStake]->pprev->IsProofOfStake());
+    BOOST_CHECK_EQUAL(chainActive.Tip()->nChainTx, nChainTx);
+
+    // Staking on coins from before the snapshot needs only the chainstate, not their blocks
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    std::map<COutPoint, CStakeCache> cache;
+    CacheKernel(cache, COutPoint(vTx[1].GetHash(), 0), pindexPrev);
+    CacheKernel(cache, COutPoint(vTx[29].GetHash(), 0), pindexPrev); // not mature yet
+    CacheKernel(cache, COutPoint(GetRandHash(), 0), pindexPrev);
+    BOOST_REQUIRE_EQUAL(cache.size(), 1U);
+    BOOST_CHECK_EQUAL(cache.begin()->second.nHeight, 1);
+    BOOST_CHECK_EQUAL(cache.begin()->second.nValue, COIN);
+
+    CMutableTransaction txStake;
+    txStake.vin.push_back(CTxIn(COutPoint(vTx[2].GetHash(), 0)));
+    txStake.vout.resize(2);
+    txStake.vout[0].SetEmpty();
+    txStake.vout[1] = vTx[2].vout[0];
+    // Weighted by the 2 coins staked, a target of 2^223 is met by any kernel hash below 2^250
+    do {
+        txStake.nTime++;
+    } while (UintToArith256(ComputeStakeKernelHash(pindexPrev, vTx[2].nTime, txStake.vin[0].prevout, txStake.nTime)).bits() > 250);
+    arith_uint256 bnTarget(1);
+    bnTarget <<= 223;
+    const unsigned int nBits = bnTarget.GetCompact();
+    CValidationState state;
+    BOOST_CHECK(CheckProofOfStake(pindexPrev, txStake, nBits, state));
+    BOOST_CHECK(CheckKernel(pindexPrev, nBits, txStake.nTime, txStake.vin[0].prevout));
+    txStake.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    BOOST_CHECK(!CheckProofOfStake(pindexPrev, txStake, nBits, state));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
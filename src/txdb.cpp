@@ -19,12 +19,18 @@ using namespace std;
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_ADDRESSINDEX = 'a';
+static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_SPENTINDEX = 'p';
+static const char DB_STAKEINDEX = 's';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_INDEX_SNAPSHOT = 'S';
+static const char DB_INDEX_BEST_BLOCK = 'i';
 
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
@@ -145,9 +151,20 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // A block index snapshot no longer matches once the index changes
+    if (!blockinfo.empty())
+        batch.Erase(DB_INDEX_SNAPSHOT);
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::WriteIndexSnapshotId(const uint256 &id) {
+    return Write(DB_INDEX_SNAPSHOT, id, true);
+}
+
+bool CBlockTreeDB::ReadIndexSnapshotId(uint256 &id) {
+    return Read(DB_INDEX_SNAPSHOT, id);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
@@ -159,6 +176,87 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WriteIndexBestBlock(const std::string &name, const CBlockLocator &locator) {
+    return Write(std::make_pair(DB_INDEX_BEST_BLOCK, name), locator);
+}
+
+bool CBlockTreeDB::ReadIndexBestBlock(const std::string &name, CBlockLocator &locator) {
+    return Read(std::make_pair(DB_INDEX_BEST_BLOCK, name), locator);
+}
+
+bool CBlockTreeDB::UpdateAddressIndex(const CAddressIndexUpdate &update) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = update.vAddressIndex.begin(); it != update.vAddressIndex.end(); it++)
+        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    for (std::vector<CAddressIndexKey>::const_iterator it = update.vAddressIndexErase.begin(); it != update.vAddressIndexErase.end(); it++)
+        batch.Erase(make_pair(DB_ADDRESSINDEX, *it));
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = update.vUnspentIndex.begin(); it != update.vUnspentIndex.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+    }
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it = update.vSpentIndex.begin(); it != update.vSpentIndex.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(int nType, const uint160 &hash, std::vector<std::pair<CAddressIndexKey, CAmount> > &vEntries, int nStart, int nEnd) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexSeekKey(nType, hash, nStart)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX || key.second.nAddressType != nType || key.second.hash != hash)
+            break;
+        if (nEnd > 0 && key.second.nHeight > nEnd)
+            break;
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("%s: failed to read value", __func__);
+        vEntries.push_back(make_pair(key.second, nValue));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(int nType, const uint160 &hash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vEntries) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressUnspentKey(nType, hash, uint256(), 0)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressUnspentKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSUNSPENTINDEX || key.second.nAddressType != nType || key.second.hash != hash)
+            break;
+        CAddressUnspentValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read value", __func__);
+        vEntries.push_back(make_pair(key.second, value));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value) {
+    return Read(make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool CBlockTreeDB::WriteStakeIndex(const uint256 &hashBlock, const CStakeRecord &record) {
+    return Write(make_pair(DB_STAKEINDEX, hashBlock), record);
+}
+
+bool CBlockTreeDB::ReadStakeIndex(const uint256 &hashBlock, CStakeRecord &record) {
+    return Read(make_pair(DB_STAKEINDEX, hashBlock), record);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
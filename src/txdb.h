@@ -6,9 +6,11 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "stakeindex.h"
 
 #include <map>
 #include <string>
@@ -112,8 +114,22 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    //! Identify the block index snapshot that matches the index as stored. Cleared whenever the index is written.
+    bool WriteIndexSnapshotId(const uint256 &id);
+    bool ReadIndexSnapshotId(uint256 &id);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    //! Locator of the last block a background index (see index/base.h) has written
+    bool WriteIndexBestBlock(const std::string &name, const CBlockLocator &locator);
+    bool ReadIndexBestBlock(const std::string &name, CBlockLocator &locator);
+    //! Apply the changes of one block to the address, unspent output and spent indexes in one batch
+    bool UpdateAddressIndex(const CAddressIndexUpdate &update);
+    //! Entries of an address from height nStart on, up to height nEnd if it is not 0
+    bool ReadAddressIndex(int nType, const uint160 &hash, std::vector<std::pair<CAddressIndexKey, CAmount> > &vEntries, int nStart = 0, int nEnd = 0);
+    bool ReadAddressUnspentIndex(int nType, const uint160 &hash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vEntries);
+    bool ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    bool WriteStakeIndex(const uint256 &hashBlock, const CStakeRecord &record);
+    bool ReadStakeIndex(const uint256 &hashBlock, CStakeRecord &record);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
@@ -18,6 +18,8 @@
 #include "utiltime.h"
 #include "version.h"
 
+#include <queue>
+
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -73,6 +75,72 @@ void CTxMemPoolEntry::UpdateLockPoints(const LockPoints& lp)
     lockPoints = lp;
 }
 
+/** Lower bounds of the fee histogram ranges, in satoshis per kB */
+static const CAmount FEE_HISTOGRAM_BOUNDS[] = {
+    0, 1000, 2000, 3000, 4000, 5000, 6000, 8000, 10000, 12000, 15000, 20000,
+    25000, 30000, 40000, 50000, 60000, 80000, 100000, 120000, 150000, 200000,
+    250000, 300000, 400000, 500000, 600000, 800000, 1000000, 1500000, 2000000,
+    3000000, 5000000, 10000000
+};
+
+CFeeRateHistogram::CFeeRateHistogram() : nForgottenSequence(0)
+{
+    BOOST_FOREACH(CAmount nFeeRateFrom, FEE_HISTOGRAM_BOUNDS)
+        vBuckets.push_back(Bucket(nFeeRateFrom));
+}
+
+void CFeeRateHistogram::Update(const CFeeRate& feeRate, int64_t nSize, CAmount nFees, int nSign, uint64_t nSequence)
+{
+    const CAmount* pEnd = FEE_HISTOGRAM_BOUNDS + vBuckets.size();
+    const CAmount* pBound = std::upper_bound(FEE_HISTOGRAM_BOUNDS, pEnd, feeRate.GetFeePerK());
+    // Negative fee rates (from prioritisation) go to the lowest range
+    const unsigned int nBucket = pBound == FEE_HISTOGRAM_BOUNDS ? 0 : pBound - FEE_HISTOGRAM_BOUNDS - 1;
+
+    Bucket& bucket = vBuckets[nBucket];
+    bucket.nCount += nSign;
+    bucket.nSize += nSign * nSize;
+    bucket.nFees += nSign * nFees;
+
+    Change change = {nSequence, nBucket, nSign, nSize, nFees};
+    vChanges.push_back(change);
+    if (vChanges.size() > MAX_FEE_HISTOGRAM_CHANGES) {
+        nForgottenSequence = vChanges.front().nSequence;
+        vChanges.pop_front();
+    }
+}
+
+bool CFeeRateHistogram::GetDelta(uint64_t nSinceSequence, std::vector<Bucket>& vDeltaRet) const
+{
+    vDeltaRet.clear();
+    if (nSinceSequence < nForgottenSequence)
+        return false;
+
+    std::vector<Bucket> vDelta;
+    BOOST_FOREACH(const Bucket& bucket, vBuckets)
+        vDelta.push_back(Bucket(bucket.nFeeRateFrom));
+    std::vector<bool> vChanged(vBuckets.size(), false);
+    for (std::deque<Change>::const_reverse_iterator it = vChanges.rbegin(); it != vChanges.rend() && it->nSequence > nSinceSequence; ++it) {
+        Bucket& bucket = vDelta[it->nBucket];
+        bucket.nCount += it->nSign;
+        bucket.nSize += it->nSign * it->nSize;
+        bucket.nFees += it->nSign * it->nFees;
+        vChanged[it->nBucket] = true;
+    }
+    for (unsigned int i = 0; i < vDelta.size(); i++) {
+        if (vChanged[i])
+            vDeltaRet.push_back(vDelta[i]);
+    }
+    return true;
+}
+
+void CFeeRateHistogram::clear(uint64_t nSequence)
+{
+    BOOST_FOREACH(Bucket& bucket, vBuckets)
+        bucket = Bucket(bucket.nFeeRateFrom);
+    vChanges.clear();
+    nForgottenSequence = nSequence;
+}
+
 // Update the given tx for any in-mempool descendants.
 // Assumes that setMemPoolChildren is correct for the given tx and all
 // descendants.
@@ -112,7 +180,9 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
             modifyCount++;
             cachedDescendants[updateIt].insert(cit);
             // Update ancestor state for each descendant
+            UpdateFeeHistograms(cit, -1);
             mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCount()));
+            UpdateFeeHistograms(cit, 1);
         }
     }
     mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
@@ -123,7 +193,7 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
 // for each entry, look for descendants that are outside hashesToUpdate, and
 // add fee/size information for such descendants to the parent.
 // for each such descendant, also update the ancestor state to include the parent.
-void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate)
+void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate, size_t nClusterLimit)
 {
     LOCK(cs);
     // For each entry in vHashesToUpdate, store the set of in-mempool, but not
@@ -163,7 +233,35 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
             }
         }
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
+        MergeClusters(it, false);
+    }
+
+    // Linearize each cluster the transactions ended up in once, rather than
+    // after every merge
+    std::set<TxCluster*> setMerged;
+    BOOST_FOREACH(const uint256 &hash, vHashesToUpdate) {
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end())
+            setMerged.insert(mapLinks[it].cluster);
     }
+    BOOST_FOREACH(TxCluster* cluster, setMerged)
+        LinearizeCluster(cluster);
+
+    // Joining clusters through a block's transactions can go past the size
+    // limit that is enforced on acceptance; evict their tail chunks, as
+    // TrimToSize does, until they fit
+    unsigned int nTxnRemoved = 0;
+    BOOST_FOREACH(const uint256 &hash, vHashesToUpdate) {
+        txiter it;
+        while ((it = mapTx.find(hash)) != mapTx.end() && mapLinks[it].cluster->vTxs.size() > nClusterLimit) {
+            setEntries stage;
+            StageTailChunk(mapLinks[it].cluster, stage);
+            nTxnRemoved += stage.size();
+            RemoveStaged(stage, false);
+        }
+    }
+    if (nTxnRemoved > 0)
+        LogPrint("mempool", "Removed %u txn over the cluster limit after a reorg\n", nTxnRemoved);
 }
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
@@ -285,7 +383,9 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
             CAmount modifyFee = -removeIt->GetModifiedFee();
             int modifySigOps = -removeIt->GetSigOpCount();
             BOOST_FOREACH(txiter dit, setDescendants) {
+                UpdateFeeHistograms(dit, -1);
                 mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+                UpdateFeeHistograms(dit, 1);
             }
         }
     }
@@ -344,7 +444,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nHistogramSequence(0)
 {
     _clear(); //lock free clear
 
@@ -359,6 +459,8 @@ CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
 
 CTxMemPool::~CTxMemPool()
 {
+    for (clusterSet::iterator it = setClusters.begin(); it != setClusters.end(); ++it)
+        delete it->second;
     delete minerPolicyEstimator;
 }
 
@@ -434,6 +536,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     }
     UpdateAncestorsOf(true, newit, setAncestors);
     UpdateEntryForAncestors(newit, setAncestors);
+    MergeClusters(newit);
+    UpdateFeeHistograms(newit, 1);
 
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
@@ -442,14 +546,72 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     vTxHashes.emplace_back(hash, newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
 
+    NotifyEntryAdded(newit);
     return true;
 }
 
-void CTxMemPool::removeUnchecked(txiter it)
+void CTxMemPool::addAddressIndex(const CTxMemPoolEntry& entry, const CCoinsViewCache& view)
+{
+    LOCK(cs);
+    const CTransaction& tx = entry.GetTx();
+    const uint256 hash = tx.GetHash();
+    std::vector<CMempoolAddressDeltaKey>& vInserted = mapAddressInserted[hash];
+    uint160 hashAddress;
+    for (unsigned int j = 0; j < tx.vin.size(); j++) {
+        const CTxOut& prev = view.GetOutputFor(tx.vin[j]);
+        const int nType = GetAddressIndexType(prev.scriptPubKey, hashAddress);
+        if (nType == ADDRESS_INDEX_NONE)
+            continue;
+        CMempoolAddressDeltaKey key(nType, hashAddress, hash, j, true);
+        mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), -prev.nValue, tx.vin[j].prevout)));
+        vInserted.push_back(key);
+    }
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const int nType = GetAddressIndexType(tx.vout[k].scriptPubKey, hashAddress);
+        if (nType == ADDRESS_INDEX_NONE)
+            continue;
+        CMempoolAddressDeltaKey key(nType, hashAddress, hash, k, false);
+        mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), tx.vout[k].nValue)));
+        vInserted.push_back(key);
+    }
+}
+
+void CTxMemPool::getAddressIndex(const std::vector<std::pair<int, uint160> >& vAddresses, std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> >& vResults) const
+{
+    LOCK(cs);
+    for (std::vector<std::pair<int, uint160> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        addressDeltaMap::const_iterator ait = mapAddress.lower_bound(CMempoolAddressDeltaKey(it->first, it->second));
+        for (; ait != mapAddress.end() && ait->first.nAddressType == it->first && ait->first.hash == it->second; ++ait)
+            vResults.push_back(*ait);
+    }
+}
+
+void CTxMemPool::removeAddressIndex(const uint256& txhash)
+{
+    std::map<uint256, std::vector<CMempoolAddressDeltaKey> >::iterator it = mapAddressInserted.find(txhash);
+    if (it == mapAddressInserted.end())
+        return;
+    BOOST_FOREACH(const CMempoolAddressDeltaKey& key, it->second)
+        mapAddress.erase(key);
+    mapAddressInserted.erase(it);
+}
+
+void CTxMemPool::UpdateFeeHistograms(txiter it, int nSign)
 {
+    ++nHistogramSequence;
+    feeHistogram.Update(CFeeRate(it->GetModifiedFee(), it->GetTxSize()), it->GetTxSize(), it->GetModifiedFee(), nSign, nHistogramSequence);
+    ancestorFeeHistogram.Update(CFeeRate(it->GetModFeesWithAncestors(), it->GetSizeWithAncestors()), it->GetTxSize(), it->GetModifiedFee(), nSign, nHistogramSequence);
+}
+
+void CTxMemPool::removeUnchecked(txiter it, bool fInBlock)
+{
+    NotifyEntryRemoved(it);
+    UpdateFeeHistograms(it, -1);
+
     const uint256 hash = it->GetTx().GetHash();
     BOOST_FOREACH(const CTxIn& txin, it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
+    removeAddressIndex(hash);
 
     if (vTxHashes.size() > 1) {
         vTxHashes[it->vTxHashesIdx] = std::move(vTxHashes.back());
@@ -466,7 +628,7 @@ void CTxMemPool::removeUnchecked(txiter it)
     mapLinks.erase(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
-    minerPolicyEstimator->removeTx(hash);
+    minerPolicyEstimator->removeTx(hash, fInBlock);
 }
 
 // Calculates descendants of entry that are not already in setDescendants, and adds to
@@ -621,11 +783,19 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
 
 void CTxMemPool::_clear()
 {
+    for (clusterSet::iterator it = setClusters.begin(); it != setClusters.end(); ++it)
+        delete it->second;
+    setClusters.clear();
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapAddress.clear();
+    mapAddressInserted.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
+    ++nHistogramSequence;
+    feeHistogram.clear(nHistogramSequence);
+    ancestorFeeHistogram.clear(nHistogramSequence);
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
@@ -762,7 +932,40 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     }
 
     assert(totalTxSize == checkTotal);
+
+    // Every transaction is in exactly one cluster, after its parents
+    size_t nClusterTxs = 0;
+    for (clusterSet::const_iterator ci = setClusters.begin(); ci != setClusters.end(); ++ci) {
+        const TxCluster* cluster = ci->second;
+        assert(!cluster->vTxs.empty());
+        assert(cluster->vChunks.back().nEnd == cluster->vTxs.size());
+        setEntries setSeen;
+        BOOST_FOREACH(txiter it, cluster->vTxs) {
+            assert(mapLinks.find(it)->second.cluster == cluster);
+            BOOST_FOREACH(txiter parent, GetMemPoolParents(it))
+                assert(setSeen.count(parent));
+            setSeen.insert(it);
+        }
+        nClusterTxs += cluster->vTxs.size();
+        innerUsage += cluster->nUsage;
+    }
+    assert(nClusterTxs == mapTx.size());
     assert(innerUsage == cachedInnerUsage);
+
+    // The fee histograms match the entries as they are now
+    CFeeRateHistogram feeCheck, ancestorFeeCheck;
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        feeCheck.Update(CFeeRate(it->GetModifiedFee(), it->GetTxSize()), it->GetTxSize(), it->GetModifiedFee(), 1, 0);
+        ancestorFeeCheck.Update(CFeeRate(it->GetModFeesWithAncestors(), it->GetSizeWithAncestors()), it->GetTxSize(), it->GetModifiedFee(), 1, 0);
+    }
+    for (unsigned int i = 0; i < feeHistogram.GetBuckets().size(); i++) {
+        assert(feeHistogram.GetBuckets()[i].nCount == feeCheck.GetBuckets()[i].nCount);
+        assert(feeHistogram.GetBuckets()[i].nSize == feeCheck.GetBuckets()[i].nSize);
+        assert(feeHistogram.GetBuckets()[i].nFees == feeCheck.GetBuckets()[i].nFees);
+        assert(ancestorFeeHistogram.GetBuckets()[i].nCount == ancestorFeeCheck.GetBuckets()[i].nCount);
+        assert(ancestorFeeHistogram.GetBuckets()[i].nSize == ancestorFeeCheck.GetBuckets()[i].nSize);
+        assert(ancestorFeeHistogram.GetBuckets()[i].nFees == ancestorFeeCheck.GetBuckets()[i].nFees);
+    }
 }
 
 bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb)
@@ -865,6 +1068,11 @@ CFeeRate CTxMemPool::estimateSmartFee(int nBlocks, int *answerFoundAtBlocks) con
     LOCK(cs);
     return minerPolicyEstimator->estimateSmartFee(nBlocks, answerFoundAtBlocks, *this);
 }
+void CTxMemPool::setFeeEstimateMode(FeeEstimateMode mode)
+{
+    LOCK(cs);
+    minerPolicyEstimator->SetMode(mode);
+}
 double CTxMemPool::estimatePriority(int nBlocks) const
 {
     LOCK(cs);
@@ -920,7 +1128,9 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         deltas.second += nFeeDelta;
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
+            UpdateFeeHistograms(it, -1);
             mapTx.modify(it, update_fee_delta(deltas.second));
+            UpdateFeeHistograms(it, 1);
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -929,6 +1139,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
             BOOST_FOREACH(txiter ancestorIt, setAncestors) {
                 mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
             }
+            LinearizeCluster(mapLinks[it].cluster);
         }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
@@ -977,17 +1188,93 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
     return mempool.exists(txid) || base->HaveCoins(txid);
 }
 
+size_t DisconnectedBlockTransactions::DynamicMemoryUsage() const {
+    // Like mapTx, the multi_index overhead is estimated
+    return memusage::MallocUsage(sizeof(CTransaction) + 6 * sizeof(void*)) * queuedTx.size() + cachedInnerUsage;
+}
+
+void DisconnectedBlockTransactions::addForBlock(const std::vector<CTransaction>& vtx)
+{
+    BOOST_REVERSE_FOREACH(const CTransaction& tx, vtx) {
+        if (queuedTx.push_back(tx).second)
+            cachedInnerUsage += RecursiveDynamicUsage(tx);
+    }
+}
+
+void DisconnectedBlockTransactions::removeForBlock(const std::vector<CTransaction>& vtx)
+{
+    // Short-circuit in the common case of a block being added to the tip
+    if (queuedTx.empty())
+        return;
+    BOOST_FOREACH(const CTransaction& tx, vtx) {
+        indexed_disconnected_transactions::nth_index<1>::type::iterator it = queuedTx.get<1>().find(tx.GetHash());
+        if (it != queuedTx.get<1>().end()) {
+            cachedInnerUsage -= RecursiveDynamicUsage(*it);
+            queuedTx.get<1>().erase(it);
+        }
+    }
+}
+
+void DisconnectedBlockTransactions::removeOldest()
+{
+    assert(!queuedTx.empty());
+    cachedInnerUsage -= RecursiveDynamicUsage(queuedTx.front());
+    queuedTx.pop_front();
+}
+
+void DisconnectedBlockTransactions::clear()
+{
+    cachedInnerUsage = 0;
+    queuedTx.clear();
+}
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + memusage::DynamicUsage(setClusters) + memusage::DynamicUsage(mapAddress) + memusage::DynamicUsage(mapAddressInserted) + cachedInnerUsage;
+}
+
+uint64_t CTxMemPool::GetFeeHistograms(bool& fDelta, uint64_t nSinceSequence,
+                                      std::vector<CFeeRateHistogram::Bucket>& vFeeRateRet,
+                                      std::vector<CFeeRateHistogram::Bucket>& vAncestorFeeRateRet) const
+{
+    LOCK(cs);
+    if (fDelta && nSinceSequence <= nHistogramSequence &&
+        feeHistogram.GetDelta(nSinceSequence, vFeeRateRet) &&
+        ancestorFeeHistogram.GetDelta(nSinceSequence, vAncestorFeeRateRet))
+        return nHistogramSequence;
+
+    fDelta = false;
+    vFeeRateRet = feeHistogram.GetBuckets();
+    vAncestorFeeRateRet = ancestorFeeHistogram.GetBuckets();
+    return nHistogramSequence;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants) {
     AssertLockHeld(cs);
     UpdateForRemoveFromMempool(stage, updateDescendants);
+
+    // Take the staged transactions out of their clusters while they can
+    // still be looked up, and split what is left once they are gone
+    std::set<TxCluster*> setChanged;
     BOOST_FOREACH(const txiter& it, stage) {
-        removeUnchecked(it);
+        setChanged.insert(mapLinks[it].cluster);
+    }
+    BOOST_FOREACH(TxCluster* cluster, setChanged) {
+        size_t nKept = 0;
+        for (size_t i = 0; i < cluster->vTxs.size(); i++) {
+            if (!stage.count(cluster->vTxs[i]))
+                cluster->vTxs[nKept++] = cluster->vTxs[i];
+        }
+        cluster->vTxs.resize(nKept);
+    }
+
+    BOOST_FOREACH(const txiter& it, stage) {
+        removeUnchecked(it, updateDescendants);
+    }
+
+    BOOST_FOREACH(TxCluster* cluster, setChanged) {
+        SplitCluster(cluster);
     }
 }
 
@@ -1053,6 +1340,191 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) cons
     return it->second.children;
 }
 
+// Orders transactions ready to be linearized so the best ancestor fee rate
+// is on top of the heap
+struct CompareTxIterByAncestorFeeRate {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return CompareTxMemPoolEntryByAncestorFee()(*b, *a);
+    }
+};
+
+void CTxMemPool::MergeClusters(txiter entry, bool fLinearize)
+{
+    TxLinks& links = mapLinks[entry];
+    const bool fNew = (links.cluster == NULL);
+
+    std::set<TxCluster*> setLinked;
+    if (!fNew)
+        setLinked.insert(links.cluster);
+    BOOST_FOREACH(txiter parent, links.parents)
+        setLinked.insert(mapLinks[parent].cluster);
+    BOOST_FOREACH(txiter child, links.children)
+        setLinked.insert(mapLinks[child].cluster);
+
+    // Grow the largest cluster, so the fewest transactions are moved
+    TxCluster* cluster = NULL;
+    BOOST_FOREACH(TxCluster* linked, setLinked) {
+        if (!cluster || linked->vTxs.size() > cluster->vTxs.size())
+            cluster = linked;
+    }
+    if (!cluster)
+        cluster = new TxCluster();
+
+    // A new transaction joining a single cluster comes after all its parents
+    // there, so only the chunks at the end are affected
+    if (fNew && setLinked.size() <= 1 && links.children.empty()) {
+        setClusters.erase(std::make_pair(cluster->dTailFeeRate, cluster));
+        cachedInnerUsage -= cluster->nUsage;
+        cluster->vTxs.push_back(entry);
+        links.cluster = cluster;
+        ChunkCluster(cluster, cluster->vTxs.size() - 1);
+        return;
+    }
+
+    BOOST_FOREACH(TxCluster* linked, setLinked) {
+        if (linked == cluster)
+            continue;
+        BOOST_FOREACH(txiter it, linked->vTxs) {
+            cluster->vTxs.push_back(it);
+            mapLinks[it].cluster = cluster;
+        }
+        DeleteCluster(linked);
+    }
+    if (fNew) {
+        cluster->vTxs.push_back(entry);
+        links.cluster = cluster;
+    }
+
+    if (fLinearize)
+        LinearizeCluster(cluster);
+}
+
+void CTxMemPool::LinearizeCluster(TxCluster* cluster)
+{
+    setClusters.erase(std::make_pair(cluster->dTailFeeRate, cluster));
+    cachedInnerUsage -= cluster->nUsage;
+
+    // Topological order, taking the ready transaction with the best ancestor
+    // fee rate first
+    std::map<txiter, size_t, CompareIteratorByHash> mapWaiting;
+    std::priority_queue<txiter, std::vector<txiter>, CompareTxIterByAncestorFeeRate> queueReady;
+    BOOST_FOREACH(txiter it, cluster->vTxs) {
+        const size_t nParents = GetMemPoolParents(it).size();
+        if (nParents == 0)
+            queueReady.push(it);
+        else
+            mapWaiting[it] = nParents;
+    }
+    const size_t nTxs = cluster->vTxs.size();
+    cluster->vTxs.clear();
+    while (!queueReady.empty()) {
+        txiter it = queueReady.top();
+        queueReady.pop();
+        cluster->vTxs.push_back(it);
+        BOOST_FOREACH(txiter child, GetMemPoolChildren(it)) {
+            std::map<txiter, size_t, CompareIteratorByHash>::iterator mi = mapWaiting.find(child);
+            if (mi != mapWaiting.end() && --mi->second == 0) {
+                queueReady.push(child);
+                mapWaiting.erase(mi);
+            }
+        }
+    }
+    assert(cluster->vTxs.size() == nTxs);
+
+    cluster->vChunks.clear();
+    ChunkCluster(cluster, 0);
+}
+
+void CTxMemPool::ChunkCluster(TxCluster* cluster, size_t nFirst)
+{
+    // A transaction paying a higher fee rate than the chunk before it is
+    // merged into it, as mining it means mining that chunk first anyway
+    for (size_t i = nFirst; i < cluster->vTxs.size(); i++) {
+        TxChunk chunk;
+        chunk.nModFees = cluster->vTxs[i]->GetModifiedFee();
+        chunk.nSize = cluster->vTxs[i]->GetTxSize();
+        chunk.nEnd = i + 1;
+        while (!cluster->vChunks.empty() &&
+               (double)chunk.nModFees * cluster->vChunks.back().nSize > (double)cluster->vChunks.back().nModFees * chunk.nSize) {
+            chunk.nModFees += cluster->vChunks.back().nModFees;
+            chunk.nSize += cluster->vChunks.back().nSize;
+            cluster->vChunks.pop_back();
+        }
+        cluster->vChunks.push_back(chunk);
+    }
+
+    const TxChunk& tail = cluster->vChunks.back();
+    cluster->dTailFeeRate = (double)tail.nModFees / tail.nSize;
+    cluster->nUsage = memusage::MallocUsage(sizeof(TxCluster)) + memusage::DynamicUsage(cluster->vTxs) + memusage::DynamicUsage(cluster->vChunks);
+    cachedInnerUsage += cluster->nUsage;
+    setClusters.insert(std::make_pair(cluster->dTailFeeRate, cluster));
+}
+
+void CTxMemPool::SplitCluster(TxCluster* cluster)
+{
+    std::vector<txiter> vTxs;
+    vTxs.swap(cluster->vTxs);
+
+    // Collect each connected part by walking the links; the first part
+    // keeps the cluster
+    setEntries setPlaced;
+    TxCluster* part = cluster;
+    BOOST_FOREACH(txiter start, vTxs) {
+        if (!setPlaced.insert(start).second)
+            continue;
+        if (!part)
+            part = new TxCluster();
+        std::vector<txiter> vWork(1, start);
+        while (!vWork.empty()) {
+            txiter it = vWork.back();
+            vWork.pop_back();
+            part->vTxs.push_back(it);
+            mapLinks[it].cluster = part;
+            BOOST_FOREACH(txiter parent, GetMemPoolParents(it)) {
+                if (setPlaced.insert(parent).second)
+                    vWork.push_back(parent);
+            }
+            BOOST_FOREACH(txiter child, GetMemPoolChildren(it)) {
+                if (setPlaced.insert(child).second)
+                    vWork.push_back(child);
+            }
+        }
+        LinearizeCluster(part);
+        part = NULL;
+    }
+
+    if (vTxs.empty())
+        DeleteCluster(cluster);
+}
+
+void CTxMemPool::DeleteCluster(TxCluster* cluster)
+{
+    setClusters.erase(std::make_pair(cluster->dTailFeeRate, cluster));
+    cachedInnerUsage -= cluster->nUsage;
+    delete cluster;
+}
+
+void CTxMemPool::StageTailChunk(const TxCluster* cluster, setEntries& stage) const
+{
+    const size_t nBegin = cluster->vChunks.size() > 1 ? cluster->vChunks[cluster->vChunks.size() - 2].nEnd : 0;
+    for (size_t i = nBegin; i < cluster->vChunks.back().nEnd; i++)
+        stage.insert(cluster->vTxs[i]);
+}
+
+size_t CTxMemPool::GetClusterCountWith(const setEntries& setAncestors) const
+{
+    LOCK(cs);
+    std::set<const TxCluster*> setLinked;
+    BOOST_FOREACH(txiter it, setAncestors)
+        setLinked.insert(mapLinks.find(it)->second.cluster);
+
+    size_t nCount = 1;
+    BOOST_FOREACH(const TxCluster* cluster, setLinked)
+        nCount += cluster->vTxs.size();
+    return nCount;
+}
+
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
     LOCK(cs);
     if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
@@ -1091,19 +1563,22 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+        // Evict the lowest fee rate chunk that ends a cluster; nothing else
+        // in the mempool spends from it
+        const TxCluster* cluster = setClusters.begin()->second;
+        const TxChunk& chunk = cluster->vChunks.back();
 
         // We set the new mempool min fee to the feerate of the removed set, plus the
         // "minimum reasonable fee rate" (ie some value under which we consider txn
         // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
         // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        CFeeRate removed(chunk.nModFees, chunk.nSize);
         removed += minReasonableRelayFee;
         trackPackageRemoved(removed);
         maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
 
         setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
+        StageTailChunk(cluster, stage);
         nTxnRemoved += stage.size();
 
         std::vector<CTransaction> txn;
@@ -1136,3 +1611,35 @@ bool CTxMemPool::TransactionWithinChainLimit(const uint256& txid, size_t chainLi
     return it == mapTx.end() || (it->GetCountWithAncestors() < chainLimit &&
        it->GetCountWithDescendants() < chainLimit);
 }
+
+// A transaction always has more in-mempool ancestors than any of its parents
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+bool CTxMemPool::GetPackage(const uint256& hash, size_t nMaxCount, std::vector<CTransaction>& vtxRet) const
+{
+    LOCK(cs);
+    vtxRet.clear();
+    txiter it = mapTx.find(hash);
+    if (it == mapTx.end() || it->GetCountWithAncestors() > nMaxCount)
+        return false;
+
+    setEntries setAncestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+    std::vector<txiter> vSorted(setAncestors.begin(), setAncestors.end());
+    std::sort(vSorted.begin(), vSorted.end(), CompareTxIterByAncestorCount());
+    vtxRet.reserve(vSorted.size() + 1);
+    BOOST_FOREACH(txiter ancestorIt, vSorted)
+        vtxRet.push_back(ancestorIt->GetTx());
+    vtxRet.push_back(it->GetTx());
+    return true;
+}
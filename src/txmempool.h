@@ -6,13 +6,16 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <list>
 #include <memory>
 #include <set>
 
+#include "addressindex.h"
 #include "amount.h"
 #include "coins.h"
 #include "indirectmap.h"
+#include "policy/fees.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
@@ -20,6 +23,9 @@
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
+#include "boost/multi_index/sequenced_index.hpp"
+
+#include <boost/signals2/signal.hpp>
 
 class CAutoFile;
 class CBlockIndex;
@@ -308,6 +314,7 @@ struct descendant_score {};
 struct entry_time {};
 struct mining_score {};
 struct ancestor_score {};
+struct insertion_order {};
 
 class CBlockPolicyEstimator;
 
@@ -326,6 +333,67 @@ struct TxMempoolInfo
     CFeeRate feeRate;
 };
 
+/**
+ * Maximum number of changes a fee histogram remembers for delta queries. The
+ * log is not counted against -maxmempool, as it grows with every eviction.
+ */
+static const unsigned int MAX_FEE_HISTOGRAM_CHANGES = 20000;
+
+/**
+ * Count, size and fees of mempool transactions by fee rate range.
+ *
+ * The ranges are fixed, so the histogram is kept up to date as entries come
+ * and go instead of being rebuilt from the whole pool on every request. Each
+ * change is also logged with the mempool's histogram sequence number, so a
+ * client that has seen the histogram at some sequence can ask for just the
+ * changes since, as long as they have not been pushed out of the log.
+ */
+class CFeeRateHistogram
+{
+public:
+    struct Bucket
+    {
+        CAmount nFeeRateFrom; //!< lowest fee rate of the range, in satoshis per kB
+        int64_t nCount;
+        int64_t nSize;
+        CAmount nFees;
+
+        Bucket(CAmount nFeeRateFromIn = 0) : nFeeRateFrom(nFeeRateFromIn), nCount(0), nSize(0), nFees(0) {}
+    };
+
+private:
+    struct Change
+    {
+        uint64_t nSequence;
+        unsigned int nBucket;
+        int nSign;
+        int64_t nSize;
+        CAmount nFees;
+    };
+
+    std::vector<Bucket> vBuckets;
+    std::deque<Change> vChanges;
+    //! Highest sequence number no longer in vChanges
+    uint64_t nForgottenSequence;
+
+public:
+    CFeeRateHistogram();
+
+    /** Add (nSign = 1) or remove (nSign = -1) a transaction at feeRate */
+    void Update(const CFeeRate& feeRate, int64_t nSize, CAmount nFees, int nSign, uint64_t nSequence);
+
+    const std::vector<Bucket>& GetBuckets() const { return vBuckets; }
+
+    /**
+     * Sum the changes made after nSinceSequence into vDeltaRet, one entry per
+     * range that changed. Returns false if some of them were forgotten.
+     */
+    bool GetDelta(uint64_t nSinceSequence, std::vector<Bucket>& vDeltaRet) const;
+
+    /** Empty the histogram, forgetting every change up to nSequence */
+    void clear(uint64_t nSequence);
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -413,6 +481,10 @@ private:
     uint64_t totalTxSize;      //!< sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
 
+    CFeeRateHistogram feeHistogram;         //!< entries by their own modified fee rate
+    CFeeRateHistogram ancestorFeeHistogram; //!< entries by fee rate with ancestors
+    uint64_t nHistogramSequence;            //!< bumped on every change to the histograms
+
     CFeeRate minReasonableRelayFee;
 
     mutable int64_t lastRollingFeeUpdate;
@@ -472,12 +544,45 @@ public:
 
     const setEntries & GetMemPoolParents(txiter entry) const;
     const setEntries & GetMemPoolChildren(txiter entry) const;
+
+    /** A run of a cluster's linearization, ending before vTxs[nEnd] */
+    struct TxChunk {
+        CAmount nModFees;
+        uint64_t nSize;
+        size_t nEnd;
+    };
+
+    /**
+     * The transactions connected to each other by spends, in either direction.
+     * They are kept in a topological order (the linearization) that is cut
+     * into chunks of non-increasing fee rate, so taking whole chunks from the
+     * front always gives a valid package to mine, and the last chunk can
+     * always be evicted without orphaning anything.
+     */
+    struct TxCluster {
+        std::vector<txiter> vTxs;
+        std::vector<TxChunk> vChunks;
+        double dTailFeeRate; //!< fee rate of the last chunk, its key in setClusters
+        size_t nUsage;
+
+        TxCluster() : dTailFeeRate(0), nUsage(0) {}
+    };
+    typedef std::set<std::pair<double, TxCluster*> > clusterSet;
+
+    /** All clusters, lowest tail chunk fee rate first */
+    const clusterSet & GetClusters() const { return setClusters; }
+    /** Number of transactions in the cluster an entry with these ancestors would join, itself included */
+    size_t GetClusterCountWith(const setEntries& setAncestors) const;
+
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
         setEntries parents;
         setEntries children;
+        TxCluster* cluster;
+
+        TxLinks() : cluster(NULL) {}
     };
 
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
@@ -486,8 +591,33 @@ private:
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
+    /** Add (nSign = 1) or remove (nSign = -1) an entry from the fee histograms as it is now */
+    void UpdateFeeHistograms(txiter it, int nSign);
+
+    clusterSet setClusters;
+
+    /** Put entry in one cluster with all its in-mempool parents and children,
+     *  leaving a merged cluster for the caller to linearize unless fLinearize */
+    void MergeClusters(txiter entry, bool fLinearize = true);
+    /** Recompute a cluster's linearization and chunks after it changed */
+    void LinearizeCluster(TxCluster* cluster);
+    /** Extend a cluster's chunks with its transactions from vTxs[nFirst] on and re-index it */
+    void ChunkCluster(TxCluster* cluster, size_t nFirst);
+    /** Add the transactions of a cluster's last chunk to stage */
+    void StageTailChunk(const TxCluster* cluster, setEntries& stage) const;
+    /** Split a cluster that lost transactions into its connected parts */
+    void SplitCluster(TxCluster* cluster);
+    void DeleteCluster(TxCluster* cluster);
+
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
+    typedef std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta> addressDeltaMap;
+    //! Address index of the mempool, only kept with -addressindex
+    addressDeltaMap mapAddress;
+    std::map<uint256, std::vector<CMempoolAddressDeltaKey> > mapAddressInserted;
+
+    void removeAddressIndex(const uint256& txhash);
+
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
@@ -539,6 +669,11 @@ public:
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta) const;
     void ClearPrioritisation(const uint256 hash);
 
+    /** Add entry to the mempool address index. The outputs it spends must be in view. */
+    void addAddressIndex(const CTxMemPoolEntry& entry, const CCoinsViewCache& view);
+    /** Append the mempool address index entries of each (type, hash) address to vResults */
+    void getAddressIndex(const std::vector<std::pair<int, uint160> >& vAddresses, std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> >& vResults) const;
+
 public:
     /** Remove a set of transactions from the mempool.
      *  If a transaction is in this set, then all in-mempool descendants must
@@ -557,8 +692,10 @@ public:
      *  child transactions present in hashesToUpdate, which are already accounted
      *  for).  Note: hashesToUpdate should be the set of transactions from the
      *  disconnected block that have been accepted back into the mempool.
+     *  Clusters that grow past nClusterLimit transactions this way lose their
+     *  tail chunks until they fit.
      */
-    void UpdateTransactionsFromBlock(const std::vector<uint256> &hashesToUpdate);
+    void UpdateTransactionsFromBlock(const std::vector<uint256> &hashesToUpdate, size_t nClusterLimit);
 
     /** Try to calculate all in-mempool ancestors of entry.
      *  (these are all calculated including the tx itself)
@@ -597,6 +734,13 @@ public:
     /** Returns false if the transaction is in the mempool and not within the chain limit specified. */
     bool TransactionWithinChainLimit(const uint256& txid, size_t chainLimit) const;
 
+    /**
+     * Get a transaction with its in-mempool ancestors, parents first, as
+     * relayed in a package. Returns false if it is not in the mempool or the
+     * package would be larger than nMaxCount transactions.
+     */
+    bool GetPackage(const uint256& hash, size_t nMaxCount, std::vector<CTransaction>& vtxRet) const;
+
     unsigned long size()
     {
         LOCK(cs);
@@ -636,6 +780,9 @@ public:
 
     /** Estimate priority needed to get into the next nBlocks */
     double estimatePriority(int nBlocks) const;
+
+    /** Select how estimateSmartFee answers */
+    void setFeeEstimateMode(FeeEstimateMode mode);
     
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile& fileout) const;
@@ -643,6 +790,21 @@ public:
 
     size_t DynamicMemoryUsage() const;
 
+    /**
+     * Get the fee histograms, or with fDelta set only their changes since
+     * nSinceSequence. fDelta is cleared, and the full histograms returned,
+     * when those changes are no longer known. Returns the sequence number the
+     * result is current as of.
+     */
+    uint64_t GetFeeHistograms(bool& fDelta, uint64_t nSinceSequence,
+                              std::vector<CFeeRateHistogram::Bucket>& vFeeRateRet,
+                              std::vector<CFeeRateHistogram::Bucket>& vAncestorFeeRateRet) const;
+
+    /** Fired with cs held after an entry has been added */
+    boost::signals2::signal<void (txiter)> NotifyEntryAdded;
+    /** Fired with cs held before an entry is removed */
+    boost::signals2::signal<void (txiter)> NotifyEntryRemoved;
+
 private:
     /** UpdateForDescendants is used by UpdateTransactionsFromBlock to update
      *  the descendants for a single transaction that has been added to the
@@ -679,7 +841,7 @@ private:
      *  transactions in a chain before we've updated all the state for the
      *  removal.
      */
-    void removeUnchecked(txiter entry);
+    void removeUnchecked(txiter entry, bool fInBlock = false);
 };
 
 /** 
@@ -697,6 +859,62 @@ public:
     bool HaveCoins(const uint256 &txid) const;
 };
 
+// extracts a transaction's hash
+struct disconnectedtx_txid
+{
+    typedef uint256 result_type;
+    result_type operator() (const CTransaction &tx) const
+    {
+        return tx.GetHash();
+    }
+};
+
+/**
+ * Transactions of blocks disconnected in a reorg, held until the new chain
+ * is connected and then re-added to the mempool in one batch.
+ *
+ * Blocks are disconnected tip first and each block's transactions are queued
+ * in reverse, so reading the queue back to front visits parents before their
+ * children. Transactions that the new chain confirms again are dropped as its
+ * blocks are connected.
+ */
+struct DisconnectedBlockTransactions
+{
+    typedef boost::multi_index_container<
+        CTransaction,
+        boost::multi_index::indexed_by<
+            // in the order queued, ie. reverse topological
+            boost::multi_index::sequenced<
+                boost::multi_index::tag<insertion_order>
+            >,
+            // by txid
+            boost::multi_index::hashed_unique<disconnectedtx_txid, SaltedTxidHasher>
+        >
+    > indexed_disconnected_transactions;
+
+    indexed_disconnected_transactions queuedTx;
+    uint64_t cachedInnerUsage;
+
+    DisconnectedBlockTransactions() : cachedInnerUsage(0) {}
+
+    // The queue has to be emptied (see UpdateMempoolForReorg) before it goes
+    // away, or the mempool is left with children of transactions it never saw
+    ~DisconnectedBlockTransactions() { assert(queuedTx.empty()); }
+
+    size_t DynamicMemoryUsage() const;
+
+    /** Queue the transactions of a block that was just disconnected */
+    void addForBlock(const std::vector<CTransaction>& vtx);
+
+    /** Drop the transactions a newly connected block confirms */
+    void removeForBlock(const std::vector<CTransaction>& vtx);
+
+    /** Drop the oldest queued entry, ie. the last transaction of the most recently disconnected block */
+    void removeOldest();
+
+    void clear();
+};
+
 // We want to sort transactions by coin age priority
 typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
 
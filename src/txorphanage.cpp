@@ -0,0 +1,278 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txorphanage.h"
+
+#include "policy/policy.h"
+#include "random.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+bool CTxOrphanage::AddTx(const CTransaction& tx, NodeId peer, size_t nMaxPeerSize)
+{
+    LOCK(cs);
+
+    const uint256& hash = tx.GetHash();
+    if (mapOrphans.count(hash))
+        return false;
+
+    // Ignore big transactions, to avoid a
+    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
+    // large transaction with a missing parent then we assume
+    // it will rebroadcast it later, after the parent transaction(s)
+    // have been mined or received.
+    unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+    if (sz >= MAX_STANDARD_TX_SIZE)
+    {
+        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
+        return false;
+    }
+
+    size_t& nPeerSize = mapPeerSize[peer];
+    if (nPeerSize + sz > nMaxPeerSize)
+    {
+        LogPrint("mempool", "ignoring orphan tx %s, peer=%d is over its orphan quota (%u bytes)\n", hash.ToString(), peer, nPeerSize);
+        if (nPeerSize == 0)
+            mapPeerSize.erase(peer);
+        return false;
+    }
+
+    const int64_t nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    COrphanTx orphan = {tx, peer, nTimeExpire, sz, vOrphanList.size()};
+    mapOrphans.emplace(hash, orphan);
+    vOrphanList.push_back(hash);
+    setByExpiry.insert(make_pair(nTimeExpire, hash));
+    nPeerSize += sz;
+    nTotalSize += sz;
+
+    set<uint256> setParents;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        if (setParents.insert(txin.prevout.hash).second)
+            mapOrphansByParent[txin.prevout.hash].push_back(hash);
+
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u parents %u, %u bytes)\n", hash.ToString(),
+             mapOrphans.size(), mapOrphansByParent.size(), nTotalSize);
+    return true;
+}
+
+int CTxOrphanage::EraseTxInternal(const uint256& hash)
+{
+    AssertLockHeld(cs);
+
+    std::unordered_map<uint256, COrphanTx, SaltedTxidHasher>::iterator it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return 0;
+    const COrphanTx& orphan = it->second;
+
+    BOOST_FOREACH(const CTxIn& txin, orphan.tx.vin)
+    {
+        std::unordered_map<uint256, vector<uint256>, SaltedTxidHasher>::iterator itParent = mapOrphansByParent.find(txin.prevout.hash);
+        if (itParent == mapOrphansByParent.end())
+            continue;
+        vector<uint256>& vChildren = itParent->second;
+        vector<uint256>::iterator itChild = std::find(vChildren.begin(), vChildren.end(), hash);
+        if (itChild != vChildren.end())
+        {
+            *itChild = vChildren.back();
+            vChildren.pop_back();
+        }
+        if (vChildren.empty())
+            mapOrphansByParent.erase(itParent);
+    }
+
+    // Move the last orphan into the vacated slot of the list
+    const size_t nOldPos = orphan.nListPos;
+    if (nOldPos != vOrphanList.size() - 1)
+    {
+        vOrphanList[nOldPos] = vOrphanList.back();
+        mapOrphans[vOrphanList[nOldPos]].nListPos = nOldPos;
+    }
+    vOrphanList.pop_back();
+
+    setByExpiry.erase(make_pair(orphan.nTimeExpire, hash));
+    std::map<NodeId, size_t>::iterator itPeer = mapPeerSize.find(orphan.fromPeer);
+    assert(itPeer != mapPeerSize.end() && itPeer->second >= orphan.nSize);
+    itPeer->second -= orphan.nSize;
+    if (itPeer->second == 0)
+        mapPeerSize.erase(itPeer);
+    nTotalSize -= orphan.nSize;
+
+    mapOrphans.erase(it);
+    return 1;
+}
+
+int CTxOrphanage::EraseTx(const uint256& hash)
+{
+    LOCK(cs);
+    return EraseTxInternal(hash);
+}
+
+void CTxOrphanage::EraseForPeer(NodeId peer)
+{
+    LOCK(cs);
+
+    mapWorkSet.erase(peer);
+    if (!mapPeerSize.count(peer))
+        return;
+
+    int nErased = 0;
+    size_t nPos = 0;
+    while (nPos < vOrphanList.size())
+    {
+        // Erasing moves the last orphan to nPos, so only advance when keeping
+        const uint256 hash = vOrphanList[nPos];
+        if (mapOrphans[hash].fromPeer == peer)
+            nErased += EraseTxInternal(hash);
+        else
+            nPos++;
+    }
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+}
+
+unsigned int CTxOrphanage::LimitOrphans(unsigned int nMaxOrphans)
+{
+    LOCK(cs);
+
+    int nErased = 0;
+    const int64_t nNow = GetTime();
+    while (!setByExpiry.empty() && setByExpiry.begin()->first <= nNow)
+    {
+        const uint256 hash = setByExpiry.begin()->second;
+        nErased += EraseTxInternal(hash);
+    }
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
+
+    unsigned int nEvicted = 0;
+    while (mapOrphans.size() > nMaxOrphans)
+    {
+        // Evict a random orphan:
+        const uint256 hash = vOrphanList[GetRand(vOrphanList.size())];
+        EraseTxInternal(hash);
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+void CTxOrphanage::EraseForBlock(const std::vector<CTransaction>& vtx)
+{
+    LOCK(cs);
+
+    vector<uint256> vOrphanErase;
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+    {
+        if (mapOrphans.count(tx.GetHash()))
+            vOrphanErase.push_back(tx.GetHash());
+
+        // Which orphans spend an output this transaction spends?
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            std::unordered_map<uint256, vector<uint256>, SaltedTxidHasher>::const_iterator itParent = mapOrphansByParent.find(txin.prevout.hash);
+            if (itParent == mapOrphansByParent.end())
+                continue;
+            BOOST_FOREACH(const uint256& hashOrphan, itParent->second)
+            {
+                const CTransaction& orphanTx = mapOrphans[hashOrphan].tx;
+                BOOST_FOREACH(const CTxIn& txinOrphan, orphanTx.vin)
+                {
+                    if (txinOrphan.prevout == txin.prevout)
+                    {
+                        vOrphanErase.push_back(hashOrphan);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    if (vOrphanErase.size()) {
+        int nErased = 0;
+        BOOST_FOREACH(const uint256& hash, vOrphanErase)
+            nErased += EraseTxInternal(hash);
+        LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", nErased);
+    }
+}
+
+void CTxOrphanage::AddChildrenToWorkSet(const CTransaction& tx)
+{
+    LOCK(cs);
+
+    std::unordered_map<uint256, vector<uint256>, SaltedTxidHasher>::const_iterator itParent = mapOrphansByParent.find(tx.GetHash());
+    if (itParent == mapOrphansByParent.end())
+        return;
+    BOOST_FOREACH(const uint256& hashOrphan, itParent->second)
+        mapWorkSet[mapOrphans[hashOrphan].fromPeer].insert(hashOrphan);
+}
+
+bool CTxOrphanage::GetTxToReconsider(NodeId peer, CTransaction& txRet, NodeId& fromPeerRet)
+{
+    LOCK(cs);
+
+    std::map<NodeId, set<uint256> >::iterator itWork = mapWorkSet.find(peer);
+    if (itWork == mapWorkSet.end())
+        return false;
+
+    bool fFound = false;
+    while (!fFound && !itWork->second.empty())
+    {
+        const uint256 hash = *itWork->second.begin();
+        itWork->second.erase(itWork->second.begin());
+
+        // The orphan may have been erased since it was queued
+        std::unordered_map<uint256, COrphanTx, SaltedTxidHasher>::const_iterator it = mapOrphans.find(hash);
+        if (it != mapOrphans.end())
+        {
+            txRet = it->second.tx;
+            fromPeerRet = it->second.fromPeer;
+            fFound = true;
+        }
+    }
+    if (itWork->second.empty())
+        mapWorkSet.erase(itWork);
+    return fFound;
+}
+
+bool CTxOrphanage::HaveTxToReconsider(NodeId peer) const
+{
+    LOCK(cs);
+    return mapWorkSet.count(peer) > 0;
+}
+
+bool CTxOrphanage::HaveTx(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapOrphans.count(hash) > 0;
+}
+
+size_t CTxOrphanage::Size() const
+{
+    LOCK(cs);
+    return mapOrphans.size();
+}
+
+size_t CTxOrphanage::GetPeerSize(NodeId peer) const
+{
+    LOCK(cs);
+    std::map<NodeId, size_t>::const_iterator it = mapPeerSize.find(peer);
+    return it == mapPeerSize.end() ? 0 : it->second;
+}
+
+void CTxOrphanage::clear()
+{
+    LOCK(cs);
+    mapOrphans.clear();
+    mapOrphansByParent.clear();
+    vOrphanList.clear();
+    setByExpiry.clear();
+    mapPeerSize.clear();
+    mapWorkSet.clear();
+    nTotalSize = 0;
+}
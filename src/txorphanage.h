@@ -0,0 +1,120 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXORPHANAGE_H
+#define BITCOIN_TXORPHANAGE_H
+
+#include "coins.h"
+#include "net.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+/** Expiration time for orphan transactions in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+
+/**
+ * Transactions received from peers whose inputs are not (yet) known.
+ *
+ * Orphans are held in a hash table keyed by txid, with a second hash table
+ * from parent txid to the orphans spending it, so that an arriving parent
+ * finds its children without a scan. Each entry is also listed by expiry
+ * time, which makes expiring old orphans proportional to the number that
+ * actually expire, and in a flat vector for constant time random eviction.
+ *
+ * The memory taken by each peer's orphans is accounted for, and AddTx
+ * refuses orphans beyond the peer's quota, so that one peer flooding
+ * unconnectable transactions cannot push out the orphans of everyone else.
+ *
+ * When a parent is accepted, its orphaned children are not validated right
+ * away but added to the work set of the peer that sent them. The caller
+ * re-processes that work set in batches (GetTxToReconsider), so a single
+ * transaction can never make us validate an unbounded chain of orphans
+ * while holding cs_main.
+ *
+ * The orphanage has its own lock and may be used without holding cs_main.
+ */
+class CTxOrphanage
+{
+private:
+    struct COrphanTx
+    {
+        CTransaction tx;
+        NodeId fromPeer;
+        int64_t nTimeExpire;
+        size_t nSize;    //!< serialized size, counted against the peer's quota
+        size_t nListPos; //!< position in vOrphanList
+    };
+
+    mutable CCriticalSection cs;
+
+    std::unordered_map<uint256, COrphanTx, SaltedTxidHasher> mapOrphans;
+    //! Orphans by the txid of each of their parents
+    std::unordered_map<uint256, std::vector<uint256>, SaltedTxidHasher> mapOrphansByParent;
+    //! All orphan txids, for random eviction
+    std::vector<uint256> vOrphanList;
+    std::set<std::pair<int64_t, uint256> > setByExpiry;
+    //! Total serialized size of the orphans from each peer
+    std::map<NodeId, size_t> mapPeerSize;
+    //! Orphans whose parents were accepted, to be reconsidered per peer
+    std::map<NodeId, std::set<uint256> > mapWorkSet;
+    size_t nTotalSize;
+
+    int EraseTxInternal(const uint256& hash);
+
+public:
+    CTxOrphanage() : nTotalSize(0) {}
+
+    /**
+     * Store an orphan received from peer. Fails if it is already stored, if
+     * it is too large, or if it would take the peer over nMaxPeerSize bytes
+     * of orphans.
+     */
+    bool AddTx(const CTransaction& tx, NodeId peer, size_t nMaxPeerSize);
+
+    /** Remove an orphan, returns the number of transactions removed (0 or 1) */
+    int EraseTx(const uint256& hash);
+
+    /** Remove all orphans received from peer, and its work set */
+    void EraseForPeer(NodeId peer);
+
+    /**
+     * Expire orphans older than ORPHAN_TX_EXPIRE_TIME, then evict random
+     * orphans until at most nMaxOrphans remain. Returns the number evicted
+     * to make room, not counting the expired ones.
+     */
+    unsigned int LimitOrphans(unsigned int nMaxOrphans);
+
+    /** Remove orphans included in or conflicting with the transactions of a block */
+    void EraseForBlock(const std::vector<CTransaction>& vtx);
+
+    /** Queue the orphans spending outputs of tx for reconsideration by the peers that sent them */
+    void AddChildrenToWorkSet(const CTransaction& tx);
+
+    /**
+     * Take the next orphan out of peer's work set. The orphan itself stays
+     * stored until erased by the caller. Returns false if the work set is
+     * empty.
+     */
+    bool GetTxToReconsider(NodeId peer, CTransaction& txRet, NodeId& fromPeerRet);
+
+    bool HaveTxToReconsider(NodeId peer) const;
+
+    bool HaveTx(const uint256& hash) const;
+
+    size_t Size() const;
+
+    /** Total serialized size of the orphans from peer */
+    size_t GetPeerSize(NodeId peer) const;
+
+    void clear();
+};
+
+#endif // BITCOIN_TXORPHANAGE_H
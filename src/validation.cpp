@@ -9,6 +9,7 @@
 
 #include "validation.h"
 
+#include "addressindex.h"
 #include "addrman.h"
 #include "arith_uint256.h"
 /*
@@ -24,6 +25,8 @@
 #include "hash.h"
 #include "init.h"
 #include "key.h"
+#include "lz4.h"
+#include "mappedfile.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "policy/fees.h"
@@ -37,9 +40,11 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "stakeindex.h"
 #include "tinyformat.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "txorphanage.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "util.h"
@@ -86,8 +91,12 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fAddressIndex = false;
+bool fStakeIndex = false;
+bool fBlockCompression = DEFAULT_BLOCK_COMPRESSION;
 bool fHavePruned = false;
 bool fPruneMode = false;
+bool fTxOutSetSnapshot = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fBIP37 = false;
 bool fRequireStandard = true;
@@ -103,23 +112,7 @@ CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 CTxMemPool mempool(::minRelayTxFee);
 FeeFilterRounder filterRounder(::minRelayTxFee);
 
-struct IteratorComparator
-{
-    template<typename I>
-    bool operator()(const I& a, const I& b)
-    {
-        return &(*a) < &(*b);
-    }
-};
-
-struct COrphanTx {
-    CTransaction tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-map<COutPoint, set<map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
-void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+CTxOrphanage orphanage;
 
 /**
  * Returns true if there are nRequired or more blocks of minVersion or above
@@ -242,6 +235,9 @@ namespace {
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
+    /** Storage of the entries of mapBlockIndex. */
+    CBlockIndexArena blockIndexArena;
+
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
@@ -477,7 +473,7 @@ void FinalizeNode(NodeId nodeid) {
     BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight) {
         mapBlocksInFlight.erase(entry.hash);
     }
-    EraseOrphansFor(nodeid);
+    orphanage.EraseForPeer(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
@@ -795,112 +791,6 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
-//////////////////////////////////////////////////////////////////////////////
-//
-// mapOrphanTransactions
-//
-
-bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
-{
-    uint256 hash = tx.GetHash();
-    if (mapOrphanTransactions.count(hash))
-        return false;
-
-    // Ignore big transactions, to avoid a
-    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
-    // large transaction with a missing parent then we assume
-    // it will rebroadcast it later, after the parent transaction(s)
-    // have been mined or received.
-    // 100 orphans, each of which is at most 99,999 bytes big is
-    // at most 10 megabytes of orphans and somewhat more byprev index (in the worst case):
-    unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-    if (sz >= MAX_STANDARD_TX_SIZE)
-    {
-        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
-        return false;
-    }
-
-    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
-    assert(ret.second);
-    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-        mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
-    }
-
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
-    return true;
-}
-
-int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
-{
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
-        return 0;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
-    {
-        auto itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
-        if (itPrev == mapOrphanTransactionsByPrev.end())
-            continue;
-        itPrev->second.erase(it);
-        if (itPrev->second.empty())
-            mapOrphanTransactionsByPrev.erase(itPrev);
-    }
-    mapOrphanTransactions.erase(it);
-    return 1;
-}
-
-void EraseOrphansFor(NodeId peer)
-{
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            nErased += EraseOrphanTx(maybeErase->second.tx.GetHash());
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
-}
-
-
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
-{
-    unsigned int nEvicted = 0;
-    static int64_t nNextSweep;
-    int64_t nNow = GetTime();
-    if (nNextSweep <= nNow) {
-        // Sweep out expired orphan pool entries:
-        int nErased = 0;
-        int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
-        map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-        while (iter != mapOrphanTransactions.end())
-        {
-            map<uint256, COrphanTx>::iterator maybeErase = iter++;
-            if (maybeErase->second.nTimeExpire <= nNow) {
-                nErased += EraseOrphanTx(maybeErase->second.tx.GetHash());
-            } else {
-                nMinExpTime = std::min(maybeErase->second.nTimeExpire, nMinExpTime);
-            }
-        }
-        // Sweep again 5 minutes after the next entry that expires in order to batch the linear scan.
-        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
-        if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
-    }
-    while (mapOrphanTransactions.size() > nMaxOrphans)
-    {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
-        ++nEvicted;
-    }
-    return nEvicted;
-}
-
 bool IsFinalTx(const CTransaction &tx, int nBlockHeight, int64_t nBlockTime)
 {
     if (tx.nLockTime == 0)
@@ -1047,7 +937,7 @@ bool TestLockPointValidity(const LockPoints* lp)
     return true;
 }
 
-bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool useExistingLockPoints)
+bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool useExistingLockPoints, const CCoinsView* pcoinsView)
 {
     AssertLockHeld(cs_main);
     AssertLockHeld(mempool.cs);
@@ -1072,12 +962,13 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
     else {
         // pcoinsTip contains the UTXO set for chainActive.Tip()
         CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        const CCoinsView& view = pcoinsView ? *pcoinsView : viewMemPool;
         std::vector<int> prevheights;
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
             CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            if (!view.GetCoins(txin.prevout.hash, coins)) {
                 return error("%s: Missing input", __func__);
             }
             if (coins.nHeight == MEMPOOL_HEIGHT) {
@@ -1231,14 +1122,9 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
-bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+/** Context-free and policy checks of a loose transaction, as a single transaction or in a package */
+static bool CheckLooseTransaction(CValidationState& state, const CTransaction& tx)
 {
-    const uint256 hash = tx.GetHash();
-    AssertLockHeld(cs_main);
-    if (pfMissingInputs)
-        *pfMissingInputs = false;
     int dust_tx_count = 0;
     CAmount min_dust = 100000;
 
@@ -1286,13 +1172,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         return state.DoS(0, false, REJECT_NONSTANDARD, "time-too-new");
     }
 
-    // is it already in the memory pool?
-    if (pool.exists(hash))
-        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-in-mempool");
+    return true;
+}
 
-    // Check for conflicts with in-memory transactions
-    set<uint256> setConflicts;
-    {
+/** Reject a transaction that spends an output some mempool transaction already spends */
+static bool CheckMempoolConflicts(CTxMemPool& pool, CValidationState& state, const CTransaction& tx)
+{
     LOCK(pool.cs); // protect pool.mapNextTx
     BOOST_FOREACH(const CTxIn &txin, tx.vin)
     {
@@ -1303,8 +1188,77 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return state.Invalid(false, REJECT_CONFLICT, "txn-mempool-conflict");
         }
     }
+    return true;
+}
+
+/**
+ * Fee checks of what is about to enter the mempool: one transaction, or the
+ * new transactions of a package taken together. dPriority is the priority
+ * the free relay exception is judged by.
+ */
+static bool CheckFeePolicy(CTxMemPool& pool, CValidationState& state, CAmount nFees, CAmount nModifiedFees,
+                           unsigned int nSize, double dPriority, bool fLimitFree, const CAmount& nAbsurdFee)
+{
+    CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+    if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    } else if (GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) && nModifiedFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(dPriority)) {
+        // Require that free transactions have sufficient priority to be mined in the next block.
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
+    }
+
+    // Continuously rate-limit free (really, very-low-fee) transactions
+    // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
+    // be annoying or make others' transactions take longer to confirm.
+    if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize))
+    {
+        static CCriticalSection csFreeLimiter;
+        static double dFreeCount;
+        static int64_t nLastTime;
+        int64_t nNow = GetTime();
+
+        LOCK(csFreeLimiter);
+
+        // Use an exponentially decaying ~10-minute window:
+        dFreeCount *= pow(1.0 - 1.0/600.0, (double)(nNow - nLastTime));
+        nLastTime = nNow;
+        // -limitfreerelay unit is thousand-bytes-per-minute
+        // At default rate it would take over a month to fill 1GB
+        if (dFreeCount + nSize >= GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY) * 10 * 1000)
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "rate limited free transaction");
+        LogPrint("mempool", "Rate limit dFreeCount: %g => %g\n", dFreeCount, dFreeCount+nSize);
+        dFreeCount += nSize;
     }
 
+    if (nAbsurdFee && nFees > nAbsurdFee)
+        return state.Invalid(false,
+            REJECT_HIGHFEE, "absurdly-high-fee",
+            strprintf("%d > %d", nFees, nAbsurdFee));
+
+    return true;
+}
+
+bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
+                              bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
+                              std::vector<uint256>& vHashTxnToUncache, CCoinsViewMemPool* pviewMemPool = NULL)
+{
+    const uint256 hash = tx.GetHash();
+    AssertLockHeld(cs_main);
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+
+    if (!CheckLooseTransaction(state, tx))
+        return false; // state filled in by CheckLooseTransaction
+
+    // is it already in the memory pool?
+    if (pool.exists(hash))
+        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-in-mempool");
+
+    // Check for conflicts with in-memory transactions
+    set<uint256> setConflicts;
+    if (!CheckMempoolConflicts(pool, state, tx))
+        return false;
+
     {
         CCoinsView dummy;
         CCoinsViewCache view(&dummy);
@@ -1314,7 +1268,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         {
         LOCK(pool.cs);
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
-        view.SetBackend(viewMemPool);
+        view.SetBackend(pviewMemPool ? *pviewMemPool : viewMemPool);
 
         // do we already have it?
         bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
@@ -1397,41 +1351,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
                 strprintf("%d", nSigOpsCount));
 
-        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
-        } else if (GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) && nModifiedFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(entry.GetPriority(chainActive.Height() + 1))) {
-            // Require that free transactions have sufficient priority to be mined in the next block.
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
-        }
-
-        // Continuously rate-limit free (really, very-low-fee) transactions
-        // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
-        // be annoying or make others' transactions take longer to confirm.
-        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize))
-        {
-            static CCriticalSection csFreeLimiter;
-            static double dFreeCount;
-            static int64_t nLastTime;
-            int64_t nNow = GetTime();
-
-            LOCK(csFreeLimiter);
-
-            // Use an exponentially decaying ~10-minute window:
-            dFreeCount *= pow(1.0 - 1.0/600.0, (double)(nNow - nLastTime));
-            nLastTime = nNow;
-            // -limitfreerelay unit is thousand-bytes-per-minute
-            // At default rate it would take over a month to fill 1GB
-            if (dFreeCount + nSize >= GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY) * 10 * 1000)
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "rate limited free transaction");
-            LogPrint("mempool", "Rate limit dFreeCount: %g => %g\n", dFreeCount, dFreeCount+nSize);
-            dFreeCount += nSize;
-        }
-
-        if (nAbsurdFee && nFees > nAbsurdFee)
-            return state.Invalid(false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
+        if (!CheckFeePolicy(pool, state, nFees, nModifiedFees, nSize, entry.GetPriority(chainActive.Height() + 1), fLimitFree, nAbsurdFee))
+            return false; // state filled in by CheckFeePolicy
 
         // Calculate in-mempool ancestors, up to a limit.
         CTxMemPool::setEntries setAncestors;
@@ -1444,6 +1365,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
         }
 
+        // Each change to a cluster relinearizes all of it
+        size_t nLimitCluster = GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT);
+        if (pool.GetClusterCountWith(setAncestors) > nLimitCluster) {
+            return state.DoS(0, false, REJECT_NONSTANDARD, "too-large-mempool-cluster", false,
+                             strprintf("exceeds cluster limit [limit: %u]", nLimitCluster));
+        }
+
         // A transaction that spends outputs that would be replaced by it is invalid. Now
         // that we have the set of all ancestors we can detect this
         // pathological case by making sure setConflicts and setAncestors don't
@@ -1621,6 +1549,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+        if (fAddressIndex)
+            pool.addAddressIndex(entry, view);
 
         // trim mempool and check if tx was trimmed
         if (!fOverrideMempoolLimit) {
@@ -1635,11 +1565,246 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     return true;
 }
 
+static bool AcceptToMemoryPoolWithView(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                       bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee,
+                                       CCoinsViewMemPool* pviewMemPool)
+{
+    std::vector<uint256> vHashTxToUncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache, pviewMemPool);
+    if (!res) {
+        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
+            pcoinsTip->Uncache(hashTx);
+    }
+    return res;
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+{
+    return AcceptToMemoryPoolWithView(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, NULL);
+}
+
+bool AcceptPackageToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const std::vector<CTransaction>& package,
+                                     bool fLimitFree, bool* pfMissingInputs, const CAmount& nAbsurdFee,
+                                     std::vector<uint256>& vHashTxnToUncache)
+{
+    AssertLockHeld(cs_main);
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+
+    if (package.empty() || package.size() > MAX_PACKAGE_COUNT)
+        return state.DoS(10, false, REJECT_INVALID, "bad-package-count");
+
+    set<uint256> setPackage;
+    BOOST_FOREACH(const CTransaction& tx, package) {
+        if (!setPackage.insert(tx.GetHash()).second)
+            return state.DoS(100, false, REJECT_INVALID, "bad-package-duplicate");
+    }
+
+    // The package must be sorted, and be one transaction with its ancestors
+    set<uint256> setSeen;
+    set<uint256> setSpent;
+    set<COutPoint> setInputs;
+    BOOST_FOREACH(const CTransaction& tx, package) {
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (!setInputs.insert(txin.prevout).second)
+                return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate");
+            if (setPackage.count(txin.prevout.hash)) {
+                if (!setSeen.count(txin.prevout.hash))
+                    return state.DoS(10, false, REJECT_INVALID, "bad-package-order");
+                setSpent.insert(txin.prevout.hash);
+            }
+        }
+        setSeen.insert(tx.GetHash());
+    }
+    for (size_t i = 0; i + 1 < package.size(); i++) {
+        if (!setSpent.count(package[i].GetHash()))
+            return state.DoS(10, false, REJECT_INVALID, "bad-package-unrelated");
+    }
+
+    // Context-free and policy checks, as for single transactions; skip what
+    // the mempool already has
+    vector<const CTransaction*> vNew;
+    unsigned int nPackageSize = 0;
+    BOOST_FOREACH(const CTransaction& tx, package) {
+        if (pool.exists(tx.GetHash()))
+            continue;
+        if (!CheckLooseTransaction(state, tx))
+            return false; // state filled in by CheckLooseTransaction
+        if (!CheckMempoolConflicts(pool, state, tx))
+            return false;
+        nPackageSize += ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        vNew.push_back(&tx);
+    }
+    if (vNew.empty())
+        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-in-mempool");
+    if (nPackageSize > MAX_PACKAGE_SIZE * 1000)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "package-too-large");
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    vector<CTxMemPoolEntry> vEntries;
+    vEntries.reserve(vNew.size());
+    CAmount nPackageFees = 0;
+    CAmount nPackageModifiedFees = 0;
+    {
+    LOCK(pool.cs);
+    CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+    view.SetBackend(viewMemPool);
+    BOOST_FOREACH(const CTransaction* ptx, vNew) {
+        const CTransaction& tx = *ptx;
+        const uint256& hash = tx.GetHash();
+
+        // do we already have it?
+        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
+        if (view.HaveCoins(hash)) {
+            if (!fHadTxInCache)
+                vHashTxnToUncache.push_back(hash);
+            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+        }
+
+        // do all inputs exist? Earlier transactions of the package are in view
+        // by now.
+        BOOST_FOREACH(const CTxIn txin, tx.vin) {
+            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                vHashTxnToUncache.push_back(txin.prevout.hash);
+            if (!view.HaveCoins(txin.prevout.hash)) {
+                if (pfMissingInputs)
+                    *pfMissingInputs = true;
+                return false;
+            }
+        }
+        if (!view.HaveInputs(tx))
+            return state.Invalid(false, REJECT_DUPLICATE, "bad-txns-inputs-spent");
+
+        // Bring the best block into scope
+        view.GetBestBlock();
+
+        LockPoints lp;
+        if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp, false, &view))
+            return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
+
+        if (fRequireStandard && !AreInputsStandard(tx, view))
+            return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+
+        int64_t nSigOpsCount = GetTransactionSigOpCount(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+        if (nSigOpsCount > MAX_STANDARD_TX_SIGOPS)
+            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
+                strprintf("%d", nSigOpsCount));
+
+        CAmount nFees = view.GetValueIn(tx) - tx.GetValueOut();
+        CAmount nModifiedFees = nFees;
+        double nPriorityDummy = 0;
+        pool.ApplyDeltas(hash, nPriorityDummy, nModifiedFees);
+        nPackageFees += nFees;
+        nPackageModifiedFees += nModifiedFees;
+
+        CAmount inChainInputValue;
+        double dPriority = view.GetPriority(tx, chainActive.Height(), inChainInputValue);
+
+        bool fSpendsCoinbase = false;
+        bool fSpendsPackage = false;
+        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+            if (view.AccessCoins(txin.prevout.hash)->IsCoinBase())
+                fSpendsCoinbase = true;
+            if (setPackage.count(txin.prevout.hash))
+                fSpendsPackage = true;
+        }
+
+        vEntries.push_back(CTxMemPoolEntry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx) && !fSpendsPackage, inChainInputValue, fSpendsCoinbase, nSigOpsCount, lp));
+
+        // Make the outputs available to the rest of the package
+        view.ModifyNewCoins(hash, false)->FromTx(tx, MEMPOOL_HEIGHT);
+    }
+
+    // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
+    view.SetBackend(dummy);
+    }
+
+    // Fee checks use the fee rate of the new transactions as a whole. The
+    // package relays free only if each of them would on its own.
+    double dPackagePriority = vEntries.front().GetPriority(chainActive.Height() + 1);
+    BOOST_FOREACH(const CTxMemPoolEntry& entry, vEntries)
+        dPackagePriority = std::min(dPackagePriority, entry.GetPriority(chainActive.Height() + 1));
+    if (!CheckFeePolicy(pool, state, nPackageFees, nPackageModifiedFees, nPackageSize, dPackagePriority, fLimitFree, nAbsurdFee))
+        return false; // state filled in by CheckFeePolicy
+
+    // Each transaction must fit the chain limits with the rest of the
+    // package counted against them
+    size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    const size_t nOthers = vNew.size() - 1;
+    CTxMemPool::setEntries setPackageAncestors;
+    BOOST_FOREACH(const CTxMemPoolEntry& entry, vEntries) {
+        const size_t nOthersSize = nPackageSize - entry.GetTxSize();
+        CTxMemPool::setEntries setAncestors;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors,
+                                            nLimitAncestors > nOthers ? nLimitAncestors - nOthers : 0,
+                                            nLimitAncestorSize > nOthersSize ? nLimitAncestorSize - nOthersSize : 0,
+                                            nLimitDescendants > nOthers ? nLimitDescendants - nOthers : 0,
+                                            nLimitDescendantSize > nOthersSize ? nLimitDescendantSize - nOthersSize : 0,
+                                            errString)) {
+            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+        }
+        setPackageAncestors.insert(setAncestors.begin(), setAncestors.end());
+    }
+    size_t nLimitCluster = GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT);
+    if (pool.GetClusterCountWith(setPackageAncestors) + nOthers > nLimitCluster) {
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-large-mempool-cluster", false,
+                         strprintf("exceeds cluster limit [limit: %u]", nLimitCluster));
+    }
+
+    // Check against previous transactions, the costliest part last. The
+    // signature hashes are computed once per transaction for both passes.
+    vector<PrecomputedTransactionData> vTxData;
+    vTxData.reserve(vNew.size());
+    BOOST_FOREACH(const CTransaction* ptx, vNew) {
+        vTxData.push_back(PrecomputedTransactionData(*ptx));
+        if (!CheckInputs(*ptx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, vTxData.back()))
+            return false; // state filled in by CheckInputs
+        if (!CheckInputs(*ptx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, vTxData.back()))
+        {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
+                __func__, ptx->GetHash().ToString(), FormatStateMessage(state));
+        }
+    }
+
+    // Store transactions in memory, parents first so each finds its
+    // ancestors in the mempool
+    {
+        LOCK(pool.cs);
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        BOOST_FOREACH(const CTxMemPoolEntry& entry, vEntries) {
+            CTxMemPool::setEntries setAncestors;
+            std::string dummyErr;
+            pool.CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummyErr);
+            pool.addUnchecked(entry.GetTx().GetHash(), entry, setAncestors, !IsInitialBlockDownload());
+            if (fAddressIndex)
+                pool.addAddressIndex(entry, view);
+        }
+    }
+
+    // trim mempool and check if the package was trimmed
+    LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    BOOST_FOREACH(const CTransaction* ptx, vNew) {
+        if (!pool.exists(ptx->GetHash()))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    }
+
+    BOOST_FOREACH(const CTransaction* ptx, vNew)
+        SyncWithWallets(*ptx, NULL, NULL);
+
+    return true;
+}
+
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, CValidationState &state, const std::vector<CTransaction>& package,
+                               bool fLimitFree, bool* pfMissingInputs, const CAmount nAbsurdFee)
 {
     std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    bool res = AcceptPackageToMemoryPoolWorker(pool, state, package, fLimitFree, pfMissingInputs, nAbsurdFee, vHashTxToUncache);
     if (!res) {
         BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
             pcoinsTip->Uncache(hashTx);
@@ -1647,6 +1812,182 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return res;
 }
 
+namespace {
+
+/** Buffers for reading compressed records, one set per thread so that reads do not allocate them anew */
+struct CDiskRecordBuffers
+{
+    std::vector<unsigned char> vchCompressed;
+    CDataStream ssData;
+
+    CDiskRecordBuffers() : ssData(SER_DISK, CLIENT_VERSION) {}
+};
+
+boost::thread_specific_ptr<CDiskRecordBuffers> diskRecordBuffers;
+
+CDiskRecordBuffers& GetDiskRecordBuffers()
+{
+    if (!diskRecordBuffers.get())
+        diskRecordBuffers.reset(new CDiskRecordBuffers());
+    return *diskRecordBuffers;
+}
+
+/**
+ * Decompress the data of a compressed record, nSize bytes without the flag at
+ * pData, into a buffer of this thread. Returns NULL if it is malformed.
+ */
+CDataStream* DecompressRecord(const unsigned char* pData, unsigned int nSize)
+{
+    uint32_t nRawSize;
+    if (nSize < sizeof(nRawSize))
+        return NULL;
+    nRawSize = ReadLE32(pData);
+    // Compression only ever made the data smaller
+    if (nRawSize == 0 || nRawSize > MAX_SIZE || nSize - sizeof(nRawSize) >= nRawSize)
+        return NULL;
+
+    CDataStream& ssData = GetDiskRecordBuffers().ssData;
+    ssData.clear();
+    ssData.resize(nRawSize);
+    if (!LZ4Decompress(pData + sizeof(nRawSize), nSize - sizeof(nRawSize), (unsigned char*)&ssData[0], nRawSize))
+        return NULL;
+    return &ssData;
+}
+
+/** Read the data of a compressed record, nSize bytes without the flag, from s and decompress it like DecompressRecord */
+template <typename Stream>
+CDataStream* ReadCompressedRecord(Stream& s, unsigned int nSize)
+{
+    if (nSize > MAX_SIZE)
+        return NULL;
+    std::vector<unsigned char>& vchCompressed = GetDiskRecordBuffers().vchCompressed;
+    vchCompressed.resize(nSize);
+    s.read((char*)vchCompressed.data(), vchCompressed.size());
+    return DecompressRecord(vchCompressed.data(), vchCompressed.size());
+}
+
+/**
+ * Read what a block or undo record at pos holds into obj, leaving filein after
+ * it. pos is the position of the data, just after the record header.
+ */
+template <typename T>
+bool ReadDiskRecord(CAutoFile& filein, const CDiskBlockPos& pos, T& obj)
+{
+    unsigned int nSize;
+    filein >> nSize;
+    if (nSize & DISK_RECORD_COMPRESSED) {
+        CDataStream* pss = ReadCompressedRecord(filein, nSize & ~DISK_RECORD_COMPRESSED);
+        if (!pss)
+            return error("%s: malformed compressed data at %s", __func__, pos.ToString());
+        *pss >> obj;
+    } else {
+        filein >> obj;
+    }
+    return true;
+}
+
+/** Position of the size field in the header of the record whose data is at pos */
+CDiskBlockPos GetRecordSizePos(const CDiskBlockPos& pos)
+{
+    return CDiskBlockPos(pos.nFile, pos.nPos >= sizeof(unsigned int) ? pos.nPos - sizeof(unsigned int) : 0);
+}
+
+/**
+ * Block files mapped into memory for reading, so that reads neither open the
+ * file nor copy the data through stdio first. A mapping is replaced when a
+ * read goes past its end because the file has grown since, and the least
+ * recently used one is dropped when there are MAX_MAPPED_BLOCK_FILES.
+ */
+class CBlockFileMaps
+{
+private:
+    boost::mutex mutex;
+    //! Mapping of each block file, and when it was last used
+    std::map<int, std::pair<std::shared_ptr<const CMappedFile>, uint64_t> > mapFiles;
+    uint64_t nLastUse;
+
+public:
+    CBlockFileMaps() : nLastUse(0) {}
+
+    /** A mapping of block file nFile that covers its first nEnd bytes, or NULL if there is none */
+    std::shared_ptr<const CMappedFile> Get(int nFile, uint64_t nEnd)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<int, std::pair<std::shared_ptr<const CMappedFile>, uint64_t> >::iterator it = mapFiles.find(nFile);
+        if (it != mapFiles.end() && it->second.first->size() >= nEnd) {
+            it->second.second = ++nLastUse;
+            return it->second.first;
+        }
+
+        std::shared_ptr<const CMappedFile> pmap(new CMappedFile(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "scho")));
+        if (pmap->IsNull() || pmap->size() < nEnd)
+            return std::shared_ptr<const CMappedFile>();
+        if (it == mapFiles.end() && mapFiles.size() >= MAX_MAPPED_BLOCK_FILES) {
+            std::map<int, std::pair<std::shared_ptr<const CMappedFile>, uint64_t> >::iterator itOldest = mapFiles.begin();
+            for (it = mapFiles.begin(); it != mapFiles.end(); ++it)
+                if (it->second.second < itOldest->second.second)
+                    itOldest = it;
+            mapFiles.erase(itOldest);
+        }
+        mapFiles[nFile] = std::make_pair(pmap, ++nLastUse);
+        return pmap;
+    }
+
+    /** Forget the mapping of block file nFile, as it is about to be truncated or deleted */
+    void Drop(int nFile)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        mapFiles.erase(nFile);
+    }
+
+    /** Forget all mappings, as the block files they are of may no longer be the ones in use */
+    void Clear()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        mapFiles.clear();
+    }
+};
+
+CBlockFileMaps blockFileMaps;
+
+/**
+ * Find the serialized block of the record at pos in a mapping of its block
+ * file, decompressing it into a buffer of this thread if needed. The data
+ * stays valid as long as pmapRet is held and this thread reads no other
+ * compressed record. Returns false if the file cannot be mapped or the record
+ * is malformed, and the caller reads it through stdio instead.
+ */
+bool GetMappedBlockData(const CDiskBlockPos& pos, std::shared_ptr<const CMappedFile>& pmapRet, const char*& pbeginRet, const char*& pendRet)
+{
+    if (pos.nPos < sizeof(unsigned int))
+        return false;
+    pmapRet = blockFileMaps.Get(pos.nFile, pos.nPos);
+    if (!pmapRet)
+        return false;
+    const unsigned int nSize = ReadLE32(pmapRet->begin() + pos.nPos - sizeof(unsigned int));
+    const unsigned int nDataSize = nSize & ~DISK_RECORD_COMPRESSED;
+    if (pmapRet->size() < (uint64_t)pos.nPos + nDataSize) {
+        pmapRet = blockFileMaps.Get(pos.nFile, (uint64_t)pos.nPos + nDataSize);
+        if (!pmapRet)
+            return false;
+    }
+
+    const unsigned char* pData = pmapRet->begin() + pos.nPos;
+    if (nSize & DISK_RECORD_COMPRESSED) {
+        CDataStream* pss = DecompressRecord(pData, nDataSize);
+        if (!pss)
+            return false;
+        pbeginRet = &(*pss)[0];
+        pendRet = pbeginRet + pss->size();
+    } else {
+        pbeginRet = (const char*)pData;
+        pendRet = pbeginRet + nDataSize;
+    }
+    return true;
+}
+
+} // anon namespace
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1664,14 +2005,43 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+            CBlockHeader header;
+            std::shared_ptr<const CMappedFile> pmap;
+            const char *pbegin, *pend;
+            if (GetMappedBlockData(postx, pmap, pbegin, pend)) {
+                try {
+                    CSpanReader s(SER_DISK, CLIENT_VERSION, pbegin, pend);
+                    s >> header;
+                    s.ignore(postx.nTxOffset);
+                    s >> txOut;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize error - %s", __func__, e.what());
+                }
+                hashBlock = header.GetHash();
+                if (txOut.GetHash() != hash)
+                    return error("%s: txid mismatch", __func__);
+                return true;
+            }
+
+            CAutoFile file(OpenBlockFile(GetRecordSizePos(postx), true), SER_DISK, CLIENT_VERSION);
             if (file.IsNull())
                 return error("%s: OpenBlockFile failed", __func__);
-            CBlockHeader header;
             try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
+                unsigned int nSize;
+                file >> nSize;
+                if (nSize & DISK_RECORD_COMPRESSED) {
+                    // The offset is into the uncompressed block
+                    CDataStream* pss = ReadCompressedRecord(file, nSize & ~DISK_RECORD_COMPRESSED);
+                    if (!pss)
+                        return error("%s: malformed compressed block at %s", __func__, postx.ToString());
+                    *pss >> header;
+                    pss->ignore(postx.nTxOffset);
+                    *pss >> txOut;
+                } else {
+                    file >> header;
+                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    file >> txOut;
+                }
             } catch (const std::exception& e) {
                 return error("%s: Deserialize or I/O error - %s", __func__, e.what());
             }
@@ -1710,6 +2080,34 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     return false;
 }
 
+bool GetAddressIndex(int nType, const uint160& hash, std::vector<std::pair<CAddressIndexKey, CAmount> >& vEntries, int nStart, int nEnd)
+{
+    if (!fAddressIndex)
+        return error("%s: address index not enabled", __func__);
+    return pblocktree->ReadAddressIndex(nType, hash, vEntries, nStart, nEnd);
+}
+
+bool GetAddressUnspent(int nType, const uint160& hash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vEntries)
+{
+    if (!fAddressIndex)
+        return error("%s: address index not enabled", __func__);
+    return pblocktree->ReadAddressUnspentIndex(nType, hash, vEntries);
+}
+
+bool GetSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value)
+{
+    if (!fAddressIndex)
+        return false;
+    return pblocktree->ReadSpentIndex(key, value);
+}
+
+bool GetStakeRecord(const CBlockIndex* pindex, CStakeRecord& record)
+{
+    if (!fStakeIndex || !pindex->IsProofOfStake())
+        return false;
+    return pblocktree->ReadStakeIndex(pindex->GetBlockHash(), record);
+}
+
 
 
 
@@ -1720,7 +2118,38 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+template <typename T>
+static void SetDiskRecord(CDiskRecord& record, const T& obj)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << obj;
+    const unsigned char* pData = (const unsigned char*)&ss[0];
+
+    std::vector<unsigned char> vchCompressed;
+    if (fBlockCompression && LZ4Compress(pData, ss.size(), vchCompressed) && vchCompressed.size() + sizeof(uint32_t) < ss.size()) {
+        CDataStream ssSize(SER_DISK, CLIENT_VERSION);
+        ssSize << (uint32_t)ss.size();
+        record.vchData.reserve(ssSize.size() + vchCompressed.size());
+        record.vchData.assign(ssSize.begin(), ssSize.end());
+        record.vchData.insert(record.vchData.end(), vchCompressed.begin(), vchCompressed.end());
+        record.nSize = record.vchData.size() | DISK_RECORD_COMPRESSED;
+    } else {
+        record.vchData.assign(pData, pData + ss.size());
+        record.nSize = record.vchData.size();
+    }
+}
+
+CDiskRecord::CDiskRecord(const CBlock& block)
+{
+    SetDiskRecord(*this, block);
+}
+
+CDiskRecord::CDiskRecord(const CBlockUndo& blockundo)
+{
+    SetDiskRecord(*this, blockundo);
+}
+
+bool WriteBlockToDisk(const CDiskRecord& record, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
@@ -1728,45 +2157,83 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
     // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(messageStart) << nSize;
+    fileout << FLATDATA(messageStart) << record.nSize;
 
     // Write block
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("WriteBlockToDisk: ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    fileout.write((const char*)record.vchData.data(), record.vchData.size());
 
     return true;
 }
 
+/** The PoW hash of block, whose hash is known: up to version 6 both are the same scrypt hash */
+static uint256 GetPoWHash(const CBlockHeader& block, const uint256& hash)
+{
+    return block.nVersion <= 6 ? hash : block.GetPoWHash();
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    std::shared_ptr<const CMappedFile> pmap;
+    const char *pbegin, *pend;
+    if (GetMappedBlockData(pos, pmap, pbegin, pend)) {
+        try {
+            CSpanReader s(SER_DISK, CLIENT_VERSION, pbegin, pend);
+            s >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read, at the size field of the record header
+        CAutoFile filein(OpenBlockFile(GetRecordSizePos(pos), true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            if (!ReadDiskRecord(filein, pos, block))
+                return false;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check headers for proof-of-work blocks
-    if (block.GetHash() != consensusParams.hashGenesisBlock && block.IsProofOfWork()) {
-        if (!CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (block.IsProofOfWork()) {
+        const uint256 hash = block.GetHash();
+        if (hash != consensusParams.hashGenesisBlock && !CheckProofOfWork(GetPoWHash(block, hash), block.nBits, consensusParams))
             return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
     }
 
     return true;
 }
 
+/**
+ * The serialized block of pindex, where GetMappedBlockData finds it, after
+ * checking its header against the index. Returns false if it cannot be found
+ * that way, and the caller reads it with ReadBlockFromDisk instead.
+ */
+static bool GetRawBlockFromDisk(const CBlockIndex* pindex, std::shared_ptr<const CMappedFile>& pmapRet, const char*& pbeginRet, const char*& pendRet)
+{
+    if (!GetMappedBlockData(pindex->GetBlockPos(), pmapRet, pbeginRet, pendRet))
+        return false;
+    CBlockHeader header;
+    try {
+        CSpanReader s(SER_DISK, CLIENT_VERSION, pbeginRet, pendRet);
+        s >> header;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return header.GetHash() == pindex->GetBlockHash();
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
@@ -2188,7 +2655,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+bool UndoWriteToDisk(const CBlockUndo& blockundo, const CDiskRecord& record, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
@@ -2196,15 +2663,14 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
         return error("%s: OpenUndoFile failed", __func__);
 
     // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
+    fileout << FLATDATA(messageStart) << record.nSize;
 
     // Write undo data
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    fileout.write((const char*)record.vchData.data(), record.vchData.size());
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
@@ -2217,15 +2683,16 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    // Open history file to read, at the size field of the record header
+    CAutoFile filein(OpenUndoFile(GetRecordSizePos(pos), true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("%s: OpenUndoFile failed", __func__);
 
     // Read block
     uint256 hashChecksum;
     try {
-        filein >> blockundo;
+        if (!ReadDiskRecord(filein, pos, blockundo))
+            return false;
         filein >> hashChecksum;
     }
     catch (const std::exception& e) {
@@ -2242,8 +2709,9 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
-/** Abort with a message */
-bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
+} // anon namespace
+
+bool AbortNode(const std::string& strMessage, const std::string& userMessage)
 {
     strMiscWarning = strMessage;
     LogPrintf("*** %s\n", strMessage);
@@ -2254,14 +2722,12 @@ bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
     return false;
 }
 
-bool AbortNode(CValidationState& state, const std::string& strMessage, const std::string& userMessage="")
+static bool AbortNode(CValidationState& state, const std::string& strMessage, const std::string& userMessage="")
 {
     AbortNode(strMessage, userMessage);
     return state.Error(strMessage);
 }
 
-} // anon namespace
-
 /**
  * Apply the undo operation of a CTxInUndo to the given chain state.
  * @param undo The undo object.
@@ -2297,6 +2763,85 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
+/**
+ * The stake index record of proof-of-stake block, staked on top of pindexPrev.
+ * The kernel it spends must still be in view.
+ */
+static void MakeStakeRecord(const CBlock& block, const CBlockIndex* pindexPrev, const CCoinsViewCache& view, CStakeRecord& record)
+{
+    const COutPoint& prevout = block.vtx[1].vin[0].prevout;
+    const CCoins* coins = view.AccessCoins(prevout.hash);
+    if (!coins || !coins->IsAvailable(prevout.n))
+        return;
+    const CTxOut& txout = coins->vout[prevout.n];
+    record.prevoutKernel = prevout;
+    record.hashProofOfStake = ComputeStakeKernelHash(pindexPrev, coins->nTime, prevout, block.vtx[1].nTime);
+    record.nStakeValue = txout.nValue;
+    record.nStakerType = GetAddressIndexType(txout.scriptPubKey, record.hashStaker);
+}
+
+/**
+ * Add the address, unspent output and spent index entries of tx, the nTx'th
+ * transaction of a block at nHeight, to update. The outputs it spends must
+ * still be in view.
+ */
+static void AddConnectToAddressIndex(const CTransaction& tx, unsigned int nTx, int nHeight, const CCoinsViewCache& view, CAddressIndexUpdate& update)
+{
+    const uint256 hash = tx.GetHash();
+    uint160 hashAddress;
+    if (!tx.IsCoinBase()) {
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const COutPoint& prevout = tx.vin[j].prevout;
+            const CTxOut& prev = view.GetOutputFor(tx.vin[j]);
+            const int nType = GetAddressIndexType(prev.scriptPubKey, hashAddress);
+            if (nType != ADDRESS_INDEX_NONE) {
+                update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(nType, hashAddress, nHeight, nTx, hash, j, true), -prev.nValue));
+                update.vUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(nType, hashAddress, prevout.hash, prevout.n), CAddressUnspentValue()));
+            }
+            update.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n), CSpentIndexValue(hash, j, nHeight, prev.nValue, nType, hashAddress)));
+        }
+    }
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const CTxOut& out = tx.vout[k];
+        const int nType = GetAddressIndexType(out.scriptPubKey, hashAddress);
+        if (nType == ADDRESS_INDEX_NONE)
+            continue;
+        update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(nType, hashAddress, nHeight, nTx, hash, k, false), out.nValue));
+        update.vUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(nType, hashAddress, hash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+    }
+}
+
+/**
+ * Add what undoes AddConnectToAddressIndex for tx to update, once the outputs
+ * it spent are back in view. Transactions are undone in reverse order, so an
+ * output both created and spent in the block ends up erased.
+ */
+static void AddDisconnectToAddressIndex(const CTransaction& tx, const CTxUndo* ptxundo, unsigned int nTx, int nHeight, const CCoinsViewCache& view, CAddressIndexUpdate& update)
+{
+    const uint256 hash = tx.GetHash();
+    uint160 hashAddress;
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const int nType = GetAddressIndexType(tx.vout[k].scriptPubKey, hashAddress);
+        if (nType == ADDRESS_INDEX_NONE)
+            continue;
+        update.vAddressIndexErase.push_back(CAddressIndexKey(nType, hashAddress, nHeight, nTx, hash, k, false));
+        update.vUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(nType, hashAddress, hash, k), CAddressUnspentValue()));
+    }
+    if (!ptxundo)
+        return;
+    for (unsigned int j = 0; j < tx.vin.size(); j++) {
+        const COutPoint& prevout = tx.vin[j].prevout;
+        const CTxOut& prev = ptxundo->vprevout[j].txout;
+        update.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n), CSpentIndexValue()));
+        const int nType = GetAddressIndexType(prev.scriptPubKey, hashAddress);
+        if (nType == ADDRESS_INDEX_NONE)
+            continue;
+        update.vAddressIndexErase.push_back(CAddressIndexKey(nType, hashAddress, nHeight, nTx, hash, j, true));
+        const CCoins* coins = view.AccessCoins(prevout.hash);
+        update.vUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(nType, hashAddress, prevout.hash, prevout.n), CAddressUnspentValue(prev.nValue, prev.scriptPubKey, coins ? coins->nHeight : 0)));
+    }
+}
+
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
@@ -2316,6 +2861,11 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
+    // Only a real disconnect changes the address indexes, not one VerifyDB
+    // makes on a scratch view (which asks whether it went cleanly)
+    const bool fUpdateAddressIndex = fAddressIndex && !pfClean;
+    CAddressIndexUpdate addressUpdate;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
@@ -2352,8 +2902,15 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                     fClean = false;
             }
         }
+
+        if (fUpdateAddressIndex)
+            AddDisconnectToAddressIndex(tx, i > 0 ? &blockUndo.vtxundo[i-1] : NULL, i, pindex->nHeight, view, addressUpdate);
     }
 
+    if (fUpdateAddressIndex)
+        if (!pblocktree->UpdateAddressIndex(addressUpdate))
+            return AbortNode(state, "Failed to write address index");
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -2375,8 +2932,10 @@ void static FlushBlockFile(bool fFinalize = false)
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
+        if (fFinalize) {
+            blockFileMaps.Drop(nLastBlockFile);
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+        }
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -2458,9 +3017,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     AssertLockHeld(cs_main);
 
     int64_t nTimeStart = GetTimeMicros();
+    const uint256 hash = pindex->GetBlockHash();
 
     // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck, !fJustCheck))
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck, !fJustCheck, &hash))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
 
     // verify that the view's current state corresponds to the previous block
@@ -2469,14 +3029,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
-    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
         if (!fJustCheck)
-            view.SetBestBlock(pindex->GetBlockHash());
+            view.SetBestBlock(hash);
         return true;
     }
 
     // Set proof-of-stake hash modifier
-    pindex->nStakeModifier = ComputeStakeModifier(pindex->pprev, block.IsProofOfStake() ? block.vtx[1].vin[0].prevout.hash : block.GetHash());
+    pindex->nStakeModifier = ComputeStakeModifier(pindex->pprev, block.IsProofOfStake() ? block.vtx[1].vin[0].prevout.hash : hash);
 
     // Check difficulty
     if (block.nBits != GetNextTargetRequired(pindex->pprev, &block, chainparams.GetConsensus(), block.IsProofOfStake()))
@@ -2502,6 +3062,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                  REJECT_INVALID, "bad-cs-proofhash");
     }
 
+    // Record the kernel while it is still in the view, the coinstake spends it below
+    CStakeRecord stakeRecord;
+    if (fStakeIndex && !fJustCheck && block.IsProofOfStake())
+        MakeStakeRecord(block, pindex->pprev, view, stakeRecord);
+
     bool fScriptChecks = true;
     if (fCheckpointsEnabled) {
         CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
@@ -2579,15 +3144,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
-    std::vector<uint256> vOrphanErase;
     std::vector<int> prevheights;
     CAmount nFees = 0;
     CAmount nActualStakeReward = 0;
     int nInputs = 0;
     int64_t nSigOpsCount = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
+    CAddressIndexUpdate addressUpdate;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
@@ -2611,17 +3173,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
             }
 
-            // Which orphan pool entries must we evict?
-            for (size_t j = 0; j < tx.vin.size(); j++) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(tx.vin[j].prevout);
-                if (itByPrev == mapOrphanTransactionsByPrev.end()) continue;
-                for (auto mi = itByPrev->second.begin(); mi != itByPrev->second.end(); ++mi) {
-                    const CTransaction& orphanTx = (*mi)->second.tx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    vOrphanErase.push_back(orphanHash);
-                }
-            }
-
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
                 return state.DoS(100, error("%s: contains a non-BIP68-final transaction", __func__),
                                  REJECT_INVALID, "bad-txns-nonfinal");
@@ -2652,14 +3203,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             control.Add(vChecks);
         }
 
+        if (fAddressIndex)
+            AddConnectToAddressIndex(tx, i, pindex->nHeight, view, addressUpdate);
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
@@ -2695,9 +3246,10 @@ CAmount blockReward = nFees + GetProofOfWorkSubsidy(pindex->nHeight, chainparams
     {
         if (pindex->GetUndoPos().IsNull()) {
             CDiskBlockPos pos;
-            if (!FindUndoPos(state, pindex->nFile, pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+            CDiskRecord record(blockundo);
+            if (!FindUndoPos(state, pindex->nFile, pos, record.vchData.size() + 40))
                 return error("ConnectBlock(): FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+            if (!UndoWriteToDisk(blockundo, record, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
                 return AbortNode(state, "Failed to write undo data");
 
             // update nUndoPos in block index
@@ -2709,9 +3261,13 @@ CAmount blockReward = nFees + GetProofOfWorkSubsidy(pindex->nHeight, chainparams
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
+    if (fAddressIndex)
+        if (!pblocktree->UpdateAddressIndex(addressUpdate))
+            return AbortNode(state, "Failed to write address index");
+
+    if (!stakeRecord.IsNull())
+        if (!pblocktree->WriteStakeIndex(pindex->GetBlockHash(), stakeRecord))
+            return AbortNode(state, "Failed to write stake index");
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -2725,13 +3281,7 @@ CAmount blockReward = nFees + GetProofOfWorkSubsidy(pindex->nHeight, chainparams
     hashPrevBestCoinBase = block.vtx[0].GetHash();
 
     // Erase orphan transactions include or precluded by this block
-    if (vOrphanErase.size()) {
-        int nErased = 0;
-        BOOST_FOREACH(uint256 &orphanHash, vOrphanErase) {
-            nErased += EraseOrphanTx(orphanHash);
-        }
-        LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", nErased);
-    }
+    orphanage.EraseForBlock(block.vtx);
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
@@ -2922,8 +3472,60 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
 
 }
 
-/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
-bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, bool fBare = false)
+/**
+ * Re-add the transactions of disconnected blocks to the mempool in one batch,
+ * parents before children, all checked against the same mempool coins view.
+ * The in-mempool descendants they pick up are accounted for in a single
+ * UpdateTransactionsFromBlock pass at the end, followed by one
+ * removeForReorg and size limit pass. With fAddToMempool false the
+ * transactions are only dropped, along with anything spending them.
+ * disconnectpool is empty afterwards.
+ */
+static void UpdateMempoolForReorg(DisconnectedBlockTransactions& disconnectpool, bool fAddToMempool)
+{
+    AssertLockHeld(cs_main);
+    std::vector<uint256> vHashUpdate;
+    CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+    // disconnectpool's insertion_order index sorts the entries from oldest to
+    // newest, but the oldest entry will be the last tx from the latest mined
+    // block that was disconnected; so iterate backwards
+    DisconnectedBlockTransactions::indexed_disconnected_transactions::index<insertion_order>::type::reverse_iterator it = disconnectpool.queuedTx.get<insertion_order>().rbegin();
+    for (; it != disconnectpool.queuedTx.get<insertion_order>().rend(); ++it) {
+        const CTransaction& tx = *it;
+        // ignore validation errors in resurrected transactions
+        list<CTransaction> removed;
+        CValidationState stateDummy;
+        if (!fAddToMempool || tx.IsCoinBase() || tx.IsCoinStake() ||
+            !AcceptToMemoryPoolWithView(mempool, stateDummy, tx, false, NULL, true, 0, &viewMemPool)) {
+            // If the transaction doesn't make it in to the mempool, remove any
+            // transactions that depend on it (which would now be orphans).
+            mempool.removeRecursive(tx, removed);
+        } else if (mempool.exists(tx.GetHash())) {
+            vHashUpdate.push_back(tx.GetHash());
+        }
+    }
+    disconnectpool.clear();
+
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in
+    // the disconnected blocks that were added back and cleans up the mempool
+    // state; vHashUpdate is in topological order, as it expects.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate, GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT));
+
+    // We also need to remove any now-immature transactions
+    mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
+    // Re-limit mempool size, in case we added any transactions
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+}
+
+/**
+ * Disconnect chainActive's tip. Unless disconnectpool is NULL the block's
+ * transactions are queued there; the caller must pass it to
+ * UpdateMempoolForReorg once done, with cs_main held.
+ */
+bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions* disconnectpool)
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
@@ -2944,25 +3546,16 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
 
-    if (!fBare) {
-        // Resurrect mempool transactions from the disconnected block.
-        std::vector<uint256> vHashUpdate;
-        BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-            // ignore validation errors in resurrected transactions
+    if (disconnectpool) {
+        // Save transactions to re-add to the mempool at the end of the reorg
+        disconnectpool->addForBlock(block.vtx);
+        while (disconnectpool->DynamicMemoryUsage() > MAX_DISCONNECTED_TX_POOL_SIZE * 1000) {
+            // Drop the most recent transactions; whatever spends them in
+            // the mempool can't be mined anymore
             list<CTransaction> removed;
-            CValidationState stateDummy;
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, true)) {
-                mempool.removeRecursive(tx, removed);
-            } else if (mempool.exists(tx.GetHash())) {
-                vHashUpdate.push_back(tx.GetHash());
-            }
+            mempool.removeRecursive(disconnectpool->queuedTx.front(), removed);
+            disconnectpool->removeOldest();
         }
-        // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
-        // no in-mempool children, which is generally not true when adding
-        // previously-confirmed transactions back to the mempool.
-        // UpdateTransactionsFromBlock finds descendants of any transactions in this
-        // block that were added back and cleans up the mempool state.
-        mempool.UpdateTransactionsFromBlock(vHashUpdate);
     }
 
     // Update chainActive and related variables.
@@ -2972,6 +3565,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
         SyncWithWallets(tx, pindexDelete->pprev, NULL);
     }
+    GetMainSignals().BlockDisconnected(block);
     return true;
 }
 
@@ -2985,7 +3579,7 @@ static int64_t nTimePostConnect = 0;
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
  */
-bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const CBlock* pblock)
+bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const CBlock* pblock, DisconnectedBlockTransactions& disconnectpool)
 {
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
@@ -3024,6 +3618,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
+    disconnectpool.removeForBlock(pblock->vtx);
     // Update chainActive & related variables.
     UpdateTip(pindexNew, chainparams);
     // Tell wallet about transactions that went from mempool
@@ -3035,6 +3630,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
         SyncWithWallets(tx, pindexNew, pblock);
     }
+    GetMainSignals().BlockConnected(*pblock, pindexNew);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
@@ -3124,9 +3720,14 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
     // Disconnect active blocks which are no longer in the best chain.
     bool fBlocksDisconnected = false;
+    DisconnectedBlockTransactions disconnectpool;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams))
+        if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+            // This is likely a fatal error, but keep the mempool consistent,
+            // just in case. Only remove from the mempool in this case.
+            UpdateMempoolForReorg(disconnectpool, false);
             return false;
+        }
         fBlocksDisconnected = true;
     }
 
@@ -3149,7 +3750,7 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
         // Connect new blocks.
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
+            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -3160,6 +3761,9 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
                     break;
                 } else {
                     // A system error occurred (disk space, database error, ...).
+                    // Make the mempool consistent with the current tip, just in case
+                    // any observers try to use it before shutdown.
+                    UpdateMempoolForReorg(disconnectpool, false);
                     return false;
                 }
             } else {
@@ -3174,8 +3778,9 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     }
 
     if (fBlocksDisconnected) {
-        mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
-        LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        // If any blocks were disconnected, disconnectpool may be non empty. Add
+        // any disconnected transactions back to the mempool.
+        UpdateMempoolForReorg(disconnectpool, true);
     }
     mempool.check(pcoinsTip);
 
@@ -3214,9 +3819,10 @@ static void NotifyHeaderTip() {
  * or an activated best chain. pblock is either NULL or a pointer to a block
  * that is already loaded (to avoid loading it again from disk).
  */
-bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, const CBlock *pblock) {
+bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, const CBlock *pblock, const uint256* phashBlock) {
     CBlockIndex *pindexMostWork = NULL;
     CBlockIndex *pindexNewTip = NULL;
+    const uint256 hashBlock = phashBlock ? *phashBlock : pblock ? pblock->GetHash() : uint256();
     do {
         boost::this_thread::interruption_point();
         if (ShutdownRequested())
@@ -3237,7 +3843,7 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
                 return true;
 
             bool fInvalidFound = false;
-            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL, fInvalidFound))
+            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && hashBlock == pindexMostWork->GetBlockHash() ? pblock : NULL, fInvalidFound))
                 return false;
 
             if (fInvalidFound) {
@@ -3306,6 +3912,7 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
     setDirtyBlockIndex.insert(pindex);
     setBlockIndexCandidates.erase(pindex);
 
+    DisconnectedBlockTransactions disconnectpool;
     while (chainActive.Contains(pindex)) {
         CBlockIndex *pindexWalk = chainActive.Tip();
         pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
@@ -3313,13 +3920,15 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
         setBlockIndexCandidates.erase(pindexWalk);
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(state, chainparams)) {
-            mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
+        if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+            UpdateMempoolForReorg(disconnectpool, false);
             return false;
         }
     }
 
-    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    // Re-add the transactions of the invalidated blocks; this also limits
+    // the mempool and removes what is no longer valid at the new tip
+    UpdateMempoolForReorg(disconnectpool, true);
 
     // The resulting new best tip may not be in setBlockIndexCandidates anymore, so
     // add it again.
@@ -3332,7 +3941,6 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
     }
 
     InvalidChainFound(pindex);
-    mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
     uiInterface.NotifyBlockTip(IsInitialBlockDownload(), pindex->pprev);
     return true;
 }
@@ -3370,17 +3978,15 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
     return true;
 }
 
-static CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+static CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate(CBlockIndex(block));
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3540,7 +4146,7 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-static bool CheckBlockSignature(const CBlock& block)
+static bool CheckBlockSignature(const CBlock& block, const uint256& hash)
 {
     if (block.IsProofOfWork())
         return block.vchBlockSig.empty();
@@ -3559,7 +4165,7 @@ static bool CheckBlockSignature(const CBlock& block)
     if (whichType == TX_PUBKEY)
     {
         vector<unsigned char>& vchPubKey = vSolutions[0];
-        return CPubKey(vchPubKey).Verify(block.GetHash(), block.vchBlockSig);
+        return CPubKey(vchPubKey).Verify(hash, block.vchBlockSig);
     }
     else
     {
@@ -3571,8 +4177,6 @@ static bool CheckBlockSignature(const CBlock& block)
         opcodetype opcode;
         vector<unsigned char> vchPushValue;
 
-        uint256 hash = block.GetHash();
-
         if (!script.GetOp(pc, opcode, vchPushValue))
             return false;
         if (opcode != OP_RETURN)
@@ -3587,20 +4191,20 @@ static bool CheckBlockSignature(const CBlock& block)
     return false;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, const uint256* phash)
 {
     // Check block version
     if (block.nVersion < 7 && consensusParams.IsProtocolV2(block.GetBlockTime()))
         return state.DoS(100, false, REJECT_OBSOLETE, "bad-version", false, strprintf("rejected nVersion=%d block", block.nVersion));
 
     // Check proof of work hash
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (fCheckPOW && !CheckProofOfWork(phash ? GetPoWHash(block, *phash) : block.GetPoWHash(), block.nBits, consensusParams))
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
 
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig)
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig, const uint256* phash)
 {
     // These are checks that are independent of context.
 
@@ -3609,7 +4213,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW && block.IsProofOfWork()))
+    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW && block.IsProofOfWork(), phash))
         return false;
 
     // Check the merkle root.
@@ -3665,7 +4269,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     }
 
     // Check proof-of-stake block signature
-    if (fCheckSig && !CheckBlockSignature(block))
+    if (fCheckSig && !CheckBlockSignature(block, phash ? *phash : block.GetHash()))
         return state.DoS(100, false, REJECT_INVALID, "bad-block-signature", false, "bad proof-of-stake block signature");
 
     // Check transactions
@@ -3707,10 +4311,9 @@ static bool CheckIndexAgainstCheckpoint(const CBlockIndex* pindexPrev, CValidati
     return true;
 }
 
-bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, CBlockIndex * const pindexPrev)
+bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, CBlockIndex * const pindexPrev, const uint256* phash)
 {
-    uint256 hash = block.GetHash();
-    if (hash == consensusParams.hashGenesisBlock)
+    if ((phash ? *phash : block.GetHash()) == consensusParams.hashGenesisBlock)
            return true;
 
     assert(pindexPrev);
@@ -3761,7 +4364,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
         nLockTimeFlags |= LOCKTIME_MEDIAN_TIME_PAST;
     }
 
-    int64_t nLockTimeCutoff = (nLockTimeFlags & LOCKTIME_MEDIAN_TIME_PAST)
+    // The genesis block, which -reindex accepts like any other, has no past
+    int64_t nLockTimeCutoff = (nLockTimeFlags & LOCKTIME_MEDIAN_TIME_PAST) && pindexPrev != NULL
                               ? pindexPrev->GetPastTimeLimit()
                               : block.GetBlockTime();
     // Check that all transactions are finalized
@@ -3812,7 +4416,7 @@ bool CheckStake(CBlock* pblock, CWallet& wallet, const CChainParams& chainparams
         }
 
         // Process this block the same as if we had received it from another node
-        if (!ProcessNewBlock(state, chainparams, NULL, pblock, true, NULL, false))
+        if (!ProcessNewBlock(state, chainparams, NULL, pblock, true, NULL, false, &hashBlock))
             return error("CheckStake() : ProcessNewBlock, block not accepted");
     }
 
@@ -3820,7 +4424,41 @@ bool CheckStake(CBlock* pblock, CWallet& wallet, const CChainParams& chainparams
 }
 
 // novacoin: attempt to generate suitable proof-of-stake
-bool SignBlock(CBlock& block, CWallet& wallet, int64_t& nFees)
+bool FindStake(CWallet& wallet, CMutableTransaction& txCoinStake, CKey& key, uint256& hashPrevBlock, unsigned int& nBits)
+{
+    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // startup timestamp
+
+    // Only the tip is needed to search for a kernel; the block itself is
+    // assembled once one is found
+    int64_t nPastTimeLimit;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        hashPrevBlock = pindexPrev->GetBlockHash();
+        nBits = GetNextTargetRequired(pindexPrev, NULL, Params().GetConsensus(), true);
+        nPastTimeLimit = pindexPrev->GetPastTimeLimit();
+    }
+
+    txCoinStake = CMutableTransaction();
+    txCoinStake.nTime = GetAdjustedTime();
+    txCoinStake.nTime &= ~Params().GetConsensus().nStakeTimestampMask;
+
+    int64_t nSearchTime = txCoinStake.nTime; // search to current time
+
+    if (nSearchTime > nLastCoinStakeSearchTime)
+    {
+        // make sure coinstake would meet timestamp protocol
+        // as it would be the same as the block timestamp
+        if (wallet.FindCoinStake(wallet, nBits, 1, txCoinStake, key) && txCoinStake.nTime >= nPastTimeLimit + 1)
+            return true;
+        nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+        nLastCoinStakeSearchTime = nSearchTime;
+    }
+
+    return false;
+}
+
+bool SignBlock(CBlock& block, CWallet& wallet, int64_t nFees, CMutableTransaction& txCoinStake, const CKey& key)
 {
     // if we are trying to sign
     // something except proof-of-stake block template
@@ -3836,52 +4474,30 @@ bool SignBlock(CBlock& block, CWallet& wallet, int64_t& nFees)
         return true;
     }
 
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // startup timestamp
-
-    CKey key;
     CMutableTransaction txCoinBase(block.vtx[0]);
-    CMutableTransaction txCoinStake;
-    txCoinStake.nTime = GetAdjustedTime();
-    txCoinStake.nTime &= ~Params().GetConsensus().nStakeTimestampMask;
-
-    int64_t nSearchTime = txCoinStake.nTime; // search to current time
-
-    if (nSearchTime > nLastCoinStakeSearchTime)
-    {
-        if (wallet.CreateCoinStake(wallet, block.nBits, 1, nFees, txCoinStake, key))
-        {
-            if (txCoinStake.nTime >= pindexBestHeader->GetPastTimeLimit()+1)
-            {
-                // make sure coinstake would meet timestamp protocol
-                // as it would be the same as the block timestamp
-                txCoinBase.nTime = block.nTime = txCoinStake.nTime;
-                block.vtx[0] = txCoinBase;
+    txCoinBase.nTime = block.nTime = txCoinStake.nTime;
+    block.vtx[0] = txCoinBase;
 
-                // we have to make sure that we have no future timestamps in
-                // our transactions set
-                for (vector<CTransaction>::iterator it = block.vtx.begin(); it != block.vtx.end();)
-                    if (it->nTime > block.nTime) { it = block.vtx.erase(it); } else { ++it; }
+    // we have to make sure that we have no future timestamps in
+    // our transactions set
+    for (vector<CTransaction>::iterator it = block.vtx.begin(); it != block.vtx.end();)
+        if (it->nTime > block.nTime) { it = block.vtx.erase(it); } else { ++it; }
 
-                block.vtx.insert(block.vtx.begin() + 1, txCoinStake);
+    if (!wallet.SignCoinStake(wallet, nFees, txCoinStake))
+        return false;
 
-                block.hashMerkleRoot = BlockMerkleRoot(block);
+    block.vtx.insert(block.vtx.begin() + 1, txCoinStake);
 
-                // append a signature to our block
-                return key.Sign(block.GetHash(), block.vchBlockSig);
-            }
-        }
-        nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-        nLastCoinStakeSearchTime = nSearchTime;
-    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
 
-    return false;
+    // append a signature to our block
+    return key.Sign(block.GetHash(), block.vchBlockSig);
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fProofOfStake=true)
+static bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fProofOfStake=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3896,7 +4512,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), !fProofOfStake))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), !fProofOfStake, &hash))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3912,11 +4528,11 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         if (fCheckpointsEnabled && !CheckIndexAgainstCheckpoint(pindexPrev, state, chainparams))
             return error("%s: CheckIndexAgainstCheckpoint(): %s", __func__, state.GetRejectReason().c_str());
 
-        if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev))
+        if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev, &hash))
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (pindex->nHeight > chainparams.GetConsensus().nLastPOWBlock)
         pindex->SetProofOfStake();
@@ -3928,7 +4544,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 }
 
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+static bool AcceptBlock(const CBlock& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
 {
     if (fNewBlock) *fNewBlock = false;
     AssertLockHeld(cs_main);
@@ -3936,7 +4552,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex, block.IsProofOfStake()))
+    if (!AcceptBlockHeader(block, hash, state, chainparams, &pindex, block.IsProofOfStake()))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3961,7 +4577,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if ((!CheckBlock(block, state, chainparams.GetConsensus())) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    if ((!CheckBlock(block, state, chainparams.GetConsensus(), true, true, true, &hash)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -3979,15 +4595,18 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
         CDiskBlockPos blockPos;
-        if (dbp != NULL)
+        if (dbp != NULL) {
             blockPos = *dbp;
-        if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
-            return error("AcceptBlock(): FindBlockPos failed");
-        if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!FindBlockPos(state, blockPos, ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION)+8, nHeight, block.GetBlockTime(), true))
+                return error("AcceptBlock(): FindBlockPos failed");
+        } else {
+            CDiskRecord record(block);
+            if (!FindBlockPos(state, blockPos, record.vchData.size()+8, nHeight, block.GetBlockTime()))
+                return error("AcceptBlock(): FindBlockPos failed");
+            if (!WriteBlockToDisk(record, blockPos, chainparams.MessageStart()))
                 AbortNode(state, "Failed to write block");
+        }
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
     } catch (const std::runtime_error& e) {
@@ -4021,7 +4640,7 @@ bool static IsCanonicalBlockSignature(const CBlock* pblock, bool checkLowS)
     return checkLowS ? IsLowDERSignature(pblock->vchBlockSig, NULL, false) : IsDERSignature(pblock->vchBlockSig, NULL, false);
 }
 
-bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool fMayBanPeerIfInvalid)
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool fMayBanPeerIfInvalid, const uint256* phash)
 {
     if (!IsCanonicalBlockSignature(pblock, false)) {
         if (pfrom && pfrom->nVersion >= CANONICAL_BLOCK_SIG_VERSION)
@@ -4035,15 +4654,18 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, C
                             REJECT_INVALID, "bad-block-signature-encoding");
     }
 
+    // The hash of an old block is its scrypt hash, so work it out only once
+    const uint256 hash = phash ? *phash : pblock->GetHash();
+
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(hash);
         fRequested |= fForceProcessing;
 
         // Store to disk
         CBlockIndex *pindex = NULL;
         bool fNewBlock = false;
-        bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fRequested, dbp, &fNewBlock);
+        bool ret = AcceptBlock(*pblock, hash, state, chainparams, &pindex, fRequested, dbp, &fNewBlock);
         if (pindex && pfrom) {
             mapBlockSource[pindex->GetBlockHash()] = std::make_pair(pfrom->GetId(), fMayBanPeerIfInvalid);
             if (fNewBlock) pfrom->nLastBlockTime = GetTime();
@@ -4055,7 +4677,7 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, C
 
     NotifyHeaderTip();
 
-    if (!ActivateBestChain(state, chainparams, pblock))
+    if (!ActivateBestChain(state, chainparams, pblock, &hash))
         return error("%s: ActivateBestChain failed", __func__);
 
     return true;
@@ -4069,14 +4691,16 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
         return error("%s: CheckIndexAgainstCheckpoint(): %s", __func__, state.GetRejectReason().c_str());
 
     CCoinsViewCache viewNew(pcoinsTip);
+    const uint256 hash = block.GetHash();
     CBlockIndex indexDummy(block);
+    indexDummy.phashBlock = &hash;
     indexDummy.pprev = pindexPrev;
     indexDummy.nHeight = pindexPrev->nHeight + 1;
 
     // NOTE: CheckBlockHeader is called by CheckBlock
-    if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev))
+    if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev, &hash))
         return error("%s: Consensus::ContextualCheckBlockHeader: %s", __func__, FormatStateMessage(state));
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), fCheckPOW, fCheckMerkleRoot))
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), fCheckPOW, fCheckMerkleRoot, true, &hash))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
     if (!ContextualCheckBlock(block, state, pindexPrev))
         return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
@@ -4138,6 +4762,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMaps.Drop(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "scho"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted scho/rev (%05u)\n", __func__, *it);
@@ -4250,30 +4875,480 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error(std::string(__func__) + ": new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB()
-{
-    const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+/** Version of the block index snapshot format */
+static const int BLOCK_INDEX_SNAPSHOT_VERSION = 2;
+
+static boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+/** Digest of the block file info, which every block written to disk changes */
+static uint256 GetBlockFileInfoHash()
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << nLastBlockFile << vinfoBlockFile;
+    return ss.GetHash();
+}
+
+/**
+ * The snapshot holds one fixed-size entry per block index entry, sorted by
+ * height, with everything LoadBlockIndexDB would otherwise compute: chain
+ * work, chain tx count, skip pointer and candidate flag. Parents and skip
+ * targets are referred to by their position in the file. The snapshot carries
+ * a random id that is also stored in the block tree database, and the
+ * database forgets the id as soon as the block index is written again. Builds
+ * that predate snapshots keep the id, so the snapshot also records the best
+ * block of the chainstate and a digest of the block file info: any block such
+ * a build connects or stores changes one of them.
+ */
+bool WriteBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+    // The snapshot must match the database exactly, so only a fully flushed
+    // index is written
+    if (fReindex || mapBlockIndex.empty() || !setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty() || pcoinsTip == NULL)
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    // Generate random temporary filename
+    const uint256 id = GetRandHash();
+    unsigned short randv = 0;
+    GetRandBytes((unsigned char*)&randv, sizeof(randv));
+    boost::filesystem::path pathTmp = GetDataDir() / "blocks" / strprintf("index.snapshot.%04x", randv);
+
+    CDataStream ssIndex(SER_DISK, CLIENT_VERSION);
+    ssIndex << FLATDATA(Params().MessageStart());
+    ssIndex << BLOCK_INDEX_SNAPSHOT_VERSION << id << pcoinsTip->GetBestBlock() << GetBlockFileInfoHash();
+    ssIndex << (uint32_t)vSortedByHeight.size();
+    map<const CBlockIndex*, int32_t> mapPos;
+    int32_t nPos = 0;
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        // Parents and skip targets are lower, so they have a position already
+        const CBlockIndex* pindex = item.second;
+        const int32_t nPrev = pindex->pprev ? mapPos.at(pindex->pprev) : -1;
+        const int32_t nSkip = pindex->pskip ? mapPos.at(pindex->pskip) : -1;
+        const bool fCandidate = pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL);
+        mapPos[pindex] = nPos++;
+        ssIndex << pindex->GetBlockHash() << nPrev << nSkip;
+        ssIndex << pindex->nHeight << pindex->nFile << pindex->nDataPos << pindex->nUndoPos;
+        ssIndex << pindex->nTx << pindex->nChainTx << pindex->nStatus << pindex->nStakeModifier;
+        ssIndex << pindex->nVersion << pindex->hashMerkleRoot << pindex->nTime << pindex->nBits << pindex->nNonce;
+        ssIndex << ArithToUint256(pindex->nChainWork) << fCandidate;
+    }
+    uint256 hash = Hash(ssIndex.begin(), ssIndex.end());
+    ssIndex << hash;
+
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: Failed to open file %s", __func__, pathTmp.string());
+    try {
+        fileout << ssIndex;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!RenameOver(pathTmp, GetBlockIndexSnapshotPath()))
+        return error("%s: Rename-into-place failed", __func__);
+
+    // Only now is the snapshot complete enough to be matched
+    if (!pblocktree->WriteIndexSnapshotId(id))
+        return error("%s: Failed to write the snapshot id", __func__);
+
+    LogPrintf("%s: wrote %u block index entries in %dms\n", __func__, vSortedByHeight.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Load the block index from its snapshot, if the block tree database still
+ * matches it. The block file info must have been loaded already.
+ */
+static bool LoadBlockIndexSnapshot()
+{
+    uint256 idExpected;
+    if (!pblocktree->ReadIndexSnapshotId(idExpected))
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    FILE *file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: Failed to open file %s", __func__, path.string());
+
+    // Read the whole snapshot in one go, and check it before using any of it
+    uint64_t fileSize = boost::filesystem::file_size(path);
+    if (fileSize < sizeof(uint256))
+        return error("%s: Snapshot %s is truncated", __func__, path.string());
+    CDataStream ssIndex(SER_DISK, CLIENT_VERSION);
+    ssIndex.resize(fileSize - sizeof(uint256));
+    uint256 hashIn;
+    try {
+        if (!ssIndex.empty())
+            filein.read(&ssIndex[0], ssIndex.size());
+        filein >> hashIn;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    filein.fclose();
+
+    if (hashIn != Hash(ssIndex.begin(), ssIndex.end()))
+        return error("%s: Checksum mismatch, data corrupted", __func__);
+
+    vector<CBlockIndex*> vIndex;
+    vector<bool> vCandidate;
+    try {
+        unsigned char pchMsgTmp[4];
+        int nSnapshotVersion;
+        uint256 id, hashBestBlock, hashBlockFileInfo;
+        uint32_t nCount;
+        ssIndex >> FLATDATA(pchMsgTmp) >> nSnapshotVersion;
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)) || nSnapshotVersion != BLOCK_INDEX_SNAPSHOT_VERSION)
+            return error("%s: Snapshot does not match the block tree database", __func__);
+        ssIndex >> id >> hashBestBlock >> hashBlockFileInfo >> nCount;
+        if (id != idExpected)
+            return error("%s: Snapshot does not match the block tree database", __func__);
+        if (hashBestBlock != pcoinsTip->GetBestBlock() || hashBlockFileInfo != GetBlockFileInfoHash())
+            return error("%s: Blocks were stored or connected since the snapshot was written", __func__);
+
+        vIndex.reserve(nCount);
+        vCandidate.reserve(nCount);
+        mapBlockIndex.reserve(nCount);
+        for (uint32_t i = 0; i < nCount; i++) {
+            uint256 hashBlock, chainWork;
+            int32_t nPrev, nSkip;
+            bool fCandidate;
+            ssIndex >> hashBlock >> nPrev >> nSkip;
+            if (nPrev < -1 || nPrev >= (int32_t)i || nSkip < -1 || nSkip >= (int32_t)i)
+                throw std::runtime_error("entry refers to a later one");
+            CBlockIndex* pindex = InsertBlockIndex(hashBlock);
+            if (pindex == NULL || mapBlockIndex.size() != i + 1)
+                throw std::runtime_error("duplicate entry");
+            vIndex.push_back(pindex);
+            pindex->pprev = nPrev >= 0 ? vIndex[nPrev] : NULL;
+            pindex->pskip = nSkip >= 0 ? vIndex[nSkip] : NULL;
+            ssIndex >> pindex->nHeight >> pindex->nFile >> pindex->nDataPos >> pindex->nUndoPos;
+            ssIndex >> pindex->nTx >> pindex->nChainTx >> pindex->nStatus >> pindex->nStakeModifier;
+            ssIndex >> pindex->nVersion >> pindex->hashMerkleRoot >> pindex->nTime >> pindex->nBits >> pindex->nNonce;
+            ssIndex >> chainWork >> fCandidate;
+            pindex->nChainWork = UintToArith256(chainWork);
+            vCandidate.push_back(fCandidate);
+        }
+    }
+    catch (const std::exception& e) {
+        // Leave nothing behind for the database path to trip over
+        mapBlockIndex.clear();
+        blockIndexArena.Clear();
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // What is left to do takes a single pass over entries sorted by height
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        CBlockIndex* pindex = vIndex[i];
+        if (pindex->nTx > 0 && pindex->pprev && !pindex->pprev->nChainTx)
+            mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
+        if (vCandidate[i])
+            setBlockIndexCandidates.insert(pindex);
+        if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
+            pindexBestInvalid = pindex;
+        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+            pindexBestHeader = pindex;
+    }
+
+    LogPrintf("%s: loaded %u block index entries from %s in %dms\n", __func__, vIndex.size(), path.string(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/** Version of the UTXO set snapshot format */
+static const int TXOUTSET_SNAPSHOT_VERSION = 1;
+/** Bytes of a UTXO set snapshot that are written out or hashed at once */
+static const size_t TXOUTSET_SNAPSHOT_BUFFER = 1 << 20;
+
+/** Append what is collected in ss to the snapshot file and its hash */
+static void WriteTxOutSetSnapshotData(CDataStream& ss, CHashWriter& hasher, CAutoFile& fileout)
+{
+    if (ss.empty())
+        return;
+    hasher.write(&ss[0], ss.size());
+    fileout.write(&ss[0], ss.size());
+    ss.clear();
+}
+
+/**
+ * A UTXO set snapshot starts with the block it was taken at, followed by the
+ * hash, header, transaction count, stake modifier and proof-of-stake flag of
+ * every block of its chain after the genesis block: all a node needs to
+ * validate the blocks that follow without having those before. Then come the
+ * coins of each transaction as the chainstate database stores them, in txid
+ * order and ended by a null txid, their count, and the double SHA256 of
+ * everything before. Nothing in it depends on the node that wrote it, so the
+ * hash of a snapshot taken at a given block can be pinned in the chain
+ * parameters.
+ */
+bool DumpTxOutSetSnapshot(CCoinsView* coinsview, const boost::filesystem::path& path, CTxOutSetSnapshotInfo& info)
+{
+    int64_t nStart = GetTimeMillis();
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(coinsview->Cursor());
+    info.hashBlock = pcursor->GetBestBlock();
+
+    // Block index entries never move, so only collecting them needs the lock
+    vector<const CBlockIndex*> vChain;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(info.hashBlock);
+        if (it == mapBlockIndex.end())
+            return error("%s: Block %s of the UTXO set is not in the block index", __func__, info.hashBlock.ToString());
+        for (const CBlockIndex* pindex = it->second; pindex->pprev; pindex = pindex->pprev)
+            vChain.push_back(pindex);
+    }
+    reverse(vChain.begin(), vChain.end());
+    info.nHeight = vChain.size();
+    info.nTransactions = 0;
+
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: Failed to open file %s", __func__, pathTmp.string());
+
+    CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    try {
+        ss << FLATDATA(Params().MessageStart()) << TXOUTSET_SNAPSHOT_VERSION << info.hashBlock << info.nHeight;
+        BOOST_FOREACH(const CBlockIndex* pindex, vChain) {
+            ss << pindex->GetBlockHash() << pindex->nVersion << pindex->hashMerkleRoot << pindex->nTime << pindex->nBits << pindex->nNonce;
+            ss << pindex->nTx << pindex->nStakeModifier << pindex->IsProofOfStake();
+            if (ss.size() >= TXOUTSET_SNAPSHOT_BUFFER)
+                WriteTxOutSetSnapshotData(ss, hasher, fileout);
+        }
+
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            CCoins coins;
+            if (!pcursor->GetKey(txid) || !pcursor->GetValue(coins))
+                return error("%s: unable to read value", __func__);
+            ss << txid << coins;
+            info.nTransactions++;
+            if (ss.size() >= TXOUTSET_SNAPSHOT_BUFFER)
+                WriteTxOutSetSnapshotData(ss, hasher, fileout);
+            pcursor->Next();
+        }
+        ss << uint256() << info.nTransactions;
+        WriteTxOutSetSnapshotData(ss, hasher, fileout);
+
+        info.hashSnapshot = hasher.GetHash();
+        fileout << info.hashSnapshot;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!RenameOver(pathTmp, path))
+        return error("%s: Rename-into-place failed", __func__);
+
+    LogPrintf("%s: wrote %u transactions at height %d to %s in %dms\n", __func__, info.nTransactions, info.nHeight, path.string(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Nothing is written before the whole file has been hashed and the hash
+ * matched against the chain parameters. The coins then go into the database
+ * in batches as large as the coins cache, and as the snapshot has them in
+ * txid order, each batch covers a range of keys of its own. Until the block
+ * index and the best block are written at the end, a flag in the block tree
+ * database tells the next startup that the chainstate is incomplete.
+ */
+bool LoadTxOutSetSnapshot(const CChainParams& chainparams, CCoinsView* coinsview, const boost::filesystem::path& path)
+{
+    LOCK(cs_main);
+    if (chainActive.Height() > 0 || mapBlockIndex.size() != 1)
+        return error("%s: A UTXO set snapshot can only be loaded into a new data directory", __func__);
+
+    int64_t nStart = GetTimeMillis();
+    FILE *file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: Failed to open file %s", __func__, path.string());
+    uint64_t fileSize = boost::filesystem::file_size(path);
+    if (fileSize < sizeof(uint256))
+        return error("%s: Snapshot %s is truncated", __func__, path.string());
+
+    uint256 hashBlock, hashSnapshot, hashIn;
+    int nHeight;
+    try {
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        std::vector<char> vBuffer(TXOUTSET_SNAPSHOT_BUFFER);
+        for (uint64_t nLeft = fileSize - sizeof(uint256); nLeft > 0; ) {
+            size_t nRead = std::min<uint64_t>(nLeft, vBuffer.size());
+            filein.read(&vBuffer[0], nRead);
+            hasher.write(&vBuffer[0], nRead);
+            nLeft -= nRead;
+        }
+        filein >> hashIn;
+        hashSnapshot = hasher.GetHash();
+
+        unsigned char pchMsgTmp[4];
+        int nSnapshotVersion;
+        rewind(filein.Get());
+        filein >> FLATDATA(pchMsgTmp) >> nSnapshotVersion >> hashBlock >> nHeight;
+        if (memcmp(pchMsgTmp, chainparams.MessageStart(), sizeof(pchMsgTmp)) || nSnapshotVersion != TXOUTSET_SNAPSHOT_VERSION)
+            return error("%s: %s is not a UTXO set snapshot of this network", __func__, path.string());
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (hashSnapshot != hashIn)
+        return error("%s: Checksum mismatch, data corrupted", __func__);
+    MapTxOutSetSnapshots::const_iterator itPinned = chainparams.TxOutSetSnapshots().find(nHeight);
+    if (itPinned == chainparams.TxOutSetSnapshots().end() || itPinned->second.hashBlock != hashBlock || itPinned->second.hashSnapshot != hashSnapshot)
+        return error("%s: The snapshot of block %s at height %d with hash %s is not one the chain parameters accept", __func__, hashBlock.ToString(), nHeight, hashSnapshot.ToString());
+    LogPrintf("%s: loading the UTXO set of block %s at height %d\n", __func__, hashBlock.ToString(), nHeight);
+
+    // The genesis block is in the index, though not connected yet at startup
+    CBlockIndex* pindexPrev = mapBlockIndex.begin()->second;
+    if (pindexPrev->GetBlockHash() != chainparams.GetConsensus().hashGenesisBlock)
+        return error("%s: Wrong genesis block", __func__);
+    uint64_t nTransactions = 0;
+    try {
+        for (int i = 0; i < nHeight; i++) {
+            uint256 hash;
+            bool fProofOfStake;
+            filein >> hash;
+            CBlockIndex* pindex = InsertBlockIndex(hash);
+            if (pindex == NULL || mapBlockIndex.size() != (size_t)i + 2)
+                throw std::runtime_error("duplicate block");
+            filein >> pindex->nVersion >> pindex->hashMerkleRoot >> pindex->nTime >> pindex->nBits >> pindex->nNonce;
+            filein >> pindex->nTx >> pindex->nStakeModifier >> fProofOfStake;
+            if (pindex->nTx == 0)
+                throw std::runtime_error("block without transactions");
+            pindex->pprev = pindexPrev;
+            pindex->nHeight = pindexPrev->nHeight + 1;
+            pindex->BuildSkip();
+            pindex->nChainWork = pindexPrev->nChainWork + GetBlockProof(*pindex);
+            pindex->nChainTx = pindexPrev->nChainTx + pindex->nTx;
+            pindex->nStatus = BLOCK_VALID_SCRIPTS;
+            if (fProofOfStake)
+                pindex->SetProofOfStake();
+            setDirtyBlockIndex.insert(pindex);
+            pindexPrev = pindex;
+        }
+        if (pindexPrev->GetBlockHash() != hashBlock)
+            throw std::runtime_error("chain does not end at the block of the snapshot");
+
+        pblocktree->WriteFlag("txoutsetloading", true);
+        CCoinsMap mapCoins;
+        size_t nBatchUsage = 0;
+        while (true) {
+            uint256 txid;
+            filein >> txid;
+            if (txid.IsNull())
+                break;
+            CCoinsCacheEntry& entry = mapCoins[txid];
+            filein >> entry.coins;
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            nBatchUsage += entry.coins.DynamicMemoryUsage();
+            nTransactions++;
+            if (nBatchUsage >= nCoinCacheUsage) {
+                if (!coinsview->BatchWrite(mapCoins, uint256()))
+                    return error("%s: Failed to write to coin database", __func__);
+                nBatchUsage = 0;
+                int nPercent = ftell(filein.Get()) * 100 / fileSize;
+                LogPrintf("%s: %u transactions loaded (%d%%)\n", __func__, nTransactions, nPercent);
+                uiInterface.ShowProgress(_("Loading UTXO set snapshot..."), nPercent);
+            }
+        }
+        if (!coinsview->BatchWrite(mapCoins, uint256()))
+            return error("%s: Failed to write to coin database", __func__);
+        uiInterface.ShowProgress("", 100);
+
+        uint64_t nTransactionsIn;
+        filein >> nTransactionsIn;
+        if (nTransactionsIn != nTransactions || (uint64_t)ftell(filein.Get()) != fileSize - sizeof(uint256))
+            throw std::runtime_error("transaction count mismatch");
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // The blocks before the snapshot are missing as if they had been pruned
+    pblocktree->WriteFlag("txoutsetsnapshot", true);
+    pblocktree->WriteFlag("prunedblockfiles", true);
+    fTxOutSetSnapshot = true;
+    fHavePruned = true;
+
+    setBlockIndexCandidates.insert(pindexPrev);
+    if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexPrev->nChainWork)
+        pindexBestHeader = pindexPrev;
+    pcoinsTip->SetBestBlock(hashBlock);
+    chainActive.SetTip(pindexPrev);
+    PruneBlockIndexCandidates();
+
+    // Block index first and then the best block, as with every flush
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return error("%s: %s", __func__, FormatStateMessage(state));
+    pblocktree->WriteFlag("txoutsetloading", false);
+
+    LogPrintf("%s: loaded %u transactions at height %d from %s in %dms\n", __func__, nTransactions, nHeight, path.string(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool static LoadBlockIndexDB()
+{
+    const CChainParams& chainparams = Params();
+
+    // Load block file info
+    pblocktree->ReadLastBlockFile(nLastBlockFile);
+    vinfoBlockFile.resize(nLastBlockFile + 1);
+    LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
+    for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
+        pblocktree->ReadBlockFileInfo(nFile, vinfoBlockFile[nFile]);
+    }
+    LogPrintf("%s: last block file info: %s\n", __func__, vinfoBlockFile[nLastBlockFile].ToString());
+    for (int nFile = nLastBlockFile + 1; true; nFile++) {
+        CBlockFileInfo info;
+        if (pblocktree->ReadBlockFileInfo(nFile, info)) {
+            vinfoBlockFile.push_back(info);
+        } else {
+            break;
+        }
+    }
+
+    const bool fFromSnapshot = LoadBlockIndexSnapshot();
+    if (!fFromSnapshot && !pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
         return false;
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
+    // Calculate nChainWork, unless the snapshot came with it
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+    if (!fFromSnapshot) {
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        }
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
@@ -4304,23 +5379,6 @@ bool static LoadBlockIndexDB()
             pindexBestHeader = pindex;
     }
 
-    // Load block file info
-    pblocktree->ReadLastBlockFile(nLastBlockFile);
-    vinfoBlockFile.resize(nLastBlockFile + 1);
-    LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
-    for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
-        pblocktree->ReadBlockFileInfo(nFile, vinfoBlockFile[nFile]);
-    }
-    LogPrintf("%s: last block file info: %s\n", __func__, vinfoBlockFile[nLastBlockFile].ToString());
-    for (int nFile = nLastBlockFile + 1; true; nFile++) {
-        CBlockFileInfo info;
-        if (pblocktree->ReadBlockFileInfo(nFile, info)) {
-            vinfoBlockFile.push_back(info);
-        } else {
-            break;
-        }
-    }
-
     // Check presence of scho files
     LogPrintf("Checking all scho files are present...\n");
     set<int> setBlkDataFiles;
@@ -4344,14 +5402,25 @@ bool static LoadBlockIndexDB()
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chainstate came from a UTXO set snapshot, and whether loading it was completed
+    pblocktree->ReadFlag("txoutsetsnapshot", fTxOutSetSnapshot);
+    bool fTxOutSetLoading = false;
+    pblocktree->ReadFlag("txoutsetloading", fTxOutSetLoading);
+    if (fTxOutSetLoading)
+        return error("%s: Loading a UTXO set snapshot was interrupted, the chainstate is incomplete. Restart with -reindex", __func__);
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
+    // Check whether we have an address index
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+
+    // Check whether we have a stake index
+    pblocktree->ReadFlag("stakeindex", fStakeIndex);
+    LogPrintf("%s: stake index %s\n", __func__, fStakeIndex ? "enabled" : "disabled");
 
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
@@ -4411,8 +5480,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
+        if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruned or loaded from a UTXO set snapshot, only go back as far as we have data.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
@@ -4490,7 +5559,7 @@ bool RewindBlockIndex(const CChainParams& params)
             // of the blockchain).
             break;
         }
-        if (!DisconnectTip(state, params, true)) {
+        if (!DisconnectTip(state, params, NULL)) {
             return error("RewindBlockIndex: unable to disconnect block at height %i", pindex->nHeight);
         }
         // Occasionally flush state to disk.
@@ -4533,8 +5602,7 @@ void UnloadBlockIndex()
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
+    orphanage.clear();
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4552,11 +5620,11 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
+    blockFileMaps.Clear();
     fHavePruned = false;
+    fTxOutSetSnapshot = false;
 }
 
 bool LoadBlockIndex()
@@ -4578,9 +5646,11 @@ bool InitBlockIndex(const CChainParams& chainparams)
     if (chainActive.Genesis() != NULL)
         return true;
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
-    pblocktree->WriteFlag("txindex", fTxIndex);
+    // Use the provided setting for -addressindex and -stakeindex in the new database
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fStakeIndex = GetBoolArg("-stakeindex", DEFAULT_STAKEINDEX);
+    pblocktree->WriteFlag("stakeindex", fStakeIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4588,14 +5658,14 @@ bool InitBlockIndex(const CChainParams& chainparams)
         try {
             CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            CDiskRecord record(block);
             CDiskBlockPos blockPos;
             CValidationState state;
-            if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
+            if (!FindBlockPos(state, blockPos, record.vchData.size()+8, 0, block.GetBlockTime()))
                 return error("LoadBlockIndex(): FindBlockPos failed");
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(record, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
-            CBlockIndex *pindex = AddToBlockIndex(block);
+            CBlockIndex *pindex = AddToBlockIndex(block, block.GetHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("LoadBlockIndex(): genesis block not accepted");
             // Force a chainstate write so that when we VerifyDB in a moment, it doesn't check stale data
@@ -4626,6 +5696,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
             nRewind++; // start one byte further next time, in case of failure
             schodat.SetLimit(); // remove former limit
             unsigned int nSize = 0;
+            bool fCompressed;
             try {
                 // locate a header
                 unsigned char buf[MESSAGE_START_SIZE];
@@ -4636,7 +5707,9 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                     continue;
                 // read size
                 schodat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                fCompressed = (nSize & DISK_RECORD_COMPRESSED) != 0;
+                nSize &= ~DISK_RECORD_COMPRESSED;
+                if (nSize < (fCompressed ? sizeof(uint32_t) : 80) || nSize > MAX_BLOCK_SIZE)
                     continue;
             } catch (const std::exception&) {
                 // no valid block header found; don't complain
@@ -4650,7 +5723,14 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 schodat.SetLimit(nBlockPos + nSize);
                 schodat.SetPos(nBlockPos);
                 CBlock block;
-                schodat >> block;
+                if (fCompressed) {
+                    CDataStream* pss = ReadCompressedRecord(schodat, nSize);
+                    if (!pss)
+                        throw std::ios_base::failure("malformed compressed block");
+                    *pss >> block;
+                } else {
+                    schodat >> block;
+                }
                 nRewind = schodat.GetPos();
 
                 // detect out of order blocks, and store them for later
@@ -4667,7 +5747,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
                     LOCK(cs_main);
                     CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
+                    if (AcceptBlock(block, hash, state, chainparams, NULL, true, dbp, NULL))
                         nLoaded++;
                     if (state.IsError())
                         break;
@@ -4696,14 +5776,15 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                         std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
                         if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
                         {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                            const uint256 hashChild = block.GetHash();
+                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, hashChild.ToString(),
                                     head.ToString());
                             LOCK(cs_main);
                             CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
+                            if (AcceptBlock(block, hashChild, dummy, chainparams, NULL, true, &it->second, NULL))
                             {
                                 nLoaded++;
-                                queue.push_back(block.GetHash());
+                                queue.push_back(hashChild);
                             }
                         }
                         range.first++;
@@ -4723,6 +5804,298 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0;
 }
 
+namespace {
+
+/** A block found in the block files by -reindex */
+struct CReindexBlock
+{
+    uint256 hash;
+    uint256 hashPrev;
+    CDiskBlockPos pos;
+};
+
+/**
+ * Find every block in block file nFile. Only the header is deserialized, which
+ * is enough to link the block to its parent, and the rest of it is skipped.
+ */
+void ScanBlockFile(const CChainParams& chainparams, int nFile, std::vector<CReindexBlock>& vBlocksRet)
+{
+    FILE* fileIn = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+    if (!fileIn)
+        return; // This error is logged in OpenBlockFile
+
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile schodat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = schodat.GetPos();
+        while (!schodat.eof()) {
+            boost::this_thread::interruption_point();
+
+            schodat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            schodat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            bool fCompressed;
+            try {
+                // locate a header
+                unsigned char buf[MESSAGE_START_SIZE];
+                schodat.FindByte(chainparams.MessageStart()[0]);
+                nRewind = schodat.GetPos()+1;
+                schodat >> FLATDATA(buf);
+                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                schodat >> nSize;
+                fCompressed = (nSize & DISK_RECORD_COMPRESSED) != 0;
+                nSize &= ~DISK_RECORD_COMPRESSED;
+                if (nSize < (fCompressed ? sizeof(uint32_t) : 80) || nSize > MAX_BLOCK_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            try {
+                uint64_t nBlockPos = schodat.GetPos();
+                schodat.SetLimit(nBlockPos + nSize);
+                CBlockHeader header;
+                if (fCompressed) {
+                    // The header is at the start, but only the whole block decompresses
+                    CDataStream* pss = ReadCompressedRecord(schodat, nSize);
+                    if (!pss)
+                        throw std::ios_base::failure("malformed compressed block");
+                    *pss >> header;
+                } else {
+                    schodat >> header;
+                }
+
+                CReindexBlock block;
+                block.hash = header.GetHash();
+                block.hashPrev = header.hashPrevBlock;
+                block.pos = CDiskBlockPos(nFile, nBlockPos);
+                vBlocksRet.push_back(block);
+
+                // skip the transactions
+                if (!schodat.Seek(nBlockPos + nSize))
+                    break;
+                nRewind = nBlockPos + nSize;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    LogPrintf("Reindexing block file scho%05u.dat: %u blocks\n", (unsigned int)nFile, vBlocksRet.size());
+}
+
+void ThreadScanBlockFiles(const CChainParams& chainparams, std::vector<std::vector<CReindexBlock> >& vFiles, std::atomic<int>& nNextFile)
+{
+    int nFile;
+    while ((nFile = nNextFile++) < (int)vFiles.size())
+        ScanBlockFile(chainparams, nFile, vFiles[nFile]);
+}
+
+/**
+ * Put the blocks in the order they can be indexed in: the order of the files,
+ * except that a block waits for its parent. A block found twice is indexed
+ * once, and a block whose parent is in none of the files is left out.
+ */
+void OrderReindexBlocks(const CChainParams& chainparams, const std::vector<std::vector<CReindexBlock> >& vFiles, std::vector<const CReindexBlock*>& vOrderRet)
+{
+    AssertLockHeld(cs_main);
+    std::set<uint256> setOrdered;
+    std::multimap<uint256, const CReindexBlock*> mapBlocksUnknownParent;
+    BOOST_FOREACH(const std::vector<CReindexBlock>& vBlocks, vFiles) {
+        BOOST_FOREACH(const CReindexBlock& block, vBlocks) {
+            if (block.hash != chainparams.GetConsensus().hashGenesisBlock && !setOrdered.count(block.hashPrev) && !mapBlockIndex.count(block.hashPrev)) {
+                LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, block.hash.ToString(),
+                        block.hashPrev.ToString());
+                mapBlocksUnknownParent.insert(std::make_pair(block.hashPrev, &block));
+                continue;
+            }
+
+            // Place the block and, recursively, its earlier encountered successors
+            std::deque<const CReindexBlock*> queue;
+            queue.push_back(&block);
+            while (!queue.empty()) {
+                const CReindexBlock* pblock = queue.front();
+                queue.pop_front();
+                if (!setOrdered.insert(pblock->hash).second)
+                    continue;
+                vOrderRet.push_back(pblock);
+                std::pair<std::multimap<uint256, const CReindexBlock*>::iterator, std::multimap<uint256, const CReindexBlock*>::iterator> range = mapBlocksUnknownParent.equal_range(pblock->hash);
+                for (std::multimap<uint256, const CReindexBlock*>::iterator it = range.first; it != range.second; ++it)
+                    queue.push_back(it->second);
+                mapBlocksUnknownParent.erase(range.first, range.second);
+            }
+        }
+    }
+    if (!mapBlocksUnknownParent.empty())
+        LogPrintf("%s: %u blocks left out, their parent is in none of the block files\n", __func__, mapBlocksUnknownParent.size());
+}
+
+/**
+ * Reads the blocks in vOrder and runs the context-free checks on them, ahead
+ * of the thread that indexes and connects them, which gets them from Take().
+ * CheckBlock caches its result in the block, so AcceptBlock and ConnectBlock
+ * do not repeat it.
+ */
+class CReindexPrefetcher
+{
+private:
+    const Consensus::Params& consensusParams;
+    const std::vector<const CReindexBlock*>& vOrder;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! Next block a reader thread reads
+    size_t nNextRead;
+    //! Next block Take() returns
+    size_t nNextTake;
+    //! Blocks read but not taken yet, NULL where reading failed
+    std::map<size_t, std::shared_ptr<CBlock> > mapRead;
+
+public:
+    CReindexPrefetcher(const Consensus::Params& consensusParamsIn, const std::vector<const CReindexBlock*>& vOrderIn) :
+        consensusParams(consensusParamsIn), vOrder(vOrderIn), nNextRead(0), nNextTake(0) {}
+
+    void ThreadRead()
+    {
+        while (true) {
+            size_t n;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (nNextRead < vOrder.size() && nNextRead >= nNextTake + REINDEX_PREFETCH_BLOCKS)
+                    cond.wait(lock);
+                if (nNextRead == vOrder.size())
+                    return;
+                n = nNextRead++;
+            }
+
+            std::shared_ptr<CBlock> pblock(new CBlock());
+            if (!ReadBlockFromDisk(*pblock, vOrder[n]->pos, consensusParams) || pblock->GetHash() != vOrder[n]->hash) {
+                LogPrintf("%s: no block %s at %s\n", __func__, vOrder[n]->hash.ToString(), vOrder[n]->pos.ToString());
+                pblock.reset();
+            } else {
+                CValidationState state;
+                CheckBlock(*pblock, state, consensusParams, true, true, true, &vOrder[n]->hash);
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                mapRead[n] = pblock;
+            }
+            cond.notify_all();
+        }
+    }
+
+    /** The next block of vOrder, or NULL if it could not be read */
+    std::shared_ptr<CBlock> Take()
+    {
+        std::shared_ptr<CBlock> pblock;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            std::map<size_t, std::shared_ptr<CBlock> >::iterator it;
+            while ((it = mapRead.find(nNextTake)) == mapRead.end())
+                cond.wait(lock);
+            pblock = it->second;
+            mapRead.erase(it);
+            nNextTake++;
+        }
+        cond.notify_all();
+        return pblock;
+    }
+};
+
+/** Wait for threads, making sure they are gone before their shared state when this thread is interrupted */
+void JoinReindexThreads(boost::thread_group& threads)
+{
+    try {
+        threads.join_all();
+    } catch (const boost::thread_interrupted&) {
+        threads.interrupt_all();
+        threads.join_all();
+        throw;
+    }
+}
+
+} // anon namespace
+
+bool ReindexBlockFiles(const CChainParams& chainparams)
+{
+    int64_t nStart = GetTimeMillis();
+    int nFiles = 0;
+    while (boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nFiles, 0), "scho")))
+        nFiles++;
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_SCRIPTCHECK_THREADS));
+
+    // Stage one: find the blocks in all files at once
+    std::vector<std::vector<CReindexBlock> > vFiles(nFiles);
+    {
+        std::atomic<int> nNextFile(0);
+        boost::thread_group scanThreads;
+        for (int i = 0; i < std::min(nThreads, nFiles); i++)
+            scanThreads.create_thread(boost::bind(&ThreadScanBlockFiles, boost::cref(chainparams), boost::ref(vFiles), boost::ref(nNextFile)));
+        JoinReindexThreads(scanThreads);
+    }
+
+    // Stage two: decide the order to index them in
+    std::vector<const CReindexBlock*> vOrder;
+    {
+        LOCK(cs_main);
+        OrderReindexBlocks(chainparams, vFiles, vOrder);
+    }
+    LogPrintf("Found %u blocks in %d block files in %dms\n", vOrder.size(), nFiles, GetTimeMillis() - nStart);
+
+    // Stage three: index and connect them, while the next ones are read and checked
+    CReindexPrefetcher prefetcher(chainparams.GetConsensus(), vOrder);
+    boost::thread_group readThreads;
+    for (int i = 0; i < nThreads; i++)
+        readThreads.create_thread(boost::bind(&CReindexPrefetcher::ThreadRead, &prefetcher));
+
+    int nLoaded = 0;
+    bool fOk = true;
+    try {
+        for (size_t i = 0; i < vOrder.size(); i++) {
+            boost::this_thread::interruption_point();
+            std::shared_ptr<CBlock> pblock = prefetcher.Take();
+            if (!pblock)
+                continue;
+
+            CDiskBlockPos pos = vOrder[i]->pos;
+            CValidationState state;
+            bool fAccepted;
+            {
+                LOCK(cs_main);
+                fAccepted = AcceptBlock(*pblock, vOrder[i]->hash, state, chainparams, NULL, true, &pos, NULL);
+            }
+            if (state.IsError()) {
+                fOk = false;
+                break;
+            }
+            NotifyHeaderTip();
+
+            // Connect it while it is in memory, instead of reading it again afterwards
+            if (fAccepted) {
+                nLoaded++;
+                if (!ActivateBestChain(state, chainparams, pblock.get(), &vOrder[i]->hash)) {
+                    fOk = false;
+                    break;
+                }
+            }
+        }
+    } catch (const boost::thread_interrupted&) {
+        readThreads.interrupt_all();
+        readThreads.join_all();
+        throw;
+    }
+    readThreads.interrupt_all();
+    JoinReindexThreads(readThreads);
+
+    LogPrintf("Reindexed %i blocks in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return fOk;
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -4983,7 +6356,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
             // requesting or processing some txs which have already been included in a block
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
-                   mapOrphanTransactions.count(inv.hash) ||
+                   orphanage.HaveTx(inv.hash) ||
                    pcoinsTip->HaveCoinsInCache(inv.hash);
         }
     case MSG_BLOCK:
@@ -5049,11 +6422,16 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
+                    // Send block from disk. A full block goes out as it is on disk,
+                    // without deserializing it and serializing it again.
+                    std::shared_ptr<const CMappedFile> pmap;
+                    const char *pbegin, *pend;
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    if (inv.type == MSG_BLOCK && GetRawBlockFromDisk((*mi).second, pmap, pbegin, pend))
+                        pfrom->PushMessage(NetMsgType::BLOCK, CFlatData((void*)pbegin, (void*)pend));
+                    else if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    else if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage(NetMsgType::BLOCK, block);
                     /*
                     // Disable BIP152
@@ -5162,6 +6540,53 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
+/**
+ * Reconsider up to nMax orphans from peer's work set, whose parents have been
+ * accepted since they arrived. Accepted orphans queue their own children.
+ */
+static void ProcessOrphanTxs(NodeId peer, unsigned int nMax) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CTransaction orphanTx;
+    NodeId fromPeer;
+    for (unsigned int i = 0; i < nMax && orphanage.GetTxToReconsider(peer, orphanTx, fromPeer); i++)
+    {
+        const uint256& orphanHash = orphanTx.GetHash();
+        bool fMissingInputs = false;
+        // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+        // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+        // anyone relaying LegitTxX banned)
+        CValidationState stateDummy;
+
+        if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs)) {
+            LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+            RelayTransaction(orphanTx);
+            orphanage.AddChildrenToWorkSet(orphanTx);
+            orphanage.EraseTx(orphanHash);
+        }
+        else if (!fMissingInputs)
+        {
+            int nDos = 0;
+            if (stateDummy.IsInvalid(nDos) && nDos > 0)
+            {
+                // Punish peer that gave us an invalid orphan tx
+                Misbehaving(fromPeer, nDos);
+                LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+            }
+            // Has inputs but not accepted to mempool
+            // Probably non-standard or insufficient fee/priority
+            LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+            orphanage.EraseTx(orphanHash);
+            if (!stateDummy.CorruptionPossible()) {
+                // Do not use rejection cache for transactions as they can have been malleated.
+                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                assert(recentRejects);
+                recentRejects->insert(orphanHash);
+            }
+        }
+        mempool.check(pcoinsTip);
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -5722,8 +7147,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
-        deque<COutPoint> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
@@ -5741,9 +7164,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs)) {
             mempool.check(pcoinsTip);
             RelayTransaction(tx);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
+            orphanage.AddChildrenToWorkSet(tx);
 
             pfrom->nLastTXTime = GetTime();
 
@@ -5752,64 +7173,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 tx.GetHash().ToString(),
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
 
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransaction& orphanTx = (*mi)->second.tx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for transactions as they can have been malleated.
-                            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
+            // Process a first batch of the orphans that depended on this one,
+            // ProcessMessages works through the rest
+            ProcessOrphanTxs(pfrom->GetId(), MAX_ORPHAN_TX_BATCH);
         }
         else if (fMissingInputs)
         {
@@ -5820,19 +7186,24 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     break;
                 }
             }
-            if (!fRejectedParents) {
+            if (fRejectedParents && pfrom->nVersion >= PACKAGE_RELAY_VERSION) {
+                // The parents may be fine with this child paying for them
+                LogPrint("mempool", "requesting package of orphan with rejected parents %s peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                pfrom->PushMessage(NetMsgType::GETPACKAGE, tx.GetHash());
+            } else if (!fRejectedParents) {
                 BOOST_FOREACH(const CTxIn& txin, tx.vin) {
                     CInv _inv(MSG_TX, txin.prevout.hash);
                     pfrom->AddInventoryKnown(_inv);
                     if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
                 }
-                AddOrphanTx(tx, pfrom->GetId());
+                size_t nMaxPeerSize = (size_t)std::max((int64_t)0, GetArg("-maxorphanpeersize", DEFAULT_MAX_ORPHAN_PEER_SIZE)) * 1000;
+                orphanage.AddTx(tx, pfrom->GetId(), nMaxPeerSize);
 
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+                // DoS prevention: do not allow the orphanage to grow unbounded
                 unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+                unsigned int nEvicted = orphanage.LimitOrphans(nMaxOrphanTx);
                 if (nEvicted > 0)
-                    LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+                    LogPrint("mempool", "orphanage overflow, removed %u tx\n", nEvicted);
             } else {
                 LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
             }
@@ -5884,6 +7255,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     {
         CBlockHeaderAndShortTxIDs cmpctblock;
         vRecv >> cmpctblock;
+        const uint256 hashBlock = cmpctblock.header.GetHash();
 
         // Keep a CBlock for "optimistic" compactblock reconstructions (see
         // below)
@@ -5901,7 +7273,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         CBlockIndex *pindex = NULL;
         CValidationState state;
-        if (!AcceptBlockHeader(cmpctblock.header, state, chainparams, &pindex)) {
+        if (!AcceptBlockHeader(cmpctblock.header, hashBlock, state, chainparams, &pindex)) {
             int nDoS;
             if (state.IsInvalid(nDoS)) {
                 if (nDoS > 0)
@@ -5927,7 +7299,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 // We requested this block for some reason, but our mempool will probably be useless
                 // so we just grab the block via normal getdata
                 std::vector<CInv> vInv(1);
-                vInv[0] = CInv(MSG_BLOCK, cmpctblock.header.GetHash());
+                vInv[0] = CInv(MSG_BLOCK, hashBlock);
                 pfrom->PushMessage(NetMsgType::GETDATA, vInv);
             }
             return true;
@@ -5965,7 +7337,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 } else if (status == READ_STATUS_FAILED) {
                     // Duplicate txindexes, the block is now in-flight, so just request it
                     std::vector<CInv> vInv(1);
-                    vInv[0] = CInv(MSG_BLOCK, cmpctblock.header.GetHash());
+                    vInv[0] = CInv(MSG_BLOCK, hashBlock);
                     pfrom->PushMessage(NetMsgType::GETDATA, vInv);
                     return true;
                 }
@@ -5984,7 +7356,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 if (req.indexes.empty()) {
                     // Dirty hack to jump to BLOCKTXN code (TODO: move message handling into their own functions)
                     BlockTransactions txn;
-                    txn.blockhash = cmpctblock.header.GetHash();
+                    txn.blockhash = hashBlock;
                     CDataStream blockTxnMsg(SER_NETWORK, PROTOCOL_VERSION);
                     blockTxnMsg << txn;
                     return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnMsg, nTimeReceived, chainparams);
@@ -6015,7 +7387,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 // We requested this block, but its far into the future, so our
                 // mempool will probably be useless - request the block normally
                 std::vector<CInv> vInv(1);
-                vInv[0] = CInv(MSG_BLOCK, cmpctblock.header.GetHash());
+                vInv[0] = CInv(MSG_BLOCK, hashBlock);
                 pfrom->PushMessage(NetMsgType::GETDATA, vInv);
                 return true;
             } else {
@@ -6052,7 +7424,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 }
             }
             CValidationState state;
-            ProcessNewBlock(state, chainparams, pfrom, &block, true, NULL, false);
+            ProcessNewBlock(state, chainparams, pfrom, &block, true, NULL, false, &hashBlock);
             // TODO: could send reject message if block is invalid?
         }
 
@@ -6157,17 +7529,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         // - Once a headers message is received that is valid and does connect,
         //   nUnconnectingHeaders gets reset back to 0.
         if (mapBlockIndex.find(headers[0].hashPrevBlock) == mapBlockIndex.end() && nCount < MAX_BLOCKS_TO_ANNOUNCE) {
+            const uint256 hashLast = headers.back().GetHash();
             nodestate->nUnconnectingHeaders++;
             pfrom->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256());
             LogPrint("net", "received header %s: missing prev block %s, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
-                    headers[0].GetHash().ToString(),
+                    (nCount == 1 ? hashLast : headers[0].GetHash()).ToString(),
                     headers[0].hashPrevBlock.ToString(),
                     pindexBestHeader->nHeight,
                     pfrom->id, nodestate->nUnconnectingHeaders);
             // Set hashLastUnknownBlock for this peer, so that if we
             // eventually get the headers - even from a different peer -
             // we can use this peer to download.
-            UpdateBlockAvailability(pfrom->GetId(), headers.back().GetHash());
+            UpdateBlockAvailability(pfrom->GetId(), hashLast);
 
             if (nodestate->nUnconnectingHeaders % MAX_UNCONNECTING_HEADERS == 0) {
                 Misbehaving(pfrom->GetId(), 20);
@@ -6193,7 +7566,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 break;
             }
             // ToDo: enable header check for PoW blocks
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, header.GetHash(), state, chainparams, &pindexLast)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6316,8 +7689,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     {
         CBlock block;
         vRecv >> block;
+        const uint256 hash = block.GetHash();
 
-        LogPrint("net", "received block %s peer=%d\n", block.GetHash().ToString(), pfrom->id);
+        LogPrint("net", "received block %s peer=%d\n", hash.ToString(), pfrom->id);
 
         CValidationState state;
         // Process all blocks from whitelisted peers, even if not requested,
@@ -6325,12 +7699,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         // Such an unrequested block may still be processed, subject to the
         // conditions in AcceptBlock().
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL, true);
+        ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL, true, &hash);
         int nDoS;
         if (state.IsInvalid(nDoS)) {
             assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
             pfrom->PushMessage(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hash);
             if (nDoS > 0) {
                 LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), nDoS);
@@ -6558,6 +7932,96 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
     }
 
+    else if (strCommand == NetMsgType::GETPACKAGE)
+    {
+        uint256 hash;
+        vRecv >> hash;
+
+        // Like getdata, only answer for transactions we relayed or that the
+        // peer already knows about, so the mempool can't be probed
+        bool fKnown;
+        {
+            LOCK(pfrom->cs_inventory);
+            fKnown = pfrom->filterInventoryKnown.contains(hash);
+        }
+        vector<CTransaction> vtx;
+        {
+            LOCK(cs_main);
+            if (fKnown || mapRelay.count(hash))
+                mempool.GetPackage(hash, MAX_PACKAGE_COUNT, vtx);
+        }
+        if (vtx.empty()) {
+            vector<CInv> vNotFound(1, CInv(MSG_TX, hash));
+            pfrom->PushMessage(NetMsgType::NOTFOUND, vNotFound);
+        } else {
+            pfrom->PushMessage(NetMsgType::PACKAGE, vtx);
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::PACKAGE)
+    {
+        // Same restrictions as single transactions
+        if (!fRelayTxes && (!pfrom->fWhitelisted || !GetBoolArg("-whitelistrelay", DEFAULT_WHITELISTRELAY)))
+        {
+            LogPrint("net", "package sent in violation of protocol peer=%d\n", pfrom->id);
+            return true;
+        }
+
+        vector<CTransaction> vtx;
+        vRecv >> vtx;
+        if (vtx.empty())
+            return true;
+        BOOST_FOREACH(const CTransaction& tx, vtx)
+            pfrom->AddInventoryKnown(CInv(MSG_TX, tx.GetHash()));
+
+        LOCK(cs_main);
+
+        BOOST_FOREACH(const CTransaction& tx, vtx) {
+            pfrom->setAskFor.erase(tx.GetHash());
+            mapAlreadyAskedFor.erase(tx.GetHash());
+        }
+
+        bool fMissingInputs = false;
+        CValidationState state;
+        const uint256 hashChild = vtx.back().GetHash();
+        if (AcceptPackageToMemoryPool(mempool, state, vtx, true, &fMissingInputs)) {
+            mempool.check(pcoinsTip);
+            BOOST_FOREACH(const CTransaction& tx, vtx) {
+                RelayTransaction(tx);
+                orphanage.EraseTx(tx.GetHash());
+                orphanage.AddChildrenToWorkSet(tx);
+            }
+            pfrom->nLastTXTime = GetTime();
+
+            LogPrint("mempool", "AcceptPackageToMemoryPool: peer=%d: accepted %u txn with child %s (poolsz %u txn, %u kB)\n",
+                pfrom->id, vtx.size(), hashChild.ToString(),
+                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+        } else if (!fMissingInputs) {
+            if (!state.CorruptionPossible()) {
+                // Do not ask for these again, nor for the package when the
+                // child is announced once more
+                assert(recentRejects);
+                BOOST_FOREACH(const CTransaction& tx, vtx)
+                    recentRejects->insert(tx.GetHash());
+            }
+
+            int nDoS = 0;
+            if (state.IsInvalid(nDoS))
+            {
+                LogPrint("mempoolrej", "package with child %s from peer=%d was not accepted: %s\n", hashChild.ToString(),
+                    pfrom->id,
+                    FormatStateMessage(state));
+                if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+                    pfrom->PushMessage(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
+                                       state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hashChild);
+                if (nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+            }
+        }
+    }
+
+
     else if (strCommand == NetMsgType::NOTFOUND) {
         // We do not care about the NOTFOUND message, but logging an Unknown Command
         // message would be undesirable as we transmit it ourselves.
@@ -6596,6 +8060,13 @@ bool ProcessMessages(CNode* pfrom)
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // Finish reconsidering the orphans of this peer before taking new messages
+    if (orphanage.HaveTxToReconsider(pfrom->GetId())) {
+        LOCK(cs_main);
+        ProcessOrphanTxs(pfrom->GetId(), MAX_ORPHAN_TX_BATCH);
+        if (orphanage.HaveTxToReconsider(pfrom->GetId())) return fOk;
+    }
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -7234,14 +8705,11 @@ class CMainCleanup
 public:
     CMainCleanup() {}
     ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        // block headers, the entries themselves belong to blockIndexArena
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
-        mapOrphanTransactions.clear();
-        mapOrphanTransactionsByPrev.clear();
+        orphanage.clear();
     }
 } instance_of_cmaincleanup;
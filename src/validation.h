@@ -33,16 +33,24 @@
 #include <boost/unordered_map.hpp>
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
 class CInv;
+class CKey;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
 class CWallet;
 
+struct CAddressIndexKey;
+struct CAddressUnspentKey;
+struct CAddressUnspentValue;
 struct CDiskTxPos;
+struct CSpentIndexKey;
+struct CSpentIndexValue;
+struct CStakeRecord;
 struct PrecomputedTransactionData;
 struct CNodeStateStats;
 struct LockPoints;
@@ -61,10 +69,10 @@ static const CAmount HIGH_TX_FEE_PER_KB = 0.1 * COIN;
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB; 
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
-/** Expiration time for orphan transactions in seconds */
-static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
-/** Minimum time between orphan transactions expire time checks in seconds */
-static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+/** Default for -maxorphanpeersize, maximum kilobytes of orphan transactions kept from one peer */
+static const unsigned int DEFAULT_MAX_ORPHAN_PEER_SIZE = 1000;
+/** Maximum number of orphans reconsidered at a time while holding cs_main */
+static const unsigned int MAX_ORPHAN_TX_BATCH = 100;
 /** Default for -limitancestorcount, max number of in-mempool ancestors */
 static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
 /** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
@@ -73,19 +81,33 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitclustercount, max number of transactions in a mempool cluster */
+static const unsigned int DEFAULT_CLUSTER_LIMIT = 250;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Maximum number of transactions in a package */
+static const unsigned int MAX_PACKAGE_COUNT = 25;
+/** Maximum kilobytes of the transactions of a package that are new to the mempool */
+static const unsigned int MAX_PACKAGE_SIZE = 101;
+/** Maximum kilobytes of transactions from disconnected blocks held for re-adding to the mempool after a reorg */
+static const unsigned int MAX_DISCONNECTED_TX_POOL_SIZE = 20000;
 /** The maximum size of a scho?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
+/** The maximum number of block files kept memory mapped for reading */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = sizeof(void*) > 4 ? 64 : 4;
 /** The pre-allocation chunk size for scho?????.dat files (since 0.8) */
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Set in the size field of a block or undo record whose data is compressed */
+static const unsigned int DISK_RECORD_COMPRESSED = 0x80000000;
 
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Number of blocks -reindex reads ahead of the block it is indexing and connecting */
+static const unsigned int REINDEX_PREFETCH_BLOCKS = 64;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -136,6 +158,9 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = true;
+static const bool DEFAULT_ADDRESSINDEX = false;
+static const bool DEFAULT_STAKEINDEX = false;
+static const bool DEFAULT_BLOCK_COMPRESSION = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
@@ -176,6 +201,9 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fStakeIndex;
+extern bool fBlockCompression;
 extern bool fIsBareMultisigStd;
 extern bool fBIP37;
 extern bool fRequireStandard;
@@ -202,6 +230,8 @@ static const uint64_t nMinDiskSpace = 52428800;
 extern bool fHavePruned;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
+/** True if the chainstate was loaded from a UTXO set snapshot, so the blocks before it were never downloaded. */
+extern bool fTxOutSetSnapshot;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
@@ -235,9 +265,12 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @param[in]   pblock  The block we want to process.
  * @param[in]   fForceProcessing Process this block even if unrequested; used for non-network block sources and whitelisted peers.
  * @param[out]  dbp     The already known disk position of pblock, or NULL if not yet stored.
+ * @param[in]   phash   The hash of pblock if the caller has it already, or NULL.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool fMayBanPeerIfInvalid);
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool fMayBanPeerIfInvalid, const uint256* phash = NULL);
+/** Abort with a message: log it, show it to the user and start shutting down. Always returns false. */
+bool AbortNode(const std::string& strMessage, const std::string& userMessage = "");
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (scho?????.dat) */
@@ -248,6 +281,8 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Rebuild the block index from the block files (-reindex), connecting the blocks as they are indexed */
+bool ReindexBlockFiles(const CChainParams& chainparams);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
@@ -276,8 +311,16 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(const std::string& strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256 &hash, CTransaction &tx, const Consensus::Params& params, uint256 &hashBlock, bool fAllowSlow = false);
-/** Find the best known block, and make it the tip of the block chain */
-bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock = NULL);
+/** Entries of an address in the address index from height nStart on, up to nEnd if it is not 0. Fails without -addressindex. */
+bool GetAddressIndex(int nType, const uint160& hash, std::vector<std::pair<CAddressIndexKey, CAmount> >& vEntries, int nStart = 0, int nEnd = 0);
+/** Unspent outputs of an address from the address index. Fails without -addressindex. */
+bool GetAddressUnspent(int nType, const uint160& hash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vEntries);
+/** The input that spent an output, from the spent index. Fails without -addressindex or if it is unspent. */
+bool GetSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value);
+/** What proof-of-stake block pindex staked, from the stake index. Fails without -stakeindex or for a proof-of-work block. */
+bool GetStakeRecord(const CBlockIndex* pindex, CStakeRecord& record);
+/** Find the best known block, and make it the tip of the block chain. phashBlock is the hash of pblock if the caller has it already. */
+bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock = NULL, const uint256* phashBlock = NULL);
 CAmount GetProofOfWorkSubsidy(int nBlockHeight, const Consensus::Params& consensusParams);
 CAmount GetProofOfStakeSubsidy();
 
@@ -313,11 +356,35 @@ void Misbehaving(NodeId nodeid, int howmuch);
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
+/** Save the flushed block index to a snapshot that the next startup loads instead of the database. */
+bool WriteBlockIndexSnapshot();
+
+/** What DumpTxOutSetSnapshot wrote */
+struct CTxOutSetSnapshotInfo
+{
+    uint256 hashBlock;      //!< block the snapshot was taken at
+    int nHeight;
+    uint64_t nTransactions; //!< transactions with unspent outputs
+    uint256 hashSnapshot;   //!< hash of the contents, which the chain parameters pin
+};
+/** Write the UTXO set in coinsview, with the block index entries of its chain, to a snapshot at path. */
+bool DumpTxOutSetSnapshot(CCoinsView* coinsview, const boost::filesystem::path& path, CTxOutSetSnapshotInfo& info);
+/** Load a UTXO set snapshot the chain parameters pin into the new chainstate coinsview, and make its block the tip. */
+bool LoadTxOutSetSnapshot(const CChainParams& chainparams, CCoinsView* coinsview, const boost::filesystem::path& path);
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/**
+ * (try to) add a package to memory pool: a transaction with (some of) its
+ * unconfirmed ancestors, parents first. The transactions not yet in the
+ * mempool are accepted or rejected together, and the fee checks apply to
+ * their combined fee rate so that a child can pay for its parents.
+ */
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, CValidationState &state, const std::vector<CTransaction>& package,
+                               bool fLimitFree, bool* pfMissingInputs, const CAmount nAbsurdFee=0);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -404,12 +471,13 @@ bool SequenceLocks(const CTransaction &tx, int flags, std::vector<int>* prevHeig
  * Simulates calling SequenceLocks() with data from the tip of the current active chain.
  * Optionally stores in LockPoints the resulting height and time calculated and the hash
  * of the block needed for calculation or skips the calculation and uses the LockPoints
- * passed in for evaluation.
+ * passed in for evaluation. Inputs are looked up in the mempool and pcoinsTip unless
+ * pcoinsView is given.
  * The LockPoints should not be considered valid if CheckSequenceLocks returns false.
  *
  * See consensus/consensus.h for flag definitions.
  */
-bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp = NULL, bool useExistingLockPoints = false);
+bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp = NULL, bool useExistingLockPoints = false, const CCoinsView* pcoinsView = NULL);
 
 /**
  * Closure representing one script verification
@@ -449,21 +517,40 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Block or undo data as it is written to disk: serialized, and compressed in
+ * the LZ4 block format if -blockcompression is set and that makes it smaller.
+ * The size field in the record header then has DISK_RECORD_COMPRESSED set and
+ * gives the compressed length, and the data starts with the uncompressed size.
+ */
+class CDiskRecord
+{
+public:
+    //! Size field of the record header
+    unsigned int nSize;
+    //! What follows the record header
+    std::vector<unsigned char> vchData;
+
+    explicit CDiskRecord(const CBlock& block);
+    explicit CDiskRecord(const CBlockUndo& blockundo);
+};
+
 /** Functions for disk access for blocks */
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+bool WriteBlockToDisk(const CDiskRecord& record, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 
 /** Functions for validating blocks and updating the block tree */
 
-/** Context-independent validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = false);
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
+/** Context-independent validity checks. phash is the hash of the block if the caller has it already. */
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = false, const uint256* phash = NULL);
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true, const uint256* phash = NULL);
 
 /** Context-dependent validity checks.
  *  By "context", we mean only the previous block headers, but not the UTXO
- *  set; UTXO-related validity checks are done in ConnectBlock(). */
-bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, CBlockIndex *pindexPrev);
+ *  set; UTXO-related validity checks are done in ConnectBlock(). phash is the
+ *  hash of the block if the caller has it already. */
+bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, CBlockIndex *pindexPrev, const uint256* phash = NULL);
 bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex *pindexPrev);
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
@@ -480,7 +567,10 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
 /** Proof-of-stake checks */
 bool CheckStake(CBlock* pblock, CWallet& wallet, const CChainParams& chainparams);
-bool SignBlock(CBlock& block, CWallet& wallet, int64_t& nFees);
+/** Search for a kernel on the current tip, returning the unsigned coinstake and the tip and target it was found for */
+bool FindStake(CWallet& wallet, CMutableTransaction& txCoinStake, CKey& key, uint256& hashPrevBlock, unsigned int& nBits);
+/** Complete a block template with a coinstake from FindStake and sign it */
+bool SignBlock(CBlock& block, CWallet& wallet, int64_t nFees, CMutableTransaction& txCoinStake, const CKey& key);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
@@ -9,7 +9,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 70013;
+static const int PROTOCOL_VERSION = 70014;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -43,6 +43,9 @@ static const int SENDHEADERS_VERSION = 70012;
 //! "feefilter" tells peers to filter invs to you by fee starts with this version
 static const int FEEFILTER_VERSION = 70013;
 
+//! "getpackage" and "package" messages for relaying transactions with their ancestors start with this version
+static const int PACKAGE_RELAY_VERSION = 70014;
+
 /*
 // Disable BIP152
 //! shord-id-based block download starts with this version
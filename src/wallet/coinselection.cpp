@@ -0,0 +1,283 @@
+// Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/coinselection.h"
+
+#include "random.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "wallet/wallet.h"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+struct CompareInputCoinValueDesc
+{
+    bool operator()(const CInputCoin& a, const CInputCoin& b) const
+    {
+        return a.nValue > b.nValue;
+    }
+    bool operator()(const CInputCoin& a, const CAmount& n) const
+    {
+        return a.nValue > n;
+    }
+    bool operator()(const CAmount& n, const CInputCoin& b) const
+    {
+        return n > b.nValue;
+    }
+};
+
+CInputCoin::CInputCoin(const CWalletTx* txIn, unsigned int iIn, int nDepthIn, bool fFromMeIn)
+{
+    tx = txIn;
+    i = iIn;
+    nValue = tx->vout[i].nValue;
+    nDepth = nDepthIn;
+    fFromMe = fFromMeIn;
+}
+
+void CCoinSelectionPool::Set(const vector<COutput>& vOutputs)
+{
+    vector<CInputCoin> vCoinsIn;
+    vCoinsIn.reserve(vOutputs.size());
+    BOOST_FOREACH(const COutput& output, vOutputs)
+    {
+        if (!output.fSpendable)
+            continue;
+        vCoinsIn.push_back(CInputCoin(output.tx, output.i, output.nDepth, output.tx->IsFromMe(ISMINE_ALL)));
+    }
+    Set(vCoinsIn);
+}
+
+void CCoinSelectionPool::Set(const vector<CInputCoin>& vCoinsIn)
+{
+    vCoins = vCoinsIn;
+
+    // Shuffle first so that the stable sort leaves equal values in random order;
+    // like the knapsack solver this only needs a fast rng
+    seed_insecure_rand();
+    for (size_t i = vCoins.size(); i > 1; i--)
+        std::swap(vCoins[i - 1], vCoins[insecure_rand() % i]);
+    std::stable_sort(vCoins.begin(), vCoins.end(), CompareInputCoinValueDesc());
+}
+
+bool CCoinSelectionPool::Remove(const CInputCoin& coin)
+{
+    pair<vector<CInputCoin>::iterator, vector<CInputCoin>::iterator> range =
+        std::equal_range(vCoins.begin(), vCoins.end(), coin, CompareInputCoinValueDesc());
+    vector<CInputCoin>::iterator it = std::find(range.first, range.second, coin);
+    if (it == range.second)
+        return false;
+    vCoins.erase(it);
+    return true;
+}
+
+bool SelectCoinsBnB(const vector<CInputCoin>& vCoins, const CAmount& nTargetValue, const CAmount& nCostOfChange,
+                    vector<CInputCoin>& vSelectedRet, CAmount& nValueRet)
+{
+    vSelectedRet.clear();
+    nValueRet = 0;
+
+    // Coins above the upper bound can never be part of a solution
+    const size_t nFirst = std::lower_bound(vCoins.begin(), vCoins.end(), nTargetValue + nCostOfChange, CompareInputCoinValueDesc()) - vCoins.begin();
+
+    CAmount nAvailable = 0;
+    for (size_t i = nFirst; i < vCoins.size(); i++)
+        nAvailable += vCoins[i].nValue;
+    if (nAvailable < nTargetValue)
+        return false;
+
+    // vCurrSelection[k] tells whether vCoins[nFirst + k] is in the current branch
+    vector<bool> vCurrSelection;
+    vector<bool> vBestSelection;
+    vCurrSelection.reserve(vCoins.size() - nFirst);
+    CAmount nCurrValue = 0;
+    CAmount nBestValue = 0;
+
+    for (size_t nTries = 0; nTries < BNB_TOTAL_TRIES; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nCurrValue + nAvailable < nTargetValue || nCurrValue > nTargetValue + nCostOfChange)
+        {
+            fBacktrack = true;
+        }
+        else if (nCurrValue >= nTargetValue)
+        {
+            if (vBestSelection.empty() || nCurrValue < nBestValue)
+            {
+                vBestSelection = vCurrSelection;
+                nBestValue = nCurrValue;
+                if (nBestValue == nTargetValue)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack)
+        {
+            // Walk back to the last included coin and try the branch without it
+            while (!vCurrSelection.empty() && !vCurrSelection.back())
+            {
+                vCurrSelection.pop_back();
+                nAvailable += vCoins[nFirst + vCurrSelection.size()].nValue;
+            }
+            if (vCurrSelection.empty())
+                break; // searched everything
+            vCurrSelection.back() = false;
+            nCurrValue -= vCoins[nFirst + vCurrSelection.size() - 1].nValue;
+        }
+        else
+        {
+            const CInputCoin& coin = vCoins[nFirst + vCurrSelection.size()];
+            nAvailable -= coin.nValue;
+
+            // Including a coin equal to the one just left out would only
+            // revisit branches already searched
+            if (!vCurrSelection.empty() && !vCurrSelection.back() &&
+                coin.nValue == vCoins[nFirst + vCurrSelection.size() - 1].nValue)
+            {
+                vCurrSelection.push_back(false);
+            }
+            else
+            {
+                vCurrSelection.push_back(true);
+                nCurrValue += coin.nValue;
+            }
+        }
+    }
+
+    if (vBestSelection.empty())
+        return false;
+
+    for (size_t i = 0; i < vBestSelection.size(); i++)
+        if (vBestSelection[i])
+            vSelectedRet.push_back(vCoins[nFirst + i]);
+    nValueRet = nBestValue;
+    return true;
+}
+
+static void ApproximateBestSubset(const vector<CInputCoin>& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+                                  vector<char>& vfBest, CAmount& nBest, int iterations = KNAPSACK_ITERATIONS)
+{
+    vector<char> vfIncluded;
+
+    vfBest.assign(vValue.size(), true);
+    nBest = nTotalLower;
+
+    seed_insecure_rand();
+
+    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++)
+    {
+        vfIncluded.assign(vValue.size(), false);
+        CAmount nTotal = 0;
+        bool fReachedTarget = false;
+        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++)
+        {
+            for (unsigned int i = 0; i < vValue.size(); i++)
+            {
+                //The solver here uses a randomized algorithm,
+                //the randomness serves no real security purpose but is just
+                //needed to prevent degenerate behavior and it is important
+                //that the rng is fast. We do not use a constant random sequence,
+                //because there may be some privacy improvement by making
+                //the selection random.
+                if (nPass == 0 ? insecure_rand()&1 : !vfIncluded[i])
+                {
+                    nTotal += vValue[i].nValue;
+                    vfIncluded[i] = true;
+                    if (nTotal >= nTargetValue)
+                    {
+                        fReachedTarget = true;
+                        if (nTotal < nBest)
+                        {
+                            nBest = nTotal;
+                            vfBest = vfIncluded;
+                        }
+                        nTotal -= vValue[i].nValue;
+                        vfIncluded[i] = false;
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool SelectCoinsKnapsack(const vector<CInputCoin>& vCoins, const CAmount& nTargetValue,
+                         vector<CInputCoin>& vSelectedRet, CAmount& nValueRet)
+{
+    vSelectedRet.clear();
+    nValueRet = 0;
+
+    // Coins less than nTargetValue + MIN_CHANGE are the tail of the pool, the
+    // lowest larger coin is the one right before them
+    vector<CInputCoin>::const_iterator itLower = std::upper_bound(vCoins.begin(), vCoins.end(), nTargetValue + MIN_CHANGE, CompareInputCoinValueDesc());
+    const CInputCoin* pcoinLowestLarger = itLower == vCoins.begin() ? NULL : &*(itLower - 1);
+
+    vector<CInputCoin>::const_iterator itExact = std::lower_bound(itLower, vCoins.end(), nTargetValue, CompareInputCoinValueDesc());
+    if (itExact != vCoins.end() && itExact->nValue == nTargetValue)
+    {
+        vSelectedRet.push_back(*itExact);
+        nValueRet = itExact->nValue;
+        return true;
+    }
+
+    vector<CInputCoin> vValue(itLower, vCoins.end());
+    CAmount nTotalLower = 0;
+    BOOST_FOREACH(const CInputCoin& coin, vValue)
+        nTotalLower += coin.nValue;
+
+    if (nTotalLower == nTargetValue)
+    {
+        vSelectedRet = vValue;
+        nValueRet = nTotalLower;
+        return true;
+    }
+
+    if (nTotalLower < nTargetValue)
+    {
+        if (pcoinLowestLarger == NULL)
+            return false;
+        vSelectedRet.push_back(*pcoinLowestLarger);
+        nValueRet = pcoinLowestLarger->nValue;
+        return true;
+    }
+
+    // Solve subset sum by stochastic approximation
+    int nIterations = std::max((size_t)1, std::min((size_t)KNAPSACK_ITERATIONS, KNAPSACK_MAX_WORK / vValue.size()));
+    vector<char> vfBest;
+    CAmount nBest;
+
+    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
+    if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest, nIterations);
+
+    // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
+    //                                   or the next bigger coin is closer), return the bigger coin
+    if (pcoinLowestLarger &&
+        ((nBest != nTargetValue && nBest < nTargetValue + MIN_CHANGE) || pcoinLowestLarger->nValue <= nBest))
+    {
+        vSelectedRet.push_back(*pcoinLowestLarger);
+        nValueRet = pcoinLowestLarger->nValue;
+    }
+    else {
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+            {
+                vSelectedRet.push_back(vValue[i]);
+                nValueRet += vValue[i].nValue;
+            }
+
+        LogPrint("selectcoins", "SelectCoins() best subset: ");
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+                LogPrint("selectcoins", "%s ", FormatMoney(vValue[i].nValue));
+        LogPrint("selectcoins", "total %s\n", FormatMoney(nBest));
+    }
+
+    return true;
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_COINSELECTION_H
+#define BITCOIN_WALLET_COINSELECTION_H
+
+#include "amount.h"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+class COutput;
+class CWalletTx;
+
+//! Maximum number of steps taken by the branch and bound search before giving up
+static const size_t BNB_TOTAL_TRIES = 100000;
+//! Bound on coins * iterations spent in the stochastic knapsack solver
+static const size_t KNAPSACK_MAX_WORK = 1000000;
+//! Iterations of the knapsack solver when the candidate set is small
+static const int KNAPSACK_ITERATIONS = 1000;
+
+/** A spendable wallet output as seen by coin selection */
+class CInputCoin
+{
+public:
+    const CWalletTx* tx;
+    unsigned int i;
+    CAmount nValue;
+    int nDepth;
+    bool fFromMe;
+
+    CInputCoin(const CWalletTx* txIn, unsigned int iIn, int nDepthIn = 0, bool fFromMeIn = false);
+
+    std::pair<const CWalletTx*, unsigned int> GetPair() const
+    {
+        return std::make_pair(tx, i);
+    }
+
+    friend bool operator==(const CInputCoin& a, const CInputCoin& b)
+    {
+        return a.tx == b.tx && a.i == b.i;
+    }
+};
+
+/**
+ * Candidate coins kept sorted by descending value, so that solvers can find
+ * the coins around a target by binary search instead of sorting every time.
+ * Coins of equal value are kept in random order, which keeps the choice
+ * between identical coins unpredictable.
+ */
+class CCoinSelectionPool
+{
+private:
+    std::vector<CInputCoin> vCoins;
+
+public:
+    /** Replace the pool with the spendable outputs in vOutputs */
+    void Set(const std::vector<COutput>& vOutputs);
+    /** Replace the pool with vCoinsIn */
+    void Set(const std::vector<CInputCoin>& vCoinsIn);
+    /** Remove a coin, returns false if it was not in the pool */
+    bool Remove(const CInputCoin& coin);
+
+    const std::vector<CInputCoin>& GetCoins() const { return vCoins; }
+    size_t size() const { return vCoins.size(); }
+    bool empty() const { return vCoins.empty(); }
+    void clear() { vCoins.clear(); }
+};
+
+/**
+ * Depth-first branch and bound search over vCoins (sorted by descending
+ * value) for a subset whose total lies in [nTargetValue, nTargetValue +
+ * nCostOfChange]. Larger coins are included first; the search stops at the
+ * first exact match and gives up after BNB_TOTAL_TRIES steps, returning the
+ * subset with the least excess found so far, if any.
+ */
+bool SelectCoinsBnB(const std::vector<CInputCoin>& vCoins, const CAmount& nTargetValue, const CAmount& nCostOfChange,
+                    std::vector<CInputCoin>& vSelectedRet, CAmount& nValueRet);
+
+/**
+ * Stochastic subset-sum selection over vCoins (sorted by descending value),
+ * preferring a single larger coin when it leaves less change. Large
+ * candidate sets get proportionally fewer iterations, see KNAPSACK_MAX_WORK.
+ */
+bool SelectCoinsKnapsack(const std::vector<CInputCoin>& vCoins, const CAmount& nTargetValue,
+                         std::vector<CInputCoin>& vSelectedRet, CAmount& nValueRet);
+
+#endif // BITCOIN_WALLET_COINSELECTION_H
@@ -117,6 +117,8 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
 
     if (fRescan && fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
+    if (fRescan && fTxOutSetSnapshot)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled on a node started from a UTXO set snapshot, it does not have the blocks before it");
 
     CBitcoinSecret vchSecret;
     bool fGood = vchSecret.SetString(strSecret);
@@ -248,6 +250,8 @@ UniValue importaddress(const UniValue& params, bool fHelp)
 
     if (fRescan && fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
+    if (fRescan && fTxOutSetSnapshot)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled on a node started from a UTXO set snapshot, it does not have the blocks before it");
 
     // Whether to import a p2sh version, too
     bool fP2SH = false;
@@ -411,6 +415,8 @@ UniValue importpubkey(const UniValue& params, bool fHelp)
 
     if (fRescan && fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
+    if (fRescan && fTxOutSetSnapshot)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled on a node started from a UTXO set snapshot, it does not have the blocks before it");
 
     if (!IsHex(params[0].get_str()))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Pubkey must be a hex string");
@@ -456,6 +462,8 @@ UniValue importwallet(const UniValue& params, bool fHelp)
 
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing wallets is disabled in pruned mode");
+    if (fTxOutSetSnapshot)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Importing wallets is disabled on a node started from a UTXO set snapshot, it does not have the blocks before it");
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
@@ -0,0 +1,201 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/stakepolicy.h"
+
+#include "util.h"
+#include "utilmoneystr.h"
+#include "wallet/wallet.h"
+
+#include <algorithm>
+#include <map>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+struct CompareOutputValue
+{
+    bool operator()(const COutput& a, const COutput& b) const
+    {
+        return a.tx->vout[a.i].nValue < b.tx->vout[b.i].nValue;
+    }
+};
+
+CStakePolicy::CStakePolicy()
+{
+    nCombineThreshold = DEFAULT_STAKE_COMBINE_THRESHOLD;
+    nSplitThreshold = DEFAULT_STAKE_SPLIT_THRESHOLD;
+    nTargetOutputs = DEFAULT_STAKE_TARGET_OUTPUTS;
+    nMaxCombineInputs = DEFAULT_STAKE_MAX_COMBINE_INPUTS;
+    nMaxSplitOutputs = DEFAULT_STAKE_MAX_SPLIT_OUTPUTS;
+    fRebalance = DEFAULT_STAKE_REBALANCE;
+}
+
+bool CStakePolicy::InitFromArgs(std::string& strError)
+{
+    if (mapArgs.count("-stakecombinethreshold"))
+    {
+        if (!ParseMoney(mapArgs["-stakecombinethreshold"], nCombineThreshold) || nCombineThreshold <= 0)
+        {
+            strError = strprintf("Invalid amount for -stakecombinethreshold=<amount>: '%s'", mapArgs["-stakecombinethreshold"]);
+            return false;
+        }
+    }
+    // The split threshold follows the combine threshold unless given
+    nSplitThreshold = 2 * nCombineThreshold;
+    if (mapArgs.count("-stakesplitthreshold"))
+    {
+        if (!ParseMoney(mapArgs["-stakesplitthreshold"], nSplitThreshold) || nSplitThreshold < nCombineThreshold)
+        {
+            strError = strprintf("Invalid amount for -stakesplitthreshold=<amount>: '%s' (must be at least -stakecombinethreshold)", mapArgs["-stakesplitthreshold"]);
+            return false;
+        }
+    }
+
+    int64_t n = GetArg("-staketargetoutputs", DEFAULT_STAKE_TARGET_OUTPUTS);
+    if (n < 0)
+    {
+        strError = strprintf("Invalid value for -staketargetoutputs: %d", n);
+        return false;
+    }
+    nTargetOutputs = n;
+
+    n = GetArg("-stakemaxcombine", DEFAULT_STAKE_MAX_COMBINE_INPUTS);
+    if (n < 1)
+    {
+        strError = strprintf("Invalid value for -stakemaxcombine: %d (must be at least 1)", n);
+        return false;
+    }
+    nMaxCombineInputs = n;
+
+    n = GetArg("-stakemaxsplit", DEFAULT_STAKE_MAX_SPLIT_OUTPUTS);
+    if (n < 1 || n > MAX_STAKE_REBALANCE_OUTPUTS)
+    {
+        strError = strprintf("Invalid value for -stakemaxsplit: %d (must be between 1 and %u)", n, MAX_STAKE_REBALANCE_OUTPUTS);
+        return false;
+    }
+    nMaxSplitOutputs = n;
+
+    fRebalance = GetBoolArg("-stakerebalance", DEFAULT_STAKE_REBALANCE);
+    return true;
+}
+
+CAmount CStakePolicy::GetTargetOutputValue(const CAmount& nBalance) const
+{
+    // Never aim below the combine threshold, or split outputs would just be merged again
+    if (nTargetOutputs == 0)
+        return std::max(nCombineThreshold, nSplitThreshold / 2);
+    return std::max(nCombineThreshold, nBalance / nTargetOutputs);
+}
+
+unsigned int CStakePolicy::GetCoinStakeOutputs(const CAmount& nCredit, const CAmount& nBalance, size_t nOutputs) const
+{
+    if (nCredit < nSplitThreshold)
+        return 1;
+
+    CAmount nSplit = nMaxSplitOutputs;
+    if (nTargetOutputs > 0)
+    {
+        if (nOutputs >= nTargetOutputs)
+            return 1;
+        nSplit = std::min(nSplit, (CAmount)(nTargetOutputs - nOutputs + 1));
+    }
+    nSplit = std::min(nSplit, nCredit / GetTargetOutputValue(nBalance));
+    return std::max(nSplit, (CAmount)1);
+}
+
+bool CStakePolicy::PlanRebalance(const std::vector<COutput>& vCoins, std::vector<COutput>& vInputsRet, unsigned int& nOutputsRet) const
+{
+    vInputsRet.clear();
+    nOutputsRet = 0;
+
+    CAmount nBalance = 0;
+    size_t nOutputs = 0;
+    map<CScript, vector<COutput> > mapSmall;
+    const COutput* pcoinLargest = NULL;
+    BOOST_FOREACH(const COutput& out, vCoins)
+    {
+        if (!out.fSpendable)
+            continue;
+        const CTxOut& txout = out.tx->vout[out.i];
+        nBalance += txout.nValue;
+        nOutputs++;
+        if (ShouldCombine(txout.nValue))
+            mapSmall[txout.scriptPubKey].push_back(out);
+        if (!pcoinLargest || txout.nValue > pcoinLargest->tx->vout[pcoinLargest->i].nValue)
+            pcoinLargest = &out;
+    }
+    const CAmount nTargetValue = GetTargetOutputValue(nBalance);
+
+    // Combine the script with the most small outputs, smallest first, until
+    // the result is worth a full output
+    const vector<COutput>* pvSmall = NULL;
+    for (map<CScript, vector<COutput> >::const_iterator it = mapSmall.begin(); it != mapSmall.end(); ++it)
+        if (!pvSmall || it->second.size() > pvSmall->size())
+            pvSmall = &it->second;
+    if (pvSmall && pvSmall->size() >= 2)
+    {
+        vector<COutput> vSmall(*pvSmall);
+        std::sort(vSmall.begin(), vSmall.end(), CompareOutputValue());
+        CAmount nValue = 0;
+        BOOST_FOREACH(const COutput& out, vSmall)
+        {
+            if (vInputsRet.size() >= MAX_STAKE_REBALANCE_INPUTS || nValue >= nTargetValue)
+                break;
+            vInputsRet.push_back(out);
+            nValue += out.tx->vout[out.i].nValue;
+        }
+        if (vInputsRet.size() >= 2)
+        {
+            nOutputsRet = 1;
+            return true;
+        }
+        vInputsRet.clear();
+    }
+
+    // Split the largest output while the wallet is short of its target count
+    if (nTargetOutputs > 0 && nOutputs < nTargetOutputs && pcoinLargest)
+    {
+        CAmount nSplit = pcoinLargest->tx->vout[pcoinLargest->i].nValue / nTargetValue;
+        nSplit = std::min(nSplit, (CAmount)(nTargetOutputs - nOutputs + 1));
+        nSplit = std::min(nSplit, (CAmount)MAX_STAKE_REBALANCE_OUTPUTS);
+        if (nSplit >= 2)
+        {
+            vInputsRet.push_back(*pcoinLargest);
+            nOutputsRet = nSplit;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+CStakeOutputStats CStakePolicy::GetStats(const std::vector<COutput>& vCoins) const
+{
+    CStakeOutputStats stats;
+    vector<CAmount> vValues;
+    vValues.reserve(vCoins.size());
+    BOOST_FOREACH(const COutput& out, vCoins)
+    {
+        if (!out.fSpendable)
+            continue;
+        const CAmount nValue = out.tx->vout[out.i].nValue;
+        vValues.push_back(nValue);
+        stats.nTotal += nValue;
+        if (ShouldCombine(nValue))
+            stats.nSmall++;
+        if (nValue >= nSplitThreshold)
+            stats.nLarge++;
+    }
+    if (vValues.empty())
+        return stats;
+
+    std::sort(vValues.begin(), vValues.end());
+    stats.nOutputs = vValues.size();
+    stats.nMin = vValues.front();
+    stats.nMedian = vValues[vValues.size() / 2];
+    stats.nMax = vValues.back();
+    return stats;
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_STAKEPOLICY_H
+#define BITCOIN_WALLET_STAKEPOLICY_H
+
+#include "amount.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class COutput;
+
+//! -stakecombinethreshold default: coinstakes merge extra inputs below this value
+static const CAmount DEFAULT_STAKE_COMBINE_THRESHOLD = 500 * COIN;
+//! -stakesplitthreshold default: coinstakes worth at least this are split
+static const CAmount DEFAULT_STAKE_SPLIT_THRESHOLD = 2 * DEFAULT_STAKE_COMBINE_THRESHOLD;
+//! -staketargetoutputs default: 0 means no target, only the thresholds apply
+static const unsigned int DEFAULT_STAKE_TARGET_OUTPUTS = 0;
+//! -stakemaxcombine default: inputs per coinstake, including the kernel
+static const unsigned int DEFAULT_STAKE_MAX_COMBINE_INPUTS = 10;
+//! -stakemaxsplit default: outputs a coinstake may pay to
+static const unsigned int DEFAULT_STAKE_MAX_SPLIT_OUTPUTS = 2;
+//! -stakerebalance default
+static const bool DEFAULT_STAKE_REBALANCE = false;
+//! Seconds between background rebalancing runs
+static const int64_t STAKE_REBALANCE_INTERVAL = 10 * 60;
+//! Keeps rebalancing transactions well below the standard size limit
+static const unsigned int MAX_STAKE_REBALANCE_INPUTS = 50;
+static const unsigned int MAX_STAKE_REBALANCE_OUTPUTS = 50;
+
+/** Summary of the value distribution of the wallet's staking outputs */
+struct CStakeOutputStats
+{
+    size_t nOutputs;
+    size_t nSmall; //!< below the combine threshold
+    size_t nLarge; //!< at or above the split threshold
+    CAmount nTotal;
+    CAmount nMin;
+    CAmount nMedian;
+    CAmount nMax;
+
+    CStakeOutputStats() : nOutputs(0), nSmall(0), nLarge(0), nTotal(0), nMin(0), nMedian(0), nMax(0) {}
+};
+
+/**
+ * Decides how the wallet's staking value is spread over outputs. Outputs
+ * that are too small get merged into coinstakes (or combined in background
+ * transactions), large coinstakes are split, and with a target output count
+ * splitting continues until the wallet holds about that many outputs of
+ * roughly equal value.
+ */
+class CStakePolicy
+{
+public:
+    CAmount nCombineThreshold;
+    CAmount nSplitThreshold;
+    unsigned int nTargetOutputs;
+    unsigned int nMaxCombineInputs;
+    unsigned int nMaxSplitOutputs;
+    bool fRebalance;
+
+    CStakePolicy();
+
+    /** Read the -stake* options, returns false and sets strError on bad values */
+    bool InitFromArgs(std::string& strError);
+
+    /** Value each staking output should have for a staking balance of nBalance */
+    CAmount GetTargetOutputValue(const CAmount& nBalance) const;
+
+    /** Whether a coinstake may merge an extra input of nValue */
+    bool ShouldCombine(const CAmount& nValue) const { return nValue < nCombineThreshold; }
+
+    /**
+     * Number of outputs a coinstake crediting nCredit should pay to, given a
+     * staking balance of nBalance held in nOutputs outputs
+     */
+    unsigned int GetCoinStakeOutputs(const CAmount& nCredit, const CAmount& nBalance, size_t nOutputs) const;
+
+    /**
+     * Pick the next background transaction: either several small outputs of
+     * one script to combine into one, or one large output to split into
+     * nOutputsRet. Returns false when the distribution needs no change.
+     */
+    bool PlanRebalance(const std::vector<COutput>& vCoins, std::vector<COutput>& vInputsRet, unsigned int& nOutputsRet) const;
+
+    CStakeOutputStats GetStats(const std::vector<COutput>& vCoins) const;
+};
+
+#endif // BITCOIN_WALLET_STAKEPOLICY_H
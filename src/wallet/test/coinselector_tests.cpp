@@ -0,0 +1,180 @@
+// Copyright (c) 2026 The Scholarship Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/coinselection.h"
+#include "wallet/wallet.h"
+
+#include <memory>
+#include <vector>
+
+#include "wallet/test/wallet_test_fixture.h"
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinselector_tests, WalletTestingSetup)
+
+static const CWallet testWallet;
+static std::vector<std::unique_ptr<CWalletTx> > vTestTxs;
+
+static CInputCoin MakeCoin(const CAmount& nValue)
+{
+    static int nextLockTime = 0;
+    CMutableTransaction tx;
+    tx.nLockTime = nextLockTime++; // so all transactions get different hashes
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    vTestTxs.emplace_back(new CWalletTx(&testWallet, tx));
+    return CInputCoin(vTestTxs.back().get(), 0, 6 * 24);
+}
+
+static void MakePool(const std::vector<CAmount>& vValues, CCoinSelectionPool& pool)
+{
+    std::vector<CInputCoin> vCoins;
+    BOOST_FOREACH(const CAmount& nValue, vValues)
+        vCoins.push_back(MakeCoin(nValue));
+    pool.Set(vCoins);
+}
+
+static bool IsSortedDescending(const CCoinSelectionPool& pool)
+{
+    for (size_t i = 1; i < pool.size(); i++)
+        if (pool.GetCoins()[i - 1].nValue < pool.GetCoins()[i].nValue)
+            return false;
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(pool_set_remove)
+{
+    CCoinSelectionPool pool;
+    std::vector<CAmount> vValues;
+    for (int i = 0; i < 50; i++)
+        vValues.push_back(((i * 37) % 11 + 1) * CENT);
+    MakePool(vValues, pool);
+    BOOST_CHECK_EQUAL(pool.size(), 50U);
+    BOOST_CHECK(IsSortedDescending(pool));
+
+    const CInputCoin coin = pool.GetCoins()[17];
+    BOOST_CHECK(pool.Remove(coin));
+    BOOST_CHECK(!pool.Remove(coin));
+    BOOST_CHECK_EQUAL(pool.size(), 49U);
+    BOOST_CHECK(IsSortedDescending(pool));
+
+    vTestTxs.clear();
+}
+
+BOOST_AUTO_TEST_CASE(bnb_search)
+{
+    CCoinSelectionPool pool;
+    std::vector<CInputCoin> vSelected;
+    CAmount nValueRet;
+
+    std::vector<CAmount> vValues;
+    vValues.push_back(1 * CENT);
+    vValues.push_back(2 * CENT);
+    vValues.push_back(3 * CENT);
+    vValues.push_back(4 * CENT);
+    vValues.push_back(50 * CENT);
+    MakePool(vValues, pool);
+
+    // Exact matches, coins larger than the target are never used
+    BOOST_CHECK(SelectCoinsBnB(pool.GetCoins(), 1 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 1 * CENT);
+    BOOST_CHECK_EQUAL(vSelected.size(), 1U);
+
+    BOOST_CHECK(SelectCoinsBnB(pool.GetCoins(), 7 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK_EQUAL(vSelected.size(), 2U); // largest first: 4 + 3
+
+    BOOST_CHECK(SelectCoinsBnB(pool.GetCoins(), 10 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 10 * CENT);
+    BOOST_CHECK_EQUAL(vSelected.size(), 4U);
+
+    BOOST_CHECK(SelectCoinsBnB(pool.GetCoins(), 60 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 60 * CENT);
+    BOOST_CHECK_EQUAL(vSelected.size(), 5U);
+
+    // No exact match, and nothing within the cost of change
+    BOOST_CHECK(!SelectCoinsBnB(pool.GetCoins(), 11 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK(vSelected.empty());
+    BOOST_CHECK(!SelectCoinsBnB(pool.GetCoins(), 61 * CENT, 0, vSelected, nValueRet));
+
+    // With a cost of change the least excess within range wins
+    BOOST_CHECK(SelectCoinsBnB(pool.GetCoins(), 11 * CENT, 40 * CENT, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 50 * CENT);
+    BOOST_CHECK(SelectCoinsBnB(pool.GetCoins(), 45 * CENT, 10 * CENT, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 50 * CENT);
+    BOOST_CHECK_EQUAL(vSelected.size(), 1U);
+
+    // Many identical coins: the search must not enumerate equivalent subsets
+    vValues.assign(5000, 3 * CENT);
+    MakePool(vValues, pool);
+    BOOST_CHECK(!SelectCoinsBnB(pool.GetCoins(), 1000 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK(SelectCoinsBnB(pool.GetCoins(), 999 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(vSelected.size(), 333U);
+
+    vTestTxs.clear();
+}
+
+BOOST_AUTO_TEST_CASE(knapsack_fallback)
+{
+    CCoinSelectionPool pool;
+    std::vector<CInputCoin> vSelected;
+    CAmount nValueRet;
+
+    std::vector<CAmount> vValues;
+    vValues.push_back(6 * CENT);
+    vValues.push_back(7 * CENT);
+    vValues.push_back(8 * CENT);
+    vValues.push_back(20 * CENT);
+    vValues.push_back(30 * CENT);
+    MakePool(vValues, pool);
+
+    BOOST_CHECK(!SelectCoinsBnB(pool.GetCoins(), 16 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK(SelectCoinsKnapsack(pool.GetCoins(), 16 * CENT, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 20 * CENT);
+    BOOST_CHECK_EQUAL(vSelected.size(), 1U);
+
+    BOOST_CHECK(!SelectCoinsKnapsack(pool.GetCoins(), 72 * CENT, vSelected, nValueRet));
+
+    // A large pool still gets an answer from the bounded solver
+    vValues.clear();
+    for (int i = 0; i < 20000; i++)
+        vValues.push_back((i % 97 + 1) * 1000 + 7);
+    MakePool(vValues, pool);
+    BOOST_CHECK(SelectCoinsKnapsack(pool.GetCoins(), 3 * COIN + 1, vSelected, nValueRet));
+    BOOST_CHECK(nValueRet >= 3 * COIN + 1);
+
+    vTestTxs.clear();
+}
+
+BOOST_AUTO_TEST_CASE(select_coins_pool)
+{
+    CCoinSelectionPool pool;
+    std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(testWallet.cs_wallet);
+
+    std::vector<CInputCoin> vCoins;
+    for (int i = 0; i < 10; i++)
+        vCoins.push_back(MakeCoin(COIN));
+
+    // Unconfirmed coins are left out by the confirmation filter
+    CInputCoin fresh = MakeCoin(5 * COIN);
+    fresh.nDepth = 0;
+    vCoins.push_back(fresh);
+    pool.Set(vCoins);
+
+    BOOST_CHECK(testWallet.SelectCoinsMinConf(3 * COIN, 1, 1, 0, pool, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 3 * COIN);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 3U);
+    BOOST_CHECK(!setCoinsRet.count(fresh.GetPair()));
+
+    BOOST_CHECK(!testWallet.SelectCoinsMinConf(11 * COIN, 1, 1, 0, pool, setCoinsRet, nValueRet));
+
+    vTestTxs.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -353,4 +353,167 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
 }
 
+BOOST_AUTO_TEST_CASE(stake_policy)
+{
+    CStakePolicy policy;
+    std::vector<COutput> vInputs;
+    unsigned int nOutputs;
+
+    LOCK(wallet.cs_wallet);
+
+    // Defaults split a coinstake in two once it reaches the split threshold
+    BOOST_CHECK_EQUAL(policy.GetCoinStakeOutputs(DEFAULT_STAKE_SPLIT_THRESHOLD - 1, 10000 * COIN, 1), 1U);
+    BOOST_CHECK_EQUAL(policy.GetCoinStakeOutputs(DEFAULT_STAKE_SPLIT_THRESHOLD, 10000 * COIN, 1), 2U);
+    BOOST_CHECK_EQUAL(policy.GetCoinStakeOutputs(100 * DEFAULT_STAKE_SPLIT_THRESHOLD, 10000 * COIN, 1), 2U);
+
+    // With a target count, splitting stops once the wallet has enough outputs
+    policy.nTargetOutputs = 10;
+    policy.nMaxSplitOutputs = 8;
+    BOOST_CHECK_EQUAL(policy.GetTargetOutputValue(10000 * COIN), 1000 * COIN);
+    BOOST_CHECK_EQUAL(policy.GetTargetOutputValue(1000 * COIN), DEFAULT_STAKE_COMBINE_THRESHOLD);
+    BOOST_CHECK_EQUAL(policy.GetCoinStakeOutputs(5000 * COIN, 10000 * COIN, 1), 5U);
+    BOOST_CHECK_EQUAL(policy.GetCoinStakeOutputs(5000 * COIN, 10000 * COIN, 8), 3U);
+    BOOST_CHECK_EQUAL(policy.GetCoinStakeOutputs(5000 * COIN, 10000 * COIN, 10), 1U);
+
+    // Small outputs of one script are combined, smallest first
+    empty_wallet();
+    for (int i = 0; i < 5; i++)
+        add_coin(100 * COIN);
+    add_coin(10 * COIN);
+    add_coin(5000 * COIN);
+    BOOST_CHECK(policy.PlanRebalance(vCoins, vInputs, nOutputs));
+    BOOST_CHECK_EQUAL(nOutputs, 1U);
+    BOOST_CHECK_EQUAL(vInputs.size(), 6U);
+    BOOST_CHECK_EQUAL(vInputs[0].tx->vout[vInputs[0].i].nValue, 10 * COIN);
+
+    CStakeOutputStats stats = policy.GetStats(vCoins);
+    BOOST_CHECK_EQUAL(stats.nOutputs, 7U);
+    BOOST_CHECK_EQUAL(stats.nSmall, 6U);
+    BOOST_CHECK_EQUAL(stats.nLarge, 1U);
+    BOOST_CHECK_EQUAL(stats.nMin, 10 * COIN);
+    BOOST_CHECK_EQUAL(stats.nMedian, 100 * COIN);
+    BOOST_CHECK_EQUAL(stats.nMax, 5000 * COIN);
+
+    // Short of the target, the largest output is split
+    empty_wallet();
+    add_coin(600 * COIN);
+    add_coin(5000 * COIN);
+    BOOST_CHECK(policy.PlanRebalance(vCoins, vInputs, nOutputs));
+    BOOST_CHECK_EQUAL(vInputs.size(), 1U);
+    BOOST_CHECK_EQUAL(vInputs[0].tx->vout[vInputs[0].i].nValue, 5000 * COIN);
+    BOOST_CHECK_EQUAL(nOutputs, 8U);
+
+    // Without a target nothing is split in the background
+    policy.nTargetOutputs = 0;
+    BOOST_CHECK(!policy.PlanRebalance(vCoins, vInputs, nOutputs));
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(stake_key_cache)
+{
+    CWallet stakeWallet;
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    BOOST_CHECK(stakeWallet.AddKeyPubKey(key, pubkey));
+
+    CScript scriptP2PK = CScript() << ToByteVector(pubkey) << OP_CHECKSIG;
+    CScript scriptP2PKH = GetScriptForDestination(pubkey.GetID());
+    CStakeKey stakeKey;
+
+    // Pay to address kernels stake to the public key
+    BOOST_CHECK(stakeWallet.GetStakeKey(stakeWallet, scriptP2PKH, stakeKey));
+    BOOST_CHECK(stakeKey.key == key);
+    BOOST_CHECK(stakeKey.pubkey == pubkey);
+    BOOST_CHECK(stakeKey.scriptPubKeyOut == scriptP2PK);
+
+    BOOST_CHECK(stakeWallet.GetStakeKey(stakeWallet, scriptP2PK, stakeKey));
+    BOOST_CHECK(stakeKey.scriptPubKeyOut == scriptP2PK);
+
+    // Other script types and foreign keys cannot stake
+    BOOST_CHECK(!stakeWallet.GetStakeKey(stakeWallet, GetScriptForDestination(CScriptID(scriptP2PK)), stakeKey));
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    BOOST_CHECK(!stakeWallet.GetStakeKey(stakeWallet, GetScriptForDestination(keyOther.GetPubKey().GetID()), stakeKey));
+
+    // Keys from another key store are not served from the wallet's cache
+    CBasicKeyStore keystoreEmpty;
+    BOOST_CHECK(!stakeWallet.GetStakeKey(keystoreEmpty, scriptP2PKH, stakeKey));
+
+    // After a lock state change keys are derived again
+    stakeWallet.NotifyStatusChanged(&stakeWallet);
+    BOOST_CHECK(stakeWallet.GetStakeKey(stakeWallet, scriptP2PKH, stakeKey));
+    BOOST_CHECK(stakeKey.key == key);
+
+    // Coinstake inputs sign from the cached key alone
+    CStakeKeyStore keystoreStake(stakeKey);
+    CPubKey pubkeyOut;
+    CKey keyOut;
+    BOOST_CHECK(keystoreStake.GetPubKey(pubkey.GetID(), pubkeyOut) && pubkeyOut == pubkey);
+    BOOST_CHECK(keystoreStake.GetKey(pubkey.GetID(), keyOut) && keyOut == key);
+    BOOST_CHECK(!keystoreStake.GetPubKey(keyOther.GetPubKey().GetID(), pubkeyOut));
+}
+
+BOOST_AUTO_TEST_CASE(keypool_topup_batch)
+{
+    // Enough keys to take the multithreaded derivation path
+    const unsigned int nPoolSize = 2 * KEYPOOL_PARALLEL_THRESHOLD;
+    std::set<int64_t> setKeyPool;
+    {
+        LOCK(pwalletMain->cs_wallet);
+        pwalletMain->SetMinVersion(FEATURE_HD);
+        BOOST_CHECK(pwalletMain->SetHDMasterKey(pwalletMain->GenerateNewHDMasterKey()));
+        BOOST_CHECK(pwalletMain->TopUpKeyPool(nPoolSize));
+        BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), nPoolSize + 1);
+        BOOST_CHECK_EQUAL(pwalletMain->GetHDChain().nExternalChainCounter, nPoolSize + 1);
+        setKeyPool = pwalletMain->setKeyPool;
+    }
+
+    // The whole batch was committed to the database
+    CWallet wallet("wallet_test.dat");
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK(wallet.setKeyPool == setKeyPool);
+    BOOST_CHECK_EQUAL(wallet.GetHDChain().nExternalChainCounter, nPoolSize + 1);
+
+    CWalletDB walletdb("wallet_test.dat");
+    std::set<std::string> setKeypaths;
+    BOOST_FOREACH(int64_t nIndex, setKeyPool)
+    {
+        CKeyPool keypool;
+        BOOST_CHECK(walletdb.ReadPool(nIndex, keypool));
+        BOOST_CHECK(wallet.HaveKey(keypool.vchPubKey.GetID()));
+        setKeypaths.insert(wallet.mapKeyMetadata[keypool.vchPubKey.GetID()].hdKeypath);
+    }
+    BOOST_CHECK_EQUAL(setKeypaths.size(), nPoolSize + 1);
+    BOOST_CHECK_EQUAL(setKeypaths.count("m/0'/0'/0'"), 1U);
+    BOOST_CHECK_EQUAL(setKeypaths.count(strprintf("m/0'/0'/%u'", nPoolSize)), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(add_key_in_transaction)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddWatchOnly(script));
+
+        // The watched script is erased through the same handle as the key is written
+        CWalletDB walletdb("wallet_test.dat");
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(pwalletMain->AddKeyPubKeyWithDB(walletdb, key, key.GetPubKey()));
+        BOOST_CHECK(!pwalletMain->HaveWatchOnly(script));
+        BOOST_CHECK(walletdb.TxnCommit());
+    }
+
+    CWallet wallet("wallet_test.dat");
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK(wallet.HaveKey(key.GetPubKey().GetID()));
+    BOOST_CHECK(!wallet.HaveWatchOnly(script));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
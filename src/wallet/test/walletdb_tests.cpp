@@ -137,4 +137,45 @@ BOOST_AUTO_TEST_CASE(no_dest_fails) {
     BOOST_CHECK(!walletdb->WriteDestData(dst, "key", "value"));
 }
 
+BOOST_AUTO_TEST_CASE(write_load_tx) {
+    auto walletdb = TmpDB(pathTemp, "write_load_tx");
+
+    // Enough records to take the multithreaded decode path
+    const unsigned int nTx = WALLET_LOAD_PARALLEL_THRESHOLD + 10;
+    std::vector<uint256> vHash;
+    for (unsigned int i = 0; i < nTx; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(i == 0 ? GetRandHash() : vHash[i - 1], 0);
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = 1000 + i;
+        mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        CWalletTx wtx(NULL, CTransaction(mtx));
+        wtx.nOrderPos = nTx - i;
+        BOOST_CHECK(walletdb->WriteTx(wtx));
+        vHash.push_back(wtx.GetHash());
+    }
+
+    // A double spend of the first transaction's output
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(vHash[0], 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1;
+    CWalletTx wtxConflict(NULL, CTransaction(mtx));
+    wtxConflict.nOrderPos = nTx + 1;
+    BOOST_CHECK(walletdb->WriteTx(wtxConflict));
+
+    auto w = LoadWallet(walletdb.get());
+    LOCK2(cs_main, w->cs_wallet);
+    BOOST_CHECK_EQUAL(nTx + 1, w->mapWallet.size());
+    BOOST_CHECK_EQUAL(nTx + 1, w->wtxOrdered.size());
+    BOOST_CHECK(w->wtxOrdered.begin()->second.first->GetHash() == vHash.back());
+    BOOST_CHECK(w->wtxOrdered.rbegin()->second.first->GetHash() == wtxConflict.GetHash());
+    for (unsigned int i = 0; i + 1 < nTx; i++)
+        BOOST_CHECK(w->IsSpent(vHash[i], 0));
+    BOOST_CHECK(!w->IsSpent(vHash.back(), 0));
+    BOOST_CHECK_EQUAL(1, w->GetConflicts(wtxConflict.GetHash()).count(vHash[1]));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -32,6 +32,7 @@
 #include <assert.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -47,14 +48,13 @@ bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
 const char * DEFAULT_WALLET_DAT = "wallet.dat";
 const uint32_t BIP32_HARDENED_KEY_LIMIT = 0x80000000;
 
-static int64_t GetStakeCombineThreshold() { return 500 * COIN; }
-static int64_t GetStakeSplitThreshold() { return 2 * GetStakeCombineThreshold(); }
-
 /**
  * Fees smaller than this (in satoshi) are considered zero fee (for transaction creation)
  * Override with -mintxfee
  */
 CFeeRate CWallet::minTxFee = CFeeRate(DEFAULT_TRANSACTION_MINFEE);
+/** How staking outputs are split and combined, see -stake* options */
+CStakePolicy CWallet::stakePolicy;
 /**
  * If fee estimation does not have enough data to provide estimates, use this fee instead.
  * Has no effect if not using fee estimation
@@ -72,10 +72,10 @@ CAmount nMinimumInputValue = 0;
  * @{
  */
 
-struct CompareValueOnly
+struct CompareOrderPosOnly
 {
-    bool operator()(const pair<CAmount, pair<const CWalletTx*, unsigned int> >& t1,
-                    const pair<CAmount, pair<const CWalletTx*, unsigned int> >& t2) const
+    bool operator()(const pair<int64_t, CWallet::TxPair>& t1,
+                    const pair<int64_t, CWallet::TxPair>& t2) const
     {
         return t1.first < t2.first;
     }
@@ -95,16 +95,56 @@ const CWalletTx* CWallet::GetWalletTx(const uint256& hash) const
     return &(it->second);
 }
 
-CPubKey CWallet::GenerateNewKey()
+static void MakeNewKeyRange(bool fCompressed, std::vector<CNewKey>* pvKeys, size_t nFirst, size_t nStride)
 {
-    AssertLockHeld(cs_wallet); // mapKeyMetadata
-    bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+    for (size_t i = nFirst; i < pvKeys->size(); i += nStride)
+    {
+        CNewKey& newKey = (*pvKeys)[i];
+        newKey.key.MakeNewKey(fCompressed);
+        newKey.pubkey = newKey.key.GetPubKey();
+        assert(newKey.key.VerifyPubKey(newKey.pubkey));
+    }
+}
+
+static void DeriveHDKeyRange(const CExtKey* pchainKey, uint32_t nFirstIndex, std::vector<CNewKey>* pvKeys, size_t nFirst, size_t nStride)
+{
+    for (size_t i = nFirst; i < pvKeys->size(); i += nStride)
+    {
+        // always derive hardened keys
+        // childIndex | BIP32_HARDENED_KEY_LIMIT = derive childIndex in hardened child-index-range
+        // example: 1 | BIP32_HARDENED_KEY_LIMIT == 0x80000001 == 2147483649
+        CExtKey childKey;
+        CNewKey& newKey = (*pvKeys)[i];
+        pchainKey->Derive(childKey, (nFirstIndex + i) | BIP32_HARDENED_KEY_LIMIT);
+        newKey.key = childKey.key;
+        newKey.pubkey = newKey.key.GetPubKey();
+        assert(newKey.key.VerifyPubKey(newKey.pubkey));
+    }
+}
+
+/** Run func(nFirst, nStride) on enough threads to cover nItems independent items. */
+static void RunKeyWorkers(size_t nItems, const boost::function<void (size_t, size_t)>& func)
+{
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_KEYPOOL_THREADS));
+    if (nItems < KEYPOOL_PARALLEL_THRESHOLD)
+        nThreads = 1;
 
-    CKey secret;
+    boost::thread_group workers;
+    for (int i = 1; i < nThreads; i++)
+        workers.create_thread(boost::bind(func, i, nThreads));
+    func(0, nThreads);
+    workers.join_all();
+}
+
+void CWallet::GenerateNewKeys(unsigned int nCount, std::vector<CNewKey>& vKeysOut)
+{
+    AssertLockHeld(cs_wallet); // hdChain
+    bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
 
     // Create new metadata
     int64_t nCreationTime = GetTime();
-    CKeyMetadata metadata(nCreationTime);
+    vKeysOut.clear();
+    vKeysOut.reserve(nCount);
 
     // use HD key derivation if HD was enabled during wallet creation
     if (IsHDEnabled()) {
@@ -113,7 +153,6 @@ CPubKey CWallet::GenerateNewKey()
         CExtKey masterKey;             //hd master key
         CExtKey accountKey;            //key at m/0'
         CExtKey externalChainChildKey; //key at m/0'/0'
-        CExtKey childKey;              //key at m/0'/0'/<n>'
 
         // try to get the master key
         if (!GetKey(hdChain.masterKeyID, key))
@@ -128,70 +167,114 @@ CPubKey CWallet::GenerateNewKey()
         // derive m/0'/0'
         accountKey.Derive(externalChainChildKey, BIP32_HARDENED_KEY_LIMIT);
 
-        // derive child key at next index, skip keys already known to the wallet
-        do
-        {
-            // always derive hardened keys
-            // childIndex | BIP32_HARDENED_KEY_LIMIT = derive childIndex in hardened child-index-range
-            // example: 1 | BIP32_HARDENED_KEY_LIMIT == 0x80000001 == 2147483649
-            externalChainChildKey.Derive(childKey, hdChain.nExternalChainCounter | BIP32_HARDENED_KEY_LIMIT);
-            metadata.hdKeypath     = "m/0'/0'/"+std::to_string(hdChain.nExternalChainCounter)+"'";
-            metadata.hdMasterKeyID = hdChain.masterKeyID;
-            // increment childkey index
-            hdChain.nExternalChainCounter++;
-        } while(HaveKey(childKey.key.GetPubKey().GetID()));
-        secret = childKey.key;
-
-        // update the chain model in the database
-        if (!CWalletDB(strWalletFile).WriteHDChain(hdChain))
-            throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
+        // derive child keys at the next indexes, skip keys already known to the wallet
+        while (vKeysOut.size() < nCount)
+        {
+            std::vector<CNewKey> vBatch(nCount - vKeysOut.size());
+            RunKeyWorkers(vBatch.size(), boost::bind(&DeriveHDKeyRange, &externalChainChildKey, hdChain.nExternalChainCounter, &vBatch, _1, _2));
+            BOOST_FOREACH(CNewKey& newKey, vBatch)
+            {
+                newKey.metadata = CKeyMetadata(nCreationTime);
+                newKey.metadata.hdKeypath     = "m/0'/0'/"+std::to_string(hdChain.nExternalChainCounter)+"'";
+                newKey.metadata.hdMasterKeyID = hdChain.masterKeyID;
+                // increment childkey index
+                hdChain.nExternalChainCounter++;
+                if (!HaveKey(newKey.pubkey.GetID()))
+                    vKeysOut.push_back(newKey);
+            }
+        }
     } else {
-        secret.MakeNewKey(fCompressed);
+        vKeysOut.resize(nCount);
+        RunKeyWorkers(vKeysOut.size(), boost::bind(&MakeNewKeyRange, fCompressed, &vKeysOut, _1, _2));
+        BOOST_FOREACH(CNewKey& newKey, vKeysOut)
+            newKey.metadata = CKeyMetadata(nCreationTime);
     }
+}
 
-    // Compressed public keys were introduced in version 0.6.0
-    if (fCompressed)
-        SetMinVersion(FEATURE_COMPRPUBKEY);
+void CWallet::AddNewKey(CWalletDB& walletdb, const CNewKey& newKey)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
 
-    CPubKey pubkey = secret.GetPubKey();
-    assert(secret.VerifyPubKey(pubkey));
+    // Compressed public keys were introduced in version 0.6.0
+    if (newKey.pubkey.IsCompressed())
+        SetMinVersion(FEATURE_COMPRPUBKEY, &walletdb);
 
-    mapKeyMetadata[pubkey.GetID()] = metadata;
-    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
-        nTimeFirstKey = nCreationTime;
+    mapKeyMetadata[newKey.pubkey.GetID()] = newKey.metadata;
+    if (!nTimeFirstKey || newKey.metadata.nCreateTime < nTimeFirstKey)
+        nTimeFirstKey = newKey.metadata.nCreateTime;
 
-    if (!AddKeyPubKey(secret, pubkey))
+    if (!AddKeyPubKeyWithDB(walletdb, newKey.key, newKey.pubkey))
         throw std::runtime_error(std::string(__func__) + ": AddKey failed");
-    return pubkey;
+}
+
+CPubKey CWallet::GenerateNewKey()
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
+
+    std::vector<CNewKey> vNewKeys;
+    GenerateNewKeys(1, vNewKeys);
+
+    // update the chain model in the database
+    CWalletDB walletdb(strWalletFile);
+    if (IsHDEnabled() && !walletdb.WriteHDChain(hdChain))
+        throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
+
+    AddNewKey(walletdb, vNewKeys[0]);
+    return vNewKeys[0].pubkey;
 }
 
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
+{
+    CWalletDB walletdb(strWalletFile);
+    return AddKeyPubKeyWithDB(walletdb, secret, pubkey);
+}
+
+bool CWallet::AddKeyPubKeyWithDB(CWalletDB& walletdb, const CKey& secret, const CPubKey &pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
-    if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
-        return false;
+
+    if (!IsCrypted()) {
+        if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
+            return false;
+    } else {
+        // Encrypted keys are written through walletdb as well
+        std::vector<unsigned char> vchCryptedSecret;
+        if (!EncryptKey(secret, pubkey, vchCryptedSecret))
+            return false;
+        if (!AddCryptedKey(walletdb, pubkey, vchCryptedSecret))
+            return false;
+    }
 
     // check if we need to remove from watch-only
     CScript script;
     script = GetScriptForDestination(pubkey.GetID());
     if (HaveWatchOnly(script))
-        RemoveWatchOnly(script);
+        RemoveWatchOnly(walletdb, script);
     script = GetScriptForRawPubKey(pubkey);
     if (HaveWatchOnly(script))
-        RemoveWatchOnly(script);
+        RemoveWatchOnly(walletdb, script);
 
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
-        return CWalletDB(strWalletFile).WriteKey(pubkey,
-                                                 secret.GetPrivKey(),
-                                                 mapKeyMetadata[pubkey.GetID()]);
+        return walletdb.WriteKey(pubkey,
+                                 secret.GetPrivKey(),
+                                 mapKeyMetadata[pubkey.GetID()]);
     }
     return true;
 }
 
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
                             const vector<unsigned char> &vchCryptedSecret)
+{
+    if (pwalletdbEncryption)
+        return AddCryptedKey(*pwalletdbEncryption, vchPubKey, vchCryptedSecret);
+    CWalletDB walletdb(strWalletFile);
+    return AddCryptedKey(walletdb, vchPubKey, vchCryptedSecret);
+}
+
+bool CWallet::AddCryptedKey(CWalletDB& walletdb, const CPubKey &vchPubKey,
+                            const vector<unsigned char> &vchCryptedSecret)
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
@@ -199,16 +282,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
         return true;
     {
         LOCK(cs_wallet);
-        if (pwalletdbEncryption)
-            return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
-                                                        vchCryptedSecret,
-                                                        mapKeyMetadata[vchPubKey.GetID()]);
-        else
-            return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
-                                                            vchCryptedSecret,
-                                                            mapKeyMetadata[vchPubKey.GetID()]);
+        return walletdb.WriteCryptedKey(vchPubKey,
+                                        vchCryptedSecret,
+                                        mapKeyMetadata[vchPubKey.GetID()]);
     }
-    return false;
 }
 
 bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
@@ -266,6 +343,12 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 }
 
 bool CWallet::RemoveWatchOnly(const CScript &dest)
+{
+    CWalletDB walletdb(strWalletFile);
+    return RemoveWatchOnly(walletdb, dest);
+}
+
+bool CWallet::RemoveWatchOnly(CWalletDB& walletdb, const CScript &dest)
 {
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
@@ -273,7 +356,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
-        if (!CWalletDB(strWalletFile).EraseWatchOnly(dest))
+        if (!walletdb.EraseWatchOnly(dest))
             return false;
 
     return true;
@@ -669,9 +752,88 @@ bool CWallet::SelectCoinsForStaking(CAmount& nTargetValue, std::set<std::pair<co
     return true;
 }
 
-bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CAmount& nFees, CMutableTransaction& tx, CKey& key)
+void CWallet::ClearStakeKeys(CCryptoKeyStore* keystore)
+{
+    LOCK(cs_stakeKeys);
+    mapStakeKeys.clear();
+    setUnstakeableScripts.clear();
+    nStakeKeysGeneration++;
+}
+
+bool CWallet::GetStakeKey(const CKeyStore& keystore, const CScript& scriptPubKey, CStakeKey& stakeKeyRet)
+{
+    // Only keys of this wallet are cached, where lock changes clear them
+    const bool fCache = &keystore == this;
+    uint64_t nGeneration = 0;
+    if (fCache)
+    {
+        LOCK(cs_stakeKeys);
+        map<CScript, CStakeKey>::const_iterator it = mapStakeKeys.find(scriptPubKey);
+        if (it != mapStakeKeys.end())
+        {
+            stakeKeyRet = it->second;
+            return true;
+        }
+        if (setUnstakeableScripts.count(scriptPubKey))
+            return false;
+        nGeneration = nStakeKeysGeneration;
+    }
+
+    vector<vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions) || (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH))
+    {
+        // only support pay to public key and pay to address
+        LogPrint("coinstake", "GetStakeKey : no support for script %s\n", HexStr(scriptPubKey.begin(), scriptPubKey.end()));
+        if (fCache)
+        {
+            LOCK(cs_stakeKeys);
+            setUnstakeableScripts.insert(scriptPubKey);
+        }
+        return false;
+    }
+
+    CKeyID keyID = whichType == TX_PUBKEYHASH ? CKeyID(uint160(vSolutions[0])) : CKeyID(Hash160(vSolutions[0]));
+    if (!keystore.GetKey(keyID, stakeKeyRet.key))
+    {
+        LogPrint("coinstake", "GetStakeKey : failed to get key for kernel type=%d\n", whichType);
+        return false;  // unable to find corresponding public key
+    }
+    stakeKeyRet.pubkey = stakeKeyRet.key.GetPubKey();
+
+    if (whichType == TX_PUBKEYHASH) // pay to address type
+    {
+        // convert to pay to public key type
+        stakeKeyRet.scriptPubKeyOut = CScript() << stakeKeyRet.pubkey.getvch() << OP_CHECKSIG;
+    }
+    else
+    {
+        if (stakeKeyRet.pubkey != CPubKey(vSolutions[0]))
+        {
+            LogPrint("coinstake", "GetStakeKey : invalid key for kernel type=%d\n", whichType);
+            return false; // keys mismatch
+        }
+        stakeKeyRet.scriptPubKeyOut = scriptPubKey;
+    }
+
+    if (fCache)
+    {
+        LOCK(cs_stakeKeys);
+        if (nGeneration == nStakeKeysGeneration)
+            mapStakeKeys[scriptPubKey] = stakeKeyRet;
+    }
+    return true;
+}
+
+bool CWallet::FindCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& tx, CKey& key)
 {
-    CBlockIndex* pindexPrev = pindexBestHeader;
+    // The kernel is checked against the tip the block will build on, not the
+    // best header, which may be ahead of the validated chain
+    CBlockIndex* pindexPrev;
+    {
+        LOCK(cs_main);
+        pindexPrev = chainActive.Tip();
+    }
     arith_uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(nBits);
 
@@ -714,18 +876,30 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
         {
             boost::this_thread::interruption_point();
             COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-            CacheKernel(stakeCache, prevoutStake, pindexPrev); //this will do a 2 disk loads per op
+            CacheKernel(stakeCache, prevoutStake, pindexPrev); //this looks the output up in the chainstate
         }
 
     }
 
+    // Derive the keys of new stakeable scripts now rather than once a kernel is found
+    CStakeKey stakeKey;
+    BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& pcoin, setCoins)
+        GetStakeKey(keystore, pcoin.first->vout[pcoin.second].scriptPubKey, stakeKey);
+
     int64_t nCredit = 0;
     CScript scriptPubKeyKernel;
     BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& pcoin, setCoins)
     {
+        // Give up if the tip moved; nBits was computed for the old one
+        {
+            LOCK(cs_main);
+            if (pindexPrev != chainActive.Tip())
+                return false;
+        }
+
         static int nMaxStakeSearchInterval = 60;
         bool fKernelFound = false;
-        for (unsigned int n=0; n<min(nSearchInterval,(int64_t)nMaxStakeSearchInterval) && !fKernelFound && pindexPrev == pindexBestHeader; n++)
+        for (unsigned int n=0; n<min(nSearchInterval,(int64_t)nMaxStakeSearchInterval) && !fKernelFound; n++)
         {
             boost::this_thread::interruption_point();
             // Search backward in time from the given txNew timestamp
@@ -735,57 +909,18 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             {
                 // Found a kernel
                 LogPrint("coinstake", "CreateCoinStake : kernel found\n");
-                vector<vector<unsigned char> > vSolutions;
-                txnouttype whichType;
-                CScript scriptPubKeyOut;
                 scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-                if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
-                {
-                    LogPrint("coinstake", "CreateCoinStake : failed to parse kernel\n");
+                if (!GetStakeKey(keystore, scriptPubKeyKernel, stakeKey))
                     break;
-                }
-                LogPrint("coinstake", "CreateCoinStake : parsed kernel type=%d\n", whichType);
-                if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
-                {
-                    LogPrint("coinstake", "CreateCoinStake : no support for kernel type=%d\n", whichType);
-                    break;  // only support pay to public key and pay to address
-                }
-                if (whichType == TX_PUBKEYHASH) // pay to address type
-                {
-                    // convert to pay to public key type
-                    if (!keystore.GetKey(uint160(vSolutions[0]), key))
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                        break;  // unable to find corresponding public key
-                    }
-
-                    scriptPubKeyOut << key.GetPubKey().getvch() << OP_CHECKSIG;
-                }
-                if (whichType == TX_PUBKEY)
-                {
-
-                    if (!keystore.GetKey(Hash160(vSolutions[0]), key))
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                        break;  // unable to find corresponding public key
-                    }
-
-                    if (key.GetPubKey() != vSolutions[0])
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : invalid key for kernel type=%d\n", whichType);
-                        break; // keys mismatch
-                    }
-
-                    scriptPubKeyOut = scriptPubKeyKernel;
-                }
+                key = stakeKey.key;
 
                 txNew.nTime -= n;
                 txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
                 nCredit += pcoin.first->vout[pcoin.second].nValue;
                 vwtxPrev.push_back(pcoin.first);
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+                txNew.vout.push_back(CTxOut(0, stakeKey.scriptPubKeyOut));
 
-                LogPrint("coinstake", "CreateCoinStake : added kernel type=%d\n", whichType);
+                LogPrint("coinstake", "CreateCoinStake : added kernel\n");
                 fKernelFound = true;
                 break;
             }
@@ -806,13 +941,13 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             && pcoin.first->GetHash() != txNew.vin[0].prevout.hash)
         {
             // Stop adding more inputs if already too many inputs
-            if (txNew.vin.size() >= 10)
+            if (txNew.vin.size() >= stakePolicy.nMaxCombineInputs)
                 break;
             // Stop adding inputs if reached reserve limit
             if (nCredit + pcoin.first->vout[pcoin.second].nValue > nBalance - nReserveBalance)
                 break;
             // Do not add additional significant input
-            if (pcoin.first->vout[pcoin.second].nValue >= GetStakeCombineThreshold() )
+            if (!stakePolicy.ShouldCombine(pcoin.first->vout[pcoin.second].nValue))
                 continue;
 
             txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
@@ -821,42 +956,81 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
         }
     }
 
-    // Calculate reward
+    // Calculate reward; fees are added by SignCoinStake once the block is assembled
     {
-        int64_t nReward = nFees + GetProofOfStakeSubsidy();
+        int64_t nReward = GetProofOfStakeSubsidy();
         if (nReward < 0)
            return false;
 
         nCredit += nReward;
     }
 
-    if (nCredit >= GetStakeSplitThreshold())
+    // Split stake as the policy asks; the outputs of this stake count as one
+    // towards the target, the selected coins stand in for the staking balance
+    unsigned int nOutputs = stakePolicy.GetCoinStakeOutputs(nCredit, nValueIn, setCoins.size() - txNew.vin.size() + 1);
+    for (unsigned int i = 1; i < nOutputs; i++)
         txNew.vout.push_back(CTxOut(0, txNew.vout[1].scriptPubKey)); //split stake
 
     // Set output amount
-    if (txNew.vout.size() == 3)
+    CAmount nSplitValue = (nCredit / nOutputs / CENT) * CENT;
+    for (unsigned int i = 1; i < nOutputs; i++)
+        txNew.vout[i].nValue = nSplitValue;
+    txNew.vout[nOutputs].nValue = nCredit - nSplitValue * (nOutputs - 1);
+
+    // Found a coinstake, still to be signed
+    tx = txNew;
+    return true;
+}
+
+bool CWallet::SignCoinStake(const CKeyStore& keystore, const CAmount& nFees, CMutableTransaction& tx)
+{
+    if (tx.vin.empty() || tx.vout.size() < 2)
+        return false;
+
+    if (nFees + GetProofOfStakeSubsidy() < 0)
+        return false;
+
+    vector<const CWalletTx*> vwtxPrev;
     {
-        txNew.vout[1].nValue = (nCredit / 2 / CENT) * CENT;
-        txNew.vout[2].nValue = nCredit - txNew.vout[1].nValue;
+        LOCK(cs_wallet);
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            const CWalletTx* pcoin = GetWalletTx(txin.prevout.hash);
+            if (!pcoin || txin.prevout.n >= pcoin->vout.size())
+                return error("SignCoinStake : unknown input %s", txin.prevout.ToString());
+            vwtxPrev.push_back(pcoin);
+        }
     }
-    else
-        txNew.vout[1].nValue = nCredit;
+
+    // All inputs pay to the kernel key, which FindCoinStake has cached
+    CStakeKey stakeKey;
+    if (!GetStakeKey(keystore, vwtxPrev[0]->vout[tx.vin[0].prevout.n].scriptPubKey, stakeKey))
+        return false;
+
+    // Add the fees, keeping the split chosen by FindCoinStake
+    const unsigned int nOutputs = tx.vout.size() - 1;
+    CAmount nCredit = nFees;
+    for (unsigned int i = 1; i <= nOutputs; i++)
+        nCredit += tx.vout[i].nValue;
+    CAmount nSplitValue = (nCredit / nOutputs / CENT) * CENT;
+    for (unsigned int i = 1; i < nOutputs; i++)
+        tx.vout[i].nValue = nSplitValue;
+    tx.vout[nOutputs].nValue = nCredit - nSplitValue * (nOutputs - 1);
 
     // Sign
+    CStakeKeyStore keystoreStake(stakeKey);
     int nIn = 0;
     BOOST_FOREACH(const CWalletTx* pcoin, vwtxPrev)
     {
-        if (!SignSignature(*this, *pcoin, txNew, nIn++, SIGHASH_ALL))
-            return error("CreateCoinStake : failed to sign coinstake");
+        if (!SignSignature(keystoreStake, *pcoin, tx, nIn++, SIGHASH_ALL))
+            return error("SignCoinStake : failed to sign coinstake");
     }
 
     // Limit size
-    unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
+    unsigned int nBytes = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
     if (nBytes >= MAX_STANDARD_TX_SIZE)
-        return error("CreateCoinStake : exceeded coinstake size limit");
+        return error("SignCoinStake : exceeded coinstake size limit");
 
-    // Successfully generated coinstake
-    tx = CTransaction(txNew);
     return true;
 }
 
@@ -1053,6 +1227,62 @@ void CWallet::MarkDirty()
     }
 }
 
+void CWallet::LoadToWallet(std::vector<CWalletTx>& vWtx)
+{
+    AssertLockHeld(cs_wallet);
+
+    std::vector<std::pair<COutPoint, uint256> > vSpends;
+    std::vector<std::pair<int64_t, TxPair> > vOrdered;
+    vOrdered.reserve(vWtx.size());
+
+    // Records come out of the database sorted by txid, so the hint keeps
+    // each insert amortized constant. The transactions are moved out of vWtx.
+    BOOST_FOREACH(CWalletTx& wtxIn, vWtx)
+    {
+        const uint256 hash = wtxIn.GetHash();
+        CWalletTx& wtx = mapWallet.insert(mapWallet.end(), std::make_pair(hash, CWalletTx()))->second;
+        wtx = std::move(wtxIn);
+        wtx.BindWallet(this);
+        vOrdered.push_back(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+        if (!wtx.IsCoinBase())
+            BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+                vSpends.push_back(std::make_pair(txin.prevout, hash));
+    }
+
+    std::stable_sort(vOrdered.begin(), vOrdered.end(), CompareOrderPosOnly());
+    for (size_t i = 0; i < vOrdered.size(); i++)
+        wtxOrdered.insert(wtxOrdered.end(), vOrdered[i]);
+
+    std::sort(vSpends.begin(), vSpends.end());
+    for (size_t i = 0; i < vSpends.size(); i++)
+        mapTxSpends.insert(mapTxSpends.end(), vSpends[i]);
+
+    // Metadata only needs syncing where an outpoint has several spenders
+    for (size_t i = 0; i < vSpends.size(); )
+    {
+        size_t j = i + 1;
+        while (j < vSpends.size() && vSpends[j].first == vSpends[i].first)
+            j++;
+        if (j - i > 1)
+            SyncMetaData(mapTxSpends.equal_range(vSpends[i].first));
+        i = j;
+    }
+
+    for (size_t i = 0; i < vOrdered.size(); i++)
+    {
+        const CWalletTx& wtxIn = *vOrdered[i].second.first;
+        BOOST_FOREACH(const CTxIn& txin, wtxIn.vin) {
+            std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(txin.prevout.hash);
+            if (mi != mapWallet.end()) {
+                CWalletTx& prevtx = mi->second;
+                if (prevtx.nIndex == -1 && !prevtx.hashUnset()) {
+                    MarkConflicted(prevtx.hashBlock, wtxIn.GetHash());
+                }
+            }
+        }
+    }
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
@@ -2241,165 +2471,70 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
-                                  vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, const vector<COutput>& vCoins,
+                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CAmount& nCostOfChange) const
 {
-    vector<char> vfIncluded;
-
-    vfBest.assign(vValue.size(), true);
-    nBest = nTotalLower;
-
-    seed_insecure_rand();
-
-    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++)
-    {
-        vfIncluded.assign(vValue.size(), false);
-        CAmount nTotal = 0;
-        bool fReachedTarget = false;
-        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++)
-        {
-            for (unsigned int i = 0; i < vValue.size(); i++)
-            {
-                //The solver here uses a randomized algorithm,
-                //the randomness serves no real security purpose but is just
-                //needed to prevent degenerate behavior and it is important
-                //that the rng is fast. We do not use a constant random sequence,
-                //because there may be some privacy improvement by making
-                //the selection random.
-                if (nPass == 0 ? insecure_rand()&1 : !vfIncluded[i])
-                {
-                    nTotal += vValue[i].first;
-                    vfIncluded[i] = true;
-                    if (nTotal >= nTargetValue)
-                    {
-                        fReachedTarget = true;
-                        if (nTotal < nBest)
-                        {
-                            nBest = nTotal;
-                            vfBest = vfIncluded;
-                        }
-                        nTotal -= vValue[i].first;
-                        vfIncluded[i] = false;
-                    }
-                }
-            }
-        }
-    }
+    CCoinSelectionPool pool;
+    pool.Set(vCoins);
+    return SelectCoinsMinConf(nTargetValue, nConfMine, nConfTheirs, nMaxAncestors, pool, setCoinsRet, nValueRet, nCostOfChange);
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, vector<COutput> vCoins,
-                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, const CCoinSelectionPool& pool,
+                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CAmount& nCostOfChange) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
 
-    // List of values less than target
-    pair<CAmount, pair<const CWalletTx*,unsigned int> > coinLowestLarger;
-    coinLowestLarger.first = std::numeric_limits<CAmount>::max();
-    coinLowestLarger.second.first = NULL;
-    vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
-    CAmount nTotalLower = 0;
-
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
-    BOOST_FOREACH(const COutput &output, vCoins)
+    // Filtering keeps the pool order, so vEligible stays sorted by value
+    vector<CInputCoin> vEligible;
+    vEligible.reserve(pool.size());
+    BOOST_FOREACH(const CInputCoin& coin, pool.GetCoins())
     {
-        if (!output.fSpendable)
+        if (coin.nDepth < (coin.fFromMe ? nConfMine : nConfTheirs))
             continue;
 
-        const CWalletTx *pcoin = output.tx;
-
-        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+        // Only unconfirmed transactions can be in the mempool
+        if (coin.nDepth == 0 && !mempool.TransactionWithinChainLimit(coin.tx->GetHash(), nMaxAncestors))
             continue;
 
-        if (!mempool.TransactionWithinChainLimit(pcoin->GetHash(), nMaxAncestors))
-            continue;
+        vEligible.push_back(coin);
+    }
 
-        int i = output.i;
-        CAmount n = pcoin->vout[i].nValue;
+    // Prefer an exact match, which needs no change output
+    vector<CInputCoin> vSelected;
+    if (!SelectCoinsBnB(vEligible, nTargetValue, nCostOfChange, vSelected, nValueRet) &&
+        !SelectCoinsKnapsack(vEligible, nTargetValue, vSelected, nValueRet))
+        return false;
 
-        pair<CAmount,pair<const CWalletTx*,unsigned int> > coin = make_pair(n,make_pair(pcoin, i));
+    BOOST_FOREACH(const CInputCoin& coin, vSelected)
+        setCoinsRet.insert(coin.GetPair());
+    return true;
+}
 
-        if (n == nTargetValue)
-        {
-            setCoinsRet.insert(coin.second);
-            nValueRet += coin.first;
-            return true;
-        }
-        else if (n < nTargetValue + MIN_CHANGE)
-        {
-            vValue.push_back(coin);
-            nTotalLower += n;
-        }
-        else if (n < coinLowestLarger.first)
-        {
-            coinLowestLarger = coin;
-        }
-    }
+void CWallet::InitCoinSelectionPool(const vector<COutput>& vAvailableCoins, const CCoinControl* coinControl, CCoinSelectionPool& pool) const
+{
+    pool.Set(vAvailableCoins);
 
-    if (nTotalLower == nTargetValue)
+    // remove preset inputs from the pool
+    if (coinControl && coinControl->HasSelected())
     {
-        for (unsigned int i = 0; i < vValue.size(); ++i)
+        std::vector<COutPoint> vPresetInputs;
+        coinControl->ListSelected(vPresetInputs);
+        BOOST_FOREACH(const COutPoint& outpoint, vPresetInputs)
         {
-            setCoinsRet.insert(vValue[i].second);
-            nValueRet += vValue[i].first;
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+            if (it != mapWallet.end() && outpoint.n < it->second.vout.size())
+                pool.Remove(CInputCoin(&it->second, outpoint.n));
         }
-        return true;
     }
-
-    if (nTotalLower < nTargetValue)
-    {
-        if (coinLowestLarger.second.first == NULL)
-            return false;
-        setCoinsRet.insert(coinLowestLarger.second);
-        nValueRet += coinLowestLarger.first;
-        return true;
-    }
-
-    // Solve subset sum by stochastic approximation
-    std::sort(vValue.begin(), vValue.end(), CompareValueOnly());
-    std::reverse(vValue.begin(), vValue.end());
-    vector<char> vfBest;
-    CAmount nBest;
-
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest);
-
-    // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
-    //                                   or the next bigger coin is closer), return the bigger coin
-    if (coinLowestLarger.second.first &&
-        ((nBest != nTargetValue && nBest < nTargetValue + MIN_CHANGE) || coinLowestLarger.first <= nBest))
-    {
-        setCoinsRet.insert(coinLowestLarger.second);
-        nValueRet += coinLowestLarger.first;
-    }
-    else {
-        for (unsigned int i = 0; i < vValue.size(); i++)
-            if (vfBest[i])
-            {
-                setCoinsRet.insert(vValue[i].second);
-                nValueRet += vValue[i].first;
-            }
-
-        LogPrint("selectcoins", "SelectCoins() best subset: ");
-        for (unsigned int i = 0; i < vValue.size(); i++)
-            if (vfBest[i])
-                LogPrint("selectcoins", "%s ", FormatMoney(vValue[i].first));
-        LogPrint("selectcoins", "total %s\n", FormatMoney(nBest));
-    }
-
-    return true;
 }
 
-bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CCoinSelectionPool& pool, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, const CAmount& nCostOfChange) const
 {
-    vector<COutput> vCoins(vAvailableCoins);
-
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs)
     {
-        BOOST_FOREACH(const COutput& out, vCoins)
+        BOOST_FOREACH(const COutput& out, vAvailableCoins)
         {
             if (!out.fSpendable)
                  continue;
@@ -2431,26 +2566,17 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
             return false; // TODO: Allow non-wallet inputs
     }
 
-    // remove preset inputs from vCoins
-    for (vector<COutput>::iterator it = vCoins.begin(); it != vCoins.end() && coinControl && coinControl->HasSelected();)
-    {
-        if (setPresetCoins.count(make_pair(it->tx, it->i)))
-            it = vCoins.erase(it);
-        else
-            ++it;
-    }
-
     size_t nMaxChainLength = std::min(GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT), GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT));
     bool fRejectLongChains = GetBoolArg("-walletrejectlongchains", DEFAULT_WALLET_REJECT_LONG_CHAINS);
 
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 10, 0, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet));
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 10, 0, pool, setCoinsRet, nValueRet, nCostOfChange) ||
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, pool, setCoinsRet, nValueRet, nCostOfChange) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, pool, setCoinsRet, nValueRet, nCostOfChange)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), pool, setCoinsRet, nValueRet, nCostOfChange)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, pool, setCoinsRet, nValueRet, nCostOfChange)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, pool, setCoinsRet, nValueRet, nCostOfChange)) ||
+        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), pool, setCoinsRet, nValueRet, nCostOfChange));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -2576,6 +2702,17 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
             std::vector<COutput> vAvailableCoins;
             AvailableCoins(vAvailableCoins, true, coinControl);
 
+            // the pool is sorted once and shared by every pass of the fee loop
+            CCoinSelectionPool pool;
+            InitCoinSelectionPool(vAvailableCoins, coinControl, pool);
+
+            // Change worth less than the fee for its output and for spending
+            // it later is better left to the fee
+            CFeeRate feeRateChange(GetMinimumFee(1000, nTxConfirmTarget, mempool));
+            if (coinControl && coinControl->fOverrideFeeRate)
+                feeRateChange = coinControl->nFeeRate;
+            const CAmount nCostOfChange = feeRateChange.GetFee(CHANGE_OUTPUT_SIZE) + feeRateChange.GetFee(CHANGE_SPEND_SIZE);
+
             nFeeRet = 0;
             // Start with no fee and loop until there is enough fee
             while (true)
@@ -2625,7 +2762,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Choose coins to use
                 set<pair<const CWalletTx*,unsigned int> > setCoins;
                 CAmount nValueIn = 0;
-                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl))
+                if (!SelectCoins(vAvailableCoins, pool, nValueToSelect, setCoins, nValueIn, coinControl, nCostOfChange))
                 {
                     strFailReason = _("Insufficient funds");
                     return false;
@@ -2704,8 +2841,9 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     }
 
                     // Never create dust outputs; if we would, just
-                    // add the dust to the fee.
-                    if (newTxOut.IsDust(::minRelayTxFee))
+                    // add the dust to the fee. The same goes for change
+                    // that costs more to create and spend than it is worth.
+                    if (newTxOut.IsDust(::minRelayTxFee) || (nSubtractFeeFromAmount == 0 && nChange <= nCostOfChange))
                     {
                         nChangePosInOut = -1;
                         nFeeRet += nChange;
@@ -3102,8 +3240,6 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
-
         // Top up key pool
         unsigned int nTargetSize;
         if (kpSize > 0)
@@ -3111,16 +3247,63 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         else
             nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
+        if (setKeyPool.size() >= nTargetSize + 1)
+            return true;
+
+        CHDChain hdChainOld = hdChain;
+        std::vector<CNewKey> vNewKeys;
+        GenerateNewKeys(nTargetSize + 1 - setKeyPool.size(), vNewKeys);
+
+        int64_t nBegin = 1;
+        if (!setKeyPool.empty())
+            nBegin = *(--setKeyPool.end()) + 1;
+
+        // Write the keys, their pool entries and the HD chain model in a
+        // single database transaction. The in-memory wallet only learns about
+        // the keys once that transaction has committed.
+        CWalletDB walletdb(strWalletFile);
+        std::vector<std::vector<unsigned char> > vCryptedSecrets(vNewKeys.size());
+        bool fWritten = walletdb.TxnBegin();
+        for (unsigned int i = 0; fWritten && i < vNewKeys.size(); i++)
         {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error(std::string(__func__) + ": writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            const CNewKey& newKey = vNewKeys[i];
+            if (IsCrypted())
+                fWritten = EncryptKey(newKey.key, newKey.pubkey, vCryptedSecrets[i]) &&
+                           walletdb.WriteCryptedKey(newKey.pubkey, vCryptedSecrets[i], newKey.metadata);
+            else
+                fWritten = walletdb.WriteKey(newKey.pubkey, newKey.key.GetPrivKey(), newKey.metadata);
+            fWritten = fWritten && walletdb.WritePool(nBegin + i, CKeyPool(newKey.pubkey));
         }
+        if (fWritten && IsHDEnabled())
+            fWritten = walletdb.WriteHDChain(hdChain);
+        if (fWritten)
+            fWritten = walletdb.TxnCommit();
+        if (!fWritten) {
+            walletdb.TxnAbort();
+            hdChain = hdChainOld;
+            throw runtime_error(std::string(__func__) + ": writing generated keys failed");
+        }
+
+        for (unsigned int i = 0; i < vNewKeys.size(); i++)
+        {
+            const CNewKey& newKey = vNewKeys[i];
+            if (newKey.pubkey.IsCompressed())
+                SetMinVersion(FEATURE_COMPRPUBKEY, &walletdb);
+            LoadKeyMetadata(newKey.pubkey, newKey.metadata);
+            if (IsCrypted() ? !LoadCryptedKey(newKey.pubkey, vCryptedSecrets[i]) : !LoadKey(newKey.key, newKey.pubkey))
+                throw runtime_error(std::string(__func__) + ": AddKey failed");
+
+            // check if we need to remove from watch-only
+            CScript script = GetScriptForDestination(newKey.pubkey.GetID());
+            if (HaveWatchOnly(script))
+                RemoveWatchOnly(walletdb, script);
+            script = GetScriptForRawPubKey(newKey.pubkey);
+            if (HaveWatchOnly(script))
+                RemoveWatchOnly(walletdb, script);
+
+            setKeyPool.insert(setKeyPool.end(), nBegin + i);
+        }
+        LogPrintf("keypool added keys %d to %d, size=%u\n", nBegin, nBegin + vNewKeys.size() - 1, setKeyPool.size());
     }
     return true;
 }
@@ -3568,6 +3751,82 @@ uint64_t CWallet::GetStakeWeight() const
     return nWeight;
 }
 
+CStakeOutputStats CWallet::GetStakeOutputStats() const
+{
+    vector<COutput> vCoins;
+    AvailableCoinsForStaking(vCoins);
+
+    // Only the outputs FindCoinStake can use: mature for the kernel, as
+    // GetStakeWeight counts them, and signable by a key of ours
+    vector<COutput> vStakeable;
+    vStakeable.reserve(vCoins.size());
+    {
+        LOCK(cs_wallet);
+        BOOST_FOREACH(const COutput& out, vCoins)
+        {
+            if (out.nDepth < Params().GetConsensus().nCoinbaseMaturity)
+                continue;
+            if (!(IsMine(out.tx->vout[out.i]) & ISMINE_SPENDABLE))
+                continue;
+            vStakeable.push_back(out);
+        }
+    }
+    return stakePolicy.GetStats(vStakeable);
+}
+
+bool CWallet::RebalanceStakeOutputs()
+{
+    // A wallet unlocked for staking only must not spend
+    if (!stakePolicy.fRebalance || IsLocked() || fWalletUnlockStakingOnly)
+        return false;
+
+    LOCK2(cs_main, cs_wallet);
+
+    // Only mature confirmed outputs are candidates, so outputs of a previous
+    // rebalancing transaction are left alone until they can stake themselves
+    vector<COutput> vCoins;
+    AvailableCoinsForStaking(vCoins);
+
+    vector<COutput> vInputs;
+    unsigned int nOutputs;
+    if (!stakePolicy.PlanRebalance(vCoins, vInputs, nOutputs))
+        return false;
+
+    CCoinControl coinControl;
+    CAmount nValue = 0;
+    BOOST_FOREACH(const COutput& out, vInputs)
+    {
+        coinControl.Select(COutPoint(out.tx->GetHash(), out.i));
+        nValue += out.tx->vout[out.i].nValue;
+    }
+
+    // Pay back to the script of the first input, the fee is shared by all outputs
+    const CScript& scriptPubKey = vInputs[0].tx->vout[vInputs[0].i].scriptPubKey;
+    vector<CRecipient> vecSend;
+    CAmount nSplitValue = (nValue / nOutputs / CENT) * CENT;
+    for (unsigned int i = 0; i < nOutputs; i++)
+    {
+        CRecipient recipient = {scriptPubKey, i + 1 < nOutputs ? nSplitValue : nValue - nSplitValue * (nOutputs - 1), true};
+        vecSend.push_back(recipient);
+    }
+
+    CWalletTx wtx;
+    CReserveKey reservekey(this);
+    CAmount nFeeRequired;
+    int nChangePosRet = -1;
+    std::string strError;
+    if (!CreateTransaction(vecSend, wtx, reservekey, nFeeRequired, nChangePosRet, strError, &coinControl) ||
+        !CommitTransaction(wtx, reservekey))
+    {
+        LogPrintf("RebalanceStakeOutputs: failed to create transaction: %s\n", strError);
+        return false;
+    }
+
+    LogPrint("coinstake", "RebalanceStakeOutputs: %u inputs worth %s to %u outputs in %s\n",
+             vInputs.size(), FormatMoney(nValue), nOutputs, wtx.GetHash().ToString());
+    return true;
+}
+
 /** @} */ // end of Actions
 
 class CAffectedKeysVisitor : public boost::static_visitor<void> {
@@ -3713,6 +3972,13 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
     if (showDebug)
         strUsage += HelpMessageOpt("-sendfschoransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), DEFAULT_SEND_FREE_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-stakecombinethreshold=<amt>", strprintf(_("Merge staking outputs below this value (in %s) into coinstakes (default: %s)"),
+                                                                         CURRENCY_UNIT, FormatMoney(DEFAULT_STAKE_COMBINE_THRESHOLD)));
+    strUsage += HelpMessageOpt("-stakemaxcombine=<n>", strprintf(_("Maximum number of inputs in a coinstake (default: %u)"), DEFAULT_STAKE_MAX_COMBINE_INPUTS));
+    strUsage += HelpMessageOpt("-stakemaxsplit=<n>", strprintf(_("Maximum number of outputs a coinstake is split into (default: %u)"), DEFAULT_STAKE_MAX_SPLIT_OUTPUTS));
+    strUsage += HelpMessageOpt("-stakerebalance", strprintf(_("Periodically send transactions to self that combine small staking outputs and, with -staketargetoutputs, split large ones. Rebalanced coins have to mature again before they can stake (default: %u)"), DEFAULT_STAKE_REBALANCE));
+    strUsage += HelpMessageOpt("-stakesplitthreshold=<amt>", strprintf(_("Split coinstakes worth at least this value (in %s) (default: twice -stakecombinethreshold)"), CURRENCY_UNIT));
+    strUsage += HelpMessageOpt("-staketargetoutputs=<n>", strprintf(_("Number of staking outputs of about equal value to aim for, 0 to only apply the thresholds (default: %u)"), DEFAULT_STAKE_TARGET_OUTPUTS));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), DEFAULT_SPEND_ZEROCONF_CHANGE));
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
     strUsage += HelpMessageOpt("-usehd", _("Use hierarchical deterministic key generation (HD) after BIP32. Only has effect during wallet creation/first start") + " " + strprintf(_("(default: %u)"), DEFAULT_USE_HD_WALLET));
@@ -3730,6 +3996,8 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", DEFAULT_WALLET_PRIVDB));
+        strUsage += HelpMessageOpt("-walletloadthreads=<n>", strprintf("Set the number of threads used to decode wallet transactions on startup (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)",
+                                                                       1, MAX_WALLET_LOAD_THREADS, DEFAULT_WALLET_LOAD_THREADS));
         strUsage += HelpMessageOpt("-walletrejectlongchains", strprintf(_("Wallet will not create transactions that violate mempool chain limits (default: %u"), DEFAULT_WALLET_REJECT_LONG_CHAINS));
     }
 
@@ -3858,6 +4126,18 @@ bool CWallet::InitLoadWallet()
                 return InitError(_("Prune: last wallet synchronisation goes beyond pruned data. You need to -reindex (download the whole blockchain again in case of pruned node)"));
         }
 
+        // Neither can it go back before a UTXO set snapshot, whose earlier blocks were never downloaded.
+        // The block the wallet last saw does not need to be read again.
+        if (fTxOutSetSnapshot)
+        {
+            CBlockIndex *block = chainActive.Tip();
+            while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA) && pindexRescan != block)
+                block = block->pprev;
+
+            if (pindexRescan != block && pindexRescan != block->pprev)
+                return InitError(_("Last wallet synchronisation goes back before the UTXO set snapshot this node was started from. Use this wallet with a node that has the whole block chain"));
+        }
+
         uiInterface.InitMessage(_("Rescanning..."));
         LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
         nStart = GetTimeMillis();
@@ -3948,6 +4228,10 @@ bool CWallet::ParameterInteraction()
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfschoransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
 
+    std::string strError;
+    if (!stakePolicy.InitFromArgs(strError))
+        return InitError(strError);
+
     return true;
 }
 
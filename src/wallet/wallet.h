@@ -13,7 +13,9 @@
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 #include "script/ismine.h"
+#include "wallet/coinselection.h"
 #include "wallet/crypter.h"
+#include "wallet/stakepolicy.h"
 #include "wallet/walletdb.h"
 #include "wallet/rpcwallet.h"
 #include "pos.h"
@@ -28,6 +30,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/bind.hpp>
+
 extern CWallet* pwalletMain;
 
 /**
@@ -42,6 +46,10 @@ extern bool fSendFreeTransactions;
 extern bool fWalletUnlockStakingOnly;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
+//! Maximum number of threads used to derive keys when topping up the keypool
+static const int MAX_KEYPOOL_THREADS = 16;
+//! Below this many new keys, keypool top-up derives them on the calling thread
+static const unsigned int KEYPOOL_PARALLEL_THRESHOLD = 64;
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 10000;
 //! -fallbackfee default
@@ -50,6 +58,10 @@ static const CAmount DEFAULT_FALLBACK_FEE = 10000;
 static const CAmount DEFAULT_TRANSACTION_MINFEE = 10000;
 //! minimum change amount
 static const CAmount MIN_CHANGE = CENT;
+//! Size of a pay-to-pubkey-hash change output, for the cost of change
+static const unsigned int CHANGE_OUTPUT_SIZE = 34;
+//! Size of an input that spends such an output later, for the cost of change
+static const unsigned int CHANGE_SPEND_SIZE = 148;
 //! Default for -spendzeroconfchange
 static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! Default for -sendfschoransactions
@@ -108,6 +120,15 @@ public:
     }
 };
 
+/** A freshly generated key that has not been added to the keystore yet */
+class CNewKey
+{
+public:
+    CKey key;
+    CPubKey pubkey;
+    CKeyMetadata metadata;
+};
+
 /** Address book data */
 class CAddressBookData
 {
@@ -439,6 +460,42 @@ public:
 
 
 
+/** Signing key of a stakeable script, as cached by CWallet::GetStakeKey */
+class CStakeKey
+{
+public:
+    CKey key; //!< the secret lives in secure memory
+    CPubKey pubkey;
+    CScript scriptPubKeyOut; //!< coinstake output script, pay to public key
+};
+
+/**
+ * Key store holding only a cached stake key, used to sign coinstake inputs
+ * without decrypting the key or recomputing its public key per input.
+ */
+class CStakeKeyStore : public CBasicKeyStore
+{
+private:
+    CKeyID keyID;
+    CPubKey pubkey;
+
+public:
+    CStakeKeyStore(const CStakeKey& stakeKey)
+    {
+        keyID = stakeKey.pubkey.GetID();
+        pubkey = stakeKey.pubkey;
+        mapKeys[keyID] = stakeKey.key;
+    }
+
+    bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const
+    {
+        if (address != keyID)
+            return false;
+        vchPubKeyOut = pubkey;
+        return true;
+    }
+};
+
 /** Private key that includes an expiration date in case it never gets used. */
 class CWalletKey
 {
@@ -560,9 +617,12 @@ private:
     /**
      * Select a set of coins such that nValueRet >= nTargetValue and at least
      * all coins from coinControl are selected; Never select unconfirmed coins
-     * if they are not ours
+     * if they are not ours. pool holds vAvailableCoins as set up by
+     * InitCoinSelectionPool with the same coinControl.
      */
-    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CCoinSelectionPool& pool, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL, const CAmount& nCostOfChange = 0) const;
+    /** Fill pool with vAvailableCoins less the inputs preset by coinControl, which SelectCoins adds itself */
+    void InitCoinSelectionPool(const std::vector<COutput>& vAvailableCoins, const CCoinControl *coinControl, CCoinSelectionPool& pool) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -578,6 +638,19 @@ private:
 
     std::map<COutPoint, CStakeCache> stakeCache;
 
+    /**
+     * Keys of stakeable scripts, filled while staking so that a found kernel
+     * can be signed without a Solver run or key decryption. Emptied whenever
+     * the wallet is locked or unlocked; nStakeKeysGeneration lets a lookup
+     * racing with that avoid caching a stale key.
+     */
+    mutable CCriticalSection cs_stakeKeys;
+    std::map<CScript, CStakeKey> mapStakeKeys;
+    std::set<CScript> setUnstakeableScripts;
+    uint64_t nStakeKeysGeneration;
+
+    void ClearStakeKeys(CCryptoKeyStore* keystore);
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -657,6 +730,9 @@ public:
 
         fAbortRescan = false;
         fScanningWallet = false;
+
+        nStakeKeysGeneration = 0;
+        NotifyStatusChanged.connect(boost::bind(&CWallet::ClearStakeKeys, this, _1));
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -688,12 +764,15 @@ public:
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false) const;
 
     /**
-     * Shuffle and select coins until nTargetValue is reached while avoiding
-     * small change; This method is stochastic for some inputs and upon
-     * completion the coin set and corresponding actual target value is
-     * assembled
+     * Select coins until nTargetValue is reached while avoiding small change;
+     * an exact match is searched for first (SelectCoinsBnB), then the
+     * stochastic knapsack solver is used. The exact match may exceed
+     * nTargetValue by up to nCostOfChange, the fee that creating a change
+     * output and spending it later would cost. Upon completion the coin set
+     * and corresponding actual target value is assembled
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CAmount& nCostOfChange = 0) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, const CCoinSelectionPool& pool, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CAmount& nCostOfChange = 0) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -715,8 +794,14 @@ public:
      * Generate a new key
      */
     CPubKey GenerateNewKey();
+    //! Generates nCount new keys without adding them to the store, using several threads for large batches
+    void GenerateNewKeys(unsigned int nCount, std::vector<CNewKey>& vKeysOut);
+    //! Adds a key returned by GenerateNewKeys to the store, and saves it through walletdb.
+    void AddNewKey(CWalletDB& walletdb, const CNewKey& newKey);
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    //! Adds a key to the store, and saves it through walletdb.
+    bool AddKeyPubKeyWithDB(CWalletDB& walletdb, const CKey& key, const CPubKey &pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
     bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
     //! Load metadata (used by LoadWallet)
@@ -726,6 +811,8 @@ public:
 
     //! Adds an encrypted key to the store, and saves it to disk.
     bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
+    //! Adds an encrypted key to the store, and saves it through walletdb.
+    bool AddCryptedKey(CWalletDB& walletdb, const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     //! Adds an encrypted key to the store, without saving it to disk (used by LoadWallet)
     bool LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddCScript(const CScript& redeemScript);
@@ -743,6 +830,8 @@ public:
     //! Adds a watch-only address to the store, and saves it to disk.
     bool AddWatchOnly(const CScript &dest);
     bool RemoveWatchOnly(const CScript &dest);
+    //! Removes a watch-only address from the store, and erases it through walletdb.
+    bool RemoveWatchOnly(CWalletDB& walletdb, const CScript &dest);
     //! Adds a watch-only address to the store, without saving it to disk (used by LoadWallet)
     bool LoadWatchOnly(const CScript &dest);
 
@@ -762,6 +851,8 @@ public:
 
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
+    //! Adds decoded transactions to the wallet and builds the spend and order indexes in bulk (used by LoadWallet)
+    void LoadToWallet(std::vector<CWalletTx>& vWtx);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
@@ -796,6 +887,7 @@ public:
 
     static CFeeRate minTxFee;
     static CFeeRate fallbackFee;
+    static CStakePolicy stakePolicy;
     /**
      * Estimate the minimum fee considering user set parameters
      * and the required fee
@@ -924,11 +1016,19 @@ public:
     bool AbandonTransaction(const uint256& hashTx);
 
     /* Staking */
-    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CAmount& nFees, CMutableTransaction& tx, CKey& key);
+    /** Search for a kernel and build the unsigned coinstake paying the stake subsidy */
+    bool FindCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& tx, CKey& key);
+    /** Add the block's fees to a coinstake from FindCoinStake and sign it */
+    bool SignCoinStake(const CKeyStore& keystore, const CAmount& nFees, CMutableTransaction& tx);
     bool SelectCoinsForStaking(CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
     void AvailableCoinsForStaking(std::vector<COutput>& vCoins) const;
     bool HaveAvailableCoinsForStaking() const;
     uint64_t GetStakeWeight() const;
+    /** Get the key and coinstake output script for a kernel paying to scriptPubKey */
+    bool GetStakeKey(const CKeyStore& keystore, const CScript& scriptPubKey, CStakeKey& stakeKeyRet);
+    CStakeOutputStats GetStakeOutputStats() const;
+    /** Send one transaction to self that moves the staking outputs towards stakePolicy */
+    bool RebalanceStakeOutputs();
 
     /* Returns the wallets help message */
     static std::string GetWalletHelpString(bool showDebug);
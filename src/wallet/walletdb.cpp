@@ -20,6 +20,7 @@
 
 #include <atomic>
 
+#include <boost/bind.hpp>
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
@@ -345,6 +346,24 @@ DBErrors CWalletDB::ReorderTransactions(CWallet* pwallet)
     return DB_LOAD_OK;
 }
 
+/**
+ * A "tx" record collected during the cursor scan. Records are decoded after
+ * the scan, once keys and metadata are loaded, so that the expensive
+ * deserialization and checks can be spread over several threads.
+ */
+class CWalletTxRecord {
+public:
+    uint256 hash;
+    CDataStream ssValue;
+    CWalletTx wtx;
+    std::string strErr;
+    bool fValid;
+    bool fUpgraded;
+
+    CWalletTxRecord(const uint256& hashIn, const CDataStream& ssValueIn)
+        : hash(hashIn), ssValue(ssValueIn), fValid(false), fUpgraded(false) {}
+};
+
 class CWalletScanState {
 public:
     unsigned int nKeys;
@@ -354,6 +373,7 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    vector<CWalletTxRecord> vTxRecords;
 
     CWalletScanState() {
         nKeys = nCKeys = nKeyMeta = 0;
@@ -384,38 +404,10 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             ssValue >>
                 pwallet->mapAddressBook[DecodeDestination(strAddress)].purpose;
         } else if (strType == "tx") {
+            // Decoded later by DecodeWalletTxRecords
             uint256 hash;
             ssKey >> hash;
-            CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
-                return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            wss.vTxRecords.push_back(CWalletTxRecord(hash, ssValue));
         }
         else if (strType == "acentry")
         {
@@ -631,6 +623,70 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
     return true;
 }
 
+static void DecodeWalletTxRecord(CWalletTxRecord& rec)
+{
+    try {
+        rec.ssValue >> rec.wtx;
+        CValidationState state;
+        if (!(CheckTransaction(rec.wtx, state) && (rec.wtx.GetHash() == rec.hash) && state.IsValid()))
+            return;
+
+        // Undo serialize changes in 31600
+        if (31404 <= rec.wtx.fTimeReceivedIsTxTime && rec.wtx.fTimeReceivedIsTxTime <= 31703)
+        {
+            if (!rec.ssValue.empty())
+            {
+                char fTmp;
+                char fUnused;
+                rec.ssValue >> fTmp >> fUnused >> rec.wtx.strFromAccount;
+                rec.strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                                       rec.wtx.fTimeReceivedIsTxTime, fTmp, rec.wtx.strFromAccount, rec.hash.ToString());
+                rec.wtx.fTimeReceivedIsTxTime = fTmp;
+            }
+            else
+            {
+                rec.strErr = strprintf("LoadWallet() repairing tx ver=%d %s", rec.wtx.fTimeReceivedIsTxTime, rec.hash.ToString());
+                rec.wtx.fTimeReceivedIsTxTime = 0;
+            }
+            rec.fUpgraded = true;
+        }
+        rec.fValid = true;
+    } catch (...) {
+        rec.fValid = false;
+    }
+    // The raw record is no longer needed
+    rec.ssValue = CDataStream(SER_DISK, CLIENT_VERSION);
+}
+
+static void DecodeWalletTxRecordRange(vector<CWalletTxRecord>* pvRecords, size_t nFirst, size_t nStride)
+{
+    for (size_t i = nFirst; i < pvRecords->size(); i += nStride)
+        DecodeWalletTxRecord((*pvRecords)[i]);
+}
+
+/**
+ * Decode all collected "tx" records. Records are independent of each other
+ * and of the wallet, so each worker takes every n-th record.
+ */
+static void DecodeWalletTxRecords(vector<CWalletTxRecord>& vRecords)
+{
+    int nThreads = GetArg("-walletloadthreads", DEFAULT_WALLET_LOAD_THREADS);
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    nThreads = std::max(1, std::min(nThreads, MAX_WALLET_LOAD_THREADS));
+    if (vRecords.size() < WALLET_LOAD_PARALLEL_THRESHOLD)
+        nThreads = 1;
+
+    int64_t nStart = GetTimeMillis();
+    boost::thread_group workers;
+    for (int i = 1; i < nThreads; i++)
+        workers.create_thread(boost::bind(&DecodeWalletTxRecordRange, &vRecords, i, nThreads));
+    DecodeWalletTxRecordRange(&vRecords, 0, nThreads);
+    workers.join_all();
+    LogPrint("db", "Decoded %u wallet transactions using %d threads in %dms\n",
+             vRecords.size(), nThreads, GetTimeMillis() - nStart);
+}
+
 static bool IsKeyType(string strType)
 {
     return (strType== "key" || strType == "wkey" ||
@@ -697,6 +753,32 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        // Keys and metadata are loaded; now decode the transactions and
+        // index them in one go.
+        DecodeWalletTxRecords(wss.vTxRecords);
+        vector<CWalletTx> vWtx;
+        vWtx.reserve(wss.vTxRecords.size());
+        BOOST_FOREACH(CWalletTxRecord& rec, wss.vTxRecords)
+        {
+            if (!rec.strErr.empty())
+                LogPrintf("%s\n", rec.strErr);
+            if (!rec.fValid)
+            {
+                // Rescan if there is a bad transaction record:
+                fNoncriticalErrors = true;
+                SoftSetBoolArg("-rescan", true);
+                continue;
+            }
+            if (rec.fUpgraded)
+                wss.vWalletUpgrade.push_back(rec.hash);
+            if (rec.wtx.nOrderPos == -1)
+                wss.fAnyUnordered = true;
+            vWtx.push_back(CWalletTx());
+            vWtx.back() = std::move(rec.wtx);
+        }
+        wss.vTxRecords.clear();
+        pwallet->LoadToWallet(vWtx);
     }
     catch (const boost::thread_interrupted&) {
         throw;
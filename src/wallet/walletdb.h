@@ -22,6 +22,12 @@
 #include <vector>
 
 static const bool DEFAULT_FLUSHWALLET = true;
+//! -walletloadthreads default (0 = auto, one per core)
+static const int DEFAULT_WALLET_LOAD_THREADS = 0;
+//! Maximum number of threads used to decode transaction records on load
+static const int MAX_WALLET_LOAD_THREADS = 16;
+//! Below this many transaction records, decoding is done on the calling thread
+static const unsigned int WALLET_LOAD_PARALLEL_THRESHOLD = 1000;
 
 class CAccount;
 class CAccountingEntry;